@@ -0,0 +1,226 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ansi_terminal.h"
+#include "log.h"
+
+// the longest run of unchanged cells written over again rather than moved
+// past, since moving the cursor forward takes at least four bytes
+#define ANSI_MAX_REWRITE 3
+
+// UTF-8 of the half blocks U+2580 and U+2584, which are drawn in the
+// foreground color over the background color
+#define UPPER_HALF_BLOCK "\xe2\x96\x80"
+#define LOWER_HALF_BLOCK "\xe2\x96\x84"
+
+AnsiTerminal *ansi_terminal_create(int fd) {
+	AnsiTerminal *terminal = calloc(sizeof(AnsiTerminal), 1);
+	terminal->fd = fd;
+	ansi_terminal_forget(terminal);
+	return terminal;
+}
+
+void ansi_terminal_forget(AnsiTerminal *terminal) {
+	free(terminal->shown);
+	terminal->shown = NULL;
+	terminal->cursor_y = -1;
+	terminal->cursor_x = -1;
+	terminal->fg = -1;
+	terminal->bg = -1;
+}
+
+static void emit(AnsiTerminal *terminal, const char *bytes, size_t n) {
+	if (terminal->out_length + n > terminal->out_size) {
+		terminal->out_size = 2 * (terminal->out_length + n);
+		terminal->out = realloc(terminal->out, terminal->out_size);
+	}
+	memcpy(terminal->out + terminal->out_length, bytes, n);
+	terminal->out_length += n;
+}
+
+static void emit_string(AnsiTerminal *terminal, const char *string) {
+	emit(terminal, string, strlen(string));
+}
+
+static void move_to(AnsiTerminal *terminal, int y, int x) {
+	char sequence[32];
+
+	if (terminal->cursor_y == y && terminal->cursor_x == x)
+		return;
+	if (terminal->cursor_y == y && terminal->cursor_x < x)
+		snprintf(sequence, sizeof(sequence), "\e[%dC",
+		         x - terminal->cursor_x);
+	else if (y == 0 && x == 0)
+		snprintf(sequence, sizeof(sequence), "\e[H");
+	else
+		snprintf(sequence, sizeof(sequence), "\e[%d;%dH", y + 1, x + 1);
+	emit_string(terminal, sequence);
+	terminal->cursor_y = y;
+	terminal->cursor_x = x;
+}
+
+static void set_colors(AnsiTerminal *terminal, int fg, int bg) {
+	char sequence[32];
+
+	if (terminal->fg == fg && terminal->bg == bg)
+		return;
+	if (fg == ANSI_DEFAULT_COLOR && bg == ANSI_DEFAULT_COLOR)
+		snprintf(sequence, sizeof(sequence), "\e[m");
+	else
+		snprintf(sequence, sizeof(sequence), "\e[3%d;4%dm", fg, bg);
+	emit_string(terminal, sequence);
+	terminal->fg = fg;
+	terminal->bg = bg;
+}
+
+/**
+ * @return the color a cell of an enum block_type is seen in, which is the
+ *         background color, since cells are drawn with spaces
+ */
+static int block_color(int color) {
+	return color == no_type ? ANSI_DEFAULT_COLOR : render_palette[color].bg;
+}
+
+/**
+ * Find the colors a cell is written in
+ */
+static void cell_colors(FramebufferCell cell, int *fg, int *bg) {
+	if (cell.ch != FRAMEBUFFER_HALVES) {
+		*fg = cell.color == no_type ? ANSI_DEFAULT_COLOR
+		                            : render_palette[cell.color].fg;
+		*bg = block_color(cell.color);
+	} else if (cell.color != no_type) {
+		// an upper half block, over the lower half
+		*fg = block_color(cell.color);
+		*bg = block_color(cell.lower);
+	} else {
+		// a lower half block, over the terminal's own background
+		*fg = block_color(cell.lower);
+		*bg = ANSI_DEFAULT_COLOR;
+	}
+}
+
+/**
+ * Write a cell where the cursor is
+ */
+static void put(AnsiTerminal *terminal, FramebufferCell cell) {
+	int fg, bg;
+
+	cell_colors(cell, &fg, &bg);
+	set_colors(terminal, fg, bg);
+	if (cell.ch != FRAMEBUFFER_HALVES)
+		emit(terminal, &cell.ch, 1);
+	else if (cell.color != no_type)
+		emit_string(terminal, UPPER_HALF_BLOCK);
+	else
+		emit_string(terminal, LOWER_HALF_BLOCK);
+	// past the last column, where the cursor ends up depends on the
+	// terminal
+	if (++terminal->cursor_x == terminal->columns)
+		terminal->cursor_y = -1;
+}
+
+/**
+ * Check whether the cells between the cursor and column x of its row can be
+ * written over again more cheaply than moved past
+ */
+static int cheaper_to_rewrite(AnsiTerminal *terminal, Framebuffer *frame,
+                              int y, int x) {
+	if (terminal->cursor_y != y || terminal->cursor_x >= x ||
+	    x - terminal->cursor_x > ANSI_MAX_REWRITE)
+		return 0;
+	// the cells must not need a change of colors
+	for (int i = terminal->cursor_x; i < x; i++) {
+		int fg, bg;
+		cell_colors(frame->cells[y * frame->columns + i], &fg, &bg);
+		if (fg != terminal->fg || bg != terminal->bg)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Write the whole output buffer, and empty it
+ * @return number of bytes written, or -1 on failure
+ */
+static int write_out(AnsiTerminal *terminal) {
+	size_t written = 0;
+	ssize_t n;
+
+	while (written < terminal->out_length) {
+		n = write(terminal->fd, terminal->out + written,
+		          terminal->out_length - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("write");
+			terminal->out_length = 0;
+			ansi_terminal_forget(terminal);
+			return -1;
+		}
+		written += n;
+	}
+	terminal->out_length = 0;
+	return written;
+}
+
+int ansi_terminal_flush(AnsiTerminal *terminal, Framebuffer *frame) {
+	int size = frame->rows * frame->columns;
+
+	if (terminal->shown == NULL || terminal->rows != frame->rows ||
+	    terminal->columns != frame->columns) {
+		// start over from a blank screen
+		ansi_terminal_forget(terminal);
+		terminal->shown = malloc(sizeof(FramebufferCell) * size);
+		for (int i = 0; i < size; i++)
+			terminal->shown[i] =
+			    (FramebufferCell){' ', no_type, no_type};
+		terminal->rows = frame->rows;
+		terminal->columns = frame->columns;
+		set_colors(terminal, ANSI_DEFAULT_COLOR, ANSI_DEFAULT_COLOR);
+		emit_string(terminal, "\e[H\e[2J");
+		terminal->cursor_y = 0;
+		terminal->cursor_x = 0;
+	}
+
+	for (int y = 0; y < frame->rows; y++) {
+		// most rows do not change at all
+		int row = y * frame->columns;
+		if (memcmp(frame->cells + row, terminal->shown + row,
+		           sizeof(FramebufferCell) * frame->columns) == 0)
+			continue;
+		for (int x = 0; x < frame->columns; x++) {
+			int i = row + x;
+			FramebufferCell cell = frame->cells[i];
+			if (cell.ch == terminal->shown[i].ch &&
+			    cell.color == terminal->shown[i].color &&
+			    cell.lower == terminal->shown[i].lower)
+				continue;
+			if (cheaper_to_rewrite(terminal, frame, y, x))
+				while (terminal->cursor_x < x)
+					put(terminal,
+					    frame->cells[row +
+					                 terminal->cursor_x]);
+			else
+				move_to(terminal, y, x);
+			put(terminal, cell);
+			terminal->shown[i] = cell;
+		}
+	}
+
+	return write_out(terminal);
+}
+
+void ansi_terminal_destroy(AnsiTerminal *terminal) {
+	if (terminal->fg != ANSI_DEFAULT_COLOR ||
+	    terminal->bg != ANSI_DEFAULT_COLOR) {
+		set_colors(terminal, ANSI_DEFAULT_COLOR, ANSI_DEFAULT_COLOR);
+		write_out(terminal);
+	}
+	free(terminal->shown);
+	free(terminal->out);
+	free(terminal);
+}
@@ -0,0 +1,70 @@
+/**
+ * Writes framebuffers to a terminal with ANSI escape sequences, without
+ * curses.
+ *
+ * The terminal keeps a copy of what it last wrote, and writes only the cells
+ * of a frame that differ from it: a cursor movement to reach each run of
+ * changed cells, and a change of colors only where the colors change. The
+ * whole frame is then written with a single write(), which keeps the bytes
+ * and system calls per frame low over slow links like SSH, and through
+ * multiplexers like tmux.
+ *
+ * Halves of cells are drawn with the Unicode half blocks, encoded in UTF-8.
+ */
+#ifndef TTETRIS_ANSI_TERMINAL_H
+#define TTETRIS_ANSI_TERMINAL_H
+
+#include <stddef.h>
+
+#include "framebuffer.h"
+
+// ANSI color number that stands for the terminal's own color
+#define ANSI_DEFAULT_COLOR 9
+
+typedef struct ttetris_ansi_terminal AnsiTerminal;
+
+struct ttetris_ansi_terminal {
+	int fd;
+	/* what the terminal shows, as far as we know, with the size of the
+	 * frame it was written from. NULL until the first frame, or once
+	 * something else may have drawn on the terminal. */
+	FramebufferCell *shown;
+	int rows;
+	int columns;
+	/* where the cursor is, or -1 if not known */
+	int cursor_y;
+	int cursor_x;
+	/* colors the terminal draws in, as ANSI color numbers with
+	 * ANSI_DEFAULT_COLOR for the terminal's own, or -1 if not known */
+	int fg;
+	int bg;
+	/* escape sequences and text of the frame being written */
+	char *out;
+	size_t out_length;
+	size_t out_size;
+};
+
+/**
+ * Allocate a terminal that writes to fd. The first frame clears the screen.
+ */
+AnsiTerminal *ansi_terminal_create(int fd);
+
+/**
+ * Forget what the terminal shows, so that the next frame clears the screen
+ * and draws everything. Use this once something else drew on the terminal.
+ */
+void ansi_terminal_forget(AnsiTerminal *terminal);
+
+/**
+ * Bring the terminal up to date with a frame, in a single write
+ * @return number of bytes written, or -1 on failure
+ */
+int ansi_terminal_flush(AnsiTerminal *terminal, Framebuffer *frame);
+
+/**
+ * Put the terminal's colors back to its own, and free the terminal. The file
+ * descriptor is left open.
+ */
+void ansi_terminal_destroy(AnsiTerminal *terminal);
+
+#endif // TTETRIS_ANSI_TERMINAL_H
@@ -0,0 +1,302 @@
+/**
+ * Benchmark for the render backends.
+ *
+ * The same frames are replayed through each backend: every board of a frame
+ * is published, and then the frame is drawn. The rate at which frames are
+ * drawn is reported for each backend, along with the bytes written to the
+ * terminal per frame. While frames are replayed, standard output goes to a
+ * temporary file, which stands in for the terminal, so no TTY is needed.
+ * Curses assumes the terminal named by TERM, or an xterm if it is not set.
+ *
+ * Frames are read from a recording made with the client's -R option, or else
+ * made up by playing seeded games with random inputs.
+ *
+ * usage: bench_render [-f FRAMES] [-b BOARDS] [-r ROWS] [-c COLUMNS]
+ *                     [-i RECORDING] [BACKEND...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "render.h"
+#include "tetris_game.h"
+
+#define MAX_BOARDS 64
+
+struct bench_result {
+	long frames;
+	long bytes;
+	double seconds;
+};
+
+static const struct bench_backend {
+	char *name;
+	enum render_backend backend;
+} known_backends[] = {
+    {"headless", RENDER_HEADLESS},
+    {"ansi", RENDER_ANSI},
+    {"curses", RENDER_CURSES},
+};
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void) {
+	printf("usage: bench_render [-f FRAMES] [-b BOARDS] [-r ROWS] "
+	       "[-c COLUMNS] [-i RECORDING] [BACKEND...]\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * read a recording made by render_record
+ * @return the records, or NULL if the file could not be read or is not a
+ *         recording
+ */
+static struct render_record *read_recording(char *path, long *n_records) {
+	FILE *fp = fopen(path, "rb");
+	struct render_record *records = NULL;
+	long size = 0;
+
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	*n_records = 0;
+	for (;;) {
+		if (*n_records == size) {
+			size = size ? 2 * size : 1024;
+			records = realloc(records, sizeof(*records) * size);
+		}
+		if (fread(records + *n_records, sizeof(*records), 1, fp) != 1)
+			break;
+		struct render_record *record = records + *n_records;
+		if (record->nboards == 0 || record->nboards > MAX_BOARDS ||
+		    record->board >= record->nboards ||
+		    record->nboards != records[0].nboards) {
+			fprintf(stderr, "%s: not a recording\n", path);
+			free(records);
+			fclose(fp);
+			return NULL;
+		}
+		(*n_records)++;
+	}
+	fclose(fp);
+	if (*n_records == 0) {
+		fprintf(stderr, "%s: no frames\n", path);
+		free(records);
+		return NULL;
+	}
+	return records;
+}
+
+/**
+ * make up frames by playing a seeded game on every board. Each frame, one of
+ * the boards always moves, and every other board moves with a chance of one
+ * in four, as when a few players press keys at once.
+ * @return the records
+ */
+static struct render_record *make_up_frames(int n_frames, int n_boards,
+                                            long *n_records) {
+	struct render_record *records =
+	    malloc(sizeof(*records) * n_frames * n_boards);
+	struct game_contents *games[MAX_BOARDS] = {NULL};
+	struct game_view_data *view = NULL;
+	unsigned seed = 1;
+
+	for (int b = 0; b < n_boards; b++)
+		new_seeded_game(&games[b], b + 1);
+
+	*n_records = 0;
+	for (int f = 0; f < n_frames; f++) {
+		for (int b = 0; b < n_boards; b++) {
+			struct game_contents *gc = games[b];
+			if (b != f % n_boards && rand_r(&seed) % 4)
+				continue;
+			switch (rand_r(&seed) % 16) {
+			case 0:
+				hard_drop(gc);
+				break;
+			case 1:
+			case 2:
+			case 3:
+				rotate_block(gc, 1);
+				break;
+			case 4:
+			case 5:
+			case 6:
+			case 7:
+				translate_block_left(gc);
+				break;
+			case 8:
+			case 9:
+			case 10:
+			case 11:
+				translate_block_right(gc);
+				break;
+			default:
+				lower_block(gc, 1);
+			}
+			if (game_over(gc)) {
+				destroy_game(&games[b]);
+				new_seeded_game(&games[b], f * n_boards + b);
+				gc = games[b];
+			}
+			generate_game_view_data(gc, &view);
+			records[(*n_records)++] =
+			    (struct render_record){f, b, n_boards, *view};
+		}
+	}
+
+	for (int b = 0; b < n_boards; b++)
+		destroy_game(&games[b]);
+	destroy_game_view_data(&view);
+	return records;
+}
+
+/**
+ * @return the number of bytes written to standard output so far
+ */
+static long output_bytes(void) {
+	struct stat st;
+
+	fflush(stdout);
+	if (fstat(STDOUT_FILENO, &st) < 0)
+		return 0;
+	return st.st_size;
+}
+
+/**
+ * replay the records through a backend, with standard output going to a file
+ */
+static void run_backend(enum render_backend backend, int rows, int columns,
+                        struct render_record *records, long n_records,
+                        struct bench_result *res) {
+	int n_boards = records[0].nboards;
+	char name_buffers[MAX_BOARDS][8];
+	char *names[MAX_BOARDS];
+
+	for (int b = 0; b < n_boards; b++) {
+		snprintf(name_buffers[b], sizeof(name_buffers[b]), "%d", b);
+		names[b] = name_buffers[b];
+	}
+
+	// the first board is the local player's, as far as a compact layout
+	// is concerned
+	render_use_backend(backend);
+	render_set_local_board(names[0]);
+	render_set_size(rows, columns);
+	render_init(n_boards, names);
+
+	res->frames = 0;
+	long start_bytes = output_bytes();
+	double start = now();
+	for (long i = 0; i < n_records; i++) {
+		render_game_view_data_at(records[i].board, &records[i].view);
+		if (i + 1 < n_records &&
+		    records[i + 1].frame == records[i].frame)
+			continue;
+		render_frame();
+		res->frames++;
+	}
+	res->seconds = now() - start;
+	res->bytes = output_bytes() - start_bytes;
+
+	render_close();
+}
+
+int main(int argc, char **argv) {
+	int n_frames = 5000, n_boards = 4, rows = 40, columns = 160;
+	char *recording = NULL;
+	char *default_backends[] = {"headless", "ansi", "curses"};
+	char **backends = default_backends;
+	int n_backends = 3;
+
+	int opt;
+	while ((opt = getopt(argc, argv, ":hf:b:r:c:i:")) != -1) {
+		switch (opt) {
+		case 'f':
+			n_frames = atoi(optarg);
+			break;
+		case 'b':
+			n_boards = atoi(optarg);
+			break;
+		case 'r':
+			rows = atoi(optarg);
+			break;
+		case 'c':
+			columns = atoi(optarg);
+			break;
+		case 'i':
+			recording = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc) {
+		backends = argv + optind;
+		n_backends = argc - optind;
+	}
+	if (n_frames < 1 || n_boards < 1 || n_boards > MAX_BOARDS ||
+	    rows < 1 || columns < 1)
+		usage();
+
+	logging_set_fp(fopen("/dev/null", "w"));
+
+	long n_records;
+	struct render_record *records =
+	    recording ? read_recording(recording, &n_records)
+	              : make_up_frames(n_frames, n_boards, &n_records);
+	if (records == NULL)
+		return EXIT_FAILURE;
+
+	// the results go where standard output went, and standard output
+	// goes to the file that stands in for the terminal
+	FILE *results = fdopen(dup(STDOUT_FILENO), "w");
+	FILE *screen = tmpfile();
+	if (results == NULL || screen == NULL) {
+		perror("bench_render");
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+	dup2(fileno(screen), STDOUT_FILENO);
+	setenv("TERM", "xterm", 0);
+
+	fprintf(results, "%d boards, %ld frames from %s, %dx%d terminal\n\n",
+	        records[0].nboards, records[n_records - 1].frame + 1L,
+	        recording ? recording : "seeded games", rows, columns);
+	fprintf(results, "%-8s %12s %12s\n", "backend", "frames/s",
+	        "bytes/frame");
+	fflush(results);
+
+	for (int i = 0; i < n_backends; i++) {
+		const struct bench_backend *backend = NULL;
+		for (size_t k = 0; k < sizeof(known_backends) /
+		                           sizeof(known_backends[0]);
+		     k++)
+			if (strcmp(backends[i], known_backends[k].name) == 0)
+				backend = known_backends + k;
+		if (backend == NULL) {
+			fprintf(stderr, "unknown backend %s\n", backends[i]);
+			continue;
+		}
+
+		struct bench_result res;
+		run_backend(backend->backend, rows, columns, records,
+		            n_records, &res);
+		fprintf(results, "%-8s %12.0f %12.1f\n", backend->name,
+		        res.frames / res.seconds,
+		        (double)res.bytes / res.frames);
+		fflush(results);
+	}
+
+	free(records);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,336 @@
+/**
+ * Loopback benchmark for the server's reactor backends.
+ *
+ * For each backend the benchmark starts a tetris-mint-server, connects a
+ * number of clients, groups them into parties and starts the games. Every
+ * client then keeps one ROTATE in flight: it sends the next one as soon as the
+ * server echoes its own board back. The rate at which frames arrive (boards
+ * from inputs, and from gravity) is reported for each backend.
+ *
+ * With -U, the clients connect over a Unix domain socket instead of TCP, which
+ * leaves out the cost of the TCP stack.
+ *
+ * usage: bench_server [-s SERVER] [-p PORT] [-c CLIENTS] [-g PARTY_SIZE]
+ *                     [-d SECONDS] [-t THREADS] [-U PATH] [BACKEND...]
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "generic.h"
+#include "log.h"
+#include "message.h"
+#include "transport.h"
+
+#define HEADER_SIZE sizeof(MessageHeader)
+
+struct bench_client {
+	SOCKET fd;
+	char name[16];
+	/* the client's party slot, once the game started */
+	int slot;
+	char buffer[8 * MAXMSG];
+	int length;
+	/* non-zero while a ROTATE is waiting for its board */
+	char waiting;
+};
+
+struct bench_result {
+	long frames;
+	long bytes;
+	long inputs;
+	double seconds;
+};
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void) {
+	printf("usage: bench_server [-s SERVER] [-p PORT] [-c CLIENTS] "
+	       "[-g PARTY_SIZE] [-d SECONDS] [-t THREADS] [-U PATH] "
+	       "[BACKEND...]\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * start the server with the given backend, discarding its output
+ * @return the pid of the server
+ */
+static pid_t start_server(char *server, int port, char *backend,
+                          char *threads, char *socket_path) {
+	char port_str[6];
+	snprintf(port_str, sizeof(port_str), "%d", port);
+
+	// don't let the child inherit (and print) our buffered output
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		if (socket_path)
+			execl(server, server, "-U", socket_path, "-r", backend,
+			      "-t", threads, (char *)NULL);
+		else
+			execl(server, server, "-p", port_str, "-r", backend,
+			      "-t", threads, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static SOCKET connect_client(TransportAddress *address) {
+	// the server may still be starting up
+	for (int attempt = 0; attempt < 100; attempt++) {
+		SOCKET fd = transport_connect(address);
+		if (fd >= 0)
+			return fd;
+		usleep(20000);
+	}
+	return -1;
+}
+
+/**
+ * Find the client's slot in the list of party members sent when the game
+ * started
+ * @return the slot, or -1 if the client is not in the list
+ */
+static int party_slot(struct bench_client *client, char *body, int length) {
+	Blob blob = {length, body};
+	StringArray *members = string_array_deserialize(&blob);
+	int slot = string_array_index_of(members, client->name);
+
+	string_array_destroy(members);
+	return slot;
+}
+
+/**
+ * Read everything available on the client's socket and count the frames.
+ * @return the number of bytes read, or -1 if the server hung up
+ */
+static int drain_client(struct bench_client *client, struct bench_result *res,
+                        int count) {
+	int total = 0;
+	int n;
+
+	while ((n = recv(client->fd, client->buffer + client->length,
+	                 sizeof(client->buffer) - client->length,
+	                 MSG_DONTWAIT)) > 0) {
+		total += n;
+		client->length += n;
+
+		char *cursor = client->buffer;
+		char *end = client->buffer + client->length;
+		while (end - cursor >= (long)HEADER_SIZE) {
+			MessageHeader *header = (MessageHeader *)cursor;
+			if (end - cursor <
+			    (long)(HEADER_SIZE + header->content_length))
+				break;
+			if (header->message_type == MSG_TYPE_GAME_STARTED)
+				client->slot = party_slot(
+				    client, cursor + HEADER_SIZE,
+				    header->content_length);
+			// a board carrying our own slot answers our input
+			if (header->message_type == MSG_TYPE_BOARD &&
+			    (uint8_t)cursor[HEADER_SIZE] == client->slot)
+				client->waiting = 0;
+			if (count)
+				res->frames++;
+			cursor += HEADER_SIZE + header->content_length;
+		}
+		client->length = end - cursor;
+		memmove(client->buffer, cursor, client->length);
+	}
+	if (count)
+		res->bytes += total;
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		return -1;
+	return total;
+}
+
+static int run_backend(char *server, int port, char *socket_path,
+                       char *backend, char *threads, int n_clients,
+                       int party_size, double duration,
+                       struct bench_result *res) {
+	struct bench_client *clients =
+	    calloc(n_clients, sizeof(struct bench_client));
+	struct pollfd *fds = calloc(n_clients, sizeof(struct pollfd));
+	char rotate = 1;
+	int ret = EXIT_SUCCESS;
+
+	TransportAddress address;
+
+	memset(res, 0, sizeof(struct bench_result));
+	if (socket_path)
+		transport_address_unix(&address, socket_path);
+	else
+		transport_address_tcp(&address, "127.0.0.1", port);
+	pid_t pid = start_server(server, port, backend, threads, socket_path);
+
+	for (int i = 0; i < n_clients; i++) {
+		clients[i].fd = connect_client(&address);
+		if (clients[i].fd < 0) {
+			fprintf(stderr, "%s: could not connect client %d\n",
+			        backend, i);
+			n_clients = i;
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+		snprintf(clients[i].name, sizeof(clients[i].name), "bench%d",
+		         i);
+		clients[i].slot = -1;
+		message_nbytes(clients[i].fd, clients[i].name,
+		               sizeof(clients[i].name), 0, MSG_TYPE_REGISTER);
+		fds[i].fd = clients[i].fd;
+		fds[i].events = POLLIN;
+	}
+	// let the registrations land before naming opponents
+	usleep(200000);
+
+	// the first client of each party names the others and starts the game
+	for (int leader = 0; leader < n_clients; leader += party_size) {
+		int members = party_size;
+		if (leader + members > n_clients)
+			members = n_clients - leader;
+		StringArray *names = string_array_create(members - 1, 15);
+		for (int i = 1; i < members; i++)
+			string_array_set_item(names, i - 1,
+			                      clients[leader + i].name);
+		Blob *blob = string_array_serialize(names);
+		message_blob(clients[leader].fd, blob, 0, MSG_TYPE_OPPONENT);
+		message_nbytes(clients[leader].fd, NULL, 0, 0,
+		               MSG_TYPE_START_GAME);
+		destroy_blob(blob);
+		string_array_destroy(names);
+	}
+	usleep(200000);
+	for (int i = 0; i < n_clients; i++)
+		drain_client(&clients[i], res, 0);
+
+	double start = now();
+	while ((res->seconds = now() - start) < duration) {
+		for (int i = 0; i < n_clients; i++) {
+			if (clients[i].waiting)
+				continue;
+			message_nbytes(clients[i].fd, &rotate, 1, 0,
+			               MSG_TYPE_ROTATE);
+			clients[i].waiting = 1;
+			res->inputs++;
+		}
+		if (poll(fds, n_clients, 100) < 0 && errno != EINTR)
+			break;
+		for (int i = 0; i < n_clients; i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (drain_client(&clients[i], res, 1) < 0) {
+				fprintf(stderr, "%s: server hung up\n",
+				        backend);
+				ret = EXIT_FAILURE;
+				goto out;
+			}
+		}
+	}
+
+out:
+	for (int i = 0; i < n_clients; i++)
+		close(clients[i].fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	free(clients);
+	free(fds);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	char server[1024];
+	int port = 5599;
+	char *threads = "1";
+	char *socket_path = NULL;
+	int n_clients = 64;
+	int party_size = 4;
+	double duration = 5;
+	char *default_backends[] = {"select", "epoll", "uring"};
+	char **backends = default_backends;
+	int n_backends = 3;
+
+	// the message helpers log every frame, which would dominate the
+	// measurement
+	logging_set_fp(fopen("/dev/null", "w"));
+
+	// by default, expect the server next to the benchmark
+	snprintf(server, sizeof(server), "%s", argv[0]);
+	char *slash = strrchr(server, '/');
+	snprintf(slash ? slash + 1 : server,
+	         sizeof(server) - (slash ? slash + 1 - server : 0),
+	         "tetris-mint-server");
+
+	int opt;
+	while ((opt = getopt(argc, argv, ":hs:p:c:g:d:t:U:")) != -1) {
+		switch (opt) {
+		case 's':
+			snprintf(server, sizeof(server), "%s", optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			n_clients = atoi(optarg);
+			break;
+		case 'g':
+			party_size = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 't':
+			threads = optarg;
+			break;
+		case 'U':
+			socket_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc) {
+		backends = argv + optind;
+		n_backends = argc - optind;
+	}
+	if (n_clients < 1 || party_size < 1)
+		usage();
+
+	printf("%d clients in parties of %d over %s, %s reactor thread(s), "
+	       "%.1f seconds per backend\n\n",
+	       n_clients, party_size, socket_path ? socket_path : "TCP",
+	       threads, duration);
+	printf("%-8s %12s %12s %12s\n", "backend", "inputs/s", "frames/s",
+	       "MB/s");
+
+	for (int i = 0; i < n_backends; i++) {
+		struct bench_result res;
+		// each backend gets its own port, since an io_uring server
+		// may hold on to its listening socket for a moment after it
+		// exits, and keep accepting connections there
+		if (run_backend(server, port + i, socket_path, backends[i],
+		                threads, n_clients, party_size, duration,
+		                &res) != EXIT_SUCCESS)
+			continue;
+		printf("%-8s %12.0f %12.0f %12.2f\n", backends[i],
+		       res.inputs / res.seconds, res.frames / res.seconds,
+		       res.bytes / res.seconds / 1e6);
+	}
+
+	return EXIT_SUCCESS;
+}
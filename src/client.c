@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include "client_conn.h"
+#include "client_loop.h"
 #include "event.h"
 #include "log.h"
 #include "offline.h"
@@ -15,33 +16,80 @@
 #include "tetris_game.h"
 #include "widgets.h"
 
+// whether online games predict the player's own board (see prediction.h)
+static int predict = 1;
+// whether online games simulate every board from relayed inputs (see
+// lockstep.h)
+static int lockstep = 0;
+// whether online games send inputs and receive boards as datagrams (see
+// udp.h)
+static int datagrams = 0;
+// (optional) path of the server's Unix domain socket, used instead of TCP
+static char *socket_path = NULL;
+// how many times a second games are drawn
+static int fps = 60;
+
+// how long the lobby waits before asking again for opponents when nobody is
+// online
+#define LOBBY_RELIST_MS 2000
+
 /**
  * print the usage and exit
  */
 void usage() {
-	fprintf(stderr,
-	        "Usage: ./client [-h] [-f] [-l] [-s] [-a ADDRESS] [-p PORT]\n");
+	fprintf(stderr, "Usage: ./client [-h] [-f] [-l] [-s] [-n] [-k] [-u] "
+	                "[-A] [-L LOSS] [-F FPS] [-R RECORDING] [-a ADDRESS] "
+	                "[-p PORT] [-U PATH]\n");
 	exit(EXIT_FAILURE);
 }
 
+/**
+ * connect to the server over TCP, or over its Unix domain socket if one was
+ * given
+ */
+static int connect_to_server(NetClient *net_client, char *host, int port) {
+	TransportAddress address;
+
+	if (socket_path)
+		transport_address_unix(&address, socket_path);
+	else
+		transport_address_tcp(&address, host, port);
+	return tetris_connect_to(net_client, &address);
+}
+
+/**
+ * draw the boards that changed since the last frame
+ */
+static void draw_frame(void *data) { render_frame(); }
+
 /**
  * run an offline game of tetris
  */
 int run_offline(ControlKeybindings keybindings) {
-	// initialize the player list
-	player_init();
+	// initialize the player list. The game clock is advanced by the loop
+	// waiting for keys, so that the game is only drawn from this thread.
+	player_init_manual_clock();
+	ClientLoop *loop = client_loop_create(player_game_clock());
+	client_loop_set_frames(loop, fps, draw_frame, NULL);
 
 	// create a single player
 	char *names[1];
 	names[0] = "You";
 	Player *player = player_create(0, names[0]);
+	if (player == NULL) {
+		client_loop_destroy(loop);
+		return EXIT_FAILURE;
+	}
 	player_game_start(player);
 
 	render_init(1, names);
-	keyboard_input_loop(offline_control_set(player), keybindings, NULL);
+	keyboard_input_loop(loop, offline_control_set(player), keybindings,
+	                    NULL);
 
-	player_game_stop(player);
+	// the name is free again for the next game
+	player_disconnect(player);
 	render_close();
+	client_loop_destroy(loop);
 	return EXIT_SUCCESS;
 }
 
@@ -50,7 +98,7 @@ int run_offline(ControlKeybindings keybindings) {
  */
 int run_list_online_players(char *host, int port) {
 	NetClient *net_client = net_client_init();
-	if (tetris_connect(net_client, host, port) == EXIT_FAILURE) {
+	if (connect_to_server(net_client, host, port) == EXIT_FAILURE) {
 		perror("run_list_online_players");
 		return EXIT_FAILURE;
 	}
@@ -58,35 +106,132 @@ int run_list_online_players(char *host, int port) {
 	tetris_listen(net_client);
 
 	StringArray *names = tetris_list(net_client);
+	if (names == NULL) {
+		tetris_disconnect(net_client);
+		return EXIT_FAILURE;
+	}
 	for (int i = 0; i < names->length; i++) {
 		fprintf(stderr, "%s\n", string_array_get_item(names, i));
 	}
+	string_array_destroy(names);
 
 	tetris_disconnect(net_client);
 	return EXIT_SUCCESS;
 }
 
-void *player_lobby(void *_net_client) {
-	NetClient *net_client = (NetClient *)_net_client;
-	// get the list of possible opponents
-	StringArray *online_usernames = tetris_list(net_client);
-	while (online_usernames->length == 0) {
-		sleep(2);
-		online_usernames = tetris_list(net_client);
-	};
+/**
+ * ask the server for what the game was set up with on the command line, once
+ * the player has registered
+ */
+static void set_up_online_game(NetClient *net_client, char *host, int port) {
+	// in lockstep, the player's own board is simulated from the relayed
+	// inputs like every other board
+	if (lockstep)
+		tetris_lockstep(net_client);
+	else if (predict)
+		tetris_predict(net_client);
+	if (datagrams && tetris_use_datagrams(net_client, host, port) !=
+	                     EXIT_SUCCESS)
+		fprintf(logging_fp, "set_up_online_game: using the connection "
+		                    "for inputs and boards\n");
+}
 
-	WidgetSelection *selection = ttviz_select(
-	    online_usernames->strings, online_usernames->length, "Opponent", 0);
-	StringArray *opponents = selection_to_string_array(selection);
-	tetris_opponent(net_client, opponents);
+/**
+ * Register the player, let them pick their opponents from the online
+ * players, and start the game. Everything runs on the loop's thread: the loop
+ * reads the server's responses while it waits for keys, and returns after
+ * each so that the requests can be checked. The lobby ends as soon as the
+ * game starts, whether the player started it or was picked as an opponent.
+ * @return EXIT_SUCCESS once the game has started, or EXIT_FAILURE
+ */
+static int run_lobby(ClientLoop *loop, NetClient *net_client, char *host,
+                     int port) {
+	Player *player = net_client->player;
+	NetRequest *registration, *listing = NULL;
+	StringArray *online_usernames = NULL;
+	WidgetSelect *select = NULL;
+	uint64_t list_at_ms = 0;
+	int ch, wait_ms;
+
+	fprintf(logging_fp, "Sending registration username=%s\n",
+	        player->name);
+	registration = tetris_register(net_client, player->name);
+	if (registration == NULL)
+		return EXIT_FAILURE;
 
-	tetris_tell_server_to_start(net_client);
+	while (!ttetris_event_is_complete(player->game_start_event)) {
+		// nothing needs doing until a key or a response arrives,
+		// unless the online players are to be listed again
+		wait_ms = -1;
+		if (!registration && !listing && !online_usernames) {
+			uint64_t now = monotonic_ms();
+			wait_ms =
+			    now < list_at_ms ? (int)(list_at_ms - now) : 0;
+		}
+		ch = client_loop_getch(loop, wait_ms);
+
+		if (registration &&
+		    ttetris_net_request_is_complete(registration)) {
+			int registered =
+			    registration->type == MSG_TYPE_REGISTER_SUCCESS;
+			ttetris_net_request_release(net_client, registration);
+			registration = NULL;
+			if (!registered) {
+				fprintf(logging_fp, "The username %s is taken "
+				                    "by another player\n",
+				        player->name);
+				return EXIT_FAILURE;
+			}
+			fprintf(logging_fp, "Registered successfully! Fetching "
+			                    "online players from server...");
+			set_up_online_game(net_client, host, port);
+		}
 
-	// free up resources
-	string_array_destroy(online_usernames);
-	selection_destroy(selection);
+		// get the list of possible opponents, again a while later if
+		// nobody else is online yet
+		if (!registration && !listing && !online_usernames &&
+		    monotonic_ms() >= list_at_ms)
+			listing = tetris_list_request(net_client);
+		if (listing && ttetris_net_request_is_complete(listing)) {
+			online_usernames =
+			    tetris_list_response(net_client, listing);
+			listing = NULL;
+			if (online_usernames->length == 0) {
+				string_array_destroy(online_usernames);
+				online_usernames = NULL;
+				list_at_ms = monotonic_ms() + LOBBY_RELIST_MS;
+			} else {
+				select = ttviz_select_begin(
+				    online_usernames->strings,
+				    online_usernames->length, "Opponent", 0);
+			}
+			continue;
+		}
+
+		if (select && ttviz_select_feed(select, ch)) {
+			WidgetSelection *selection = ttviz_select_end(select);
+			select = NULL;
+			StringArray *opponents =
+			    selection_to_string_array(selection);
+			tetris_opponent(net_client, opponents);
+			tetris_tell_server_to_start(net_client);
+			string_array_destroy(opponents);
+			selection_destroy(selection);
+		}
+	}
 
-	return NULL;
+	fprintf(logging_fp, "run_lobby: unblocked by game start\n");
+
+	// free up resources
+	if (select)
+		selection_destroy(ttviz_select_end(select));
+	if (online_usernames)
+		string_array_destroy(online_usernames);
+	if (listing)
+		ttetris_net_request_release(net_client, listing);
+	if (registration)
+		ttetris_net_request_release(net_client, registration);
+	return EXIT_SUCCESS;
 }
 
 /**
@@ -94,18 +239,22 @@ void *player_lobby(void *_net_client) {
  */
 int run_online(ControlKeybindings keybindings, char *host, int port) {
 	fprintf(logging_fp, "run_online(%s, %d)\n", host, port);
-	// initialize the player list
-	player_init();
+	// initialize the player list. The game clock is advanced by the loop,
+	// like everything else that happens during the game.
+	player_init_manual_clock();
+	ClientLoop *loop = client_loop_create(player_game_clock());
+	client_loop_set_frames(loop, fps, draw_frame, NULL);
 
 	// connect to the server
 	NetClient *net_client = net_client_init(host, port);
-	if (tetris_connect(net_client, host, port) == EXIT_FAILURE) {
+	if (connect_to_server(net_client, host, port) == EXIT_FAILURE) {
 		char errmsg[256];
 		last_error_message_to_buffer(errmsg, 256);
 		fprintf(logging_fp, "run_online: %s\n", errmsg);
+		client_loop_destroy(loop);
 		return EXIT_FAILURE;
 	}
-	tetris_listen(net_client);
+	tetris_listen_on(net_client, loop);
 
 	// prompt for a username
 	char username[32];
@@ -114,39 +263,31 @@ int run_online(ControlKeybindings keybindings, char *host, int port) {
 	fprintf(logging_fp, "Entered username=%s\n", username);
 
 	// create our player
-	Player *player = player_create(0, username);
-	player->fd = net_client->fd;
+	Player *player = player_create(net_client->fd, username);
+	if (player == NULL) {
+		tetris_disconnect(net_client);
+		client_loop_destroy(loop);
+		return EXIT_FAILURE;
+	}
 	net_client->player = player;
 
-	fprintf(logging_fp, "Sending registration username=%s\n", username);
-
-	// register our player
-	NetRequest *request = tetris_register(net_client, username);
-	ttetris_net_request_block_for_response(request);
-
-	fprintf(
-	    logging_fp,
-	    "Registered successfully! Fetching online players from server...");
-
-	// get the list of possible opponents
-
-	pthread_t _thread;
-	pthread_create(&_thread, NULL, player_lobby, net_client);
-
-	// block until we hear from the server that the game has started
-	ttetris_event_block_for_completion(player->game_start_event);
-
-	fprintf(logging_fp, "run_online: unblocked by game start\n");
-
-	// cancel the lobby thread if it is still running
-	pthread_cancel(_thread);
+	if (run_lobby(loop, net_client, host, port) != EXIT_SUCCESS) {
+		tetris_disconnect(net_client);
+		net_client->player = NULL;
+		player_disconnect(player);
+		client_loop_destroy(loop);
+		return EXIT_FAILURE;
+	}
 
 	// create the renderer and start the input loop
-	keyboard_input_loop(tcp_control_set(), keybindings, net_client);
+	keyboard_input_loop(loop, tcp_control_set(), keybindings, net_client);
 
 	render_close();
 
 	tetris_disconnect(net_client);
+	net_client->player = NULL;
+	player_disconnect(player);
+	client_loop_destroy(loop);
 	return EXIT_SUCCESS;
 }
 
@@ -204,6 +345,7 @@ int main(int argc, char *argv[]) {
 	char port[6] = "5555";
 
 	int list_players = 0;
+	FILE *record_fp = NULL;
 
 #ifdef THIS_IS_WINDOWS
 	char *log_filename = "nul";
@@ -216,7 +358,7 @@ int main(int argc, char *argv[]) {
 	// treated differently than unknown flags. The proceding colons indicate
 	// that flags must have a value.
 	int opt;
-	while ((opt = getopt(argc, argv, ":hlf:a:p:")) != -1) {
+	while ((opt = getopt(argc, argv, ":hlnkuAL:F:R:U:f:a:p:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage();
@@ -235,6 +377,39 @@ int main(int argc, char *argv[]) {
 		case 'l':
 			list_players = 1;
 			break;
+		case 'n':
+			predict = 0;
+			break;
+		case 'k':
+			lockstep = 1;
+			break;
+		case 'u':
+			datagrams = 1;
+			break;
+		case 'A':
+			render_use_backend(RENDER_ANSI);
+			break;
+		case 'L':
+			// drop datagrams on purpose, to test over loopback
+			udp_set_loss(atoi(optarg));
+			break;
+		case 'F':
+			fps = atoi(optarg);
+			if (fps <= 0)
+				usage();
+			break;
+		case 'R':
+			// keep the frames drawn, to replay with bench_render
+			record_fp = fopen(optarg, "wb");
+			if (record_fp == NULL) {
+				perror(optarg);
+				usage();
+			}
+			render_record(record_fp);
+			break;
+		case 'U':
+			socket_path = optarg;
+			break;
 		case ':':
 			printf("option -%c needs a value\n", optopt);
 			break;
@@ -269,5 +444,10 @@ int main(int argc, char *argv[]) {
 	// make sure terminal is functional when we exit
 	endwin();
 
+	if (record_fp) {
+		render_record(NULL);
+		fclose(record_fp);
+	}
+
 	return exit_code;
 }
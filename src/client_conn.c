@@ -22,123 +22,142 @@
 #include "message.h"
 #include "render.h"
 #include "tetris_game.h"
+#include "transport.h"
 
-// for backward compatibility
-#define h_addr h_addr_list[0]
+void tetris_send_message(NetClient *net_client, char *body,
+                         msg_type_t message_type) {
+	uint16_t len = strlen(body) + 1;
+	// nothing waits for a reply, so the message is not a request
+	message_nbytes(net_client->fd, body, len, 0, message_type);
+}
 
 /**
- * Borrowed from GNU Socket Tutorial
- *
- * @return EXIT_SUCCESS or EXIT_FAILURE
+ * Send the inputs batched during the frame to the server
  */
-static int init_sockaddr(struct sockaddr_in *name, const char *hostname,
-                         uint16_t port) {
-	struct hostent *hostinfo;
-
-	name->sin_family = AF_INET;
-	name->sin_port = htons(port);
-	hostinfo = gethostbyname(hostname);
-	if (hostinfo == NULL) {
-		fprintf(logging_fp, "Unknown host %s.\n", hostname);
-		return EXIT_FAILURE;
+static void tetris_flush_inputs(void *_net_client) {
+	NetClient *net_client = (NetClient *)_net_client;
+
+	if (net_client->batch_length == 0)
+		return;
+	// the socket is set by the listening thread (see datagrams_offered)
+	SOCKET udp_fd = __atomic_load_n(&net_client->udp_fd, __ATOMIC_ACQUIRE);
+	if (udp_fd >= 0) {
+		// the inputs are sent again until the server acknowledges
+		// them
+		udp_inputs_add(&net_client->udp_inputs, net_client->batch_seq,
+		               net_client->batch, net_client->batch_length);
+		udp_inputs_send(&net_client->udp_inputs, udp_fd,
+		                net_client->udp_token);
+	} else {
+		message_nbytes(
+		    net_client->fd, (char *)net_client->batch,
+		    sizeof(struct input_record) * net_client->batch_length,
+		    net_client->batch_seq, MSG_TYPE_INPUTS);
 	}
-	name->sin_addr = *(struct in_addr *)hostinfo->h_addr;
-
-	return EXIT_SUCCESS;
-}
-
-void tetris_send_message(NetClient *net_client, char *body,
-                         msg_type_t message_type) {
-	uint16_t len = strlen(body) + 1;
-	ttetris_net_request(net_client, body, len, message_type);
+	net_client->batch_length = 0;
 }
 
 /**
- * get socket or exit if an error occurs
+ * Add an input to the batch for the current frame. With prediction, the
+ * input is also applied to the predicted game, which is drawn without waiting
+ * for the server.
  */
-int get_socket() {
-#ifdef THIS_IS_WINDOWS
-	WSADATA wsaData;
-	int startup_result;
-	// perform the required initialization for winsock
-	if ((startup_result = WSAStartup(MAKEWORD(2, 2), &wsaData)) != 0) {
-		fprintf(logging_fp, "WSAStartup failed with error: %d\n",
-		        startup_result);
-		return EXIT_FAILURE;
+static void tetris_input(NetClient *net_client, enum player_event event,
+                         int arg) {
+	struct input_record *last = NULL;
+	uint16_t seq;
+
+	if (net_client->prediction) {
+		seq = prediction_input(net_client->prediction, event, arg);
+		if (prediction_view(net_client->prediction,
+		                    &net_client->player->view) == EXIT_SUCCESS)
+			render_game_view_data_at(net_client->player->party_slot,
+			                         net_client->player->view);
+	} else {
+		// numbered inputs skip 0, like in MSG_TYPE_INPUTS
+		seq = net_client->next_seq++;
+		if (net_client->next_seq == 0)
+			net_client->next_seq = 1;
 	}
-#endif
 
-	int sock = socket(PF_INET, SOCK_STREAM, 0);
-	if (sock >= 0)
-		return sock;
+	// inputs are numbered one after the other, so a repeat of the last
+	// input only needs to be counted
+	if (net_client->batch_length > 0)
+		last = &net_client->batch[net_client->batch_length - 1];
+	if (last && last->event == event && last->arg == arg &&
+	    last->repeat < UINT8_MAX) {
+		last->repeat++;
+		return;
+	}
 
-	perror("socket (client)");
-	return EXIT_FAILURE;
+	if (net_client->batch_length == INPUT_BATCH_MAX)
+		tetris_flush_inputs(net_client);
+	if (net_client->batch_length == 0)
+		net_client->batch_seq = seq;
+	net_client->batch[net_client->batch_length++] = (struct input_record){
+	    (monotonic_ms() - net_client->clock_start_ms) / PLAYER_TICK_MS,
+	    event, arg, 1, 0};
 }
 
 static void tetris_translate(void *net_client, int x) {
-	char xdir = x > 0 ? 1 : 0;
-	char message[2];
-	sprintf(message, "%c", xdir);
-	tetris_send_message((NetClient *)net_client, message,
-	                    MSG_TYPE_TRANSLATE);
+	tetris_input((NetClient *)net_client, PLAYER_EVENT_TRANSLATE, x > 0);
 }
 
 static void tetris_lower(void *net_client) {
-	ttetris_net_request((NetClient *)net_client, NULL, 0, MSG_TYPE_LOWER);
+	tetris_input((NetClient *)net_client, PLAYER_EVENT_LOWER, 0);
 }
 
 static void tetris_rotate(void *net_client, int theta) {
-	char dir = theta > 0 ? 1 : 0;
-	char message[2];
-	sprintf(message, "%c", dir);
-	tetris_send_message((NetClient *)net_client, message, MSG_TYPE_ROTATE);
+	tetris_input((NetClient *)net_client, PLAYER_EVENT_ROTATE, theta > 0);
 }
 
 static void tetris_drop(void *net_client) {
-	ttetris_net_request((NetClient *)net_client, NULL, 0, MSG_TYPE_DROP);
+	tetris_input((NetClient *)net_client, PLAYER_EVENT_DROP, 0);
 }
 
 static void tetris_swap_hold(void *net_client) {
-	ttetris_net_request((NetClient *)net_client, NULL, 0,
-	                    MSG_TYPE_SWAP_HOLD);
+	tetris_input((NetClient *)net_client, PLAYER_EVENT_SWAP_HOLD, 0);
 }
 
-StringArray *tetris_list(NetClient *net_client) {
-	NetRequest *request =
-	    ttetris_net_request(net_client, NULL, 0, MSG_TYPE_LIST);
-	ttetris_net_request_block_for_response(request);
-
-	MessageHeader *header = (MessageHeader *)request->cursor;
+NetRequest *tetris_list_request(NetClient *net_client) {
+	return ttetris_net_request(net_client, NULL, 0, MSG_TYPE_LIST);
+}
 
+StringArray *tetris_list_response(NetClient *net_client, NetRequest *request) {
 	// deserialize names
-	Blob *body = malloc(sizeof(Blob));
-	body->bytes = request->cursor;
-	body->length = header->content_length;
-	return string_array_deserialize(body);
+	Blob body = {request->length, request->cursor};
+	StringArray *names = string_array_deserialize(&body);
+	ttetris_net_request_release(net_client, request);
+	return names;
+}
+
+StringArray *tetris_list(NetClient *net_client) {
+	NetRequest *request = tetris_list_request(net_client);
+	if (request == NULL)
+		return NULL;
+	ttetris_net_request_block_for_response(request);
+	return tetris_list_response(net_client, request);
 }
 
 /**
  * establish a connection to the server
  */
-int tetris_connect(NetClient *net_client, char *host, int port) {
-	struct sockaddr_in servername;
-
-	/* Create the socket. */
-	SOCKET sock_fd = get_socket();
-
-	/* Connect to the server. */
-	init_sockaddr(&servername, host, port);
-	if (0 > connect(sock_fd, (struct sockaddr *)&servername,
-	                sizeof(servername))) {
+int tetris_connect_to(NetClient *net_client, TransportAddress *address) {
+	SOCKET sock_fd = transport_connect(address);
+	if (sock_fd < 0)
 		return EXIT_FAILURE;
-	}
 
 	net_client->fd = sock_fd;
 
 	return EXIT_SUCCESS;
 }
 
+int tetris_connect(NetClient *net_client, char *host, int port) {
+	TransportAddress address;
+	transport_address_tcp(&address, host, port);
+	return tetris_connect_to(net_client, &address);
+}
+
 /**
  * register
  */
@@ -148,13 +167,24 @@ NetRequest *tetris_register(NetClient *net_client, char *username) {
 	return ttetris_net_request(net_client, message, 16, MSG_TYPE_REGISTER);
 }
 
+void tetris_lockstep(NetClient *net_client) {
+	net_client->lockstep_mode = 1;
+	message_nbytes(net_client->fd, NULL, 0, 0, MSG_TYPE_LOCKSTEP);
+}
+
+void tetris_predict(NetClient *net_client) {
+	net_client->prediction = prediction_create();
+	message_nbytes(net_client->fd, NULL, 0, 0, MSG_TYPE_PREDICT);
+}
+
 /**
  * select opponent by username
  */
 void tetris_opponent(NetClient *net_client, StringArray *usernames) {
 	Blob *message = string_array_serialize(usernames);
-	ttetris_net_request(net_client, message->bytes, message->length,
-	                    MSG_TYPE_OPPONENT);
+	// the server does not reply, so the message is not a request
+	message_nbytes(net_client->fd, message->bytes, message->length, 0,
+	               MSG_TYPE_OPPONENT);
 	free(message->bytes);
 	free(message);
 }
@@ -164,36 +194,318 @@ void tetris_tell_server_to_start(NetClient *net_client) {
 }
 
 void tetris_disconnect(NetClient *net_client) {
+	if (net_client->udp_running) {
+		net_client->udp_running = 0;
+		pthread_join(net_client->udp_thread, NULL);
+	}
+	if (net_client->loop) {
+		client_loop_unwatch(net_client->loop, net_client->fd);
+		if (net_client->udp_fd >= 0) {
+			client_loop_unwatch(net_client->loop,
+			                    net_client->udp_fd);
+			timer_wheel_cancel(player_game_clock(),
+			                   &net_client->udp_timer);
+		}
+		net_client->loop = NULL;
+	}
+	if (net_client->udp_fd >= 0) {
+		close(net_client->udp_fd);
+		net_client->udp_fd = -1;
+	}
 	close(net_client->fd);
 	net_client->is_listen_thread_started = 0;
 }
 
 static int read_game_view_data(char *buffer, struct game_view_data *view) {
-	// get the player associated with the board
-	char *board_name = buffer;
-	unsigned int name_length = strnlen(board_name, PLAYER_NAME_MAX_CHARS);
-	// move the pointer past the name string
-	buffer += name_length + 1;
+	// there is nowhere to read boards to before the game started
+	if (view == NULL)
+		return EXIT_FAILURE;
+	// the board belongs to the player in the slot of the first byte
+	uint8_t slot = buffer[0];
 	// copy the game view data
-	memcpy(view, buffer, sizeof(struct game_view_data));
-	render_game_view_data(board_name, view);
+	memcpy(view, buffer + 1, sizeof(struct game_view_data));
+	render_game_view_data_at(slot, view);
 
 	return EXIT_SUCCESS;
 }
 
-void ttetris_net_request_complete(NetRequest *request) {
-	fprintf(logging_fp, "ttetris_net_request_complete\n");
+/**
+ * Reconcile the predicted game with the state sent by the server, and draw it
+ * again if the prediction was wrong
+ */
+static int read_game_state(NetClient *net_client, uint16_t ack, char *buffer,
+                           uint16_t length) {
+	struct game_state state;
+	Player *player = net_client->player;
+
+	if (net_client->prediction == NULL || length != sizeof(state))
+		return EXIT_FAILURE;
+	memcpy(&state, buffer, sizeof(state));
+	if (prediction_reconcile(net_client->prediction, ack, &state) != 1)
+		return EXIT_SUCCESS;
+	if (prediction_view(net_client->prediction, &player->view) ==
+	    EXIT_SUCCESS)
+		render_game_view_data_at(player->party_slot, player->view);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Draw a party member's game as simulated in lockstep
+ */
+static void render_lockstep(NetClient *net_client, int slot) {
+	Lockstep *lockstep = net_client->lockstep;
+	Player *player = net_client->player;
+
+	if (lockstep_view(lockstep, slot, &player->view) == EXIT_SUCCESS)
+		render_game_view_data_at(slot, player->view);
+}
+
+/**
+ * Apply a lockstep message to the party's games (see MSG_TYPE_LOCKSTEP)
+ */
+static int read_lockstep(NetClient *net_client, msg_type_t message_type,
+                         char *buffer, uint16_t length) {
+	Lockstep *lockstep = net_client->lockstep;
+	struct lockstep_event event;
+	struct lockstep_hash hash;
+	struct lockstep_snapshot *snapshot;
+
+	if (lockstep == NULL)
+		return EXIT_FAILURE;
+
+	switch (message_type) {
+	case MSG_TYPE_EVENT:
+		if (length != sizeof(event))
+			return EXIT_FAILURE;
+		memcpy(&event, buffer, sizeof(event));
+		if (lockstep_event(lockstep, event.slot, event.tick,
+		                   event.event, event.arg))
+			render_lockstep(net_client, event.slot);
+		break;
+	case MSG_TYPE_HASH:
+		if (length != sizeof(hash))
+			return EXIT_FAILURE;
+		memcpy(&hash, buffer, sizeof(hash));
+		if (lockstep_check(lockstep, hash.slot, hash.hash) !=
+		    EXIT_SUCCESS)
+			message_nbytes(net_client->fd, (char *)&hash.slot, 1,
+			               0, MSG_TYPE_RESYNC);
+		break;
+	case MSG_TYPE_SNAPSHOT:
+		if (length != sizeof(*snapshot))
+			return EXIT_FAILURE;
+		snapshot = malloc(sizeof(*snapshot));
+		memcpy(snapshot, buffer, sizeof(*snapshot));
+		if (lockstep_snapshot(lockstep, snapshot->slot, snapshot->tick,
+		                      &snapshot->state) == EXIT_SUCCESS)
+			render_lockstep(net_client, snapshot->slot);
+		free(snapshot);
+		break;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Tell the server where to send datagrams, by sending an empty batch of inputs
+ */
+static void udp_hello(NetClient *net_client) {
+	struct udp_header header = {UDP_MAGIC_NUMBER, 0, 0,
+	                            net_client->udp_token};
+	Frame *frame = frame_create(NULL, 0, 0, MSG_TYPE_INPUTS);
+
+	udp_send(net_client->udp_fd, NULL, 0, &header, frame->bytes,
+	         frame->length);
+	frame_unref(frame);
+}
+
+/**
+ * Say hello until the server answers, and from then on send inputs again
+ * until they are acknowledged
+ */
+static void udp_resend(NetClient *net_client) {
+	// until the server answers, it may not know where to send datagrams
+	if (!net_client->udp_answered)
+		udp_hello(net_client);
+	else if (udp_inputs_resend_due(&net_client->udp_inputs))
+		udp_inputs_send(&net_client->udp_inputs, net_client->udp_fd,
+		                net_client->udp_token);
+}
+
+/**
+ * Receive a datagram from the server, if one has arrived
+ * @param view where a board is read to
+ */
+static void udp_read(NetClient *net_client, struct game_view_data *view) {
+	char buffer[UDP_DATAGRAM_MAX];
+	struct udp_header *udp = (struct udp_header *)buffer;
+	MessageHeader *header = (MessageHeader *)(udp + 1);
+	char *body = (char *)(header + 1);
+
+	if (udp_receive(net_client->udp_fd, buffer, NULL, NULL) < 0)
+		return;
+	if (!net_client->udp_answered)
+		fprintf(logging_fp, "udp_read: the server answered\n");
+	net_client->udp_answered = 1;
+	udp_inputs_ack(&net_client->udp_inputs, udp->ack);
+
+	// a board or state older than the last one shown is skipped
+	switch (header->message_type) {
+	case MSG_TYPE_BOARD:
+		if (udp_latest_accept(&net_client->udp_latest,
+		                      (uint8_t)body[0], udp->seq))
+			read_game_view_data(body, view);
+		break;
+	case MSG_TYPE_STATE:
+		if (udp_latest_accept(&net_client->udp_latest,
+		                      net_client->player->party_slot, udp->seq))
+			read_game_state(net_client, header->request_id, body,
+			                header->content_length);
+		break;
+	}
+}
+
+/**
+ * Receive datagrams from the server, and send inputs again until they are
+ * acknowledged. Used when there is no client loop.
+ */
+static void *udp_thread(void *_net_client) {
+	NetClient *net_client = (NetClient *)_net_client;
+	// the listening thread reads boards into the player's view, so boards
+	// read here need a view of their own
+	struct game_view_data *view = malloc(sizeof(struct game_view_data));
+
+	while (net_client->udp_running) {
+		udp_resend(net_client);
+		if (udp_wait(net_client->udp_fd, UDP_RESEND_MS) > 0)
+			udp_read(net_client, view);
+	}
+	free(view);
+	return NULL;
+}
+
+static void udp_readable(void *_net_client) {
+	NetClient *net_client = (NetClient *)_net_client;
+	// everything runs on the loop's thread, so the player's view is free
+	udp_read(net_client, net_client->player->view);
+}
+
+static void udp_resend_timer(Timer *timer, void *data) {
+	udp_resend((NetClient *)data);
+	timer_wheel_schedule(player_game_clock(), timer, UDP_RESEND_MS);
+}
+
+/**
+ * Start sending and receiving datagrams, once the server has answered the
+ * request for them with a token
+ * @param data the server's TransportAddress
+ */
+static void datagrams_offered(NetClient *net_client, NetRequest *request,
+                              void *data) {
+	TransportAddress *server = (TransportAddress *)data;
+	uint64_t token = 0;
+	SOCKET fd;
+
+	if (request->length >= sizeof(uint64_t))
+		memcpy(&token, request->cursor, sizeof(uint64_t));
+	if (token == 0) {
+		fprintf(logging_fp, "datagrams_offered: the server does not "
+		                    "offer datagrams, so the connection is "
+		                    "used for inputs and boards\n");
+		free(server);
+		return;
+	}
+
+	fd = udp_open(server->host, server->port, 0);
+	free(server);
+	if (fd < 0)
+		return;
+	net_client->udp_token = token;
+	udp_inputs_init(&net_client->udp_inputs);
+	memset(&net_client->udp_latest, 0, sizeof(UdpLatest));
+
+	net_client->udp_answered = 0;
+
+	// inputs go out as datagrams once the socket is set. The thread
+	// flushing inputs reads it, so everything above must be visible to
+	// that thread first.
+	__atomic_store_n(&net_client->udp_fd, fd, __ATOMIC_RELEASE);
+	if (net_client->loop) {
+		// the loop's clock takes the place of the thread's timeout
+		client_loop_watch(net_client->loop, fd, udp_readable,
+		                  net_client);
+		timer_init(&net_client->udp_timer, udp_resend_timer,
+		           net_client);
+		udp_resend_timer(&net_client->udp_timer, net_client);
+		return;
+	}
+	net_client->udp_running = 1;
+	if (pthread_create(&net_client->udp_thread, NULL, udp_thread,
+	                   net_client)) {
+		perror("error creating thread");
+		net_client->udp_running = 0;
+		__atomic_store_n(&net_client->udp_fd, -1, __ATOMIC_RELEASE);
+		close(fd);
+	}
+}
+
+int tetris_use_datagrams(NetClient *net_client, char *host, int port) {
+	TransportAddress *server = malloc(sizeof(TransportAddress));
+
+	transport_address_tcp(server, host, port);
+	if (ttetris_net_request_async(net_client, NULL, 0, MSG_TYPE_DATAGRAM,
+	                              datagrams_offered,
+	                              server) != EXIT_SUCCESS) {
+		free(server);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int ttetris_net_request_complete(NetClient *client, uint16_t id, char *body,
+                                 uint16_t length, msg_type_t type) {
+	NetRequest *request = &client->requests[NET_REQUEST_SLOT(id)];
+	NetRequestCallback callback;
+
+	pthread_mutex_lock(&client->requests_lock);
+	if (!request->in_use || request->id != id ||
+	    request->cursor != NULL) {
+		pthread_mutex_unlock(&client->requests_lock);
+		fprintf(logging_fp,
+		        "ttetris_net_request_complete: no request %d\n", id);
+		return EXIT_FAILURE;
+	}
+	request->cursor = malloc(length > 0 ? length : 1);
+	memcpy(request->cursor, body, length);
+	request->length = length;
+	request->type = type;
+	// once the lock is released, a request without a callback may be
+	// released and its slot taken again
+	callback = request->callback;
+	// a request may be released without waiting for its response, so the
+	// event is only safe to use while the lock is held
 	ttetris_event_mark_complete(request->response_event);
+	pthread_mutex_unlock(&client->requests_lock);
+
+	fprintf(logging_fp, "ttetris_net_request_complete\n");
+	// nobody holds a request with a callback, so it is released here
+	if (callback) {
+		callback(client, request, request->callback_data);
+		ttetris_net_request_release(client, request);
+	}
+	return EXIT_SUCCESS;
 };
 
 int read_from_server(NetClient *net_client) {
 	Blob *blob;
-	char buffer[MAXMSG];
 
 	fprintf(logging_fp, "read_from_server: called\n");
 
-	// remember that more than one TCP packet may be read by this command
-	int nbytes = recv(net_client->fd, buffer, MAXMSG, 0);
+	// remember that more than one TCP packet may be read by this command,
+	// and that the last message may only have partially arrived
+	int nbytes = recv(net_client->fd,
+	                  net_client->inbox + net_client->inbox_length,
+	                  sizeof(net_client->inbox) - net_client->inbox_length,
+	                  0);
 
 	if (nbytes == 0) {
 		// exit early if we reached the end-of-file
@@ -208,12 +520,13 @@ int read_from_server(NetClient *net_client) {
 	} else {
 		fprintf(logging_fp, "read_from_server read %d bytes\n", nbytes);
 	}
+	net_client->inbox_length += nbytes;
 
 	// initialize pointers for moving through data
-	char *end = buffer + nbytes;
-	char *cursor = buffer;
+	char *end = net_client->inbox + net_client->inbox_length;
+	char *cursor = net_client->inbox;
 
-	while (cursor < end) {
+	while (end - cursor >= (long)sizeof(MessageHeader)) {
 		MessageHeader *header = (MessageHeader *)cursor;
 
 		// Check the magic number, used a mechanism to detect errors.
@@ -222,9 +535,15 @@ int read_from_server(NetClient *net_client) {
 		if (header->magic_number != MSG_MAGIC_NUMBER) {
 			fprintf(logging_fp,
 			        "read_from_server: incorrect magic number\n");
+			net_client->inbox_length = 0;
 			return EXIT_SUCCESS;
 		}
 
+		// wait for the rest of the message to arrive
+		if (end - cursor <
+		    (long)sizeof(MessageHeader) + header->content_length)
+			break;
+
 		fprintf(logging_fp,
 		        "read_from_server: message type=%s request_id=%d "
 		        "content_length=%d\n",
@@ -248,9 +567,23 @@ int read_from_server(NetClient *net_client) {
 			blob->bytes = cursor;
 			StringArray *party_members =
 			    string_array_deserialize(blob);
+			// boards are sent with the slot of their player, which
+			// is their position in the list
+			int slot = string_array_index_of(
+			    party_members, net_client->player->name);
+			if (slot >= 0)
+				net_client->player->party_slot = slot;
+			// boards are read into the player's view from now on
+			if (net_client->player->view == NULL)
+				net_client->player->view =
+				    create_game_view_data();
+			render_set_local_board(net_client->player->name);
 			render_init(party_members->length,
 			            party_members->strings);
 			free(blob);
+			if (net_client->lockstep_mode)
+				net_client->lockstep =
+				    lockstep_create(party_members);
 			// signal that the game has started
 			ttetris_event_mark_complete(
 			    net_client->player->game_start_event);
@@ -258,39 +591,45 @@ int read_from_server(NetClient *net_client) {
 		case MSG_TYPE_BOARD:
 			read_game_view_data(cursor, net_client->player->view);
 			break;
+		case MSG_TYPE_STATE:
+			read_game_state(net_client, header->request_id, cursor,
+			                header->content_length);
+			// the request id is an acknowledgement, not a reply
+			cursor += header->content_length;
+			continue;
+		case MSG_TYPE_EVENT:
+		case MSG_TYPE_HASH:
+		case MSG_TYPE_SNAPSHOT:
+			read_lockstep(net_client, header->message_type, cursor,
+			              header->content_length);
+			break;
 		case MSG_TYPE_REGISTER_SUCCESS:
+		case MSG_TYPE_REGISTER_FAILURE:
 		case MSG_TYPE_LIST_RESPONSE:
+		case MSG_TYPE_DATAGRAM:
 			break;
 		default:
 			// stop processing on this read chunk if it contained an
 			// unknown message
+			net_client->inbox_length = 0;
 			return EXIT_SUCCESS;
 		}
 
 		// if the message header has a non-zero request id, update the
 		// local representation
-		if (header->request_id != 0) {
-			NetRequest *request;
-			for (int i = 0; i < net_client->open_requests->length;
-			     i++) {
-				fprintf(logging_fp,
-				        "checking for responses %d\n", i);
-				request = (NetRequest *)list_get(
-				    net_client->open_requests, i);
-				if (request->id == header->request_id) {
-					request->cursor =
-					    malloc(header->content_length);
-					memcpy(request->cursor, cursor,
-					       header->content_length);
-					ttetris_net_request_complete(request);
-				}
-			}
-		}
+		if (header->request_id != 0)
+			ttetris_net_request_complete(
+			    net_client, header->request_id, cursor,
+			    header->content_length, header->message_type);
 
 		// increment the cursor by the message_size
 		cursor += header->content_length;
 	}
 
+	// keep the partial message, if any, for the next read
+	net_client->inbox_length = end - cursor;
+	memmove(net_client->inbox, cursor, net_client->inbox_length);
+
 	return EXIT_SUCCESS;
 }
 
@@ -301,6 +640,19 @@ void *tetris_thread(void *net_client) {
 	return 0;
 }
 
+static void tetris_readable(void *_net_client) {
+	NetClient *net_client = (NetClient *)_net_client;
+
+	// stop watching a connection the server has closed
+	if (read_from_server(net_client) != EXIT_SUCCESS)
+		client_loop_unwatch(net_client->loop, net_client->fd);
+}
+
+void tetris_listen_on(NetClient *net_client, ClientLoop *loop) {
+	net_client->loop = loop;
+	client_loop_watch(loop, net_client->fd, tetris_readable, net_client);
+}
+
 /**
  * start listening to the server for updates to the board
  *
@@ -330,36 +682,111 @@ NetClient *net_client_init() {
 	net_client->fd = -1;
 	net_client->online_players = list_create();
 	net_client->player = NULL;
-	net_client->open_requests = list_create();
+	memset(net_client->requests, 0, sizeof(net_client->requests));
+	// slots are taken from the end of the free list, lowest index first
+	for (int i = 0; i < NET_REQUEST_SLOTS; i++)
+		net_client->free_requests[i] = NET_REQUEST_SLOTS - 1 - i;
+	net_client->free_requests_length = NET_REQUEST_SLOTS;
+	pthread_mutex_init(&net_client->requests_lock, NULL);
+	net_client->prediction = NULL;
+	net_client->lockstep_mode = 0;
+	net_client->lockstep = NULL;
+	net_client->inbox_length = 0;
+	net_client->batch_length = 0;
+	net_client->batch_seq = 0;
+	net_client->next_seq = 1;
+	net_client->clock_start_ms = monotonic_ms();
+	net_client->udp_fd = -1;
+	net_client->udp_token = 0;
+	net_client->udp_running = 0;
+	net_client->udp_answered = 0;
+	net_client->loop = NULL;
 	return net_client;
 };
 
-NetRequest *ttetris_net_request(NetClient *client, char *bytes, uint16_t nbytes,
-                                msg_type_t message_type) {
-	NetRequest *request = malloc(sizeof(NetRequest));
-	// TODO Stop using the number of requests sent as the ID. Of course, we
-	// also want to be able to delete requests from this list at some point.
-	request->id = client->open_requests->length + 1;
+/**
+ * Take a free slot for a request, and give the request its next id
+ * @return the request, or NULL if every slot is taken
+ */
+static NetRequest *take_request(NetClient *client, NetRequestCallback callback,
+                                void *data) {
+	NetRequest *request;
+
+	pthread_mutex_lock(&client->requests_lock);
+	if (client->free_requests_length == 0) {
+		pthread_mutex_unlock(&client->requests_lock);
+		fprintf(logging_fp, "take_request: too many requests are "
+		                    "waiting for a response\n");
+		return NULL;
+	}
+	int slot = client->free_requests[--client->free_requests_length];
+	request = &client->requests[slot];
+	// the generation stays clear of 0, so that no id is 0
+	if (++request->generation == 1 << (16 - NET_REQUEST_SLOT_BITS))
+		request->generation = 1;
+	request->id = request->generation << NET_REQUEST_SLOT_BITS | slot;
+	request->in_use = 1;
+	request->cursor = NULL;
+	request->length = 0;
 	request->response_event = ttetris_event_create();
+	request->callback = callback;
+	request->callback_data = data;
+	pthread_mutex_unlock(&client->requests_lock);
+	return request;
+}
 
-	// IMPORTANT: list_append must be called before message_nbytes to avoid
-	// a race condition
-	list_append(client->open_requests, request);
+NetRequest *ttetris_net_request(NetClient *client, char *bytes, uint16_t nbytes,
+                                msg_type_t message_type) {
+	// IMPORTANT: the slot must be taken before message_nbytes to avoid a
+	// race condition
+	NetRequest *request = take_request(client, NULL, NULL);
+	if (request == NULL)
+		return NULL;
 
 	message_nbytes(client->fd, bytes, nbytes, request->id, message_type);
 
 	return request;
 };
 
+int ttetris_net_request_async(NetClient *client, char *bytes, uint16_t nbytes,
+                              msg_type_t message_type,
+                              NetRequestCallback callback, void *data) {
+	NetRequest *request = take_request(client, callback, data);
+	if (request == NULL)
+		return EXIT_FAILURE;
+
+	message_nbytes(client->fd, bytes, nbytes, request->id, message_type);
+
+	return EXIT_SUCCESS;
+}
+
 void ttetris_net_request_block_for_response(NetRequest *request) {
 	ttetris_event_block_for_completion(request->response_event);
 }
 
+int ttetris_net_request_is_complete(NetRequest *request) {
+	return ttetris_event_is_complete(request->response_event);
+}
+
+void ttetris_net_request_release(NetClient *client, NetRequest *request) {
+	pthread_mutex_lock(&client->requests_lock);
+	free(request->cursor);
+	request->cursor = NULL;
+	ttetris_event_destroy(request->response_event);
+	request->response_event = NULL;
+	request->in_use = 0;
+	client->free_requests[client->free_requests_length++] =
+	    NET_REQUEST_SLOT(request->id);
+	pthread_mutex_unlock(&client->requests_lock);
+}
+
 // define a control set for use over TCP
-static const TetrisControlSet TCPControlSet = {.translate = tetris_translate,
-                                               .lower = tetris_lower,
-                                               .rotate = tetris_rotate,
-                                               .drop = tetris_drop,
-                                               .swap_hold = tetris_swap_hold};
+static const TetrisControlSet TCPControlSet = {
+    .translate = tetris_translate,
+    .lower = tetris_lower,
+    .rotate = tetris_rotate,
+    .drop = tetris_drop,
+    .swap_hold = tetris_swap_hold,
+    .flush = tetris_flush_inputs};
 
 TetrisControlSet tcp_control_set(void) { return TCPControlSet; }
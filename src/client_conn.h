@@ -7,14 +7,56 @@
 
 #include <sys/types.h>
 
+#include "client_loop.h"
 #include "controller.h"
 #include "list.h"
+#include "lockstep.h"
 #include "message.h"
 #include "player.h"
+#include "prediction.h"
 #include "tetris_game.h"
+#include "transport.h"
+#include "udp.h"
 
+// requests waiting for a reply are kept in a table of slots. The low bits of
+// a request id are the index of its slot, and the high bits count how many
+// times the slot has been taken, so that a reply to a request that has been
+// released is not taken for the reply to the slot's next request.
+#define NET_REQUEST_SLOT_BITS 6
+#define NET_REQUEST_SLOTS (1 << NET_REQUEST_SLOT_BITS)
+#define NET_REQUEST_SLOT(id) ((id) & (NET_REQUEST_SLOTS - 1))
+
+typedef struct ttetris_netrequest NetRequest;
 typedef struct ttetris_netclient NetClient;
 
+/**
+ * Called on the listening thread once a response has arrived for a request.
+ * The request is released when the callback returns. The callback must not
+ * block, since no other response is read until it returns.
+ */
+typedef void (*NetRequestCallback)(NetClient *client, NetRequest *request,
+                                   void *data);
+
+struct ttetris_netrequest {
+	/* id should uniquely identify a request. ids can be re-used after the
+	request is released. 0 is never used, since it marks messages that
+	are not requests. */
+	uint16_t id;
+	/* number of times the slot has been taken, skipping 0 */
+	uint16_t generation;
+	/* non-zero while the slot is taken */
+	char in_use;
+	/* copy of the response's body, its length, and its message type */
+	char *cursor;
+	uint16_t length;
+	msg_type_t type;
+	// event indicating when we hear back from the server
+	TetrisEvent *response_event;
+	/* (optional) called once the response has arrived */
+	NetRequestCallback callback;
+	void *callback_data;
+};
+
 struct ttetris_netclient {
 	/* the current file descriptor */
 	SOCKET fd;
@@ -23,45 +65,111 @@ struct ttetris_netclient {
 	char is_listen_thread_started;
 	/* thread for listening to the server */
 	pthread_t listen_thread;
+	/* (optional) loop that reads from the server instead of the listening
+	 * thread (see tetris_listen_on) */
+	ClientLoop *loop;
 	/* optional list of online players */
 	List *online_players;
 	/* optional field to use for callbacks */
 	Player *player;
-	List *open_requests;
-};
-
-typedef struct ttetris_netrequest NetRequest;
-
-struct ttetris_netrequest {
-	/* id should uniquely identify a request. ids can be re-used after the
-	request is considered to be completed */
-	short id;
-	/* pointer to response content */
-	char *cursor;
-	// event indicating when we hear back from the server
-	TetrisEvent *response_event;
+	/* requests sent, indexed by NET_REQUEST_SLOT of their id, and the
+	 * indices of the slots that are free. The listening thread completes
+	 * requests while others take and release them. */
+	NetRequest requests[NET_REQUEST_SLOTS];
+	int free_requests[NET_REQUEST_SLOTS];
+	int free_requests_length;
+	pthread_mutex_t requests_lock;
+	/* (optional) prediction of the player's own game. Without one, inputs
+	 * only show up once the server sends the board back. */
+	Prediction *prediction;
+	/* non-zero if the client asked to simulate its party in lockstep, and
+	 * the simulation once the game has started */
+	char lockstep_mode;
+	Lockstep *lockstep;
+	/* bytes read from the server that do not make a whole message yet */
+	char inbox[4 * MAXMSG];
+	int inbox_length;
+	/* inputs made during the current frame, and the sequence number of
+	 * the first one */
+	struct input_record batch[INPUT_BATCH_MAX];
+	int batch_length;
+	uint16_t batch_seq;
+	/* sequence number of the next input, unless the prediction numbers
+	 * them */
+	uint16_t next_seq;
+	/* start of the client's clock, which inputs are stamped with */
+	uint64_t clock_start_ms;
+	/* (optional) datagram transport (see udp.h), and the token that
+	 * identifies its datagrams to the server */
+	SOCKET udp_fd;
+	uint64_t udp_token;
+	/* non-zero once the server has answered a datagram */
+	char udp_answered;
+	/* non-zero while the thread receiving datagrams should keep going.
+	 * With a client loop, there is no thread, and the timer resends the
+	 * inputs instead. */
+	char udp_running;
+	pthread_t udp_thread;
+	Timer udp_timer;
+	/* inputs sent as datagrams that the server has not acknowledged */
+	UdpInputs udp_inputs;
+	/* the last board received as a datagram for each player */
+	UdpLatest udp_latest;
 };
 
 /**
- * send a message to the server using the given client connection
+ * send a message to the server using the given client connection. The
+ * request must be released once its response has been read, or once it is no
+ * longer wanted.
+ * @return the request, or NULL if too many requests are waiting for a
+ *         response
  */
 NetRequest *ttetris_net_request(NetClient *client, char *bytes, uint16_t nbytes,
                                 msg_type_t message_type);
 
 /**
- * set the response for a given net request
+ * send a message to the server, and call back once the response has arrived
+ * instead of waiting for it. The request is released after the callback.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if too many requests are waiting for
+ *         a response
+ */
+int ttetris_net_request_async(NetClient *client, char *bytes, uint16_t nbytes,
+                              msg_type_t message_type,
+                              NetRequestCallback callback, void *data);
+
+/**
+ * set the response for the request with the given id. A response to a
+ * request that has been released is dropped.
  *
  * Note: This is mostly an internal-only function. This should be called by a
  separate thread that is listening to the
  * TCP network socket.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if no request was waiting for it
  */
-void ttetris_net_request_complete(NetRequest *request);
+int ttetris_net_request_complete(NetClient *client, uint16_t id, char *body,
+                                 uint16_t length, msg_type_t type);
 
 /**
- * block until a response is received for the given request
+ * block until a response is received for the given request. Only a listening
+ * thread (see tetris_listen) can receive the response while the caller is
+ * blocked.
  */
 void ttetris_net_request_block_for_response(NetRequest *request);
 
+/**
+ * check whether the response to the given request has arrived, without
+ * waiting for it. This lets a request be used as a future polled from the
+ * caller's own loop.
+ * @return non-zero once the response has arrived
+ */
+int ttetris_net_request_is_complete(NetRequest *request);
+
+/**
+ * free the request's response and event, and make its slot available to the
+ * next request
+ */
+void ttetris_net_request_release(NetClient *client, NetRequest *request);
+
 NetClient *net_client_init();
 
 void tetris_send_message(NetClient *net_client, char *body,
@@ -73,9 +181,14 @@ void tetris_send_message(NetClient *net_client, char *body,
  * Note that calling this is not enough! You should call tetris_listen after
  * this to start the listening thread.
  * @param net_client
- * @param host
- * @param port
- * @return
+ * @param address TCP host and port, or path of the server's Unix domain
+ *        socket (see transport.h)
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int tetris_connect_to(NetClient *net_client, TransportAddress *address);
+
+/**
+ * Connect to the tetris server over TCP (see tetris_connect_to)
  */
 int tetris_connect(NetClient *net_client, char *host, int port);
 
@@ -83,12 +196,58 @@ void tetris_disconnect(NetClient *net_client);
 
 void tetris_tell_server_to_start(NetClient *net_client);
 
+/**
+ * Ask for the online players, and wait for them
+ * @return the names of the online players, or NULL on failure
+ */
 StringArray *tetris_list(NetClient *net_client);
 
+/**
+ * Ask for the online players without waiting (see tetris_list_response)
+ * @return the request, or NULL on failure
+ */
+NetRequest *tetris_list_request(NetClient *net_client);
+
+/**
+ * Read the online players from the response to tetris_list_request, and
+ * release the request
+ * @return the names of the online players
+ */
+StringArray *tetris_list_response(NetClient *net_client, NetRequest *request);
+
 void tetris_listen(NetClient *net_client);
 
+/**
+ * Read from the server on the loop's thread, rather than a listening thread,
+ * whenever the loop waits for a key. Datagrams are then received by the loop
+ * too. Responses must be waited for through callbacks or by checking their
+ * requests from the loop, since nothing reads them while the thread is
+ * blocked.
+ */
+void tetris_listen_on(NetClient *net_client, ClientLoop *loop);
+
 NetRequest *tetris_register(NetClient *net_client, char *username);
 
+/**
+ * Simulate every game in the party from relayed events, rather than
+ * receiving boards (see lockstep.h). Must be called before the game starts.
+ */
+void tetris_lockstep(NetClient *net_client);
+
+/**
+ * Predict the player's own game from now on, and ask the server to send the
+ * game's state for reconciling instead of its board
+ */
+void tetris_predict(NetClient *net_client);
+
+/**
+ * Send inputs and receive boards as datagrams (see udp.h) once the server
+ * answers with a token, keeping to the connection until then, and for good if
+ * the server does not offer them
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the request could not be sent
+ */
+int tetris_use_datagrams(NetClient *net_client, char *host, int port);
+
 void tetris_opponent(NetClient *net_client, StringArray *usernames);
 
 TetrisControlSet tcp_control_set(void);
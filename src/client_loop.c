@@ -0,0 +1,191 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+#include "client_loop.h"
+#include "log.h"
+#include "render.h"
+
+// where stdin cannot be polled, or the clock has no descriptor, the loop
+// wakes up this often to look for keys and advance the clock
+#define CLIENT_LOOP_FALLBACK_MS 10
+
+struct client_loop_watch {
+	SOCKET fd;
+	void (*on_readable)(void *data);
+	void *data;
+};
+
+struct ttetris_client_loop {
+	struct client_loop_watch watches[CLIENT_LOOP_MAX_WATCHES];
+	int nwatches;
+	/* (optional) the clock advanced by the loop, and its timerfd, or -1
+	 * if it has none */
+	TimerWheel *clock;
+	int clock_fd;
+	/* (optional) called fps times a second, counting frames from
+	 * frames_start (ms) */
+	void (*on_frame)(void *data);
+	void *frame_data;
+	int fps;
+	uint64_t frames_start;
+	uint64_t frames;
+};
+
+ClientLoop *client_loop_create(TimerWheel *clock) {
+	ClientLoop *loop = calloc(sizeof(ClientLoop), 1);
+	loop->clock = clock;
+	loop->clock_fd = clock ? timer_wheel_open_fd(clock) : -1;
+	return loop;
+}
+
+int client_loop_watch(ClientLoop *loop, SOCKET fd,
+                      void (*on_readable)(void *data), void *data) {
+	if (loop->nwatches == CLIENT_LOOP_MAX_WATCHES) {
+		fprintf(logging_fp, "client_loop_watch: too many watches\n");
+		return EXIT_FAILURE;
+	}
+	loop->watches[loop->nwatches++] =
+	    (struct client_loop_watch){fd, on_readable, data};
+	return EXIT_SUCCESS;
+}
+
+void client_loop_unwatch(ClientLoop *loop, SOCKET fd) {
+	for (int i = 0; i < loop->nwatches; i++) {
+		if (loop->watches[i].fd != fd)
+			continue;
+		loop->watches[i] = loop->watches[--loop->nwatches];
+		return;
+	}
+}
+
+void client_loop_set_frames(ClientLoop *loop, int fps,
+                            void (*on_frame)(void *data), void *data) {
+	loop->on_frame = fps > 0 ? on_frame : NULL;
+	loop->frame_data = data;
+	loop->fps = fps;
+	loop->frames_start = monotonic_ms();
+	loop->frames = 0;
+}
+
+/**
+ * Call on_frame if a frame is due. Frames that fell due while the loop was
+ * busy elsewhere are skipped, not made up for.
+ * @return ms until the next frame is due, or -1 if there are no frames
+ */
+static int client_loop_frame(ClientLoop *loop) {
+	uint64_t now = monotonic_ms(), next;
+
+	if (loop->on_frame == NULL)
+		return -1;
+	next = loop->frames_start + loop->frames * 1000 / loop->fps;
+	if (now >= next) {
+		loop->on_frame(loop->frame_data);
+		loop->frames =
+		    (now - loop->frames_start) * loop->fps / 1000 + 1;
+		next = loop->frames_start + loop->frames * 1000 / loop->fps;
+	}
+	return next - now;
+}
+
+/**
+ * Call the handler of a watched descriptor that is ready, if it is still
+ * watched: an earlier handler may have stopped watching it
+ */
+static void client_loop_dispatch(ClientLoop *loop, SOCKET fd) {
+	for (int i = 0; i < loop->nwatches; i++) {
+		if (loop->watches[i].fd == fd) {
+			loop->watches[i].on_readable(loop->watches[i].data);
+			return;
+		}
+	}
+}
+
+int client_loop_getch(ClientLoop *loop, int timeout_ms) {
+	struct pollfd fds[CLIENT_LOOP_MAX_WATCHES + 2];
+	uint64_t deadline = 0;
+	int ch, nfds, wait_ms, frame_ms, handled;
+
+	if (timeout_ms >= 0)
+		deadline = monotonic_ms() + timeout_ms;
+
+	// curses may already hold keys it read along with earlier ones, which
+	// poll would not see, so ask curses first every time around. Frames
+	// come first, so that a stream of keys does not hold them back.
+	timeout(0);
+	while (1) {
+		frame_ms = client_loop_frame(loop);
+		if ((ch = getch()) != ERR)
+			break;
+		wait_ms = -1;
+		if (deadline) {
+			uint64_t now = monotonic_ms();
+			if (now >= deadline)
+				break;
+			wait_ms = deadline - now;
+		}
+		if (frame_ms >= 0 && (wait_ms < 0 || frame_ms < wait_ms))
+			wait_ms = frame_ms;
+
+		nfds = 0;
+#ifdef THIS_IS_NOT_WINDOWS
+		fds[nfds++] = (struct pollfd){STDIN_FILENO, POLLIN, 0};
+#else
+		if (wait_ms < 0 || wait_ms > CLIENT_LOOP_FALLBACK_MS)
+			wait_ms = CLIENT_LOOP_FALLBACK_MS;
+#endif
+		if (loop->clock_fd >= 0)
+			fds[nfds++] =
+			    (struct pollfd){loop->clock_fd, POLLIN, 0};
+		else if (loop->clock && (wait_ms < 0 ||
+		                         wait_ms > CLIENT_LOOP_FALLBACK_MS))
+			wait_ms = CLIENT_LOOP_FALLBACK_MS;
+		int first_watch = nfds;
+		for (int i = 0; i < loop->nwatches; i++)
+			fds[nfds++] =
+			    (struct pollfd){loop->watches[i].fd, POLLIN, 0};
+
+		if (poll(fds, nfds, wait_ms) < 0) {
+			// a resize of the terminal interrupts the wait
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		handled = 0;
+		if (loop->clock && loop->clock_fd < 0)
+			handled |= timer_wheel_catch_up(loop->clock, -1) > 0;
+		for (int i = 0; i < nfds; i++) {
+			if (!fds[i].revents)
+				continue;
+			if (fds[i].fd == loop->clock_fd)
+				handled |=
+				    timer_wheel_catch_up(loop->clock,
+				                         loop->clock_fd) > 0;
+			else if (i >= first_watch) {
+				client_loop_dispatch(loop, fds[i].fd);
+				handled = 1;
+			}
+		}
+		if (handled)
+			break;
+	}
+	timeout(-1);
+	return ch;
+}
+
+void client_loop_destroy(ClientLoop *loop) {
+	if (loop->clock_fd >= 0)
+		close(loop->clock_fd);
+	free(loop);
+}
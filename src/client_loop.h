@@ -0,0 +1,68 @@
+/**
+ * The client's event loop. A single thread waits in poll for keys on stdin,
+ * for the descriptors it was asked to watch (the connection to the server and
+ * the datagram socket), and for the tick of the game clock, and handles each
+ * as it becomes ready. Everything that draws with curses, which is not thread
+ * safe, runs on that thread.
+ *
+ * Boards are not drawn as they arrive, but at a fixed rate of frames (see
+ * client_loop_set_frames), so that boards arriving faster than the terminal
+ * can draw them replace each other instead of queueing up.
+ *
+ * The loop only runs while the client waits for a key (see client_loop_getch),
+ * so every screen waits for keys that way: the lobby and the game, offline
+ * and online.
+ */
+#ifndef TTETRIS_CLIENT_LOOP_H
+#define TTETRIS_CLIENT_LOOP_H
+
+#include "os_compat.h"
+#include "timer_wheel.h"
+
+// the most descriptors a loop can watch besides stdin and the clock
+#define CLIENT_LOOP_MAX_WATCHES 8
+
+typedef struct ttetris_client_loop ClientLoop;
+
+/**
+ * Allocate a loop
+ * @param clock (optional) a clock with no thread of its own, which the loop
+ *        advances (see player_init_manual_clock)
+ */
+ClientLoop *client_loop_create(TimerWheel *clock);
+
+/**
+ * Call on_readable on the loop's thread whenever fd can be read, or has been
+ * closed by the other end
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the loop watches too many
+ */
+int client_loop_watch(ClientLoop *loop, SOCKET fd,
+                      void (*on_readable)(void *data), void *data);
+
+/**
+ * Stop watching fd. May be called from on_readable.
+ */
+void client_loop_unwatch(ClientLoop *loop, SOCKET fd);
+
+/**
+ * Call on_frame on the loop's thread fps times a second, for as long as the
+ * loop runs. A frame that falls due while the loop is busy is skipped.
+ * @param fps frames per second, or 0 to stop
+ */
+void client_loop_set_frames(ClientLoop *loop, int fps,
+                            void (*on_frame)(void *data), void *data);
+
+/**
+ * Wait for a key, handling everything else the loop watches in the meantime
+ * @param timeout_ms how long to wait, or -1 to wait for as long as it takes
+ * @return the key, or ERR once the timeout has passed, or once anything else
+ *         has been handled, so that the caller can look at what changed
+ */
+int client_loop_getch(ClientLoop *loop, int timeout_ms);
+
+/**
+ * Free the loop. The clock is left alone.
+ */
+void client_loop_destroy(ClientLoop *loop);
+
+#endif // TTETRIS_CLIENT_LOOP_H
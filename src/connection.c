@@ -0,0 +1,340 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#define SHUT_RDWR SD_BOTH
+#else
+#include <sys/socket.h>
+#endif
+
+#include "connection.h"
+#include "log.h"
+#include "message.h"
+
+// connections indexed by socket file descriptor. Reactor threads look up
+// each other's connections, so the table is guarded.
+static Connection **connections = NULL;
+static int connections_capacity = 0;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// connections with queued messages that have not been flushed, one list for
+// each reactor thread
+struct dirty_list {
+	Connection *head;
+	pthread_mutex_t lock;
+};
+
+static struct dirty_list default_dirty_list = {NULL,
+                                               PTHREAD_MUTEX_INITIALIZER};
+static struct dirty_list *dirty_lists = &default_dirty_list;
+static int dirty_list_count = 1;
+static void (*dirty_wakeup)(int owner) = NULL;
+// non-zero if only the owners write to their connections
+static int flush_by_owner = 0;
+
+// index of the reactor thread running the current thread, or -1 for any
+// other thread
+static __thread int thread_owner = -1;
+
+void connection_set_owners(int n, void (*wakeup)(int owner)) {
+	dirty_lists = calloc(sizeof(struct dirty_list), n);
+	for (int i = 0; i < n; i++)
+		pthread_mutex_init(&dirty_lists[i].lock, NULL);
+	dirty_list_count = n;
+	dirty_wakeup = wakeup;
+}
+
+void connection_set_thread_owner(int owner) { thread_owner = owner; }
+
+void connection_set_flush_by_owner(int enabled) { flush_by_owner = enabled; }
+
+void connection_set_owner(Connection *conn, int owner) {
+	struct dirty_list *list = &dirty_lists[conn->owner];
+	Connection **link;
+	int was_dirty = 0;
+
+	// move the connection to the new owner's dirty list. If it is not on
+	// the list, it is being flushed right now and can stay where it is.
+	pthread_mutex_lock(&list->lock);
+	for (link = &list->head; conn->is_dirty && *link;
+	     link = &(*link)->next_dirty)
+		if (*link == conn) {
+			*link = conn->next_dirty;
+			conn->is_dirty = 0;
+			was_dirty = 1;
+			break;
+		}
+	// markers that looked up the old owner see the change once they hold
+	// the lock, and go to the new owner's list instead
+	__atomic_store_n(&conn->owner, owner, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&list->lock);
+
+	if (was_dirty) {
+		connection_mark_dirty(conn);
+		connection_put(conn);
+	}
+}
+
+Connection *connection_create(SOCKET fd) {
+	Connection *conn = calloc(sizeof(Connection), 1);
+	conn->fd = fd;
+	conn->refs = 1;
+	conn->outbox = message_queue_create();
+	if (thread_owner >= 0)
+		conn->owner = thread_owner;
+
+	pthread_rwlock_wrlock(&table_lock);
+	// grow the table until the socket fits
+	if (fd >= connections_capacity) {
+		int capacity = connections_capacity ? connections_capacity : 64;
+		while (fd >= capacity)
+			capacity *= 2;
+		connections =
+		    realloc(connections, sizeof(Connection *) * capacity);
+		memset(connections + connections_capacity, 0,
+		       sizeof(Connection *) *
+		           (capacity - connections_capacity));
+		connections_capacity = capacity;
+	}
+	connections[fd] = conn;
+	pthread_rwlock_unlock(&table_lock);
+
+	return conn;
+}
+
+int connection_table_size(void) { return connections_capacity; }
+
+Connection *connection_get(SOCKET fd) {
+	Connection *conn = NULL;
+
+	pthread_rwlock_rdlock(&table_lock);
+	if (fd >= 0 && fd < connections_capacity && connections[fd])
+		conn = connection_ref(connections[fd]);
+	pthread_rwlock_unlock(&table_lock);
+	return conn;
+}
+
+Connection *connection_ref(Connection *conn) {
+	__sync_add_and_fetch(&conn->refs, 1);
+	return conn;
+}
+
+void connection_put(Connection *conn) {
+	if (conn == NULL || __sync_sub_and_fetch(&conn->refs, 1) > 0)
+		return;
+	// the socket is only closed now, so that its number cannot be given
+	// to another client while someone may still write to it
+	close(conn->fd);
+	message_queue_destroy(conn->outbox);
+	free(conn->inbox);
+	free(conn);
+}
+
+void connection_destroy(Connection *conn) {
+	Connection **link;
+	int was_dirty = 0;
+
+	// once marked, the connection is not put on a dirty list again
+	__atomic_store_n(&conn->closing, 1, __ATOMIC_RELEASE);
+
+	// Unlink the connection from the dirty list. A connection that moved
+	// between reactor threads may still be on its previous owner's list,
+	// and one that is being flushed is on no list at all, in which case
+	// the flusher drops the list's reference.
+	for (int i = 0; i < dirty_list_count; i++) {
+		pthread_mutex_lock(&dirty_lists[i].lock);
+		for (link = &dirty_lists[i].head; *link;
+		     link = &(*link)->next_dirty)
+			if (*link == conn) {
+				*link = conn->next_dirty;
+				conn->is_dirty = 0;
+				was_dirty = 1;
+				break;
+			}
+		pthread_mutex_unlock(&dirty_lists[i].lock);
+	}
+	if (was_dirty)
+		connection_put(conn);
+
+	pthread_rwlock_wrlock(&table_lock);
+	connections[conn->fd] = NULL;
+	pthread_rwlock_unlock(&table_lock);
+
+	shutdown(conn->fd, SHUT_RDWR);
+	connection_put(conn);
+}
+
+int connection_receive(Connection *conn) {
+	int nbytes, total = 0;
+
+	while (1) {
+		// always leave room for at least one full-sized read
+		if (conn->inbox_capacity - conn->inbox_length < MAXMSG) {
+			conn->inbox_capacity = conn->inbox_length + MAXMSG;
+			conn->inbox =
+			    realloc(conn->inbox, conn->inbox_capacity);
+		}
+
+		nbytes = recv(conn->fd, conn->inbox + conn->inbox_length,
+		              conn->inbox_capacity - conn->inbox_length, 0);
+
+		// stop once the socket has been drained
+		if (nbytes < 0 && last_error_would_block())
+			return total;
+
+		if (nbytes < 0) {
+			char errmsg[256];
+			last_error_message_to_buffer(errmsg, 256);
+			fprintf(logging_fp, "connection_receive: %s\n", errmsg);
+			return -1;
+		}
+
+		// the peer hung up. Anything read before that is still in the
+		// inbox for the caller to handle before closing.
+		if (nbytes == 0)
+			return -1;
+
+		conn->inbox_length += nbytes;
+		total += nbytes;
+	}
+}
+
+void connection_append_inbox(Connection *conn, char *bytes, int n) {
+	if (conn->inbox_capacity - conn->inbox_length < n) {
+		conn->inbox_capacity = conn->inbox_length + n;
+		conn->inbox = realloc(conn->inbox, conn->inbox_capacity);
+	}
+	memcpy(conn->inbox + conn->inbox_length, bytes, n);
+	conn->inbox_length += n;
+}
+
+void connection_consume_inbox(Connection *conn, int n) {
+	conn->inbox_length -= n;
+	memmove(conn->inbox, conn->inbox + n, conn->inbox_length);
+}
+
+void connection_mark_dirty(Connection *conn) {
+	struct dirty_list *list;
+	int owner, was_empty = 0;
+
+	// the connection may be handed to another owner at any time, so the
+	// owner is only trusted once its list is locked
+	while (1) {
+		owner = __atomic_load_n(&conn->owner, __ATOMIC_ACQUIRE);
+		list = &dirty_lists[owner];
+		pthread_mutex_lock(&list->lock);
+		if (__atomic_load_n(&conn->owner, __ATOMIC_ACQUIRE) == owner)
+			break;
+		pthread_mutex_unlock(&list->lock);
+	}
+
+	// The list holds a reference while the connection is on it. A
+	// connection that moved while it was being flushed is still marked
+	// by its previous owner's flush, which writes what is queued now.
+	if (!__atomic_load_n(&conn->is_dirty, __ATOMIC_ACQUIRE) &&
+	    !conn->closing) {
+		connection_ref(conn);
+		conn->is_dirty = 1;
+		was_empty = list->head == NULL;
+		conn->next_dirty = list->head;
+		list->head = conn;
+	}
+	pthread_mutex_unlock(&list->lock);
+
+	// another reactor thread owns the connection, and may be waiting for
+	// events rather than about to flush
+	if (was_empty && dirty_wakeup && thread_owner >= 0 &&
+	    thread_owner != owner)
+		dirty_wakeup(owner);
+}
+
+int connection_queue_nbytes(Connection *conn, char *bytes, int n,
+                            int request_id, msg_type_t message_type) {
+	int ret = message_queue_nbytes(conn->outbox, bytes, n, request_id,
+	                               message_type);
+	connection_mark_dirty(conn);
+	return ret;
+}
+
+/**
+ * Take every connection off one dirty list and hand it to fn
+ */
+static void dirty_list_foreach(struct dirty_list *list,
+                               void (*fn)(Connection *conn, void *context),
+                               void *context) {
+	Connection *conn, *next;
+
+	// take the whole list so that other threads can keep queueing while
+	// we write
+	pthread_mutex_lock(&list->lock);
+	conn = list->head;
+	list->head = NULL;
+	pthread_mutex_unlock(&list->lock);
+
+	for (; conn; conn = next) {
+		// a connection stays marked until just before it is flushed,
+		// so anything queued in the meantime goes out with this write
+		pthread_mutex_lock(&list->lock);
+		next = conn->next_dirty;
+		// once cleared, a new owner may link the connection again
+		__atomic_store_n(&conn->is_dirty, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&list->lock);
+
+		fn(conn, context);
+		connection_put(conn);
+	}
+}
+
+void connection_foreach_dirty(void (*fn)(Connection *conn, void *context),
+                              void *context) {
+	if (thread_owner >= 0) {
+		dirty_list_foreach(&dirty_lists[thread_owner], fn, context);
+		return;
+	}
+	for (int i = 0; i < dirty_list_count; i++)
+		dirty_list_foreach(&dirty_lists[i], fn, context);
+}
+
+static void connection_flush(Connection *conn, void *context) {
+	// a connection destroyed since it was marked has nobody to write to
+	if (__atomic_load_n(&conn->closing, __ATOMIC_ACQUIRE))
+		return;
+	if (message_queue_flush(conn->outbox, conn->fd) < 0)
+		fprintf(logging_fp,
+		        "connection_flush_dirty: failed to write to socket "
+		        "%d\n",
+		        conn->fd);
+
+	// only the owner watches the socket for writability, so it is told
+	// about whatever another thread could not write
+	int owner = __atomic_load_n(&conn->owner, __ATOMIC_ACQUIRE);
+	if (dirty_wakeup && thread_owner != owner &&
+	    connection_wants_write(conn))
+		dirty_wakeup(owner);
+}
+
+void connection_flush_dirty(void) {
+	int dirty;
+
+	if (!flush_by_owner || thread_owner >= 0 || dirty_wakeup == NULL) {
+		connection_foreach_dirty(connection_flush, NULL);
+		return;
+	}
+	// the connections stay marked, and are written by their owners
+	for (int i = 0; i < dirty_list_count; i++) {
+		pthread_mutex_lock(&dirty_lists[i].lock);
+		dirty = dirty_lists[i].head != NULL;
+		pthread_mutex_unlock(&dirty_lists[i].lock);
+		if (dirty)
+			dirty_wakeup(i);
+	}
+}
+
+int connection_wants_write(Connection *conn) {
+	return message_queue_pending(conn->outbox) > 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * Server-side state for a single client socket.
+ *
+ * Every message produced for a connection is queued on its outbox rather than
+ * written immediately. Once the event (or game tick) that produced the
+ * messages has been handled, connection_flush_dirty writes each touched
+ * connection's outbox with a single system call.
+ *
+ * When the server runs several reactor threads, every connection is owned by
+ * one of them, and each owner flushes its own dirty list.
+ */
+#ifndef TTETRIS_CONNECTION_H
+#define TTETRIS_CONNECTION_H
+
+#include "message.h"
+#include "os_compat.h"
+
+typedef struct ttetris_connection Connection;
+
+struct ttetris_connection {
+	SOCKET fd;
+	/* frames waiting to be written to the socket */
+	MessageQueue *outbox;
+	/* bytes received but not yet handled, such as a partial message */
+	char *inbox;
+	int inbox_length;
+	int inbox_capacity;
+	/* non-zero while the connection is on the dirty list, or taken off it
+	 * to be flushed but not yet flushed. Changed atomically, under the
+	 * lock of the list. */
+	char is_dirty;
+	/* next connection on the dirty list */
+	Connection *next_dirty;
+	/* (optional) state kept by the reactor backend serving the socket */
+	void *reactor_data;
+	/* index of the reactor thread that serves the socket. Changed
+	 * atomically, under the lock of the old owner's dirty list. */
+	int owner;
+	/* references held by the reactor serving the socket, by the dirty list
+	 * while the connection is on it, and by whoever looked it up, changed
+	 * atomically */
+	int refs;
+	/* non-zero once the connection was destroyed, while it waits for the
+	 * last reference to be dropped */
+	char closing;
+};
+
+/**
+ * Allocate a connection for a newly accepted socket
+ */
+Connection *connection_create(SOCKET fd);
+
+/**
+ * Look up the connection for a socket, from any thread
+ * @return a reference to the connection, to be dropped with connection_put,
+ *         or NULL if the socket is not connected
+ */
+Connection *connection_get(SOCKET fd);
+
+/**
+ * Connections are indexed by socket, so every connection has an fd lower than
+ * this.
+ * @return the size of the connection table
+ */
+int connection_table_size(void);
+
+/**
+ * Take another reference to the connection, which keeps it from being freed
+ * @return the connection
+ */
+Connection *connection_ref(Connection *conn);
+
+/**
+ * Drop a reference to the connection. Once the last one is dropped, the
+ * socket is closed and the connection freed along with anything still queued
+ * on it.
+ */
+void connection_put(Connection *conn);
+
+/**
+ * Take the connection out of the table and off the dirty lists, shut the
+ * socket down, and drop the reference of the reactor serving it. Nothing more
+ * is written to the socket, but whoever still holds a reference may use the
+ * connection until they drop it.
+ */
+void connection_destroy(Connection *conn);
+
+/**
+ * Read everything currently available on the (non-blocking) socket into the
+ * connection's inbox.
+ * @return number of bytes read, or -1 if the peer hung up or the socket failed.
+ *         Bytes read before a hang up are still left in the inbox.
+ */
+int connection_receive(Connection *conn);
+
+/**
+ * Append bytes that were received some other way (for example by an
+ * asynchronous receive) to the inbox
+ */
+void connection_append_inbox(Connection *conn, char *bytes, int n);
+
+/**
+ * Drop n handled bytes from the front of the inbox
+ */
+void connection_consume_inbox(Connection *conn, int n);
+
+/**
+ * Queue a message for the connection and mark it as needing a flush
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int connection_queue_nbytes(Connection *conn, char *bytes, int n,
+                            int request_id, msg_type_t message_type);
+
+/**
+ * Mark the connection as having queued messages that need to be flushed
+ */
+void connection_mark_dirty(Connection *conn);
+
+/**
+ * Flush the outbox of every connection that has been queued to since the
+ * last call. A reactor thread only flushes the connections it owns; any other
+ * thread flushes every connection, or only wakes their owners (see
+ * connection_set_flush_by_owner).
+ */
+void connection_flush_dirty(void);
+
+/**
+ * Keep a separate dirty list for each of n reactor threads. Must be called
+ * before any connection is created.
+ * @param wakeup called when a reactor thread queues to a connection owned by
+ *        another, idle, reactor thread, which should then flush it, and when
+ *        any thread other than the owner leaves part of a connection's
+ *        outbox unwritten, so that the owner watches for writability
+ */
+void connection_set_owners(int n, void (*wakeup)(int owner));
+
+/**
+ * Mark the calling thread as the reactor thread with the given index, so
+ * that its flushes only cover the connections it owns
+ */
+void connection_set_thread_owner(int owner);
+
+/**
+ * Leave every write to the owners of the connections, for backends that
+ * write outboxes themselves. connection_flush_dirty on any other thread then
+ * only wakes the owners with connections waiting to be flushed.
+ */
+void connection_set_flush_by_owner(int enabled);
+
+/**
+ * Hand the connection to another reactor thread, moving it to that thread's
+ * dirty list if it has unflushed messages
+ */
+void connection_set_owner(Connection *conn, int owner);
+
+/**
+ * Take every connection off the dirty list and hand it to fn, for backends
+ * that write outboxes themselves rather than through
+ * connection_flush_dirty.
+ */
+void connection_foreach_dirty(void (*fn)(Connection *conn, void *context),
+                              void *context);
+
+/**
+ * @return non-zero if part of the outbox could not be written and the socket
+ *         should be watched for writability
+ */
+int connection_wants_write(Connection *conn);
+
+#endif // TTETRIS_CONNECTION_H
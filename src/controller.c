@@ -1,10 +1,37 @@
 #include "controller.h"
 #include <curses.h>
 
-void keyboard_input_loop(TetrisControlSet controls,
+#include "client_loop.h"
+#include "os_compat.h"
+
+void keyboard_input_loop(ClientLoop *loop, TetrisControlSet controls,
                          ControlKeybindings keybindings, void *context) {
-	int ch;
-	while ((ch = getch()) != keybindings.quit) {
+	int ch, wait_ms;
+	// end of the current frame, or 0 while no input is waiting to be
+	// flushed
+	uint64_t frame_end = 0;
+
+	while (1) {
+		// wait for the first input of a frame for as long as it takes,
+		// and for the rest only until the frame is over
+		wait_ms = -1;
+		if (frame_end) {
+			uint64_t now = monotonic_ms();
+			wait_ms = now < frame_end ? (int)(frame_end - now) : 0;
+		}
+
+		// the loop also returns early whenever it has handled
+		// something other than a key
+		ch = client_loop_getch(loop, wait_ms);
+		if (frame_end && monotonic_ms() >= frame_end) {
+			controls.flush(context);
+			frame_end = 0;
+		}
+		if (ch == ERR)
+			continue;
+		if (ch == keybindings.quit)
+			break;
+
 		if (ch == keybindings.translate_left)
 			controls.translate(context, 0);
 		else if (ch == keybindings.translate_right)
@@ -19,7 +46,13 @@ void keyboard_input_loop(TetrisControlSet controls,
 			controls.drop(context);
 		else if (ch == keybindings.swap)
 			controls.swap_hold(context);
+
+		if (controls.flush && !frame_end)
+			frame_end = monotonic_ms() + CONTROLLER_FRAME_MS;
 	}
+
+	if (controls.flush)
+		controls.flush(context);
 }
 
 ControlKeybindings default_keybindings(void) {
@@ -1,6 +1,12 @@
 #ifndef _CONTROLLER_H
 #define _CONTROLLER_H
 
+#include "client_loop.h"
+
+// length of a frame, over which the inputs of a control set with a flush
+// function are collected before they are flushed together
+#define CONTROLLER_FRAME_MS 16
+
 typedef struct control_keybindings {
 	int hard_drop;
 	int soft_drop;
@@ -22,17 +28,22 @@ typedef struct st_tetris_control_set {
 	void (*rotate)(void *context, int);
 	void (*drop)(void *context);
 	void (*swap_hold)(void *context);
+	/* (optional) called at the end of every frame in which there was
+	 * input, for control sets that batch their inputs */
+	void (*flush)(void *context);
 } TetrisControlSet;
 
 /**
  * capture input from the keyboard and execute the correct function from the
  * provided control set
+ * @param loop loop that waits for the keys, and handles everything else in
+ * between
  * @param controls struct containing methods to be called in response to
  * keypress events
  * @param context pointer to an object that will be passed to the methods
  * in the given control set
  */
-void keyboard_input_loop(TetrisControlSet controls,
+void keyboard_input_loop(ClientLoop *loop, TetrisControlSet controls,
                          ControlKeybindings keybindings, void *context);
 
 ControlKeybindings default_keybindings(void);
@@ -70,4 +70,25 @@ void ttetris_event_block_for_completion(TetrisEvent *event) {
 	}
 	pthread_mutex_unlock(&event->ready_mutex);
 #endif
-}
\ No newline at end of file
+}
+
+int ttetris_event_is_complete(TetrisEvent *event) {
+#ifdef THIS_IS_WINDOWS
+	return WaitForSingleObject(event->handle, 0) == WAIT_OBJECT_0;
+#else
+	pthread_mutex_lock(&event->ready_mutex);
+	int complete = event->event_state == TTETRIS_EVENT_COMPLETE;
+	pthread_mutex_unlock(&event->ready_mutex);
+	return complete;
+#endif
+}
+
+void ttetris_event_destroy(TetrisEvent *event) {
+#ifdef THIS_IS_WINDOWS
+	CloseHandle(event->handle);
+#else
+	pthread_mutex_destroy(&event->ready_mutex);
+	pthread_cond_destroy(&event->ready_cond);
+#endif
+	free(event);
+}
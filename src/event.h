@@ -25,4 +25,17 @@ void ttetris_event_mark_complete(TetrisEvent *event);
  */
 void ttetris_event_block_for_completion(TetrisEvent *event);
 
+/**
+ * Check whether an event has completed, without waiting for it
+ * @param event
+ * @return non-zero if the event has completed
+ */
+int ttetris_event_is_complete(TetrisEvent *event);
+
+/**
+ * Free an event. No thread may be blocking on it.
+ * @param event
+ */
+void ttetris_event_destroy(TetrisEvent *event);
+
 #endif // TTETRIS_EVENT_H
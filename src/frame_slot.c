@@ -0,0 +1,37 @@
+#include "frame_slot.h"
+
+void frame_slot_publish(FrameSlot *slot, struct game_view_data *view) {
+	unsigned sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+	// take the slot by making the sequence odd, once no other writer has
+	while (sequence & 1 ||
+	       !__atomic_compare_exchange_n(&slot->sequence, &sequence,
+	                                    sequence + 1, 0, __ATOMIC_ACQUIRE,
+	                                    __ATOMIC_RELAXED))
+		sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+	// readers must see the odd sequence before any of the new frame
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->view = *view;
+	__atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+unsigned frame_slot_sequence(FrameSlot *slot) {
+	return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+}
+
+unsigned frame_slot_read(FrameSlot *slot, struct game_view_data *view) {
+	unsigned before, after;
+
+	while (1) {
+		before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+		*view = slot->view;
+		// the copy must be done before the sequence is looked at again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+		if (before == after)
+			return before;
+	}
+}
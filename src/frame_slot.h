@@ -0,0 +1,43 @@
+/**
+ * Latest frame of a board, handed from whatever receives or predicts the
+ * board to whatever draws it.
+ *
+ * Publishing overwrites the frame in place, so a reader that falls behind
+ * skips the frames it missed rather than drawing them all in turn. Readers
+ * never block writers: the slot is a sequence lock, whose sequence is odd
+ * while a frame is being written, and a reader copies the frame out again if
+ * the sequence changed under it. Several writers may publish to the same slot;
+ * they take turns.
+ */
+#ifndef TTETRIS_FRAME_SLOT_H
+#define TTETRIS_FRAME_SLOT_H
+
+#include "tetris_game.h"
+
+typedef struct ttetris_frame_slot FrameSlot;
+
+struct ttetris_frame_slot {
+	/* twice the number of frames published, plus one while a frame is
+	 * being written. 0 until the first frame. */
+	unsigned sequence;
+	struct game_view_data view;
+};
+
+/**
+ * Replace the frame in the slot
+ */
+void frame_slot_publish(FrameSlot *slot, struct game_view_data *view);
+
+/**
+ * @return the current sequence of the slot, to tell whether it changed since
+ *         a frame was last read from it
+ */
+unsigned frame_slot_sequence(FrameSlot *slot);
+
+/**
+ * Copy the latest frame out of the slot
+ * @return the sequence of the frame that was copied
+ */
+unsigned frame_slot_read(FrameSlot *slot, struct game_view_data *view);
+
+#endif // TTETRIS_FRAME_SLOT_H
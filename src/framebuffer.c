@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+
+Framebuffer *framebuffer_create(int rows, int columns) {
+	Framebuffer *fb = calloc(sizeof(Framebuffer), 1);
+	framebuffer_resize(fb, rows, columns);
+	return fb;
+}
+
+void framebuffer_resize(Framebuffer *fb, int rows, int columns) {
+	free(fb->cells);
+	fb->rows = rows;
+	fb->columns = columns;
+	fb->cells = malloc(sizeof(FramebufferCell) * rows * columns);
+	framebuffer_clear(fb);
+}
+
+void framebuffer_clear(Framebuffer *fb) {
+	for (int i = 0; i < fb->rows * fb->columns; i++)
+		fb->cells[i] = (FramebufferCell){' ', no_type};
+}
+
+static void put_cell(Framebuffer *fb, int y, int x, FramebufferCell cell) {
+	if (y < 0 || y >= fb->rows || x < 0 || x >= fb->columns)
+		return;
+	fb->cells[y * fb->columns + x] = cell;
+}
+
+static void put(Framebuffer *fb, int y, int x, char ch, int color) {
+	put_cell(fb, y, x, (FramebufferCell){ch, color, no_type});
+}
+
+void framebuffer_text(Framebuffer *fb, int y, int x, char *text) {
+	for (; *text; text++, x++)
+		put(fb, y, x, *text, no_type);
+}
+
+void framebuffer_centered(Framebuffer *fb, int y, char *text) {
+	int len = strnlen(text, fb->columns);
+
+	for (int i = 0; i < len; i++)
+		put(fb, y, (fb->columns - len) / 2 + i, text[i], no_type);
+}
+
+/**
+ * Write text inside a box, cut off at its border
+ */
+static void box_text(Framebuffer *fb, struct render_box *box, int row, int col,
+                     char *text) {
+	for (; *text && col < box->width - 1; text++, col++)
+		put(fb, box->y + row, box->x + col, *text, no_type);
+}
+
+/**
+ * Blank the inside of a box and draw its border
+ */
+static void draw_box(Framebuffer *fb, struct render_box *box) {
+	int bottom = box->y + box->height - 1, right = box->x + box->width - 1;
+
+	for (int y = box->y; y <= bottom; y++) {
+		for (int x = box->x; x <= right; x++) {
+			char ch = ' ';
+			if ((y == box->y || y == bottom) &&
+			    (x == box->x || x == right))
+				ch = '+';
+			else if (y == box->y || y == bottom)
+				ch = '-';
+			else if (x == box->x || x == right)
+				ch = '|';
+			put(fb, y, x, ch, no_type);
+		}
+	}
+}
+
+/**
+ * Draw a cell of a board or piece inside a box, like render_cell does in a
+ * window
+ *
+ * @param row   index of row
+ * @param col   index of column
+ * @param color enum block_type of the cell
+ * @param is_death_line any number other than 0 indicates that this is not part
+ *              of the death line
+ */
+static void draw_cell(Framebuffer *fb, struct render_box *box, int row,
+                      int col, int color, int is_death_line) {
+	int y = box->y + 1 + row, x = box->x + 1 + col * CELL_WIDTH;
+
+	if (y <= box->y || y >= box->y + box->height - 1)
+		return;
+	if (color < no_type || color > smashboy)
+		color = no_type;
+	for (int i = 0; i < CELL_WIDTH; i++) {
+		if (x + i <= box->x || x + i >= box->x + box->width - 1)
+			continue;
+		if (color != shadow)
+			put(fb, y, x + i, is_death_line ? '_' : ' ', color);
+		else if (CELL_WIDTH == 1)
+			put(fb, y, x + i, '#', no_type);
+		else
+			put(fb, y, x + i,
+			    i == 0 ? '[' : i == CELL_WIDTH - 1 ? ']' : ' ',
+			    no_type);
+	}
+}
+
+static void draw_preview(Framebuffer *fb, struct render_box *box, char *label,
+                         enum block_type piece) {
+	struct position cells[RENDER_PIECE_CELLS];
+
+	draw_box(fb, box);
+	box_text(fb, box, 1, 2, label);
+	int cell_count =
+	    render_piece_cells(piece, right, (struct position){1, 2}, cells);
+	for (int i = 0; i < cell_count; i++)
+		draw_cell(fb, box, cells[i].y, cells[i].x, piece, 0);
+}
+
+static void draw_counter(Framebuffer *fb, struct render_box *box, char *label,
+                         int value) {
+	char output_buffer[16];
+
+	draw_box(fb, box);
+	box_text(fb, box, 1, 1, label);
+	snprintf(output_buffer, sizeof(output_buffer), "%d", value);
+	box_text(fb, box, 2, 1, output_buffer);
+}
+
+void framebuffer_draw_board(Framebuffer *fb, struct render_layout *layout,
+                            struct game_view_data *view) {
+	int(*board)[BOARD_WIDTH] = view->board;
+
+	draw_box(fb, &layout->board);
+	for (int r = 0; r < BOARD_HEIGHT; r++)
+		for (int c = 0; c < BOARD_WIDTH; c++)
+			draw_cell(fb, &layout->board, BOARD_HEIGHT - r - 1, c,
+			          board[r][c], r == BOARD_PLAY_HEIGHT);
+
+	draw_preview(fb, &layout->next_block, "NEXT", view->next_block);
+	draw_preview(fb, &layout->hold_block, "HOLD", view->hold_block);
+	draw_counter(fb, &layout->points, "POINTS", view->points);
+	draw_counter(fb, &layout->lines, "LINES", view->lines_cleared);
+}
+
+/**
+ * the color a cell of a mini board is shown in, which leaves out the shadow
+ */
+static int mini_color(int color) {
+	if (color <= shadow || color > smashboy)
+		return no_type;
+	return color;
+}
+
+void framebuffer_draw_mini_board(Framebuffer *fb, struct render_box *box,
+                                 struct game_view_data *view) {
+	draw_box(fb, box);
+	for (int y = 0; y < box->height - 2; y++) {
+		// rows of cells are counted from the bottom of the board
+		int r = BOARD_HEIGHT - 1 - 2 * y;
+		for (int c = 0; c < BOARD_WIDTH && c < box->width - 2; c++) {
+			int upper = mini_color(view->board[r][c]);
+			int lower =
+			    r > 0 ? mini_color(view->board[r - 1][c]) : no_type;
+			if (upper == lower)
+				put(fb, box->y + 1 + y, box->x + 1 + c, ' ',
+				    upper);
+			else
+				put_cell(fb, box->y + 1 + y, box->x + 1 + c,
+				         (FramebufferCell){FRAMEBUFFER_HALVES,
+				                           upper, lower});
+		}
+	}
+}
+
+void framebuffer_destroy(Framebuffer *fb) {
+	free(fb->cells);
+	free(fb);
+}
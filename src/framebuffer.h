@@ -0,0 +1,81 @@
+/**
+ * In-memory grid of terminal cells, which boards are drawn into with the same
+ * layout as on screen (see render_layout.h). Renderers that do not use curses
+ * draw each frame into one, and decide what to do with it afterwards.
+ */
+#ifndef TTETRIS_FRAMEBUFFER_H
+#define TTETRIS_FRAMEBUFFER_H
+
+#include <stdint.h>
+
+#include "render_layout.h"
+#include "tetris_game.h"
+
+// character of a cell split into an upper and a lower half, each in the
+// colors of its own enum block_type, as drawn with Unicode half blocks
+#define FRAMEBUFFER_HALVES '\1'
+
+typedef struct ttetris_framebuffer_cell FramebufferCell;
+
+struct ttetris_framebuffer_cell {
+	/* character shown, which is printable ASCII, or FRAMEBUFFER_HALVES */
+	char ch;
+	/* enum block_type whose colors (see render_palette) the cell is shown
+	 * in, or no_type for the terminal's own colors. For halves, the colors
+	 * of the upper half. */
+	uint8_t color;
+	/* for halves, the enum block_type of the lower half, else no_type */
+	uint8_t lower;
+};
+
+typedef struct ttetris_framebuffer Framebuffer;
+
+struct ttetris_framebuffer {
+	int rows;
+	int columns;
+	/* rows * columns cells, row after row */
+	FramebufferCell *cells;
+};
+
+/**
+ * Allocate a blank framebuffer
+ */
+Framebuffer *framebuffer_create(int rows, int columns);
+
+/**
+ * Change the size of a framebuffer, which leaves it blank
+ */
+void framebuffer_resize(Framebuffer *fb, int rows, int columns);
+
+/**
+ * Blank every cell
+ */
+void framebuffer_clear(Framebuffer *fb);
+
+/**
+ * Write text in the terminal's own colors, cut off at the edge
+ */
+void framebuffer_text(Framebuffer *fb, int y, int x, char *text);
+
+/**
+ * Write text centered on a row, like print_centered
+ */
+void framebuffer_centered(Framebuffer *fb, int y, char *text);
+
+/**
+ * Draw a whole board, with its previews and counters, where the layout puts
+ * them
+ */
+void framebuffer_draw_board(Framebuffer *fb, struct render_layout *layout,
+                            struct game_view_data *view);
+
+/**
+ * Draw a board as a mini board in a box (see render_layout_compact_board),
+ * without its shadow, previews or counters
+ */
+void framebuffer_draw_mini_board(Framebuffer *fb, struct render_box *box,
+                                 struct game_view_data *view);
+
+void framebuffer_destroy(Framebuffer *fb);
+
+#endif // TTETRIS_FRAMEBUFFER_H
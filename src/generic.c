@@ -10,6 +10,11 @@ Blob *create_blob(int length) {
 	return blob;
 }
 
+void destroy_blob(Blob *blob) {
+	free(blob->bytes);
+	free(blob);
+}
+
 void resize_blob(Blob *blob, int length) {
 	blob->bytes = realloc(blob->bytes, length);
 	blob->length = length;
@@ -62,13 +67,20 @@ void string_array_resize(StringArray *arr, int new_length) {
 void string_array_set_item(StringArray *arr, int index, const char *value) {
 	int len = strlen(value);
 	arr->strings[index] = malloc(len + 1);
-	strncpy(arr->strings[index], value, len);
+	memcpy(arr->strings[index], value, len + 1);
 }
 
 char *string_array_get_item(StringArray *arr, int index) {
 	return arr->strings[index];
 }
 
+int string_array_index_of(StringArray *arr, const char *value) {
+	for (int i = 0; i < arr->length; i++)
+		if (strcmp(arr->strings[i], value) == 0)
+			return i;
+	return -1;
+}
+
 Blob *string_array_serialize(StringArray *arr) {
 	int message_size = 128;
 	unsigned int message_index = 0;
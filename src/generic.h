@@ -7,6 +7,7 @@ typedef struct st_blob {
 } Blob;
 
 Blob *create_blob(int length);
+void destroy_blob(Blob *blob);
 void resize_blob(Blob *blob, int length);
 void shift_blob(Blob *blob, int shift);
 
@@ -42,6 +43,11 @@ void string_array_resize(StringArray *arr, int new_length);
 void string_array_set_item(StringArray *arr, int index, const char *value);
 char *string_array_get_item(StringArray *arr, int index);
 
+/**
+ * @return the index of the first string equal to value, or -1 if there is none
+ */
+int string_array_index_of(StringArray *arr, const char *value);
+
 Blob *string_array_serialize(StringArray *arr);
 StringArray *string_array_deserialize(Blob *blob);
 
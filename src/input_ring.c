@@ -0,0 +1,29 @@
+#include <stdlib.h>
+
+#include "input_ring.h"
+
+int input_ring_push(InputRing *ring, Input *input) {
+	unsigned tail = ring->tail;
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head == INPUT_RING_SIZE)
+		return EXIT_FAILURE;
+
+	ring->inputs[tail & (INPUT_RING_SIZE - 1)] = *input;
+	// publish the input only once it has been written
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return EXIT_SUCCESS;
+}
+
+int input_ring_pop(InputRing *ring, Input *input) {
+	unsigned head = ring->head;
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return EXIT_FAILURE;
+
+	*input = ring->inputs[head & (INPUT_RING_SIZE - 1)];
+	// release the slot only once the input has been copied out
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return EXIT_SUCCESS;
+}
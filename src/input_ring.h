@@ -0,0 +1,58 @@
+/**
+ * Bounded, lock-free queue of a player's inputs, from the thread that reads
+ * them off the network to the thread that owns the player's game.
+ *
+ * There must be a single producer and a single consumer at any time. Either
+ * side may change threads, as long as the handover itself is synchronized
+ * (for example by a lock, or by the scheduling of a simulation task).
+ */
+#ifndef TTETRIS_INPUT_RING_H
+#define TTETRIS_INPUT_RING_H
+
+#include <stdint.h>
+
+// maximum number of inputs waiting to be applied, which must be a power of
+// two. Anything beyond that is dropped.
+#define INPUT_RING_SIZE 64
+
+typedef struct ttetris_input Input;
+
+struct ttetris_input {
+	/* enum player_event */
+	uint8_t event;
+	int8_t arg;
+	/* sequence number the client gave the input, or 0 */
+	uint16_t seq;
+	/* client's clock (in game clock ticks) when the input was made, or 0
+	 * if the client did not say */
+	uint32_t client_tick;
+	/* game clock time (ms) at which the input was received */
+	uint64_t timestamp_ms;
+};
+
+typedef struct ttetris_input_ring InputRing;
+
+struct ttetris_input_ring {
+	/* next slot to read, only written by the consumer */
+	unsigned head;
+	/* keep the two indices on separate cache lines, so that the producer
+	 * and consumer do not invalidate each other's */
+	char pad[60];
+	/* next slot to write, only written by the producer */
+	unsigned tail;
+	Input inputs[INPUT_RING_SIZE];
+};
+
+/**
+ * Add an input at the back of the ring. Producer only.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the ring is full
+ */
+int input_ring_push(InputRing *ring, Input *input);
+
+/**
+ * Take the input at the front of the ring. Consumer only.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the ring is empty
+ */
+int input_ring_pop(InputRing *ring, Input *input);
+
+#endif // TTETRIS_INPUT_RING_H
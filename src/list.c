@@ -2,66 +2,53 @@
 
 #include "list.h"
 
+// capacity of a list when its first item is appended
+#define LIST_INITIAL_CAPACITY 8
+
 struct st_list *list_create() {
 	struct st_list *list = malloc(sizeof(struct st_list));
-	list->head = NULL;
+	list->items = NULL;
 	list->length = 0;
+	list->capacity = 0;
 	return list;
 }
 
-static struct st_node *list_end_node(struct st_list *list) {
-	struct st_node *target = list->head;
-	if (target == 0)
-		return target;
-	while (target->next != 0)
-		target = target->next;
-	return target;
-}
-
 void *list_get(struct st_list *list, int index) {
-	if (index >= list->length)
+	if (index < 0 || index >= list->length)
 		return 0;
-	struct st_node *node = list->head;
-	for (int i = 0; i < index; i++)
-		node = node->next;
-	return node->target;
+	return list->items[index];
 }
 
-struct st_node *list_search(struct st_list *list, int (*match)(void *)) {
-	struct st_node *node = list->head;
-	while (node != 0)
-		if (match(node->target))
-			return node->target;
-		else
-			node = node->next;
+void *list_search(struct st_list *list, int (*match)(void *)) {
+	for (int i = 0; i < list->length; i++)
+		if (match(list->items[i]))
+			return list->items[i];
 	return 0;
 }
 
 void list_append(struct st_list *list, void *target) {
-	// create a new node
-	struct st_node *node = malloc(sizeof(struct st_node));
-	node->target = target;
-	node->next = 0;
-
-	struct st_node *end = list_end_node(list);
-	if (end == 0)
-		list->head = node;
-	else
-		end->next = node;
+	// double the capacity when full, so that appends take constant time
+	// on average
+	if (list->length == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity
+		                                : LIST_INITIAL_CAPACITY;
+		list->items =
+		    realloc(list->items, list->capacity * sizeof(void *));
+	}
+	list->items[list->length++] = target;
+}
 
-	(list->length)++;
+void *list_swap_remove(struct st_list *list, int index) {
+	if (index < 0 || index >= list->length)
+		return 0;
+	void *target = list->items[index];
+	list->items[index] = list->items[--list->length];
+	return target;
 }
 
 void list_free(struct st_list *list) {
-	// first, free all the items of the list
-	struct st_node *target;
-	struct st_node *next = list->head;
-
-	while (next != 0) {
-		target = next;
-		next = target->next;
-		free(target);
-	}
+	// first, free the array of items
+	free(list->items);
 
 	// now, free the list itself
 	free(list);
@@ -1,26 +1,41 @@
 #ifndef TTETRIS_LIST_H
 #define TTETRIS_LIST_H
 
-struct st_node {
-	void *target;
-	struct st_node *next;
-};
-
 typedef struct st_list List;
 
+/**
+ * A growable array of pointers. Appending, getting an item by index and
+ * removing an item are constant time, and iterating over the items with
+ * list_get touches consecutive memory.
+ */
 struct st_list {
-	struct st_node *head;
+	/* the items, of which the first length are in the list */
+	void **items;
 	int length;
+	int capacity;
 };
 
 List *list_create();
 
+/**
+ * @return the item at index, or NULL if there is none
+ */
 void *list_get(struct st_list *list, int index);
 
-struct st_node *list_search(struct st_list *list, int (*match)(void *));
+/**
+ * @return the first item that match returns non-zero for, or NULL
+ */
+void *list_search(struct st_list *list, int (*match)(void *));
 
 void list_append(struct st_list *list, void *target);
 
+/**
+ * Remove the item at index by moving the last item into its place, which
+ * changes the order of the items
+ * @return the removed item, or NULL if there is none
+ */
+void *list_swap_remove(struct st_list *list, int index);
+
 void list_free(struct st_list *list);
 
 #endif // TTETRIS_LIST_H
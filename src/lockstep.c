@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lockstep.h"
+#include "log.h"
+#include "player.h"
+
+Lockstep *lockstep_create(StringArray *names) {
+	Lockstep *lockstep = calloc(sizeof(Lockstep), 1);
+	lockstep->names = names;
+	lockstep->games =
+	    calloc(sizeof(struct game_contents *), names->length);
+	lockstep->waiting = calloc(sizeof(char), names->length);
+	return lockstep;
+}
+
+void lockstep_destroy(Lockstep *lockstep) {
+	for (int i = 0; i < lockstep->names->length; i++)
+		destroy_game(&lockstep->games[i]);
+	string_array_destroy(lockstep->names);
+	free(lockstep->games);
+	free(lockstep->waiting);
+	free(lockstep);
+}
+
+static int lockstep_valid_slot(Lockstep *lockstep, int slot) {
+	if (slot >= 0 && slot < lockstep->names->length)
+		return 1;
+	fprintf(logging_fp, "lockstep: no party member in slot %d\n", slot);
+	return 0;
+}
+
+int lockstep_snapshot(Lockstep *lockstep, int slot, uint32_t tick,
+                      struct game_state *state) {
+	if (!lockstep_valid_slot(lockstep, slot))
+		return EXIT_FAILURE;
+	if (load_game_state(&lockstep->games[slot], state)) {
+		fprintf(logging_fp, "lockstep_snapshot: invalid state\n");
+		return EXIT_FAILURE;
+	}
+	lockstep->waiting[slot] = 0;
+	lockstep->tick = tick;
+	return EXIT_SUCCESS;
+}
+
+int lockstep_event(Lockstep *lockstep, int slot, uint32_t tick, int event,
+                   int arg) {
+	if (!lockstep_valid_slot(lockstep, slot) ||
+	    lockstep->games[slot] == NULL || lockstep->waiting[slot])
+		return 0;
+	lockstep->tick = tick;
+	return player_apply_event(lockstep->games[slot], event, arg);
+}
+
+int lockstep_check(Lockstep *lockstep, int slot, uint32_t hash) {
+	struct game_state state;
+
+	if (!lockstep_valid_slot(lockstep, slot))
+		return EXIT_SUCCESS;
+	// a game that is already waiting for a snapshot has asked for one
+	if (lockstep->games[slot] == NULL || lockstep->waiting[slot])
+		return EXIT_SUCCESS;
+
+	save_game_state(lockstep->games[slot], &state);
+	if (hash_game_state(&state) == hash)
+		return EXIT_SUCCESS;
+
+	fprintf(logging_fp,
+	        "lockstep_check: game of '%s' is out of sync at tick %u\n",
+	        string_array_get_item(lockstep->names, slot), lockstep->tick);
+	lockstep->waiting[slot] = 1;
+	lockstep->desyncs++;
+	return EXIT_FAILURE;
+}
+
+int lockstep_view(Lockstep *lockstep, int slot, struct game_view_data **view) {
+	if (!lockstep_valid_slot(lockstep, slot) ||
+	    lockstep->games[slot] == NULL)
+		return EXIT_FAILURE;
+	generate_game_view_data(lockstep->games[slot], view);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,71 @@
+/**
+ * Lockstep simulation of every game in a party on the client.
+ *
+ * Instead of the boards, the server relays the events that change each game.
+ * The client starts each game from a snapshot and applies the events to its
+ * own copy, in the order they arrive. Every so often the server sends a hash
+ * of its copy of a game. If the client's copy hashes differently it has
+ * gone out of sync, and ignores that game's events until the server answers
+ * with a fresh snapshot.
+ */
+#ifndef TTETRIS_LOCKSTEP_H
+#define TTETRIS_LOCKSTEP_H
+
+#include <stdint.h>
+
+#include "generic.h"
+#include "tetris_game.h"
+
+typedef struct ttetris_lockstep Lockstep;
+
+struct ttetris_lockstep {
+	/* names of the party members, in slot order */
+	StringArray *names;
+	/* each member's game, or NULL until its first snapshot */
+	struct game_contents **games;
+	/* non-zero for a game whose events are being ignored until the next
+	 * snapshot */
+	char *waiting;
+	/* the game clock tick of the last event */
+	uint32_t tick;
+	/* number of times a game went out of sync */
+	long desyncs;
+};
+
+/**
+ * Prepare to simulate the games of a party
+ * @param names party members, in slot order. The lockstep takes ownership.
+ */
+Lockstep *lockstep_create(StringArray *names);
+
+void lockstep_destroy(Lockstep *lockstep);
+
+/**
+ * Replace a game with a snapshot from the server
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int lockstep_snapshot(Lockstep *lockstep, int slot, uint32_t tick,
+                      struct game_state *state);
+
+/**
+ * Apply a relayed event (enum player_event) to a game
+ * @return non-zero if the game changed and should be drawn again
+ */
+int lockstep_event(Lockstep *lockstep, int slot, uint32_t tick, int event,
+                   int arg);
+
+/**
+ * Check a game against the server's hash of it. A game that does not match
+ * is set aside until the next snapshot.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the game is out of sync and a
+ *         snapshot should be requested
+ */
+int lockstep_check(Lockstep *lockstep, int slot, uint32_t hash);
+
+/**
+ * Render a game into view
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the game has no snapshot yet
+ */
+int lockstep_view(Lockstep *lockstep, int slot, struct game_view_data **view);
+
+#endif // TTETRIS_LOCKSTEP_H
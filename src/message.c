@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,7 +10,11 @@
 #ifdef THIS_IS_WINDOWS
 #include <winsock2.h>
 #else
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #include "log.h"
@@ -16,6 +22,23 @@
 #include "player.h"
 #include "tetris_game.h"
 
+// maximum number of frames handed to the kernel in one write
+#define MSG_QUEUE_MAX_IOV 64
+
+#ifdef THIS_IS_WINDOWS
+typedef WSABUF MessageIoVec;
+static void message_iov_set(MessageIoVec *iov, void *base, int len) {
+	iov->buf = base;
+	iov->len = len;
+}
+#else
+typedef struct iovec MessageIoVec;
+static void message_iov_set(MessageIoVec *iov, void *base, int len) {
+	iov->iov_base = base;
+	iov->iov_len = len;
+}
+#endif
+
 char *message_type_to_str(msg_type_t msg_type) {
 	switch (msg_type) {
 	case MSG_TYPE_UNKNOWN:
@@ -24,6 +47,8 @@ char *message_type_to_str(msg_type_t msg_type) {
 		return "REGISTER";
 	case MSG_TYPE_REGISTER_SUCCESS:
 		return "REGISTER_SUCCESS";
+	case MSG_TYPE_REGISTER_FAILURE:
+		return "REGISTER_FAILURE";
 	case MSG_TYPE_OPPONENT:
 		return "OPPONENT";
 	case MSG_TYPE_ROTATE:
@@ -46,38 +71,80 @@ char *message_type_to_str(msg_type_t msg_type) {
 		return "START_GAME";
 	case MSG_TYPE_GAME_STARTED:
 		return "GAME_STARTED";
+	case MSG_TYPE_PREDICT:
+		return "PREDICT";
+	case MSG_TYPE_STATE:
+		return "STATE";
+	case MSG_TYPE_LOCKSTEP:
+		return "LOCKSTEP";
+	case MSG_TYPE_EVENT:
+		return "EVENT";
+	case MSG_TYPE_HASH:
+		return "HASH";
+	case MSG_TYPE_RESYNC:
+		return "RESYNC";
+	case MSG_TYPE_SNAPSHOT:
+		return "SNAPSHOT";
+	case MSG_TYPE_INPUTS:
+		return "INPUTS";
+	case MSG_TYPE_DATAGRAM:
+		return "DATAGRAM";
 	default:
 		return "UNKNOWN";
 	}
 }
 
-int message_nbytes(SOCKET socket_fd, char *bytes, int nbytes, int request_id,
-                   msg_type_t message_type) {
-	unsigned long payload_bytes = sizeof(MessageHeader) + nbytes;
-	char *payload = calloc(sizeof(char), payload_bytes);
-
-	// write the payload header
-	MessageHeader *header = (MessageHeader *)payload;
+/**
+ * Fill in the wire header for a message
+ */
+static void message_header_init(MessageHeader *header, int nbytes,
+                                int request_id, msg_type_t message_type) {
+	memset(header, 0, sizeof(MessageHeader));
 	header->magic_number = MSG_MAGIC_NUMBER;
 	header->content_length = nbytes;
 	header->request_id = request_id;
 	header->message_type = message_type;
+}
 
-	// copy the body into the payload
-	memcpy(payload + sizeof(MessageHeader), bytes, nbytes);
-
-	int bytes_written = send(socket_fd, payload, payload_bytes,
+/**
+ * Gather-write the given buffers to the socket with a single system call.
+ *
+ * @param nonblocking if non-zero, return instead of waiting for space in the
+ *                    socket buffer (ignored on Windows)
+ * @return number of bytes written, or -1 on error. Use last_error_would_block
+ *         to tell a full socket apart from a real error.
+ */
+static int send_vector(SOCKET socket_fd, MessageIoVec *iov, int iovcnt,
+                       int nonblocking) {
 #ifdef THIS_IS_WINDOWS
-	                         0
+	DWORD bytes_written;
+	if (WSASend(socket_fd, iov, iovcnt, &bytes_written, 0, NULL, NULL) ==
+	    SOCKET_ERROR)
+		return -1;
+	return bytes_written;
 #else
-	                         // For Linux, MSG_NOSIGNAL prevents SIGPIPE
-	                         // from being generated if we write into a
-	                         // closed socket.
-	                         MSG_NOSIGNAL
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	// For Linux, MSG_NOSIGNAL prevents SIGPIPE from being generated if we
+	// write into a closed socket.
+	return sendmsg(socket_fd, &msg,
+	               MSG_NOSIGNAL | (nonblocking ? MSG_DONTWAIT : 0));
 #endif
-	);
+}
 
-	free(payload);
+int message_nbytes(SOCKET socket_fd, char *bytes, int nbytes, int request_id,
+                   msg_type_t message_type) {
+	MessageHeader header;
+	MessageIoVec iov[2];
+
+	// the header and body are sent together, without copying the body
+	message_header_init(&header, nbytes, request_id, message_type);
+	message_iov_set(&iov[0], &header, sizeof(MessageHeader));
+	message_iov_set(&iov[1], bytes, nbytes);
+
+	int bytes_written = send_vector(socket_fd, iov, nbytes ? 2 : 1, 0);
 
 	// Note: Windows uses a 64-bit socket number, but Linux uses a 32-bit
 	// number. For now, this will just print the lower 32 bits.
@@ -87,11 +154,7 @@ int message_nbytes(SOCKET socket_fd, char *bytes, int nbytes, int request_id,
 	        bytes_written, (uint32_t)(socket_fd & 0xFFFF), nbytes,
 	        request_id, message_type_to_str(message_type));
 
-#ifdef THIS_IS_WINDOWS
-	if (bytes_written == SOCKET_ERROR) {
-#else
 	if (bytes_written < 0) {
-#endif
 		fprintf(logging_fp,
 		        "message_nbytes: socket error during write");
 		return EXIT_FAILURE;
@@ -106,43 +169,343 @@ int message_blob(SOCKET socket_fd, Blob *blob, int request_id,
 	                      message_type);
 }
 
+Frame *frame_create(char *bytes, int nbytes, int request_id,
+                    msg_type_t message_type) {
+	// the header and body share a single allocation so that the frame can
+	// be handed to the kernel as one iovec
+	Frame *frame = malloc(sizeof(Frame) + sizeof(MessageHeader) + nbytes);
+	frame->refcount = 1;
+	frame->length = sizeof(MessageHeader) + nbytes;
+	message_header_init((MessageHeader *)frame->bytes, nbytes, request_id,
+	                    message_type);
+	if (bytes)
+		memcpy(frame_body(frame), bytes, nbytes);
+	return frame;
+}
+
+char *frame_body(Frame *frame) { return frame->bytes + sizeof(MessageHeader); }
+
+Frame *frame_ref(Frame *frame) {
+	__sync_add_and_fetch(&frame->refcount, 1);
+	return frame;
+}
+
+void frame_unref(Frame *frame) {
+	if (frame && __sync_sub_and_fetch(&frame->refcount, 1) == 0)
+		free(frame);
+}
+
+struct ttetris_msg_queue {
+	pthread_mutex_t lock;
+	/* frames waiting to be written, each holding a reference */
+	Frame **entries;
+	int length;
+	int capacity;
+	/* number of bytes of the first entry that were already written */
+	int offset;
+	/* total number of bytes waiting to be written */
+	int pending_bytes;
+	/* non-zero while an asynchronous write of the queue is in progress */
+	char write_in_flight;
+};
+
+MessageQueue *message_queue_create(void) {
+	MessageQueue *queue = calloc(sizeof(MessageQueue), 1);
+	pthread_mutex_init(&queue->lock, NULL);
+	return queue;
+}
+
+void message_queue_destroy(MessageQueue *queue) {
+	for (int i = 0; i < queue->length; i++)
+		frame_unref(queue->entries[i]);
+	free(queue->entries);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
+int message_queue_frame(MessageQueue *queue, Frame *frame) {
+	frame_ref(frame);
+
+	pthread_mutex_lock(&queue->lock);
+	// if the queue is not big enough, double it
+	if (queue->length == queue->capacity) {
+		queue->capacity = queue->capacity ? queue->capacity * 2 : 8;
+		queue->entries =
+		    realloc(queue->entries, sizeof(Frame *) * queue->capacity);
+	}
+	queue->entries[queue->length++] = frame;
+	queue->pending_bytes += frame->length;
+	pthread_mutex_unlock(&queue->lock);
+
+	return EXIT_SUCCESS;
+}
+
+int message_queue_nbytes(MessageQueue *queue, char *bytes, int nbytes,
+                         int request_id, msg_type_t message_type) {
+	Frame *frame = frame_create(bytes, nbytes, request_id, message_type);
+	message_queue_frame(queue, frame);
+	frame_unref(frame);
+	return EXIT_SUCCESS;
+}
+
+int message_queue_blob(MessageQueue *queue, Blob *blob, int request_id,
+                       msg_type_t message_type) {
+	return message_queue_nbytes(queue, blob->bytes, blob->length,
+	                            request_id, message_type);
+}
+
+/**
+ * drop n written bytes from the front of the queue
+ *
+ * The queue lock must be held by the caller.
+ */
+static void message_queue_consume(MessageQueue *queue, int nbytes) {
+	int done = 0;
+
+	queue->pending_bytes -= nbytes;
+	nbytes += queue->offset;
+	while (done < queue->length && nbytes >= queue->entries[done]->length) {
+		nbytes -= queue->entries[done]->length;
+		frame_unref(queue->entries[done]);
+		done++;
+	}
+	queue->length -= done;
+	memmove(queue->entries, queue->entries + done,
+	        sizeof(Frame *) * queue->length);
+	queue->offset = nbytes;
+}
+
+/**
+ * point iov at up to max_iov of the queued frames
+ *
+ * The queue lock must be held by the caller.
+ * @return number of iovecs filled in
+ */
+static int message_queue_fill_iov(MessageQueue *queue, MessageIoVec *iov,
+                                  int max_iov) {
+	int iovcnt = queue->length < max_iov ? queue->length : max_iov;
+	if (iovcnt == 0)
+		return 0;
+	message_iov_set(&iov[0], queue->entries[0]->bytes + queue->offset,
+	                queue->entries[0]->length - queue->offset);
+	for (int i = 1; i < iovcnt; i++)
+		message_iov_set(&iov[i], queue->entries[i]->bytes,
+		                queue->entries[i]->length);
+	return iovcnt;
+}
+
+int message_queue_flush(MessageQueue *queue, SOCKET socket_fd) {
+	MessageIoVec iov[MSG_QUEUE_MAX_IOV];
+	int iovcnt, bytes_written, pending;
+
+	pthread_mutex_lock(&queue->lock);
+	// if a write was submitted asynchronously, the queue is written out
+	// once it completes, so writing here would send frames twice
+	while (!queue->write_in_flight &&
+	       (iovcnt = message_queue_fill_iov(queue, iov,
+	                                        MSG_QUEUE_MAX_IOV)) > 0) {
+		bytes_written = send_vector(socket_fd, iov, iovcnt, 1);
+		if (bytes_written < 0) {
+			// the socket is full; the caller should wait for it to
+			// become writable and flush again
+			if (last_error_would_block())
+				break;
+			pthread_mutex_unlock(&queue->lock);
+			fprintf(logging_fp, "message_queue_flush: socket error "
+			                    "during write\n");
+			return -1;
+		}
+
+		fprintf(logging_fp,
+		        "message_queue_flush: Wrote %d bytes in %d frames to "
+		        "file pointer %x\n",
+		        bytes_written, iovcnt, (uint32_t)(socket_fd & 0xFFFF));
+		message_queue_consume(queue, bytes_written);
+	}
+	pending = queue->pending_bytes;
+	pthread_mutex_unlock(&queue->lock);
+
+	return pending;
+}
+
+#ifdef THIS_IS_NOT_WINDOWS
+int message_queue_begin_write(MessageQueue *queue, struct iovec *iov,
+                              int max_iov) {
+	int iovcnt = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	if (!queue->write_in_flight) {
+		iovcnt = message_queue_fill_iov(queue, iov, max_iov);
+		queue->write_in_flight = iovcnt > 0;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return iovcnt;
+}
+
+void message_queue_end_write(MessageQueue *queue, int nbytes) {
+	pthread_mutex_lock(&queue->lock);
+	if (nbytes > 0)
+		message_queue_consume(queue, nbytes);
+	queue->write_in_flight = 0;
+	pthread_mutex_unlock(&queue->lock);
+}
+#endif
+
+int message_queue_pending(MessageQueue *queue) {
+	int pending;
+	pthread_mutex_lock(&queue->lock);
+	pending = queue->pending_bytes;
+	pthread_mutex_unlock(&queue->lock);
+	return pending;
+}
+
+int socket_set_nodelay(SOCKET socket_fd) {
+	int opt = 1;
+	if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, (char *)&opt,
+	               sizeof(opt))) {
+#ifdef THIS_IS_NOT_WINDOWS
+		// Unix domain sockets have no such delay to disable
+		if (errno == EOPNOTSUPP)
+			return EXIT_SUCCESS;
+#endif
+		fprintf(logging_fp, "socket_set_nodelay: setsockopt failed\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int socket_set_nonblocking(SOCKET socket_fd) {
+#ifdef THIS_IS_WINDOWS
+	u_long mode = 1;
+	if (ioctlsocket(socket_fd, FIONBIO, &mode) != 0) {
+#else
+	int flags = fcntl(socket_fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+#endif
+		fprintf(logging_fp,
+		        "socket_set_nonblocking: failed to set flags\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 /**
  * Send a list of all online users over the given socket.
  */
-int send_online_users(int filedes, int request_id) {
+int send_online_users(MessageQueue *queue, int request_id) {
 	StringArray *arr = player_names(1);
 	Blob *blob = string_array_serialize(arr);
-	message_blob(filedes, blob, request_id, MSG_TYPE_LIST_RESPONSE);
+	message_queue_blob(queue, blob, request_id, MSG_TYPE_LIST_RESPONSE);
+	destroy_blob(blob);
+	string_array_destroy(arr);
 	return EXIT_SUCCESS;
 }
 
-Blob *serialize_state(Player *player) {
+/**
+ * Build the board frame for the player: the player's party slot followed by
+ * the game view data
+ */
+static Frame *serialize_state(Player *player) {
 	// first, render the board into the player view
 	generate_game_view_data(player->contents, &player->view);
-	// figure out how big our blob needs to be
-	uint8_t name_length = strnlen(player->name, PLAYER_NAME_MAX_CHARS);
-	uint16_t blob_size = sizeof(struct game_view_data) + name_length + 1;
-	// create a blob to contain the message
-	Blob *blob = create_blob(blob_size);
-	// next null-terminated bytes are used to store the player name
-	strncpy(blob->bytes, player->name, name_length + 1);
-	// strncpy will not null-terminate the string if it is longer than n,
-	// so this will keep us safe
-	blob->bytes[name_length] = 0;
-	// the game_view_data is sent directly after the null-byte
-	memcpy(blob->bytes + 1 + name_length, player->view,
-	       sizeof(struct game_view_data));
-	return blob;
+	// create a frame to contain the message
+	Frame *frame = frame_create(NULL, 1 + sizeof(struct game_view_data), 0,
+	                            MSG_TYPE_BOARD);
+	char *body = frame_body(frame);
+	body[0] = player->party_slot;
+	// the game_view_data is sent directly after the slot
+	memcpy(body + 1, player->view, sizeof(struct game_view_data));
+	return frame;
+}
+
+Frame *player_board_frame(Player *player) {
+	Frame *frame;
+
+	// Each player's frame has a lock of its own, so the workers simulating
+	// different parties do not wait for each other. It is only contended
+	// when a player's board is sent from outside their party's worker.
+	pthread_mutex_lock(&player->board_frame_lock);
+	// only serialize if the game changed since the cached frame was built,
+	// or the player took another slot in a new party
+	if (player->board_frame == NULL ||
+	    player->board_frame_version != player->state_version ||
+	    (uint8_t)frame_body(player->board_frame)[0] !=
+	        player->party_slot) {
+		frame_unref(player->board_frame);
+		player->board_frame = serialize_state(player);
+		player->board_frame_version = player->state_version;
+	}
+	frame = frame_ref(player->board_frame);
+	pthread_mutex_unlock(&player->board_frame_lock);
+
+	return frame;
+}
+
+Frame *player_state_frame(Player *player) {
+	Frame *frame = frame_create(NULL, sizeof(struct game_state),
+	                            player->input_seq, MSG_TYPE_STATE);
+	save_game_state(player->contents,
+	                (struct game_state *)frame_body(frame));
+	return frame;
+}
+
+int input_records_read(char *body, int length, uint16_t seq,
+                       const uint16_t *after, Input *inputs, int max) {
+	struct input_record record;
+	int n = 0;
+
+	for (int i = 0; i + (int)sizeof(record) <= length;
+	     i += sizeof(record)) {
+		memcpy(&record, body + i, sizeof(record));
+		for (int r = 0; r < record.repeat && n < max; r++) {
+			if (record.event >= PLAYER_EVENT_ROTATE &&
+			    record.event <= PLAYER_EVENT_SWAP_HOLD &&
+			    (after == NULL || (int16_t)(seq - *after) > 0))
+				inputs[n++] = (Input){record.event, record.arg,
+				                      seq, record.tick, 0};
+			// numbered inputs skip 0, which means "not numbered"
+			if (seq && ++seq == 0)
+				seq = 1;
+		}
+	}
+	return n;
+}
+
+Frame *lockstep_frame(Player *player, int event, int arg, uint32_t tick) {
+	if (event == PLAYER_EVENT_SNAPSHOT) {
+		struct lockstep_snapshot snapshot;
+		memset(&snapshot, 0, sizeof(snapshot));
+		snapshot.tick = tick;
+		snapshot.slot = player->party_slot;
+		save_game_state(player->contents, &snapshot.state);
+		return frame_create((char *)&snapshot, sizeof(snapshot), 0,
+		                    MSG_TYPE_SNAPSHOT);
+	}
+
+	struct lockstep_event body = {tick, player->party_slot, event, arg, 0};
+	return frame_create((char *)&body, sizeof(body), 0, MSG_TYPE_EVENT);
+}
+
+Frame *lockstep_hash_frame(Player *player, uint32_t tick) {
+	struct game_state state;
+	struct lockstep_hash body;
+
+	memset(&body, 0, sizeof(body));
+	body.tick = tick;
+	body.slot = player->party_slot;
+	save_game_state(player->contents, &state);
+	body.hash = hash_game_state(&state);
+	return frame_create((char *)&body, sizeof(body), 0, MSG_TYPE_HASH);
 }
 
 /**
- * Send information about the given player, such as the name and game view data
+ * Queue information about the given player, such as the name and game view
+ * data
  */
-int send_player(int socket_fd, struct st_player *player) {
-	if (socket_fd < 0) {
-		fprintf(stderr,
-		        "send_player: skipping invalid file descriptor %d\n",
-		        socket_fd);
+int send_player(MessageQueue *queue, struct st_player *player) {
+	if (queue == 0) {
+		fprintf(stderr, "send_player: skipping missing queue\n");
 		return EXIT_FAILURE;
 	}
 
@@ -151,19 +514,16 @@ int send_player(int socket_fd, struct st_player *player) {
 		return EXIT_FAILURE;
 	}
 
-	if (player->view == 0) {
-		fprintf(stderr, "Error: No view exists for player.\n");
+	if (player->contents == 0) {
+		fprintf(stderr, "Error: No game exists for player.\n");
 		return EXIT_FAILURE;
 	}
 
-	if (player->view->board == 0) {
-		fprintf(stderr, "Error: No board exists for player.\n");
-		return EXIT_FAILURE;
-	}
-
-	Blob *blob = serialize_state(player);
+	Frame *frame = player_board_frame(player);
+	message_queue_frame(queue, frame);
+	frame_unref(frame);
 
-	return message_blob(socket_fd, blob, 0, MSG_TYPE_BOARD);
+	return EXIT_SUCCESS;
 }
 
 // vi:noet:noai:sw=0:sts=0:ts=8
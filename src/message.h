@@ -13,7 +13,7 @@ typedef uint8_t msg_type_t;
 
 // the message must be able to hold a 4-byte integer for each cell in the
 // board, and must have additional space for metadata (such as the player's
-// name)
+// slot)
 #define MAXMSG 2048
 
 // MSG_TYPE_UNKNOWN should be avoided when possible, but is used to indicate
@@ -24,6 +24,9 @@ typedef uint8_t msg_type_t;
 // MSG_TYPE_REGISTER_SUCCESS is sent by the server when a user is successfully
 // registered
 #define MSG_TYPE_REGISTER_SUCCESS 'V'
+// MSG_TYPE_REGISTER_FAILURE is sent by the server instead when the name is
+// taken by another player who is still connected
+#define MSG_TYPE_REGISTER_FAILURE 'W'
 #define MSG_TYPE_OPPONENT 'O'
 #define MSG_TYPE_ROTATE 'R'
 #define MSG_TYPE_TRANSLATE 'T'
@@ -31,6 +34,9 @@ typedef uint8_t msg_type_t;
 #define MSG_TYPE_DROP 'D'
 #define MSG_TYPE_SWAP_HOLD 'S'
 #define MSG_TYPE_LIST 'P'
+// MSG_TYPE_BOARD carries the board of the party member in the slot of its
+// first byte, which is their position in the list sent with
+// MSG_TYPE_GAME_STARTED, followed by their struct game_view_data
 #define MSG_TYPE_BOARD 'B'
 #define MSG_TYPE_LIST_RESPONSE 'Y'
 // MSG_TYPE_START_GAME is sent from a client to the server to request that the
@@ -39,6 +45,90 @@ typedef uint8_t msg_type_t;
 // MSG_TYPE_GAME_STARTED is sent from the server to clients when the game has
 // been started
 #define MSG_TYPE_GAME_STARTED 'C'
+// MSG_TYPE_PREDICT is sent from a client that predicts its own game, asking
+// the server for the game's state instead of its board
+#define MSG_TYPE_PREDICT 'Q'
+// MSG_TYPE_STATE is sent from the server to a predicting client with the
+// authoritative state of its game. The request id is the sequence number of
+// the last input that has been applied, which clients give inputs as their
+// request id.
+#define MSG_TYPE_STATE 'Z'
+// MSG_TYPE_LOCKSTEP is sent from a client that simulates every game in its
+// party itself. Instead of boards, the server then relays the events that
+// change each game (MSG_TYPE_EVENT), and periodically a hash of each game
+// (MSG_TYPE_HASH) so that the client can tell when it has gone out of sync.
+#define MSG_TYPE_LOCKSTEP 'K'
+#define MSG_TYPE_EVENT 'E'
+#define MSG_TYPE_HASH 'H'
+// MSG_TYPE_RESYNC is sent from a lockstep client whose copy of a game does not
+// match the hash, and is answered with a MSG_TYPE_SNAPSHOT of the game. A
+// snapshot of every game is also sent when the game starts.
+#define MSG_TYPE_RESYNC 'J'
+#define MSG_TYPE_SNAPSHOT 'N'
+// MSG_TYPE_INPUTS carries a batch of inputs (struct input_record) made during
+// one frame on the client. A non-zero request id is the sequence number of
+// the first input in the batch, and the inputs after it are numbered on from
+// there, skipping 0.
+#define MSG_TYPE_INPUTS 'I'
+// MSG_TYPE_DATAGRAM is sent from a client that wants to use the datagram
+// transport (see udp.h), and is answered with the 8-byte token that
+// identifies the client's datagrams, or 0 if the server has no datagram
+// socket.
+#define MSG_TYPE_DATAGRAM 'G'
+
+// maximum number of records in a batch of inputs
+#define INPUT_BATCH_MAX 64
+
+/**
+ * Body of MSG_TYPE_EVENT: an event (enum player_event) that changed the game
+ * of the party member in the given slot, which is their position in the list
+ * sent with MSG_TYPE_GAME_STARTED
+ */
+struct lockstep_event {
+	/* game clock tick at which the event happened */
+	uint32_t tick;
+	uint8_t slot;
+	uint8_t event;
+	int8_t arg;
+	uint8_t unused;
+};
+
+/**
+ * Body of MSG_TYPE_HASH: hash_game_state of a party member's game, after every
+ * event relayed before it
+ */
+struct lockstep_hash {
+	uint32_t tick;
+	uint8_t slot;
+	uint8_t unused[3];
+	uint32_t hash;
+};
+
+/**
+ * Body of MSG_TYPE_SNAPSHOT: the full state of a party member's game, which
+ * the events relayed after it apply to
+ */
+struct lockstep_snapshot {
+	uint32_t tick;
+	uint8_t slot;
+	uint8_t unused[3];
+	struct game_state state;
+};
+
+/**
+ * An input in a MSG_TYPE_INPUTS batch. Repeats of the same input in a row are
+ * sent as one record.
+ */
+struct input_record {
+	/* client's clock, in game clock ticks, when the input was first made */
+	uint32_t tick;
+	/* enum player_event */
+	uint8_t event;
+	int8_t arg;
+	/* number of times the input was made */
+	uint8_t repeat;
+	uint8_t unused;
+};
 
 typedef struct ttetris_msg_header MessageHeader;
 
@@ -63,6 +153,125 @@ struct ttetris_msg_header {
  */
 char *message_type_to_str(msg_type_t msg_type);
 
+/**
+ * Frame is an immutable, reference counted, fully framed message (header
+ * followed by body). A frame that goes to several sockets is built once and
+ * queued by reference on each of them.
+ */
+typedef struct ttetris_frame Frame;
+
+struct ttetris_frame {
+	int refcount;
+	/* length of the header plus the body */
+	int length;
+	char bytes[];
+};
+
+/**
+ * Allocate a frame holding a copy of n bytes. If bytes is NULL, the body is
+ * left uninitialized for the caller to fill in through frame_body.
+ * @return frame with a single reference owned by the caller
+ */
+Frame *frame_create(char *bytes, int n, int request_id,
+                    msg_type_t message_type);
+
+/**
+ * @return pointer to the start of the message body
+ */
+char *frame_body(Frame *frame);
+
+/**
+ * Take an additional reference to the frame
+ * @return frame
+ */
+Frame *frame_ref(Frame *frame);
+
+/**
+ * Drop a reference to the frame, freeing it once nobody holds one
+ */
+void frame_unref(Frame *frame);
+
+/**
+ * MessageQueue collects framed messages bound for a single socket so that
+ * everything produced while handling one event (or one game tick) can be
+ * written with a single vectored write.
+ *
+ * Queues are safe to use from more than one thread.
+ */
+typedef struct ttetris_msg_queue MessageQueue;
+
+MessageQueue *message_queue_create(void);
+
+void message_queue_destroy(MessageQueue *queue);
+
+/**
+ * Append a frame to the queue. The queue takes its own reference, so the
+ * caller keeps ownership of theirs.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int message_queue_frame(MessageQueue *queue, Frame *frame);
+
+/**
+ * Frame n bytes and append them to the queue. Nothing is written to the
+ * socket until message_queue_flush is called.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int message_queue_nbytes(MessageQueue *queue, char *bytes, int n,
+                         int request_id, msg_type_t message_type);
+
+/**
+ * Wrapper for message_queue_nbytes that takes a blob
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int message_queue_blob(MessageQueue *queue, Blob *blob, int request_id,
+                       msg_type_t message_type);
+
+/**
+ * Write as much of the queue to the socket as it will accept without
+ * blocking. Anything left over stays queued, and should be retried once the
+ * socket becomes writable.
+ * @return number of bytes still queued, or -1 on a socket error
+ */
+int message_queue_flush(MessageQueue *queue, SOCKET socket_fd);
+
+#ifdef THIS_IS_NOT_WINDOWS
+#include <sys/uio.h>
+
+/**
+ * Start an asynchronous write of the queue (for example with io_uring) by
+ * pointing iov at up to max_iov of the queued frames. The frames stay queued,
+ * and message_queue_flush does nothing, until message_queue_end_write is
+ * called with the result.
+ * @return number of iovecs filled in, or 0 if there is nothing to write or a
+ *         write is already in progress
+ */
+int message_queue_begin_write(MessageQueue *queue, struct iovec *iov,
+                              int max_iov);
+
+/**
+ * Finish an asynchronous write, dropping the nbytes that were written
+ */
+void message_queue_end_write(MessageQueue *queue, int nbytes);
+#endif
+
+/**
+ * @return number of bytes waiting to be written
+ */
+int message_queue_pending(MessageQueue *queue);
+
+/**
+ * Disable Nagle's algorithm on a socket. Frames are already batched by the
+ * message queue, so there is nothing to gain by letting the kernel hold them.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int socket_set_nodelay(SOCKET socket_fd);
+
+/**
+ * Put a socket in non-blocking mode
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int socket_set_nonblocking(SOCKET socket_fd);
+
 /**
  * Write n bytes to socket
  * @return EXIT_SUCCESS or EXIT_FAILURE
@@ -77,8 +286,48 @@ int message_nbytes(SOCKET socket_fd, char *bytes, int n, int request_id,
 int message_blob(SOCKET socket_fd, Blob *blob, int request_id,
                  msg_type_t message_type);
 
-int send_online_users(int filedes, int request_id);
+int send_online_users(MessageQueue *queue, int request_id);
+
+/**
+ * Get the board frame for the player, serializing the game only if it changed
+ * since the last call (see Player.state_version).
+ * @return frame with a reference owned by the caller
+ */
+Frame *player_board_frame(Player *player);
+
+/**
+ * Build a state frame for the player: the game_state of their game,
+ * acknowledging the last input applied (see MSG_TYPE_STATE)
+ * @return frame with a reference owned by the caller
+ */
+Frame *player_state_frame(Player *player);
+
+/**
+ * Build a lockstep frame (see MSG_TYPE_LOCKSTEP) for an event applied to the
+ * player's game: an event frame, or for PLAYER_EVENT_SNAPSHOT a snapshot
+ * frame. Must be called by the owner of the game.
+ * @return frame with a reference owned by the caller
+ */
+Frame *lockstep_frame(Player *player, int event, int arg, uint32_t tick);
+
+/**
+ * Build a hash frame for the player's game. Must be called by the owner of
+ * the game.
+ * @return frame with a reference owned by the caller
+ */
+Frame *lockstep_hash_frame(Player *player, uint32_t tick);
+
+/**
+ * Read a MSG_TYPE_INPUTS body, expanding repeated inputs and numbering them
+ * from seq
+ * @param after (optional) only keep inputs numbered after this one, so that
+ *        inputs that are sent again are only read once
+ * @param inputs filled with at most max inputs
+ * @return number of inputs read
+ */
+int input_records_read(char *body, int length, uint16_t seq,
+                       const uint16_t *after, Input *inputs, int max);
 
-int send_player(int socket_fd, Player *player);
+int send_player(MessageQueue *queue, Player *player);
 
 #endif
@@ -11,11 +11,9 @@
 static Player *offline_player;
 
 /**
- * Render function that draws the board using NCurses for a given player. The
- * fd argument exists for compatibility only (with the online code) and is not
- * used. After refactoring, it will likely be removed.
+ * Render function that draws the board using NCurses for a given player.
  */
-static int renderish(int fd, Player *player) {
+static int renderish(Player *player) {
 	generate_game_view_data(player->contents, &player->view);
 	render_game_view_data(player->name, player->view);
 	return EXIT_SUCCESS;
@@ -27,27 +25,27 @@ static void offline_translate(void *context, int x) {
 	} else {
 		translate_block_right(offline_player->contents);
 	}
-	renderish(0, offline_player);
+	renderish(offline_player);
 }
 
 static void offline_lower(void *context) {
 	lower_block(offline_player->contents, 0);
-	renderish(0, offline_player);
+	renderish(offline_player);
 }
 
 static void offline_rotate(void *context, int theta) {
 	rotate_block(offline_player->contents, theta);
-	renderish(0, offline_player);
+	renderish(offline_player);
 }
 
 static void offline_drop(void *context) {
 	hard_drop(offline_player->contents);
-	renderish(0, offline_player);
+	renderish(offline_player);
 }
 
 static void offline_swap_hold(void *context) {
 	swap_hold_block(offline_player->contents);
-	renderish(0, offline_player);
+	renderish(offline_player);
 }
 
 // define a control set for use offline
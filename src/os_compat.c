@@ -1,4 +1,9 @@
+// rand_s is only declared on request
+#define _CRT_RAND_S
+
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "os_compat.h"
@@ -7,6 +12,7 @@
 #include <winsock.h>
 #else
 #include <errno.h>
+#include <time.h>
 #endif
 
 void last_error_message_to_buffer(char *buffer, unsigned int max_length) {
@@ -23,4 +29,44 @@ void last_error_message_to_buffer(char *buffer, unsigned int max_length) {
 #endif
 	// ensure null termination
 	buffer[max_length - 1] = 0;
-}
\ No newline at end of file
+}
+
+int last_error_would_block(void) {
+#ifdef THIS_IS_WINDOWS
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+uint64_t monotonic_ms(void) {
+#ifdef THIS_IS_WINDOWS
+	return GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+int random_bytes(void *buffer, unsigned int length) {
+#ifdef THIS_IS_WINDOWS
+	unsigned int word;
+	for (unsigned int i = 0; i < length; i += sizeof(word)) {
+		if (rand_s(&word) != 0)
+			return EXIT_FAILURE;
+		memcpy((char *)buffer + i, &word,
+		       length - i < sizeof(word) ? length - i : sizeof(word));
+	}
+	return EXIT_SUCCESS;
+#else
+	FILE *urandom = fopen("/dev/urandom", "rb");
+	size_t n = 0;
+
+	if (urandom == NULL)
+		return EXIT_FAILURE;
+	n = fread(buffer, 1, length, urandom);
+	fclose(urandom);
+	return n == length ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
@@ -1,6 +1,8 @@
 #ifndef _OS_COMPAT_H
 #define _OS_COMPAT_H
 
+#include <stdint.h>
+
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #define THIS_IS_WINDOWS
 // A bad hack, since rand_r is thread safe, and rand is not.
@@ -15,4 +17,23 @@ typedef struct sockaddr_in SOCKADDR_IN;
 
 void last_error_message_to_buffer(char *buffer, unsigned int max_length);
 
+/**
+ * @return non-zero if the last socket call failed only because a non-blocking
+ *         socket was not ready
+ */
+int last_error_would_block(void);
+
+/**
+ * @return milliseconds on a clock that only moves forward, from an arbitrary
+ *         starting point
+ */
+uint64_t monotonic_ms(void);
+
+/**
+ * Fill a buffer with random bytes from the operating system, which are fit
+ * for secrets
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if none could be had
+ */
+int random_bytes(void *buffer, unsigned int length);
+
 #endif // _OS_COMPAT_H
@@ -1,22 +1,116 @@
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "list.h"
+#include "log.h"
 #include "party.h"
 #include "player.h"
+#include "simulation.h"
 
 struct ttetris_party {
+	/* must be first, so that the task can be turned back into the party */
+	SimTask task;
 	List *players;
+	/* frees the party once none of its members are left in it */
+	Timer reap_timer;
 };
 
+/**
+ * Apply the events queued for every member since the party last ran, then
+ * render each board that changed once. Runs on the worker that owns the
+ * party.
+ */
+static void ttetris_party_simulate(SimTask *task) {
+	struct ttetris_party *party = (struct ttetris_party *)task;
+
+	for (int i = 0; i < party->players->length; i++) {
+		Player *player = (Player *)list_get(party->players, i);
+		// a member who joined another party is simulated by that
+		// party's worker alone
+		if (__atomic_load_n(&player->party, __ATOMIC_ACQUIRE) != party)
+			continue;
+		if (!player_simulate(player))
+			continue;
+		player->state_version++;
+		player->render(player);
+	}
+}
+
+/**
+ * Free the party, along with any of its members that only it still holds
+ */
+static void ttetris_party_free(struct ttetris_party *party) {
+	for (int i = 0; i < party->players->length; i++) {
+		Player *player = (Player *)list_get(party->players, i);
+		// members who joined another party since are playing there
+		if (player->party == party) {
+			player_game_stop(player);
+			player->party = NULL;
+		}
+		player_release(player);
+	}
+	list_free(party->players);
+	free(party);
+}
+
+/**
+ * Free a party once all its members left. Runs on the game clock's thread, so
+ * no timed event of the members' games is being handed to the party; once no
+ * worker is simulating it either, nothing else can be using the party.
+ */
+static void ttetris_party_reap(Timer *timer, void *data) {
+	struct ttetris_party *party = (struct ttetris_party *)data;
+
+	if (__atomic_load_n(&party->task.state, __ATOMIC_ACQUIRE) !=
+	    SIM_TASK_IDLE) {
+		timer_wheel_schedule(player_game_clock(), timer,
+		                     PLAYER_TICK_MS);
+		return;
+	}
+	ttetris_party_free(party);
+}
+
 struct ttetris_party *ttetris_party_create() {
 	struct ttetris_party *party = calloc(sizeof(struct ttetris_party), 1);
 	party->players = list_create();
+	simulation_task_init(&party->task, ttetris_party_simulate);
+	timer_init(&party->reap_timer, ttetris_party_reap, party);
 	return party;
 };
 
+void ttetris_party_schedule(struct ttetris_party *party) {
+	simulation_schedule(&party->task);
+}
+
 void ttetris_party_player_add(struct ttetris_party *party, Player *player) {
+	player_ref(player);
 	list_append(party->players, player);
-	player->party = party;
+}
+
+void ttetris_party_publish(struct ttetris_party *party) {
+	for (int i = 0; i < party->players->length; i++) {
+		Player *player = (Player *)list_get(party->players, i);
+		TetrisParty *old_party = player->party;
+		player->party_slot = i;
+		__atomic_store_n(&player->party, party, __ATOMIC_RELEASE);
+		if (old_party && old_party != party)
+			ttetris_party_member_left(old_party);
+	}
+}
+
+void ttetris_party_destroy(struct ttetris_party *party) {
+	ttetris_party_free(party);
+}
+
+void ttetris_party_member_left(struct ttetris_party *party) {
+	for (int i = 0; i < party->players->length; i++) {
+		Player *player = (Player *)list_get(party->players, i);
+		if (player->fd != -1 && player->party == party)
+			return;
+	}
+	fprintf(logging_fp, "ttetris_party_member_left: every member left, "
+	                    "freeing the party\n");
+	timer_wheel_schedule(player_game_clock(), &party->reap_timer, 0);
 }
 
 List *ttetris_party_get_players(struct ttetris_party *party) {
@@ -29,5 +123,7 @@ void ttetris_party_start(struct ttetris_party *party) {
 	for (int i = 0; i < party->players->length; i++) {
 		player = (Player *)list_get(party->players, i);
 		player_game_start(player);
+		// the first snapshot lets members in lockstep start simulating
+		player_post(player, PLAYER_EVENT_SNAPSHOT, 0);
 	}
 }
@@ -19,8 +19,38 @@ TetrisParty *ttetris_party_create();
 // "player.h"
 typedef struct st_player Player;
 
+/**
+ * Add a player to a party that was not published yet. The party holds a
+ * reference to them until it is freed.
+ */
 void ttetris_party_player_add(TetrisParty *party, Player *player);
 
+/**
+ * Hand the party to its members, who leave any party they were in. Once it
+ * is published, the party may be simulated, and its members do not change
+ * any more.
+ */
+void ttetris_party_publish(TetrisParty *party);
+
+/**
+ * Free a party that was not published
+ */
+void ttetris_party_destroy(TetrisParty *party);
+
+/**
+ * Tell the party that one of its members disconnected or joined another
+ * party. Once no member is left in it, the party is freed, on the game
+ * clock's thread. Departed members keep their slots until then.
+ */
+void ttetris_party_member_left(TetrisParty *party);
+
+/**
+ * Make sure the party is simulated soon, after queueing an event for one of
+ * its members. Whichever worker next simulates the party applies every
+ * member's queued events.
+ */
+void ttetris_party_schedule(TetrisParty *party);
+
 /**
  * start the tetris game for all players in the party
  *
@@ -2,71 +2,485 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "event.h"
 #include "generic.h"
 #include "list.h"
 #include "log.h"
+#include "message.h"
 #include "player.h"
+#include "pool.h"
+#include "simulation.h"
 #include "tetris_game.h"
+#include "udp.h"
+
+// players are reused as they come and go, rather than allocated for each
+static Pool player_pool = POOL_INITIALIZER(struct st_player, 64);
 
 static struct st_list *player_list;
+// the registry is shared by every reactor thread
+static pthread_mutex_t player_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void player_init() { player_list = list_create(); }
-
-void *player_clock(void *input) {
-	struct st_player *player = (struct st_player *)input;
-	fprintf(logging_fp, "player_clock: thread started\n");
-	do {
-		nanosleep((const struct timespec[]){{0, 500000000L}}, NULL);
-		lower_block(player->contents, 1);
-
-		// if the player has a party, send the board to all players
-		if (player->party) {
-			List *party_members =
-			    ttetris_party_get_players(player->party);
-			for (int i = 0; i < party_members->length; i++)
-				if (player->render(
-				        ((Player *)list_get(party_members, i))
-				            ->fd,
-				        player) == EXIT_FAILURE)
-					((Player *)list_get(party_members, i))
-					    ->fd = -1;
-		}
-		// otherwise, just send the board to the player
-		else {
-			if (player->render(player->fd, player) == EXIT_FAILURE)
-				player->fd = -1;
-		}
+// connected players, indexed by the file descriptor of their connection
+static struct st_player **players_by_fd = NULL;
+static int players_by_fd_size = 0;
+
+// connected players by name, in an open-addressing hash table with linear
+// probing. The size is a power of two, and entries of players that were taken
+// out are left as PLAYER_REMOVED, so that probes carry on past them. Used
+// counts both players and removed entries.
+static struct st_player **players_by_name = NULL;
+static int players_by_name_size = 0;
+static int players_by_name_used = 0;
+static char player_removed;
+#define PLAYER_REMOVED ((struct st_player *)&player_removed)
+
+// a single clock drives the timed events of every game
+static TimerWheel *game_clock;
+static int idle_timeout_ms = 0;
+
+void player_init_manual_clock(void) {
+	player_list = list_create();
+	game_clock = timer_wheel_create(PLAYER_TICK_MS);
+}
+
+void player_init() {
+	player_init_manual_clock();
+	timer_wheel_start(game_clock);
+}
+
+void player_set_idle_timeout(int timeout_ms) { idle_timeout_ms = timeout_ms; }
+
+void player_set_tick_done(void (*fn)(void)) {
+	timer_wheel_set_batch_done(game_clock, fn);
+}
+
+TimerWheel *player_game_clock(void) { return game_clock; }
+
+/**
+ * lower the active block, or start the lock delay once it comes to rest
+ */
+static int player_gravity(struct st_player *player) {
+	int changed =
+	    player_apply_event(player->contents, PLAYER_EVENT_GRAVITY, 0);
+
+	if (!changed && !timer_pending(&player->lock_timer)) {
+		timer_wheel_schedule(game_clock, &player->lock_timer,
+		                     PLAYER_LOCK_DELAY_MS);
+	}
+
+	if (game_over(player->contents) == 0)
+		timer_wheel_schedule(game_clock, &player->gravity_timer,
+		                     PLAYER_GRAVITY_MS);
+	else
+		player_game_stop(player);
+	return changed;
+}
 
-	} while (game_over(player->contents) == 0);
-	fprintf(logging_fp, "player_clock: thread exiting\n");
+/**
+ * place the block if it is still resting once the lock delay is over. If the
+ * player moved it off the stack in the meantime, gravity takes over again.
+ */
+static int player_lock(struct st_player *player) {
+	if (!player_apply_event(player->contents, PLAYER_EVENT_LOCK, 0))
+		return 0;
+
+	if (game_over(player->contents))
+		player_game_stop(player);
+	return 1;
+}
+
+/**
+ * stop the game of a player that has gone quiet
+ */
+static int player_idle(struct st_player *player) {
+	uint64_t idle_ms =
+	    timer_wheel_now_ms(game_clock) - player->last_input_ms;
+
+	// rather than rescheduling on every input, check when the timer
+	// expires whether there has been input since
+	if (idle_ms < (uint64_t)idle_timeout_ms) {
+		timer_wheel_schedule(game_clock, &player->idle_timer,
+		                     idle_timeout_ms - idle_ms);
+		return 0;
+	}
+	fprintf(logging_fp, "player_idle: stopping the game of idle player "
+	                    "'%s'\n",
+	        player->name);
+	player_game_stop(player);
 	return 0;
 }
 
+int player_apply_event(struct game_contents *contents,
+                       enum player_event event, int arg) {
+	switch (event) {
+	case PLAYER_EVENT_ROTATE:
+		rotate_block(contents, arg);
+		return 1;
+	case PLAYER_EVENT_TRANSLATE:
+		if (arg)
+			translate_block_left(contents);
+		else
+			translate_block_right(contents);
+		return 1;
+	case PLAYER_EVENT_LOWER:
+		lower_block(contents, 0);
+		return 1;
+	case PLAYER_EVENT_DROP:
+		hard_drop(contents);
+		return 1;
+	case PLAYER_EVENT_SWAP_HOLD:
+		swap_hold_block(contents);
+		return 1;
+	case PLAYER_EVENT_GRAVITY:
+		if (!block_can_lower(contents))
+			return 0;
+		lower_block(contents, 1);
+		return 1;
+	case PLAYER_EVENT_LOCK:
+		if (block_can_lower(contents))
+			return 0;
+		lower_block(contents, 0);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * apply a single event to the player's game, and relay it to anyone who
+ * simulates the game themselves
+ */
+static int player_apply(struct st_player *player, Input *input) {
+	int changed;
+
+	// a player has no game until it starts, and none once they left
+	if (__atomic_load_n(&player->contents, __ATOMIC_ACQUIRE) == NULL ||
+	    player->fd == -1)
+		return 0;
+
+	switch (input->event) {
+	case PLAYER_EVENT_RENDER:
+		return 1;
+	case PLAYER_EVENT_GRAVITY:
+		changed = player_gravity(player);
+		break;
+	case PLAYER_EVENT_LOCK:
+		changed = player_lock(player);
+		break;
+	case PLAYER_EVENT_IDLE:
+		return player_idle(player);
+	case PLAYER_EVENT_SNAPSHOT:
+		changed = 0;
+		break;
+	default:
+		// every other event is an input
+		changed = player_apply_event(player->contents, input->event,
+		                             input->arg);
+		player->last_input_ms = input->timestamp_ms;
+		if (input->client_tick)
+			player->last_client_tick = input->client_tick;
+		if (input->seq)
+			player->input_seq = input->seq;
+	}
+
+	// Events that left the game alone are relayed too: they leave the
+	// relayed copies alone just the same, and gravity marks a regular
+	// point at which to compare the copies.
+	if (player->relay)
+		player->relay(player, input->event, input->arg,
+		              input->timestamp_ms / PLAYER_TICK_MS);
+	return changed;
+}
+
+int player_simulate(struct st_player *player) {
+	Input input;
+	int changed = 0;
+	uint64_t now_ms = timer_wheel_now_ms(game_clock);
+
+	int pending =
+	    __atomic_exchange_n(&player->pending_events, 0, __ATOMIC_ACQ_REL);
+
+	// a snapshot shows the game as it was before this run, so that the
+	// events applied below can follow it
+	if (pending & (1 << PLAYER_EVENT_SNAPSHOT)) {
+		input = (Input){PLAYER_EVENT_SNAPSHOT, 0, 0, 0, now_ms};
+		player_apply(player, &input);
+	}
+
+	// Only take the inputs that were queued when we started, so that a
+	// player who keeps sending cannot hold on to the worker. The rest is
+	// applied the next time the party runs.
+	for (int i = 0; i < INPUT_RING_SIZE; i++) {
+		if (input_ring_pop(&player->inputs, &input) != EXIT_SUCCESS)
+			break;
+		changed |= player_apply(player, &input);
+	}
+
+	// timed events come after the inputs, which were all received before
+	// the events fired
+	for (int event = PLAYER_EVENT_RENDER; event <= PLAYER_EVENT_IDLE;
+	     event++) {
+		if (!(pending & (1 << event)))
+			continue;
+		input = (Input){event, 0, 0, 0, now_ms};
+		changed |= player_apply(player, &input);
+	}
+
+	return changed;
+}
+
+int player_post_inputs(struct st_player *player, Input *inputs, int n) {
+	uint64_t now_ms = timer_wheel_now_ms(game_clock);
+	int changed = 0;
+
+	for (int i = 0; i < n; i++)
+		inputs[i].timestamp_ms = now_ms;
+
+	// a party's games are only changed by the worker simulating it
+	if (player->party && simulation_running()) {
+		for (int i = 0; i < n; i++) {
+			// rather than block the reader, drop inputs from a
+			// player that is far ahead of the game
+			if (input_ring_push(&player->inputs, &inputs[i]) !=
+			    EXIT_SUCCESS) {
+				fprintf(logging_fp,
+				        "player_post_inputs: dropped %d "
+				        "inputs from '%s'\n",
+				        n - i, player->name);
+				n = i;
+				break;
+			}
+		}
+		ttetris_party_schedule(player->party);
+		return n;
+	}
+	for (int i = 0; i < n; i++)
+		changed |= player_apply(player, &inputs[i]);
+	if (changed) {
+		player->state_version++;
+		player->render(player);
+	}
+	return n;
+}
+
+void player_post_input(struct st_player *player, enum player_event event,
+                       int arg, uint16_t seq) {
+	Input input = {event, arg, seq, 0, 0};
+	player_post_inputs(player, &input, 1);
+}
+
+void player_post(struct st_player *player, enum player_event event, int arg) {
+	if (event >= PLAYER_EVENT_ROTATE && event <= PLAYER_EVENT_SWAP_HOLD) {
+		player_post_input(player, event, arg, 0);
+		return;
+	}
+
+	if (player->party && simulation_running()) {
+		__atomic_fetch_or(&player->pending_events, 1 << event,
+		                  __ATOMIC_RELEASE);
+		ttetris_party_schedule(player->party);
+		return;
+	}
+	Input input = {event, arg, 0, 0, timer_wheel_now_ms(game_clock)};
+	if (player_apply(player, &input)) {
+		player->state_version++;
+		player->render(player);
+	}
+}
+
+static void player_gravity_timer(Timer *timer, void *data) {
+	player_post((struct st_player *)data, PLAYER_EVENT_GRAVITY, 0);
+}
+
+static void player_lock_timer(Timer *timer, void *data) {
+	player_post((struct st_player *)data, PLAYER_EVENT_LOCK, 0);
+}
+
+static void player_idle_timer(Timer *timer, void *data) {
+	player_post((struct st_player *)data, PLAYER_EVENT_IDLE, 0);
+}
+
+/**
+ * free a player once nothing can be using them any more
+ */
+static void player_free(struct st_player *player) {
+	ttetris_event_destroy(player->game_start_event);
+	frame_unref(player->board_frame);
+	pthread_mutex_destroy(&player->board_frame_lock);
+	udp_peer_destroy(player->udp);
+	destroy_game(&player->contents);
+	destroy_game_view_data(&player->view);
+	free(player->name);
+	pool_free(&player_pool, player);
+}
+
 void player_game_start(struct st_player *player) {
-	pthread_create(&player->game_clk_thread, NULL, player_clock,
-	               (void *)player);
+	// the worker simulating the party may already be looking for the
+	// game, so it is only handed over once it is whole
+	if (player->contents == NULL) {
+		struct game_contents *contents = NULL;
+		new_game(&contents);
+		__atomic_store_n(&player->contents, contents, __ATOMIC_RELEASE);
+	}
+	player->last_input_ms = timer_wheel_now_ms(game_clock);
+	timer_wheel_schedule(game_clock, &player->gravity_timer,
+	                     PLAYER_GRAVITY_MS);
+	if (idle_timeout_ms > 0)
+		timer_wheel_schedule(game_clock, &player->idle_timer,
+		                     idle_timeout_ms);
 }
 
 void player_game_stop(struct st_player *player) {
-	pthread_cancel(player->game_clk_thread);
+	timer_wheel_cancel(game_clock, &player->gravity_timer);
+	timer_wheel_cancel(game_clock, &player->lock_timer);
+	timer_wheel_cancel(game_clock, &player->idle_timer);
 }
 
-struct st_player *get_player_from_fd(int fd) {
+/**
+ * FNV-1a hash of a name, like hash_game_state
+ */
+static unsigned int hash_name(const char *name) {
+	unsigned int hash = 2166136261u;
+
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Find where a name is in the name table, or where it would go
+ * @return the index of the player with the name, or of the first empty or
+ *         removed entry on the way to where they would be
+ */
+static int name_index(const char *name) {
+	unsigned int mask = players_by_name_size - 1;
+	int free_index = -1;
+
+	for (unsigned int i = hash_name(name) & mask;; i = (i + 1) & mask) {
+		struct st_player *player = players_by_name[i];
+		if (player == NULL)
+			return free_index >= 0 ? free_index : (int)i;
+		if (player == PLAYER_REMOVED) {
+			if (free_index < 0)
+				free_index = i;
+		} else if (strcmp(player->name, name) == 0) {
+			return i;
+		}
+	}
+}
+
+/**
+ * Size the name table for one more player, keeping at least a quarter of the
+ * entries empty so that probes stay short. Must hold player_list_lock.
+ */
+static void name_table_reserve(void) {
+	struct st_player **old = players_by_name;
+	int old_size = players_by_name_size;
+	int live = 0;
+
+	if ((players_by_name_used + 1) * 4 <= players_by_name_size * 3)
+		return;
+	for (int i = 0; i < old_size; i++)
+		if (old[i] != NULL && old[i] != PLAYER_REMOVED)
+			live++;
+	// only grow if the players, rather than removed entries, fill it
+	players_by_name_size = old_size ? old_size : 64;
+	while ((live + 1) * 2 > players_by_name_size)
+		players_by_name_size *= 2;
+	players_by_name = calloc(players_by_name_size, sizeof(*old));
+	players_by_name_used = live;
+	for (int i = 0; i < old_size; i++)
+		if (old[i] != NULL && old[i] != PLAYER_REMOVED)
+			players_by_name[name_index(old[i]->name)] = old[i];
+	free(old);
+}
+
+/**
+ * Find a connected player by name. Must hold player_list_lock.
+ */
+static struct st_player *registry_find_name(const char *name) {
 	struct st_player *player;
-	for (int i = 0; i < player_list->length; i++) {
-		player = (struct st_player *)list_get(player_list, i);
-		if (player->fd == fd)
-			return player;
+
+	if (players_by_name_size == 0)
+		return NULL;
+	player = players_by_name[name_index(name)];
+	return player == PLAYER_REMOVED ? NULL : player;
+}
+
+/**
+ * Add a player to the registry, in place of any player registered on the same
+ * connection. A name that another connected player holds stays theirs. Must
+ * hold player_list_lock.
+ */
+static void registry_add(struct st_player *player) {
+	if (player->fd >= players_by_fd_size) {
+		int size = players_by_fd_size ? players_by_fd_size : 64;
+		while (player->fd >= size)
+			size *= 2;
+		players_by_fd =
+		    realloc(players_by_fd, size * sizeof(*players_by_fd));
+		memset(players_by_fd + players_by_fd_size, 0,
+		       (size - players_by_fd_size) * sizeof(*players_by_fd));
+		players_by_fd_size = size;
 	}
-	return 0;
+	if (player->fd >= 0)
+		players_by_fd[player->fd] = player;
+
+	name_table_reserve();
+	int i = name_index(player->name);
+	if (players_by_name[i] == NULL)
+		players_by_name_used++;
+	else if (players_by_name[i] != PLAYER_REMOVED)
+		return;
+	players_by_name[i] = player;
+}
+
+/**
+ * Take a player out of the registry, unless another player took their place.
+ * Must hold player_list_lock.
+ */
+static void registry_remove(struct st_player *player) {
+	if (player->fd >= 0 && player->fd < players_by_fd_size &&
+	    players_by_fd[player->fd] == player)
+		players_by_fd[player->fd] = NULL;
+
+	if (players_by_name_size == 0)
+		return;
+	int i = name_index(player->name);
+	if (players_by_name[i] == player)
+		players_by_name[i] = PLAYER_REMOVED;
+}
+
+struct st_player *get_player_from_fd(int fd) {
+	struct st_player *player = NULL;
+
+	pthread_mutex_lock(&player_list_lock);
+	if (fd >= 0 && fd < players_by_fd_size)
+		player = players_by_fd[fd];
+	// a player is only taken out of the registry while holding the lock,
+	// so they cannot be freed before the reference is taken
+	if (player)
+		player_ref(player);
+	pthread_mutex_unlock(&player_list_lock);
+	return player;
+}
+
+void player_set_fd(struct st_player *player, int fd) {
+	pthread_mutex_lock(&player_list_lock);
+	registry_remove(player);
+	player->fd = fd;
+	if (fd != -1)
+		registry_add(player);
+	pthread_mutex_unlock(&player_list_lock);
 }
 
 StringArray *player_names(int exclude_in_game) {
 	int player_index, name_array_index;
 
+	pthread_mutex_lock(&player_list_lock);
 	StringArray *arr =
 	    string_array_create(player_list->length, PLAYER_NAME_MAX_CHARS);
 
@@ -83,6 +497,7 @@ StringArray *player_names(int exclude_in_game) {
 			continue;
 		string_array_set_item(arr, name_array_index++, player->name);
 	}
+	pthread_mutex_unlock(&player_list_lock);
 
 	// downsize the string array
 	string_array_resize(arr, name_array_index);
@@ -90,44 +505,107 @@ StringArray *player_names(int exclude_in_game) {
 	return arr;
 }
 
-/**
- * Get a player by name
- *
- * WARNING: this is a comparitively expensive operation.
- */
 Player *player_get_by_name(char *name) {
 	struct st_player *player;
-	for (int i = 0; i < player_list->length; i++) {
-		player = (struct st_player *)list_get(player_list, i);
+
+	pthread_mutex_lock(&player_list_lock);
+	player = registry_find_name(name);
+	if (player)
+		player_ref(player);
+	pthread_mutex_unlock(&player_list_lock);
+	if (player == NULL)
 		fprintf(logging_fp,
-		        "player_get_by_name: Checking player '%s'\n",
-		        player->name);
-		if (strcmp(player->name, name) == 0)
-			return player;
-	}
-	fprintf(logging_fp, "player_get_by_name: No player found for '%s'\n",
-	        name);
-	return NULL;
+		        "player_get_by_name: No player found for '%s'\n",
+		        name);
+	return player;
 }
 
 struct st_player *player_create(int fd, char *name) {
-	struct st_player *player = malloc(sizeof(struct st_player));
+	struct st_player *player = pool_alloc(&player_pool);
 	player->fd = fd;
 	player->name = malloc(strlen(name) + 1);
 	memcpy(player->name, name, strlen(name) + 1);
 	player->game_start_event = ttetris_event_create();
 	player->party = NULL;
-	/* contents will be initialized by new_game */
+	player->state_version = 0;
+	player->board_frame = NULL;
+	player->board_frame_version = 0;
+	pthread_mutex_init(&player->board_frame_lock, NULL);
+	timer_init(&player->gravity_timer, player_gravity_timer, player);
+	timer_init(&player->lock_timer, player_lock_timer, player);
+	timer_init(&player->idle_timer, player_idle_timer, player);
+	player->last_input_ms = 0;
+	memset(&player->inputs, 0, sizeof(InputRing));
+	player->pending_events = 0;
+	player->input_seq = 0;
+	player->last_client_tick = 0;
+	player->predicts = 0;
+	player->lockstep = 0;
+	player->party_slot = 0;
+	player->udp = NULL;
+	player->relay = NULL;
+	/* contents and view are only allocated once there is a game */
 	player->contents = NULL;
-	player->view = malloc(sizeof(struct game_view_data));
+	player->view = NULL;
+	player->refs = 1;
+	pthread_mutex_lock(&player_list_lock);
+	// a name belongs to a single connected player, so that looking it up
+	// finds the player who chose it
+	if (registry_find_name(name) != NULL) {
+		pthread_mutex_unlock(&player_list_lock);
+		fprintf(logging_fp,
+		        "player_create: The name '%s' is already taken\n",
+		        name);
+		player_free(player);
+		return NULL;
+	}
+	player->list_index = player_list->length;
 	list_append(player_list, player);
+	registry_add(player);
+	int count = player_list->length;
+	pthread_mutex_unlock(&player_list_lock);
 	fprintf(logging_fp, "player_create: Created player '%s'\n",
 	        player->name);
-	player_get_by_name(player->name);
 	fprintf(logging_fp, "player_create: There are now %d players\n",
-	        player_list->length);
-
-	new_game(&player->contents);
+	        count);
 
 	return player;
 }
+
+void player_ref(struct st_player *player) {
+	__sync_add_and_fetch(&player->refs, 1);
+}
+
+void player_release(struct st_player *player) {
+	if (__sync_sub_and_fetch(&player->refs, 1) > 0)
+		return;
+	// a game only runs while a party holds a reference, and the party's
+	// reaper stops it on the game clock's thread before letting go, so no
+	// timed event can still be running
+	player_free(player);
+}
+
+void player_disconnect(struct st_player *player) {
+	struct st_player *moved;
+	TetrisParty *party = player->party;
+
+	player_game_stop(player);
+
+	pthread_mutex_lock(&player_list_lock);
+	registry_remove(player);
+	__atomic_store_n(&player->fd, -1, __ATOMIC_RELEASE);
+	// the last player takes the place of the one leaving
+	list_swap_remove(player_list, player->list_index);
+	moved = list_get(player_list, player->list_index);
+	if (moved)
+		moved->list_index = player->list_index;
+	int count = player_list->length;
+	pthread_mutex_unlock(&player_list_lock);
+	fprintf(logging_fp, "player_disconnect: '%s' left, there are now %d "
+	                    "players\n",
+	        player->name, count);
+
+	if (party)
+		ttetris_party_member_left(party);
+	player_release(player);
+}
@@ -5,18 +5,55 @@
 
 #include "event.h"
 #include "generic.h"
+#include "input_ring.h"
 #include "party.h"
 #include "tetris_game.h"
+#include "timer_wheel.h"
 
 // does not count the zero-byte / null-terminator
 #define PLAYER_NAME_MAX_CHARS 15
 
+// resolution of the game clock
+#define PLAYER_TICK_MS 10
+// interval at which gravity lowers the active block
+#define PLAYER_GRAVITY_MS 500
+// how long a block may rest on the stack before it is placed
+#define PLAYER_LOCK_DELAY_MS 1000
+
 // forward-definition of TetrisParty so that we can do a circular import with
 // "party.h"
 typedef struct ttetris_party TetrisParty;
 
+// forward-definition of Frame so that we can do a circular import with
+// "message.h"
+typedef struct ttetris_frame Frame;
+
+// forward-definition of UdpPeer, which is only used by the server (see udp.h)
+typedef struct ttetris_udp_peer UdpPeer;
+
 typedef struct st_player Player;
 
+/**
+ * Anything that changes a player's game: an input from the player, or a timed
+ * game event
+ */
+enum player_event {
+	/* no change, but the board should be sent again */
+	PLAYER_EVENT_RENDER,
+	/* inputs, whose argument is the direction where it has one */
+	PLAYER_EVENT_ROTATE,
+	PLAYER_EVENT_TRANSLATE,
+	PLAYER_EVENT_LOWER,
+	PLAYER_EVENT_DROP,
+	PLAYER_EVENT_SWAP_HOLD,
+	/* timed events */
+	PLAYER_EVENT_GRAVITY,
+	PLAYER_EVENT_LOCK,
+	PLAYER_EVENT_IDLE,
+	/* no change, but the game's state should be relayed in full */
+	PLAYER_EVENT_SNAPSHOT,
+};
+
 struct st_player {
 	char *name;
 	/* (optional) party */
@@ -25,28 +62,186 @@ struct st_player {
 	TetrisEvent *game_start_event;
 	/* the current file descriptor */
 	int fd;
-	/* reference to the player's rendered board */
+	/* (optional) reference to the player's rendered board, allocated when
+	 * it is first rendered */
 	struct game_view_data *view;
-	/* player's game contents*/
+	/* (optional) player's game contents, allocated when their first game
+	 * starts */
 	struct game_contents *contents;
-	/* the player's clock thread */
-	pthread_t game_clk_thread;
-	/* render function */
-	int (*render)(int socket_fd, struct st_player *);
+	/* incremented every time the game contents change */
+	unsigned int state_version;
+	/* (optional) cached board frame, and the state version it shows,
+	 * guarded by board_frame_lock */
+	Frame *board_frame;
+	unsigned int board_frame_version;
+	pthread_mutex_t board_frame_lock;
+	/* timed game events, driven by the shared game clock */
+	Timer gravity_timer;
+	Timer lock_timer;
+	Timer idle_timer;
+	/* game clock time (ms) of the player's last input */
+	uint64_t last_input_ms;
+	/* client's clock (in game clock ticks) at the player's last input, if
+	 * the client sent it, for replaying inputs with the timing they were
+	 * made with */
+	uint32_t last_client_tick;
+	/* inputs waiting for the owner of the game. Only the thread reading
+	 * the player's connection pushes to it. */
+	InputRing inputs;
+	/* bit mask (1 << enum player_event) of the other events waiting for
+	 * the owner of the game, changed atomically */
+	int pending_events;
+	/* sequence number of the last input applied to the game */
+	uint16_t input_seq;
+	/* non-zero if the player's client predicts its own game, and wants
+	 * the game's state rather than its board */
+	char predicts;
+	/* non-zero if the player's client simulates every game in the party
+	 * from relayed events, rather than receiving boards */
+	char lockstep;
+	/* position of the player in their party */
+	int party_slot;
+	/* (optional) the player's datagram transport. Once it is set, the
+	 * player's inputs are only taken from datagrams, so that the input
+	 * ring keeps a single producer. */
+	UdpPeer *udp;
+	/* render function, called after every game tick. Online, this sends the
+	 * board to every party member. */
+	int (*render)(struct st_player *);
+	/* references held by the player's connection, every party the
+	 * player is a member of, and whoever looked the player up, changed
+	 * atomically */
+	int refs;
+	/* position of the player in the list of connected players */
+	int list_index;
+	/* (optional) called by the owner of the game for every event applied
+	 * to it other than renders and idle checks, with the game clock tick
+	 * at which the event happened */
+	void (*relay)(struct st_player *, enum player_event event, int arg,
+	              uint32_t tick);
 };
 
 void player_init();
 
+/**
+ * Like player_init, but without a thread for the game clock. The caller
+ * advances the clock instead (see player_game_clock and timer_wheel_open_fd),
+ * so that timed events and the renders they cause happen on its thread.
+ */
+void player_init_manual_clock(void);
+
+/**
+ * Stop a player's game once they have sent no input for timeout_ms. Zero (the
+ * default) disables the timeout.
+ */
+void player_set_idle_timeout(int timeout_ms);
+
+/**
+ * Call fn after every game clock tick in which any game changed, so that the
+ * boards rendered during the tick can be sent out together
+ */
+void player_set_tick_done(void (*fn)(void));
+
+/**
+ * @return the clock that drives every game, for scheduling other periodic
+ *         work
+ */
+TimerWheel *player_game_clock(void);
+
+/**
+ * Apply the change an event makes to a game: an input, or a move by gravity
+ * or the lock delay. Shared by the owner of the game and by clients that
+ * predict or simulate it, so that all of them move the blocks the same way.
+ * @return non-zero if the event changed the game
+ */
+int player_apply_event(struct game_contents *contents, enum player_event event,
+                       int arg);
+
+/**
+ * Apply the inputs queued for the player in the order they arrived, followed
+ * by any pending timed events. Must only be called by the thread that owns
+ * the game: the worker simulating the player's party.
+ * @return non-zero if the board changed and should be rendered
+ */
+int player_simulate(struct st_player *player);
+
+/**
+ * Hand an event to whoever owns the player's game. The inputs of a player in
+ * a party are pushed onto the player's input ring, and other events are
+ * flagged as pending, for the worker simulating the party; otherwise the
+ * event is applied and rendered right away.
+ */
+void player_post(struct st_player *player, enum player_event event, int arg);
+
+/**
+ * Like player_post, for an input that the client numbered so that it can
+ * tell when the input has been applied (see Player.input_seq)
+ */
+void player_post_input(struct st_player *player, enum player_event event,
+                       int arg, uint16_t seq);
+
+/**
+ * Hand a batch of inputs to whoever owns the player's game, at once. The
+ * inputs are stamped with the time they were received.
+ * @return number of inputs handed over, which is less than n if the player's
+ *         input ring filled up
+ */
+int player_post_inputs(struct st_player *player, Input *inputs, int n);
+
+/**
+ * Find the player connected on a file descriptor
+ * @return a reference to the player, to be given up with player_release, or
+ *         NULL if nobody is connected on it
+ */
 struct st_player *get_player_from_fd(int fd);
 
+/**
+ * Move a player to another connection, or to -1 once they disconnected, which
+ * means they can no longer be found by fd or by name
+ */
+void player_set_fd(struct st_player *player, int fd);
+
+/**
+ * Create a player for a connection. The player has no game until
+ * player_game_start. The reference returned belongs to the connection, and is
+ * given up by player_disconnect.
+ * @return the player, or NULL if another connected player has the name
+ */
 struct st_player *player_create(int fd, char *name);
 
+/**
+ * Take another reference to the player, for example for a party they joined
+ */
+void player_ref(struct st_player *player);
+
+/**
+ * Give up a reference to the player, and free the player once the last one is
+ * given up. Their game must have been stopped.
+ */
+void player_release(struct st_player *player);
+
+/**
+ * Tear the player down once their connection closed: stop their game, take
+ * them out of the registry and out of the list of players, and give up the
+ * connection's reference. A member of a party stays in it, so that the slots
+ * of the other members do not change, until the party is freed.
+ */
+void player_disconnect(struct st_player *player);
+
 StringArray *player_names(int exclude_in_game);
 
+/**
+ * Start the player's game, creating it if this is their first
+ */
 void player_game_start(struct st_player *player);
 
 void player_game_stop(struct st_player *player);
 
+/**
+ * Find a connected player by name
+ * @return a reference to the player, to be given up with player_release, or
+ *         NULL if nobody connected has the name
+ */
 Player *player_get_by_name(char *name);
 
 #endif
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+// objects are this far apart in a slab, so that each of them is aligned for
+// any type, and can hold the free list's pointer
+#define POOL_ALIGN 16
+
+static size_t pool_stride(Pool *pool) {
+	return (pool->object_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+void *pool_alloc(Pool *pool) {
+	void *object;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->free_list) {
+		object = pool->free_list;
+		pool->free_list = *(void **)object;
+	} else {
+		if (pool->slab_left == 0) {
+			pool->slab_next =
+			    malloc(pool_stride(pool) * pool->slab_objects);
+			pool->slab_left = pool->slab_objects;
+			pool->capacity += pool->slab_objects;
+		}
+		object = pool->slab_next;
+		pool->slab_next += pool_stride(pool);
+		pool->slab_left--;
+	}
+	pool->in_use++;
+	pthread_mutex_unlock(&pool->lock);
+
+	memset(object, 0, pool->object_size);
+	return object;
+}
+
+void pool_free(Pool *pool, void *object) {
+	if (object == NULL)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	*(void **)object = pool->free_list;
+	pool->free_list = object;
+	pool->in_use--;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_in_use(Pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	int in_use = pool->in_use;
+	pthread_mutex_unlock(&pool->lock);
+	return in_use;
+}
+
+int pool_capacity(Pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	int capacity = pool->capacity;
+	pthread_mutex_unlock(&pool->lock);
+	return capacity;
+}
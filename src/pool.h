@@ -0,0 +1,61 @@
+/**
+ * Slab allocator for objects of a single size.
+ *
+ * Objects are carved out of slabs of slab_objects at a time, and a freed
+ * object goes on a free list to be handed out again by the next allocation.
+ * Slabs are never given back, so the memory a pool holds is that of the most
+ * objects that were ever in use at once, however many come and go. A pool may
+ * be used from any thread.
+ */
+#ifndef TTETRIS_POOL_H
+#define TTETRIS_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct ttetris_pool Pool;
+
+struct ttetris_pool {
+	size_t object_size;
+	int slab_objects;
+	/* objects that were freed, each holding a pointer to the next */
+	void *free_list;
+	/* the objects of the newest slab that were not handed out yet */
+	char *slab_next;
+	int slab_left;
+	/* number of objects handed out, and carved out of slabs */
+	int in_use;
+	int capacity;
+	pthread_mutex_t lock;
+};
+
+/**
+ * Static initializer for a pool of objects of the given type, for example
+ *     static Pool player_pool = POOL_INITIALIZER(struct st_player, 64);
+ */
+#define POOL_INITIALIZER(type, per_slab)                                       \
+	{ sizeof(type), (per_slab), NULL, NULL, 0, 0, 0,                       \
+	  PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * Take an object from the pool, carving out a new slab if none are free
+ * @return the object, zeroed like by calloc
+ */
+void *pool_alloc(Pool *pool);
+
+/**
+ * Give an object back to the pool. Does nothing for NULL.
+ */
+void pool_free(Pool *pool, void *object);
+
+/**
+ * @return the number of objects handed out and not yet given back
+ */
+int pool_in_use(Pool *pool);
+
+/**
+ * @return the number of objects the pool's slabs hold, whether in use or not
+ */
+int pool_capacity(Pool *pool);
+
+#endif // TTETRIS_POOL_H
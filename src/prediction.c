@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "prediction.h"
+
+Prediction *prediction_create(void) {
+	Prediction *prediction = calloc(sizeof(Prediction), 1);
+	prediction->next_seq = 1;
+	pthread_mutex_init(&prediction->lock, NULL);
+	return prediction;
+}
+
+void prediction_destroy(Prediction *prediction) {
+	destroy_game(&prediction->contents);
+	destroy_game(&prediction->replay);
+	pthread_mutex_destroy(&prediction->lock);
+	free(prediction);
+}
+
+uint16_t prediction_input(Prediction *prediction, enum player_event event,
+                          int arg) {
+	pthread_mutex_lock(&prediction->lock);
+
+	uint16_t seq = prediction->next_seq++;
+	// 0 means that an input is not numbered
+	if (prediction->next_seq == 0)
+		prediction->next_seq = 1;
+
+	if (prediction->pending_length == PREDICTION_MAX_PENDING) {
+		prediction->pending_length--;
+		memmove(prediction->pending, prediction->pending + 1,
+		        sizeof(struct predicted_input) *
+		            prediction->pending_length);
+	}
+	prediction->pending[prediction->pending_length++] =
+	    (struct predicted_input){seq, event, arg};
+
+	if (prediction->contents)
+		player_apply_event(prediction->contents, event, arg);
+
+	pthread_mutex_unlock(&prediction->lock);
+	return seq;
+}
+
+int prediction_reconcile(Prediction *prediction, uint16_t ack,
+                         struct game_state *state) {
+	struct game_state predicted, replayed;
+	int i, acked;
+
+	pthread_mutex_lock(&prediction->lock);
+
+	if (load_game_state(&prediction->replay, state)) {
+		pthread_mutex_unlock(&prediction->lock);
+		fprintf(logging_fp, "prediction_reconcile: invalid state\n");
+		return -1;
+	}
+
+	// forget the inputs that the state already includes. Sequence numbers
+	// wrap around, so compare their distance rather than their values.
+	for (acked = 0; acked < prediction->pending_length; acked++)
+		if ((int16_t)(prediction->pending[acked].seq - ack) > 0)
+			break;
+	prediction->pending_length -= acked;
+	memmove(prediction->pending, prediction->pending + acked,
+	        sizeof(struct predicted_input) * prediction->pending_length);
+
+	for (i = 0; i < prediction->pending_length; i++)
+		player_apply_event(prediction->replay,
+		                   prediction->pending[i].event,
+		                   prediction->pending[i].arg);
+
+	// the first state has nothing to compare against
+	int rolled_back = 1;
+	if (prediction->contents) {
+		save_game_state(prediction->contents, &predicted);
+		save_game_state(prediction->replay, &replayed);
+		rolled_back =
+		    memcmp(&predicted, &replayed, sizeof(predicted)) != 0;
+		prediction->rollbacks += rolled_back;
+	}
+	if (rolled_back) {
+		struct game_contents *wrong = prediction->contents;
+		prediction->contents = prediction->replay;
+		prediction->replay = wrong;
+	}
+
+	pthread_mutex_unlock(&prediction->lock);
+	return rolled_back;
+}
+
+int prediction_view(Prediction *prediction, struct game_view_data **view) {
+	int ret = EXIT_FAILURE;
+
+	pthread_mutex_lock(&prediction->lock);
+	if (prediction->contents) {
+		generate_game_view_data(prediction->contents, view);
+		ret = EXIT_SUCCESS;
+	}
+	pthread_mutex_unlock(&prediction->lock);
+	return ret;
+}
@@ -0,0 +1,81 @@
+/**
+ * Client-side prediction of the player's own game.
+ *
+ * The client runs its own copy of the engine and applies every input as soon
+ * as it is made, instead of waiting a round trip for the server's board. Each
+ * input is numbered, and kept until the server acknowledges it.
+ *
+ * The server answers with the authoritative state of the game, along with the
+ * number of the last input it applied. The client replays the inputs that
+ * are still unacknowledged on top of that state. If the result differs from
+ * what the client predicted (for example because gravity moved the block in
+ * the meantime) the prediction is rolled back to the replayed game.
+ */
+#ifndef TTETRIS_PREDICTION_H
+#define TTETRIS_PREDICTION_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "player.h"
+#include "tetris_game.h"
+
+// maximum number of unacknowledged inputs that are kept for replaying. If the
+// server falls further behind than this, the oldest inputs are forgotten and
+// the prediction is corrected once the server catches up.
+#define PREDICTION_MAX_PENDING 256
+
+struct predicted_input {
+	uint16_t seq;
+	/* enum player_event */
+	uint8_t event;
+	int8_t arg;
+};
+
+typedef struct ttetris_prediction Prediction;
+
+struct ttetris_prediction {
+	/* the predicted game, or NULL until the first state arrives */
+	struct game_contents *contents;
+	/* the last authoritative state, with pending inputs replayed */
+	struct game_contents *replay;
+	/* inputs sent to the server but not acknowledged yet, oldest first */
+	struct predicted_input pending[PREDICTION_MAX_PENDING];
+	int pending_length;
+	/* sequence number of the next input, never 0 */
+	uint16_t next_seq;
+	/* number of times the prediction had to be rolled back */
+	long rollbacks;
+	/* inputs are made on the keyboard thread, while states arrive on the
+	 * thread listening to the server */
+	pthread_mutex_t lock;
+};
+
+Prediction *prediction_create(void);
+
+void prediction_destroy(Prediction *prediction);
+
+/**
+ * Apply an input to the predicted game, and remember it until the server
+ * acknowledges it
+ * @return sequence number to send the input with
+ */
+uint16_t prediction_input(Prediction *prediction, enum player_event event,
+                          int arg);
+
+/**
+ * Reconcile the prediction with an authoritative state from the server
+ * @param ack sequence number of the last input applied to the state
+ * @return 1 if the prediction was rolled back, 0 if it was right, or -1 if
+ *         the state is invalid
+ */
+int prediction_reconcile(Prediction *prediction, uint16_t ack,
+                         struct game_state *state);
+
+/**
+ * Render the predicted game into view
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if no state has arrived yet
+ */
+int prediction_view(Prediction *prediction, struct game_view_data **view);
+
+#endif // TTETRIS_PREDICTION_H
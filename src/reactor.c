@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+
+#include "connection.h"
+#include "log.h"
+#include "message.h"
+#include "reactor.h"
+#include "transport.h"
+
+#ifdef THIS_IS_WINDOWS
+// select only watches sockets on Windows, so rather than being woken up, the
+// reactor looks for partial writes left by other threads this often
+#define REACTOR_SELECT_RETRY_MS 10
+#else
+// pipe that wakes the select reactor, so that it watches for writability on
+// sockets that other threads could not write all of their outbox to
+static int select_wake_fds[2] = {-1, -1};
+
+static void reactor_select_wakeup(int owner) {
+	char byte = 0;
+	if (write(select_wake_fds[1], &byte, 1) < 0 &&
+	    !last_error_would_block())
+		perror("write");
+}
+#endif
+
+int reactor_backend_from_str(const char *name, enum reactor_backend *backend) {
+	if (strcmp(name, "select") == 0)
+		*backend = REACTOR_SELECT;
+	else if (strcmp(name, "epoll") == 0)
+		*backend = REACTOR_EPOLL;
+	else if (strcmp(name, "uring") == 0)
+		*backend = REACTOR_URING;
+	else
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+int reactor_run(enum reactor_backend backend, SOCKET listen_sock,
+                const ReactorHandlers *handlers) {
+	// every backend expects the listening socket to never block, so that
+	// it can drain the accept queue
+	socket_set_nonblocking(listen_sock);
+
+	switch (backend) {
+	case REACTOR_EPOLL:
+		return reactor_epoll_run(listen_sock, handlers);
+	case REACTOR_URING:
+		return reactor_uring_run(listen_sock, handlers);
+	case REACTOR_SELECT:
+	default:
+		return reactor_select_run(listen_sock, handlers);
+	}
+}
+
+int reactor_run_threads(enum reactor_backend backend, SOCKET *listen_socks,
+                        int nthreads, int pin_cpus,
+                        const ReactorHandlers *handlers) {
+	if (nthreads <= 1 || backend != REACTOR_EPOLL) {
+		// close the other sockets, so that the kernel stops handing
+		// them connections
+		if (nthreads > 1)
+			fprintf(logging_fp,
+			        "reactor_run_threads: only the epoll backend "
+			        "supports more than one reactor thread\n");
+		for (int i = 1; i < nthreads; i++)
+			close(listen_socks[i]);
+		return reactor_run(backend, listen_socks[0], handlers);
+	}
+
+	for (int i = 0; i < nthreads; i++)
+		socket_set_nonblocking(listen_socks[i]);
+	return reactor_epoll_run_threads(listen_socks, nthreads, pin_cpus,
+	                                 handlers);
+}
+
+Connection *reactor_accepted(SOCKET fd, const ReactorHandlers *handlers) {
+	socket_set_nonblocking(fd);
+	socket_set_nodelay(fd);
+	Connection *conn = connection_create(fd);
+	if (handlers->on_accept)
+		handlers->on_accept(conn);
+	return conn;
+}
+
+int reactor_readable(Connection *conn, const ReactorHandlers *handlers) {
+	int nbytes = connection_receive(conn);
+
+	// anything read before a hang up is still handled
+	if (conn->inbox_length > 0 && handlers->on_data(conn) < 0)
+		return -1;
+
+	return nbytes < 0 ? -1 : 0;
+}
+
+void reactor_close(Connection *conn, const ReactorHandlers *handlers) {
+	if (handlers->on_close)
+		handlers->on_close(conn);
+	connection_destroy(conn);
+}
+
+/**
+ * accept every connection waiting on the listening socket
+ */
+static void reactor_select_accept(SOCKET listen_sock,
+                                  const ReactorHandlers *handlers) {
+	struct sockaddr_storage clientname;
+	char peer[64];
+	socklen_t size;
+	SOCKET new;
+
+	while (1) {
+		size = sizeof(clientname);
+		new = accept(listen_sock, (struct sockaddr *)&clientname,
+		             &size);
+		if (new < 0) {
+			if (!last_error_would_block())
+				perror("accept");
+			return;
+		}
+#ifndef THIS_IS_WINDOWS
+		// select cannot watch sockets past FD_SETSIZE
+		if (new >= FD_SETSIZE) {
+			fprintf(logging_fp,
+			        "reactor_select_accept: too many connections, "
+			        "use the epoll backend\n");
+			close(new);
+			continue;
+		}
+#endif
+		transport_peer_to_str(&clientname, peer, sizeof(peer));
+		fprintf(logging_fp,
+		        "reactor_select_accept: new connection from %s.\n",
+		        peer);
+		reactor_accepted(new, handlers);
+	}
+}
+
+int reactor_select_run(SOCKET listen_sock, const ReactorHandlers *handlers) {
+	fd_set read_fd_set;
+	fd_set write_fd_set;
+	Connection *conn;
+	int fd;
+#ifdef THIS_IS_WINDOWS
+	struct timeval retry;
+#else
+	char wakeups[64];
+
+	if (pipe(select_wake_fds) < 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	socket_set_nonblocking(select_wake_fds[0]);
+	socket_set_nonblocking(select_wake_fds[1]);
+	connection_set_owners(1, reactor_select_wakeup);
+	connection_set_thread_owner(0);
+#endif
+
+	fprintf(logging_fp, "reactor_select_run: started\n");
+
+	while (1) {
+		// clear the socket fd sets
+		FD_ZERO(&read_fd_set);
+		FD_ZERO(&write_fd_set);
+
+		// add the main listening socket to our read set
+		FD_SET(listen_sock, &read_fd_set);
+#ifndef THIS_IS_WINDOWS
+		FD_SET(select_wake_fds[0], &read_fd_set);
+#endif
+
+		// add every connection to the read set, and watch for
+		// writability on any socket with a partially written outbox
+		for (fd = 0; fd < connection_table_size(); fd++) {
+			if ((conn = connection_get(fd)) == NULL)
+				continue;
+			FD_SET(fd, &read_fd_set);
+			if (connection_wants_write(conn))
+				FD_SET(fd, &write_fd_set);
+			connection_put(conn);
+		}
+
+		// Block until input arrives on one or more active sockets, or
+		// another thread leaves part of an outbox unwritten
+#ifdef THIS_IS_WINDOWS
+		retry.tv_sec = 0;
+		retry.tv_usec = REACTOR_SELECT_RETRY_MS * 1000;
+		if (select(FD_SETSIZE, &read_fd_set, &write_fd_set, NULL,
+		           &retry) < 0) {
+#else
+		if (select(FD_SETSIZE, &read_fd_set, &write_fd_set, NULL,
+		           NULL) < 0) {
+#endif
+			perror("select");
+			return EXIT_FAILURE;
+		}
+
+#ifndef THIS_IS_WINDOWS
+		// the write set is rebuilt on the next pass
+		if (FD_ISSET(select_wake_fds[0], &read_fd_set))
+			while (read(select_wake_fds[0], wakeups,
+			            sizeof(wakeups)) > 0)
+				;
+#endif
+
+		// service the listening socket
+		if (FD_ISSET(listen_sock, &read_fd_set))
+			reactor_select_accept(listen_sock, handlers);
+
+		// service all the sockets with previously accepted connections
+		for (fd = 0; fd < connection_table_size(); fd++) {
+			if ((conn = connection_get(fd)) == NULL)
+				continue;
+
+			// retry any partially written outbox
+			if (FD_ISSET(fd, &write_fd_set))
+				message_queue_flush(conn->outbox, fd);
+
+			if (FD_ISSET(fd, &read_fd_set) &&
+			    reactor_readable(conn, handlers) < 0)
+				reactor_close(conn, handlers);
+			connection_put(conn);
+		}
+
+		// write everything that was queued while handling this batch
+		// of events
+		connection_flush_dirty();
+	}
+}
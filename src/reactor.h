@@ -0,0 +1,100 @@
+/**
+ * The reactor waits for activity on the listening socket and on every client
+ * connection, and hands it to the server's handlers.
+ *
+ * More than one backend is available. select is portable, but rebuilds its
+ * descriptor sets on every wakeup and is limited to FD_SETSIZE sockets. epoll
+ * (Linux only) is edge-triggered, so the cost of a wakeup depends only on the
+ * number of sockets that are actually active. io_uring (Linux 6.0 or newer,
+ * and only if enabled at build time) keeps multishot accepts and receives in
+ * flight, and submits all of a tick's sends with one system call.
+ *
+ * The epoll backend can also run several reactor threads, each serving its
+ * own listening socket. Connections can then be moved between threads, so
+ * that everyone in a party is served by the same thread.
+ */
+#ifndef TTETRIS_REACTOR_H
+#define TTETRIS_REACTOR_H
+
+#include "connection.h"
+#include "os_compat.h"
+
+enum reactor_backend {
+	REACTOR_SELECT,
+	REACTOR_EPOLL,
+	REACTOR_URING,
+};
+
+typedef struct ttetris_reactor_handlers ReactorHandlers;
+
+struct ttetris_reactor_handlers {
+	/* a client socket was accepted and its connection created */
+	void (*on_accept)(Connection *conn);
+	/* new bytes were appended to the connection's inbox. Returns -1 when
+	 * the connection should be closed. */
+	int (*on_data)(Connection *conn);
+	/* the connection is about to be closed and destroyed */
+	void (*on_close)(Connection *conn);
+};
+
+/**
+ * Parse a backend name: "select", "epoll" or "uring"
+ * @return EXIT_SUCCESS or EXIT_FAILURE if the name is unknown
+ */
+int reactor_backend_from_str(const char *name, enum reactor_backend *backend);
+
+/**
+ * Serve the listening socket forever using the given backend
+ * @return EXIT_FAILURE if the reactor could not be started or failed
+ */
+int reactor_run(enum reactor_backend backend, SOCKET listen_sock,
+                const ReactorHandlers *handlers);
+
+/**
+ * Serve each listening socket forever with its own reactor thread. The
+ * sockets are expected to share a port through SO_REUSEPORT. Only the epoll
+ * backend supports more than one thread; the others just serve the first
+ * socket.
+ * @param pin_cpus if non-zero, pin reactor thread i to CPU i
+ * @return EXIT_FAILURE if the reactors could not be started or failed
+ */
+int reactor_run_threads(enum reactor_backend backend, SOCKET *listen_socks,
+                        int nthreads, int pin_cpus,
+                        const ReactorHandlers *handlers);
+
+/**
+ * Move a connection to the reactor thread with the given index. The move
+ * happens asynchronously if the connection is owned by another thread. Does
+ * nothing when there is only one reactor thread.
+ */
+void reactor_migrate(Connection *conn, int owner);
+
+/*
+ * Backend entry points, used by reactor_run
+ */
+int reactor_select_run(SOCKET listen_sock, const ReactorHandlers *handlers);
+int reactor_epoll_run(SOCKET listen_sock, const ReactorHandlers *handlers);
+int reactor_epoll_run_threads(SOCKET *listen_socks, int nthreads,
+                              int pin_cpus, const ReactorHandlers *handlers);
+int reactor_uring_run(SOCKET listen_sock, const ReactorHandlers *handlers);
+
+/**
+ * Set up a connection for a newly accepted socket and tell the handlers
+ * about it. Shared by every backend.
+ */
+Connection *reactor_accepted(SOCKET fd, const ReactorHandlers *handlers);
+
+/**
+ * Drain a readable socket into the connection's inbox and hand it to the
+ * handlers. Shared by the readiness based backends (select and epoll).
+ * @return -1 if the connection should be closed, otherwise 0
+ */
+int reactor_readable(Connection *conn, const ReactorHandlers *handlers);
+
+/**
+ * Tell the handlers that the connection is going away, then destroy it.
+ * Shared by every backend.
+ */
+void reactor_close(Connection *conn, const ReactorHandlers *handlers);
+
+#endif // TTETRIS_REACTOR_H
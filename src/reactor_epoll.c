@@ -0,0 +1,426 @@
+// accept4 and the CPU affinity functions are GNU extensions
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "os_compat.h"
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "connection.h"
+#include "log.h"
+#include "message.h"
+#include "reactor.h"
+#include "transport.h"
+
+// maximum number of events handled per wakeup
+#define REACTOR_EPOLL_MAX_EVENTS 256
+
+#ifdef __linux__
+
+//
+// With more than one reactor thread, each thread has its own listening
+// socket (bound to the same port with SO_REUSEPORT, so the kernel spreads new
+// connections across them) and its own epoll instance. A connection is only
+// ever read by the thread that owns it.
+//
+// Once a party forms, its members' connections are moved to the thread that
+// owns the party leader, so that every input for a game is handled on one
+// thread. A move is a two step handoff through the threads' mailboxes: the
+// current owner removes the socket from its epoll set, then the new owner
+// adds it to its own.
+//
+
+/**
+ * a request, sent to a reactor thread, to move a connection to the reactor
+ * thread `target`, or (if target is -1) to start serving it. The request
+ * holds a reference to the connection.
+ */
+struct reactor_handoff {
+	Connection *conn;
+	int target;
+	struct reactor_handoff *next;
+};
+
+struct reactor_epoll {
+	int index;
+	int epoll_fd;
+	/* eventfd used to wake the thread when its mailbox or dirty list
+	 * changes */
+	int wake_fd;
+	SOCKET listen_sock;
+	const ReactorHandlers *handlers;
+	/* (optional) CPU to pin the thread to, or -1 */
+	int cpu;
+	pthread_t thread;
+	/* pending handoffs for the thread, guarded by lock */
+	struct reactor_handoff *mailbox;
+	pthread_mutex_t lock;
+};
+
+static struct reactor_epoll *reactors = NULL;
+static int reactor_count = 0;
+
+// the reactor run by the current thread, if any
+static __thread struct reactor_epoll *current_reactor = NULL;
+
+static void reactor_epoll_wakeup(int index) {
+	uint64_t one = 1;
+	if (write(reactors[index].wake_fd, &one, sizeof(one)) < 0 &&
+	    errno != EAGAIN)
+		perror("write");
+}
+
+static void reactor_epoll_post(int index, Connection *conn, int target) {
+	struct reactor_handoff *handoff = malloc(sizeof(*handoff));
+	handoff->conn = connection_ref(conn);
+	handoff->target = target;
+
+	pthread_mutex_lock(&reactors[index].lock);
+	handoff->next = reactors[index].mailbox;
+	reactors[index].mailbox = handoff;
+	pthread_mutex_unlock(&reactors[index].lock);
+
+	reactor_epoll_wakeup(index);
+}
+
+/**
+ * start watching a connection with the reactor's epoll instance
+ */
+static int reactor_epoll_add(struct reactor_epoll *reactor,
+                             Connection *conn) {
+	struct epoll_event event;
+
+	// Both directions are registered once, edge-triggered. A writable
+	// edge is only acted on if the outbox has data left over from a
+	// partial write.
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = conn;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) <
+	    0) {
+		perror("epoll_ctl");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Stop serving a connection owned by the current thread and pass it to the
+ * target thread. Must be called by the owner.
+ */
+static void reactor_epoll_detach(struct reactor_epoll *reactor,
+                                 Connection *conn, int target) {
+	if (conn->owner != reactor->index || target == reactor->index)
+		return;
+
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	connection_set_owner(conn, target);
+	reactor_epoll_post(target, conn, -1);
+}
+
+/**
+ * handle every handoff waiting in the reactor's mailbox
+ */
+static void reactor_epoll_drain_mailbox(struct reactor_epoll *reactor) {
+	struct reactor_handoff *handoff, *next, *ordered = NULL;
+
+	pthread_mutex_lock(&reactor->lock);
+	handoff = reactor->mailbox;
+	reactor->mailbox = NULL;
+	pthread_mutex_unlock(&reactor->lock);
+
+	// the mailbox is a stack, but handoffs must be handled in the order
+	// they were posted
+	for (; handoff; handoff = next) {
+		next = handoff->next;
+		handoff->next = ordered;
+		ordered = handoff;
+	}
+
+	for (handoff = ordered; handoff; handoff = next) {
+		next = handoff->next;
+		// the connection may have been closed since the handoff was
+		// posted
+		if (__atomic_load_n(&handoff->conn->closing,
+		                    __ATOMIC_ACQUIRE)) {
+			connection_put(handoff->conn);
+			free(handoff);
+			continue;
+		}
+		if (handoff->target >= 0) {
+			reactor_epoll_detach(reactor, handoff->conn,
+			                     handoff->target);
+		} else if (reactor_epoll_add(reactor, handoff->conn) !=
+		           EXIT_SUCCESS) {
+			reactor_close(handoff->conn, reactor->handlers);
+		} else {
+			fprintf(logging_fp,
+			        "reactor_epoll_drain_mailbox: reactor %d now "
+			        "serves socket %d\n",
+			        reactor->index, handoff->conn->fd);
+		}
+		connection_put(handoff->conn);
+		free(handoff);
+	}
+}
+
+/**
+ * Drop any handoff for a connection that is about to be closed. Only the
+ * owner closes a connection, so it can only appear in its owner's mailbox.
+ */
+static void reactor_epoll_forget(struct reactor_epoll *reactor,
+                                 Connection *conn) {
+	struct reactor_handoff **link, *handoff;
+
+	pthread_mutex_lock(&reactor->lock);
+	for (link = &reactor->mailbox; *link;) {
+		handoff = *link;
+		if (handoff->conn == conn) {
+			*link = handoff->next;
+			connection_put(handoff->conn);
+			free(handoff);
+		} else {
+			link = &handoff->next;
+		}
+	}
+	pthread_mutex_unlock(&reactor->lock);
+}
+
+/**
+ * Stop watching a connection owned by the reactor, and close it. The socket
+ * stays open until the last reference to the connection is dropped, so it is
+ * taken out of the epoll set rather than left to closing.
+ */
+static void reactor_epoll_close(struct reactor_epoll *reactor,
+                                Connection *conn) {
+	reactor_epoll_forget(reactor, conn);
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	reactor_close(conn, reactor->handlers);
+}
+
+void reactor_migrate(Connection *conn, int owner) {
+	if (reactor_count <= 1 || conn == NULL || owner < 0 ||
+	    owner >= reactor_count)
+		return;
+	int current = __atomic_load_n(&conn->owner, __ATOMIC_ACQUIRE);
+	if (current == owner)
+		return;
+
+	// only the owner may remove the socket from its epoll set
+	if (current_reactor && current_reactor->index == current)
+		reactor_epoll_detach(current_reactor, conn, owner);
+	else
+		reactor_epoll_post(current, conn, owner);
+}
+
+/**
+ * accept every connection waiting on the listening socket and register them
+ * with the epoll instance
+ */
+static void reactor_epoll_accept(struct reactor_epoll *reactor) {
+	struct sockaddr_storage clientname;
+	char peer[64];
+	socklen_t size;
+	SOCKET new;
+
+	while (1) {
+		size = sizeof(clientname);
+		new = accept4(reactor->listen_sock,
+		              (struct sockaddr *)&clientname, &size,
+		              SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (new < 0) {
+			// EAGAIN means the accept queue has been drained
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				perror("accept4");
+			if (errno != EINTR)
+				return;
+			continue;
+		}
+		transport_peer_to_str(&clientname, peer, sizeof(peer));
+		fprintf(logging_fp, "reactor_epoll_accept: new connection from "
+		                    "%s.\n",
+		        peer);
+
+		Connection *conn = reactor_accepted(new, reactor->handlers);
+		if (reactor_epoll_add(reactor, conn) != EXIT_SUCCESS)
+			reactor_close(conn, reactor->handlers);
+	}
+}
+
+/**
+ * create the reactor's epoll instance and register the listening socket and
+ * wakeup eventfd
+ */
+static int reactor_epoll_init(struct reactor_epoll *reactor, int index,
+                              SOCKET listen_sock, int cpu,
+                              const ReactorHandlers *handlers) {
+	struct epoll_event event;
+
+	memset(reactor, 0, sizeof(struct reactor_epoll));
+	reactor->index = index;
+	reactor->listen_sock = listen_sock;
+	reactor->handlers = handlers;
+	reactor->cpu = cpu;
+	pthread_mutex_init(&reactor->lock, NULL);
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		perror("epoll_create1");
+		return EXIT_FAILURE;
+	}
+	reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reactor->wake_fd < 0) {
+		perror("eventfd");
+		return EXIT_FAILURE;
+	}
+
+	// the listening socket and the eventfd are the only registrations
+	// without a connection
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = NULL;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, listen_sock, &event) <
+	    0) {
+		perror("epoll_ctl");
+		return EXIT_FAILURE;
+	}
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = reactor;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd,
+	              &event) < 0) {
+		perror("epoll_ctl");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static void *reactor_epoll_loop(void *input) {
+	struct reactor_epoll *reactor = input;
+	struct epoll_event events[REACTOR_EPOLL_MAX_EVENTS];
+	Connection *conn;
+	uint64_t wakeups;
+	int nevents;
+
+	current_reactor = reactor;
+	connection_set_thread_owner(reactor->index);
+
+	if (reactor->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(reactor->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+		                           &cpus) != 0)
+			fprintf(logging_fp,
+			        "reactor_epoll_loop: could not pin reactor %d "
+			        "to cpu %d\n",
+			        reactor->index, reactor->cpu);
+	}
+
+	fprintf(logging_fp, "reactor_epoll_loop: reactor %d started\n",
+	        reactor->index);
+
+	while (1) {
+		nevents = epoll_wait(reactor->epoll_fd, events,
+		                     REACTOR_EPOLL_MAX_EVENTS, -1);
+		if (nevents < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return NULL;
+		}
+
+		for (int i = 0; i < nevents; i++) {
+			if (events[i].data.ptr == NULL) {
+				reactor_epoll_accept(reactor);
+				continue;
+			}
+			if (events[i].data.ptr == reactor) {
+				if (read(reactor->wake_fd, &wakeups,
+				         sizeof(wakeups)) < 0 &&
+				    errno != EAGAIN)
+					perror("read");
+				continue;
+			}
+
+			conn = events[i].data.ptr;
+
+			// the connection was handed to another thread
+			// earlier in this batch
+			if (conn->owner != reactor->index)
+				continue;
+
+			// retry any partially written outbox
+			if ((events[i].events & EPOLLOUT) &&
+			    connection_wants_write(conn))
+				message_queue_flush(conn->outbox, conn->fd);
+
+			// reading drains the socket, and also notices a hang
+			// up or error through a failed read
+			if ((events[i].events &
+			     (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+			    reactor_readable(conn, reactor->handlers) < 0)
+				reactor_epoll_close(reactor, conn);
+		}
+
+		reactor_epoll_drain_mailbox(reactor);
+
+		// write everything that was queued while handling this batch
+		// of events
+		connection_flush_dirty();
+	}
+}
+
+int reactor_epoll_run(SOCKET listen_sock, const ReactorHandlers *handlers) {
+	return reactor_epoll_run_threads(&listen_sock, 1, 0, handlers);
+}
+
+int reactor_epoll_run_threads(SOCKET *listen_socks, int nthreads,
+                              int pin_cpus, const ReactorHandlers *handlers) {
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	reactors = calloc(sizeof(struct reactor_epoll), nthreads);
+	for (int i = 0; i < nthreads; i++)
+		if (reactor_epoll_init(&reactors[i], i, listen_socks[i],
+		                       pin_cpus ? i % ncpus : -1,
+		                       handlers) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	reactor_count = nthreads;
+	if (nthreads > 1)
+		connection_set_owners(nthreads, reactor_epoll_wakeup);
+
+	// the first reactor runs on the calling thread
+	for (int i = 1; i < nthreads; i++)
+		pthread_create(&reactors[i].thread, NULL, reactor_epoll_loop,
+		               &reactors[i]);
+	reactor_epoll_loop(&reactors[0]);
+	return EXIT_FAILURE;
+}
+
+#else
+
+int reactor_epoll_run(SOCKET listen_sock, const ReactorHandlers *handlers) {
+	fprintf(logging_fp, "reactor_epoll_run: epoll is only available on "
+	                    "Linux\n");
+	return EXIT_FAILURE;
+}
+
+int reactor_epoll_run_threads(SOCKET *listen_socks, int nthreads,
+                              int pin_cpus, const ReactorHandlers *handlers) {
+	return reactor_epoll_run(listen_socks[0], handlers);
+}
+
+void reactor_migrate(Connection *conn, int owner) {}
+
+#endif
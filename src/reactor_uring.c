@@ -0,0 +1,517 @@
+// accept4 flags and MSG_NOSIGNAL are GNU extensions
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "os_compat.h"
+#ifdef HAVE_IO_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "connection.h"
+#include "log.h"
+#include "message.h"
+#include "reactor.h"
+
+#ifdef HAVE_IO_URING
+
+//
+// io_uring is driven through the raw system calls rather than liburing, so
+// that the backend only needs the kernel headers to build.
+//
+// The reactor keeps three kinds of requests in flight:
+// - one multishot accept on the listening socket
+// - one multishot receive per connection, which picks its buffers from a
+//   ring of provided buffers shared by every connection. Idle connections
+//   therefore hold no receive memory.
+// - at most one sendmsg per connection, covering everything in its outbox
+// - one read of an eventfd, which other threads write to once they have
+//   queued to connections (see connection_set_flush_by_owner)
+//
+// Every send queued while handling a batch of completions is submitted
+// together with the wait for the next batch. Boards rendered by the game
+// clock and by the workers are not written by those threads either: they
+// wake the reactor, so a gravity tick that updates many boards costs a
+// single system call.
+//
+
+// number of submission queue entries
+#define URING_ENTRIES 1024
+// number of provided receive buffers, which must be a power of two
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+// maximum number of frames written by one sendmsg
+#define URING_MAX_IOV 64
+
+// the request kind is stored in the low bits of the user data, next to the
+// (aligned) pointer to the connection state
+#define URING_OP_MASK 7ULL
+enum uring_op {
+	URING_OP_ACCEPT = 1,
+	URING_OP_RECV = 2,
+	URING_OP_SEND = 3,
+	URING_OP_WAKE = 4,
+};
+
+struct uring {
+	int fd;
+	/* submission ring */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	/* tail including entries that have not been handed to the kernel */
+	unsigned sq_local_tail;
+	struct io_uring_sqe *sqes;
+	/* completion ring */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	/* provided receive buffers */
+	struct io_uring_buf_ring *buf_ring;
+	unsigned short buf_tail;
+	char *buffers;
+	/* eventfd that other threads wake the reactor with, and the counter
+	 * read from it */
+	int wake_fd;
+	uint64_t wakeups;
+	const ReactorHandlers *handlers;
+};
+
+// the reactor's eventfd, for the threads waking it
+static int uring_wake_fd = -1;
+
+/**
+ * io_uring state for a single connection
+ */
+struct uring_connection {
+	Connection *conn;
+	/* number of requests for the connection that have not completed */
+	int inflight;
+	/* non-zero while the multishot receive is armed */
+	char recv_armed;
+	/* non-zero once the connection has been shut down. It is destroyed
+	 * when the last in-flight request completes. */
+	char closing;
+	/* the sendmsg arguments must stay valid until it completes */
+	struct msghdr msg;
+	struct iovec iov[URING_MAX_IOV];
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+	               NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg,
+                          unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t uring_user_data(void *ptr, enum uring_op op) {
+	return (uint64_t)(uintptr_t)ptr | op;
+}
+
+/**
+ * hand a receive buffer (back) to the kernel
+ */
+static void uring_buffer_recycle(struct uring *ring, unsigned short bid) {
+	struct io_uring_buf *buf =
+	    &ring->buf_ring->bufs[ring->buf_tail & (URING_BUFFER_COUNT - 1)];
+	buf->addr = (uintptr_t)(ring->buffers + bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = bid;
+	ring->buf_tail++;
+	__atomic_store_n(&ring->buf_ring->tail, ring->buf_tail,
+	                 __ATOMIC_RELEASE);
+}
+
+/**
+ * map the rings and register the provided buffers
+ * @return EXIT_SUCCESS or EXIT_FAILURE if io_uring is not usable
+ */
+static int uring_init(struct uring *ring) {
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	size_t sq_size, cq_size;
+	char *sq_ptr, *cq_ptr;
+
+	memset(ring, 0, sizeof(struct uring));
+	memset(&params, 0, sizeof(params));
+	// multishot receives can produce many completions per submission
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_ENTRIES * 8;
+
+	ring->fd = uring_setup(URING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		perror("io_uring_setup");
+		return EXIT_FAILURE;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_size = params.cq_off.cqes +
+	          params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+
+	sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+	              MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+		              MAP_SHARED | MAP_POPULATE, ring->fd,
+		              IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED) {
+			perror("mmap");
+			return EXIT_FAILURE;
+		}
+	}
+	ring->sqes = mmap(NULL,
+	                  params.sq_entries * sizeof(struct io_uring_sqe),
+	                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	ring->sq_head = (unsigned *)(sq_ptr + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+	ring->sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+	ring->sq_mask = *(unsigned *)(sq_ptr + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+	ring->cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+	// the buffer ring must be page aligned, which mmap guarantees
+	ring->buf_ring = mmap(NULL,
+	                      URING_BUFFER_COUNT * sizeof(struct io_uring_buf),
+	                      PROT_READ | PROT_WRITE,
+	                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ring->buf_ring == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)ring->buf_ring;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		perror("io_uring_register");
+		return EXIT_FAILURE;
+	}
+
+	ring->buffers = malloc(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+	for (int bid = 0; bid < URING_BUFFER_COUNT; bid++)
+		uring_buffer_recycle(ring, bid);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * hand every prepared submission to the kernel, optionally waiting for at
+ * least one completion in the same system call
+ */
+static int uring_submit(struct uring *ring, int wait) {
+	unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	do {
+		ret = uring_enter(ring->fd, to_submit, wait ? 1 : 0,
+		                  wait ? IORING_ENTER_GETEVENTS : 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		perror("io_uring_enter");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	// if the submission ring is full, hand it to the kernel first
+	if (ring->sq_local_tail - head >= ring->sq_entries) {
+		uring_submit(ring, 0);
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	unsigned index = ring->sq_local_tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	ring->sq_array[index] = index;
+	ring->sq_local_tail++;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+static void uring_arm_accept(struct uring *ring, SOCKET listen_sock) {
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listen_sock;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = uring_user_data(NULL, URING_OP_ACCEPT);
+}
+
+static void uring_arm_recv(struct uring *ring, struct uring_connection *uc) {
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = uc->conn->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = uring_user_data(uc, URING_OP_RECV);
+	uc->recv_armed = 1;
+	uc->inflight++;
+}
+
+static void uring_arm_wake(struct uring *ring) {
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = ring->wake_fd;
+	sqe->addr = (uintptr_t)&ring->wakeups;
+	sqe->len = sizeof(ring->wakeups);
+	sqe->user_data = uring_user_data(NULL, URING_OP_WAKE);
+}
+
+static void uring_wakeup(int owner) {
+	uint64_t one = 1;
+	if (write(uring_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("write");
+}
+
+/**
+ * queue a sendmsg for everything in the connection's outbox
+ */
+static void uring_send(struct uring *ring, struct uring_connection *uc) {
+	if (uc->closing)
+		return;
+
+	// nothing to do if the outbox is empty or already being written
+	int iovcnt =
+	    message_queue_begin_write(uc->conn->outbox, uc->iov, URING_MAX_IOV);
+	if (iovcnt == 0)
+		return;
+
+	memset(&uc->msg, 0, sizeof(uc->msg));
+	uc->msg.msg_iov = uc->iov;
+	uc->msg.msg_iovlen = iovcnt;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = uc->conn->fd;
+	sqe->addr = (uintptr_t)&uc->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = uring_user_data(uc, URING_OP_SEND);
+	uc->inflight++;
+}
+
+static void uring_send_dirty(Connection *conn, void *context) {
+	if (conn->reactor_data)
+		uring_send((struct uring *)context, conn->reactor_data);
+}
+
+/**
+ * destroy the connection once nothing references it any more
+ */
+static void uring_release(struct uring_connection *uc) {
+	if (!uc->closing || uc->inflight > 0)
+		return;
+	// a flusher may still hold the connection, but not the state kept here
+	uc->conn->reactor_data = NULL;
+	connection_destroy(uc->conn);
+	free(uc);
+}
+
+/**
+ * Shut the socket down so that its in-flight requests complete. The
+ * connection is destroyed by uring_release once they have.
+ */
+static void uring_close(struct uring *ring, struct uring_connection *uc) {
+	if (uc->closing)
+		return;
+	uc->closing = 1;
+	if (ring->handlers->on_close)
+		ring->handlers->on_close(uc->conn);
+	shutdown(uc->conn->fd, SHUT_RDWR);
+}
+
+static void uring_handle_accept(struct uring *ring, SOCKET listen_sock,
+                                struct io_uring_cqe *cqe) {
+	// a multishot accept stops after an error, so arm it again
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		uring_arm_accept(ring, listen_sock);
+
+	if (cqe->res < 0) {
+		fprintf(logging_fp, "uring_handle_accept: %s\n",
+		        strerror(-cqe->res));
+		return;
+	}
+
+	fprintf(logging_fp, "uring_handle_accept: new connection on socket "
+	                    "%d\n",
+	        cqe->res);
+
+	struct uring_connection *uc =
+	    calloc(sizeof(struct uring_connection), 1);
+	uc->conn = reactor_accepted(cqe->res, ring->handlers);
+	uc->conn->reactor_data = uc;
+	uring_arm_recv(ring, uc);
+}
+
+static void uring_handle_recv(struct uring *ring, struct uring_connection *uc,
+                              struct io_uring_cqe *cqe) {
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		uc->recv_armed = 0;
+		uc->inflight--;
+	}
+
+	if (cqe->res > 0) {
+		// copy the data out so that the buffer can go straight back
+		// to the kernel
+		unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (!uc->closing)
+			connection_append_inbox(
+			    uc->conn, ring->buffers + bid * URING_BUFFER_SIZE,
+			    cqe->res);
+		uring_buffer_recycle(ring, bid);
+		if (!uc->closing && ring->handlers->on_data(uc->conn) < 0)
+			uring_close(ring, uc);
+	} else if (cqe->res == -ENOBUFS) {
+		// every provided buffer was in use; they have been recycled
+		// by now, so just receive again
+		fprintf(logging_fp, "uring_handle_recv: out of buffers\n");
+	} else {
+		// the peer hung up (0) or the socket failed
+		uring_close(ring, uc);
+	}
+
+	if (!uc->closing && !uc->recv_armed)
+		uring_arm_recv(ring, uc);
+
+	uring_release(uc);
+}
+
+static void uring_handle_send(struct uring *ring, struct uring_connection *uc,
+                              struct io_uring_cqe *cqe) {
+	uc->inflight--;
+	message_queue_end_write(uc->conn->outbox, cqe->res);
+
+	if (cqe->res < 0) {
+		fprintf(logging_fp, "uring_handle_send: %s\n",
+		        strerror(-cqe->res));
+		uring_close(ring, uc);
+	} else {
+		// write whatever was left over, or queued in the meantime
+		uring_send(ring, uc);
+	}
+
+	uring_release(uc);
+}
+
+int reactor_uring_run(SOCKET listen_sock, const ReactorHandlers *handlers) {
+	struct uring ring;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+
+	// older kernels lack multishot requests and provided buffer rings
+	if (uring_init(&ring) != EXIT_SUCCESS) {
+		fprintf(logging_fp, "reactor_uring_run: io_uring is not "
+		                    "available, falling back to epoll\n");
+		return reactor_epoll_run(listen_sock, handlers);
+	}
+	ring.handlers = handlers;
+
+	// other threads leave their writes to this one, and wake it instead
+	ring.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring.wake_fd < 0) {
+		perror("eventfd");
+		return EXIT_FAILURE;
+	}
+	uring_wake_fd = ring.wake_fd;
+	connection_set_owners(1, uring_wakeup);
+	connection_set_thread_owner(0);
+	connection_set_flush_by_owner(1);
+
+	uring_arm_accept(&ring, listen_sock);
+	uring_arm_wake(&ring);
+
+	fprintf(logging_fp, "reactor_uring_run: started\n");
+
+	while (1) {
+		// queue a send for every connection written to while handling
+		// the last batch, then submit them together with the wait
+		connection_foreach_dirty(uring_send_dirty, &ring);
+		if (uring_submit(&ring, 1) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &ring.cqes[head & ring.cq_mask];
+			uint64_t user_data = cqe->user_data;
+			void *ptr =
+			    (void *)(uintptr_t)(user_data & ~URING_OP_MASK);
+
+			switch (user_data & URING_OP_MASK) {
+			case URING_OP_ACCEPT:
+				uring_handle_accept(&ring, listen_sock, cqe);
+				break;
+			case URING_OP_RECV:
+				uring_handle_recv(&ring, ptr, cqe);
+				break;
+			case URING_OP_SEND:
+				uring_handle_send(&ring, ptr, cqe);
+				break;
+			case URING_OP_WAKE:
+				// the dirty connections are sent to at the
+				// top of the loop
+				uring_arm_wake(&ring);
+				break;
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+#else
+
+int reactor_uring_run(SOCKET listen_sock, const ReactorHandlers *handlers) {
+	fprintf(logging_fp, "reactor_uring_run: built without io_uring "
+	                    "support, falling back to epoll\n");
+	return reactor_epoll_run(listen_sock, handlers);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "os_compat.h"
 #ifdef THIS_IS_WINDOWS
@@ -13,17 +14,15 @@
 #include <asm/ioctls.h>
 #endif
 
+#include "ansi_terminal.h"
+#include "frame_slot.h"
+#include "framebuffer.h"
 #include "log.h"
 #include "render.h"
+#include "render_layout.h"
 #include "terminal_size.h"
 #include "tetris_game.h"
 
-// width of the windows used to show the points, lines, next block, and hold
-// block
-#define SECONDARY_WIN_WIDTH 8
-#define CELL_WIDTH 2
-#define BOARD_CH_WIDTH (CELL_WIDTH * BOARD_WIDTH)
-
 struct board_display {
 	char *name;
 	WINDOW *tetris_window;
@@ -31,6 +30,13 @@ struct board_display {
 	WINDOW *hold_block_window;
 	WINDOW *points_window;
 	WINDOW *lines_window;
+	/* latest frame published for the board, and the sequence of the one
+	 * last drawn */
+	FrameSlot frame;
+	unsigned drawn;
+	/* the frame last drawn, valid once drawn is not 0. Only what differs
+	 * from it is drawn again. */
+	struct game_view_data last;
 };
 
 static struct board_display *boards = NULL;
@@ -41,6 +47,51 @@ static int dirty;
 // contents
 static int too_narrow = 0;
 static int too_short = 0;
+// flag used to indicate that every board must be drawn again at the next
+// frame, because the layout was refreshed
+static int redraw;
+// how boards are drawn, and for the backends that do not draw with curses,
+// the frame the boards are drawn into and the terminal it is written to
+static enum render_backend backend = RENDER_CURSES;
+static Framebuffer *framebuffer = NULL;
+static AnsiTerminal *terminal = NULL;
+// name and index of the local player's board, if known, and whether the other
+// boards are drawn as mini boards because they do not fit at full size
+static char *local_name = NULL;
+static int local = -1;
+static int compact = 0;
+// size to lay the boards out for, if not the size of the terminal
+static TerminalSize fixed_size = {0, 0};
+// where drawn boards are recorded, and the number of the next frame drawn
+static FILE *record_fp = NULL;
+static uint32_t record_frame = 0;
+
+void render_use_backend(enum render_backend new_backend) {
+	backend = new_backend;
+}
+
+void render_set_local_board(char *name) { local_name = name; }
+
+void render_set_size(int rows, int columns) {
+	fixed_size = (TerminalSize){rows, columns};
+	dirty = true;
+}
+
+void render_record(FILE *fp) {
+	record_fp = fp;
+	record_frame = 0;
+}
+
+Framebuffer *render_framebuffer(void) { return framebuffer; }
+
+/**
+ * the size to lay the boards out for
+ */
+static TerminalSize render_size(void) {
+	if (fixed_size.rows > 0 || backend == RENDER_HEADLESS)
+		return fixed_size;
+	return get_terminal_size();
+}
 
 static struct board_display *board_from_name(char *name) {
 	if (boards == NULL)
@@ -56,12 +107,11 @@ static struct board_display *board_from_name(char *name) {
  */
 void render_refresh_layout(void) { dirty = true; }
 
-static void set_window(WINDOW **win, int height, int width, int starty,
-                       int startx) {
+static void set_window(WINDOW **win, struct render_box box) {
 	if (!*win) {
-		*win = create_newwin(height, width, starty, startx);
-	} else if (wresize(*win, height, width) != OK ||
-	           mvwin(*win, starty, startx) != OK)
+		*win = create_newwin(box.height, box.width, box.y, box.x);
+	} else if (wresize(*win, box.height, box.width) != OK ||
+	           mvwin(*win, box.y, box.x) != OK)
 		exit(EXIT_FAILURE);
 }
 
@@ -85,7 +135,7 @@ void _render_refresh_layout(void) {
 	// next user keypress. Until we find a good solution to that, option #3
 	// is working nicely. :)
 	//
-	TerminalSize term_size = get_terminal_size();
+	TerminalSize term_size = render_size();
 	// Here, we call the "inner" resize_term function rather than the
 	// *recommended* "outer" resizeterm function. This is because in my
 	// testing, resizeterm was causing the next user keypress to get
@@ -95,42 +145,23 @@ void _render_refresh_layout(void) {
 
 	clear();
 
-	int board_min_y = (LINES - BOARD_HEIGHT) / 2;
-	if (board_min_y < 1)
-		board_min_y = 1;
-	int panel_width = COLS / nboards;
-
 	// check that the terminal is large enough to render everything
-	too_narrow = panel_width < BOARD_CH_WIDTH + 10 ? 1 : 0;
-	too_short = LINES < BOARD_HEIGHT + 2 ? 1 : 0;
-	if (too_narrow || too_short) {
+	if (!render_layout_fits(LINES, COLS, nboards, &too_narrow,
+	                        &too_short)) {
+		redraw = true;
 		refresh();
 		return;
 	}
 
 	for (int i = 0; i < nboards; i++) {
-		int panel_lowx = panel_width * i;
-		int window_lowx =
-		    panel_lowx +
-		    (panel_width - BOARD_CH_WIDTH - SECONDARY_WIN_WIDTH) / 2;
-
-		set_window(&boards[i].tetris_window, BOARD_HEIGHT + 2,
-		           BOARD_CH_WIDTH + 2, board_min_y - 1,
-		           window_lowx - 1);
+		struct render_layout layout;
+		render_layout_board(LINES, COLS, nboards, i, &layout);
 
-		int secondary_start_x = window_lowx + BOARD_CH_WIDTH + 1;
-
-		set_window(&boards[i].next_block_window, 6, SECONDARY_WIN_WIDTH,
-		           board_min_y - 1, secondary_start_x);
-
-		set_window(&boards[i].hold_block_window, 6, SECONDARY_WIN_WIDTH,
-		           board_min_y + 5, secondary_start_x);
-
-		set_window(&boards[i].points_window, 4, SECONDARY_WIN_WIDTH,
-		           board_min_y + 11, secondary_start_x);
-
-		set_window(&boards[i].lines_window, 4, SECONDARY_WIN_WIDTH,
-		           board_min_y + 15, secondary_start_x);
+		set_window(&boards[i].tetris_window, layout.board);
+		set_window(&boards[i].next_block_window, layout.next_block);
+		set_window(&boards[i].hold_block_window, layout.hold_block);
+		set_window(&boards[i].points_window, layout.points);
+		set_window(&boards[i].lines_window, layout.lines);
 
 		werase(boards[i].points_window);
 		werase(boards[i].lines_window);
@@ -148,6 +179,31 @@ void _render_refresh_layout(void) {
 	wnoutrefresh(stdscr);
 	doupdate();
 	dirty = false;
+	redraw = true;
+}
+
+/**
+ * recalculate the size of the framebuffer, for the backends that draw into
+ * one
+ */
+static void refresh_framebuffer_layout(void) {
+	TerminalSize term_size = render_size();
+
+	fprintf(logging_fp, "refresh_framebuffer_layout nboards=%d\n",
+	        nboards);
+	framebuffer_resize(framebuffer, term_size.rows, term_size.columns);
+	// whatever was on the terminal may have been lost, as when the game
+	// was suspended
+	if (terminal)
+		ansi_terminal_forget(terminal);
+	compact = 0;
+	if (!render_layout_fits(term_size.rows, term_size.columns, nboards,
+	                        &too_narrow, &too_short))
+		compact = render_layout_fits_compact(
+		    term_size.rows, term_size.columns, nboards, local,
+		    &too_narrow, &too_short);
+	dirty = false;
+	redraw = true;
 }
 
 #ifdef THIS_IS_NOT_WINDOWS
@@ -212,6 +268,25 @@ void render_init(int n, char *names[]) {
 	// This is to be explicit.
 	setlocale(LC_ALL, "ISO-8859-1");
 
+	// set the static variable for this module
+	nboards = n;
+
+	// allocate the boards array and set the names
+	boards = calloc(sizeof(struct board_display), nboards);
+	local = -1;
+	for (int i = 0; i < nboards; i++) {
+		boards[i].name = names[i];
+		if (local_name && strcmp(names[i], local_name) == 0)
+			local = i;
+	}
+
+	if (backend == RENDER_HEADLESS) {
+		// nothing to set up but the frame
+		framebuffer = framebuffer_create(0, 0);
+		refresh_framebuffer_layout();
+		return;
+	}
+
 	// initialize the curses system
 	initscr();
 
@@ -228,29 +303,27 @@ void render_init(int n, char *names[]) {
 	// hide the cursor
 	curs_set(0);
 
+	// curses normally gives up on an update when a key is waiting, and
+	// leaves the rest for the next one. Frames only draw boards that
+	// changed, so there may not be a next one for a while.
+	typeahead(-1);
+
 	// start color functionality
 	start_color();
 
 	// create numbered fg/bg pairs to be used by the COLOR_PAIR macro later
-	init_pair(0, COLOR_WHITE, COLOR_WHITE);
-	init_pair(shadow, COLOR_CYAN, COLOR_CYAN);
-	init_pair(orange, COLOR_RED, COLOR_RED);
-	init_pair(blue, COLOR_BLUE, COLOR_GREEN);
-	init_pair(cleve, COLOR_GREEN, COLOR_GREEN);
-	init_pair(rhode, COLOR_YELLOW, COLOR_YELLOW);
-	init_pair(teewee, COLOR_MAGENTA, COLOR_MAGENTA);
-	init_pair(hero, COLOR_CYAN, COLOR_CYAN);
-	init_pair(smashboy, COLOR_WHITE, COLOR_WHITE);
-
-	// set the static variable for this module
-	nboards = n;
-
-	// allocate the boards array and set the names
-	boards = calloc(sizeof(struct board_display), nboards);
-	for (int i = 0; i < nboards; i++)
-		boards[i].name = names[i];
+	for (int i = no_type; i <= smashboy; i++)
+		init_pair(i, render_palette[i].fg, render_palette[i].bg);
 
-	_render_refresh_layout();
+	if (backend == RENDER_ANSI) {
+		// curses still reads the keys, but the screen is left to the
+		// terminal once curses has cleared it
+		refresh();
+		framebuffer = framebuffer_create(0, 0);
+		terminal = ansi_terminal_create(STDOUT_FILENO);
+		refresh_framebuffer_layout();
+	} else
+		_render_refresh_layout();
 
 #ifdef THIS_IS_NOT_WINDOWS
 	signal(SIGWINCH, render_handle_sig);
@@ -285,6 +358,17 @@ void render_ingame_cleanup() {
 	free(boards);
 	boards = NULL;
 
+	if (terminal) {
+		ansi_terminal_destroy(terminal);
+		terminal = NULL;
+	}
+	if (framebuffer) {
+		framebuffer_destroy(framebuffer);
+		framebuffer = NULL;
+	}
+	if (backend == RENDER_HEADLESS)
+		return;
+
 	// clear the terminal
 	clear();
 	refresh();
@@ -356,20 +440,6 @@ static void fill_window(WINDOW *win, short color) {
 		mvwchgat(win, row, 0, width, 0, color, NULL);
 }
 
-static struct position rotate_position(struct position pos, enum rotation rot) {
-	switch (rot) {
-	case right:
-		return (struct position){.x = pos.y, .y = -pos.x};
-	case invert:
-		return (struct position){.x = -pos.x, .y = -pos.y};
-	case left:
-		return (struct position){.x = -pos.y, .y = pos.x};
-	case none:
-	default:
-		return pos;
-	}
-}
-
 /**
  * render a tetris piece in a window
  *
@@ -384,91 +454,196 @@ static struct position rotate_position(struct position pos, enum rotation rot) {
  */
 static void render_tetris_piece(WINDOW *win, enum block_type piece,
                                 enum rotation rot, struct position pos) {
-	struct position cell_offset;
-	const struct position *offsets;
-	int cell_count = get_tetris_block_offsets(&offsets, piece);
-	if (cell_count <= 0)
-		return;
-	for (int i = 0; i < cell_count; i++) {
-		cell_offset = rotate_position(offsets[i], rot);
-		render_cell(win, pos.y - cell_offset.y, pos.x + cell_offset.x,
-		            piece, 0);
-	}
+	struct position cells[RENDER_PIECE_CELLS];
+	int cell_count = render_piece_cells(piece, rot, pos, cells);
+	for (int i = 0; i < cell_count; i++)
+		render_cell(win, cells[i].y, cells[i].x, piece, 0);
 }
 
-void render_game_view_data(char *name, struct game_view_data *view) {
-	if (dirty)
-		_render_refresh_layout();
+/**
+ * Draw a board, or only what changed since the frame last drawn
+ *
+ * @param bd   board display
+ * @param view frame to draw
+ * @param full whether to draw everything, as after the layout was refreshed
+ */
+static void render_board(struct board_display *bd,
+                         struct game_view_data *view, int full) {
+	fprintf(logging_fp, "render_board: rendering board for %s\n",
+	        bd->name);
 
-	if (too_narrow) {
-		print_centered(stdscr, 1, "Terminal too narrow!");
-		print_centered(stdscr, 2, "Resize to play.");
-		refresh();
-		return;
+	int(*board)[BOARD_WIDTH] = view->board;
+	int(*last)[BOARD_WIDTH] = bd->last.board;
+	WINDOW *tetris_window = bd->tetris_window;
+
+	// render the cells of the tetris window that changed
+	int r, c, changed = full;
+	for (r = 0; r < BOARD_HEIGHT; r++)
+		for (c = 0; c < BOARD_WIDTH; c++) {
+			if (!full && board[r][c] == last[r][c])
+				continue;
+			render_cell(tetris_window, BOARD_HEIGHT - r - 1, c,
+			            board[r][c], r == BOARD_PLAY_HEIGHT);
+			changed = 1;
+		}
+
+	if (full)
+		box(tetris_window, 0, 0);
+	if (changed)
+		wnoutrefresh(tetris_window);
+
+	// pre-render the next block window
+	if (full || view->next_block != bd->last.next_block) {
+		fill_window(bd->next_block_window, COLOR_PAIR(0));
+		mvwprintw(bd->next_block_window, 1, 2, "NEXT");
+		render_tetris_piece(bd->next_block_window, view->next_block,
+		                    right, (struct position){1, 2});
+		box(bd->next_block_window, 0, 0);
+		wnoutrefresh(bd->next_block_window);
 	}
-	if (too_short) {
-		print_centered(stdscr, 1,
-		               "Terminal too short! Resize to play.");
-		refresh();
-		return;
+
+	// pre-render the hold block window
+	if (full || view->hold_block != bd->last.hold_block) {
+		fill_window(bd->hold_block_window, COLOR_PAIR(0));
+		mvwprintw(bd->hold_block_window, 1, 2, "HOLD");
+		render_tetris_piece(bd->hold_block_window, view->hold_block,
+		                    right, (struct position){1, 2});
+		box(bd->hold_block_window, 0, 0);
+		wnoutrefresh(bd->hold_block_window);
 	}
 
-	int(*board)[BOARD_WIDTH] = view->board;
-	// figure out which board is getting rendered
+	// pre-render the points window
+	char output_buffer[64];
+	if (full || view->points != bd->last.points) {
+		sprintf(output_buffer, "POINTS\n %d", view->points);
+		mvwprintw(bd->points_window, 1, 1, output_buffer);
+		box(bd->points_window, 0, 0);
+		wnoutrefresh(bd->points_window);
+	}
+
+	// pre-render the lines window
+	if (full || view->lines_cleared != bd->last.lines_cleared) {
+		sprintf(output_buffer, "LINES\n %d", view->lines_cleared);
+		mvwprintw(bd->lines_window, 1, 1, output_buffer);
+		box(bd->lines_window, 0, 0);
+		wnoutrefresh(bd->lines_window);
+	}
+
+	bd->last = *view;
+}
+
+void render_game_view_data(char *name, struct game_view_data *view) {
+	// figure out which board is getting published
 	struct board_display *bd = board_from_name(name);
 
-	if (bd == 0) {
+	if (bd == NULL) {
 		fprintf(logging_fp,
 		        "render_game_view_data: no board found for name %s\n",
 		        name);
 		return;
-	} else {
+	}
+	frame_slot_publish(&bd->frame, view);
+}
+
+void render_game_view_data_at(int index, struct game_view_data *view) {
+	if (boards == NULL || index < 0 || index >= nboards) {
 		fprintf(logging_fp,
-		        "render_game_view_data: rendering board for %s\n",
-		        name);
+		        "render_game_view_data_at: no board at index %d\n",
+		        index);
+		return;
 	}
+	frame_slot_publish(&boards[index].frame, view);
+}
 
-	WINDOW *tetris_window = bd->tetris_window;
+/**
+ * Show that the terminal is too small to draw the boards
+ */
+static void render_too_small(void) {
+	char *lines[2] = {"Terminal too short! Resize to play.", NULL};
 
-	// render the tetris window
-	int r, c;
-	for (r = 0; r < BOARD_HEIGHT; r++)
-		for (c = 0; c < BOARD_WIDTH; c++)
-			render_cell(tetris_window, BOARD_HEIGHT - r - 1, c,
-			            board[r][c], r == BOARD_PLAY_HEIGHT);
+	if (too_narrow) {
+		lines[0] = "Terminal too narrow!";
+		lines[1] = "Resize to play.";
+	}
 
-	box(tetris_window, 0, 0);
-	wnoutrefresh(tetris_window);
+	if (backend == RENDER_CURSES) {
+		for (int i = 0; i < 2 && lines[i]; i++)
+			print_centered(stdscr, i + 1, lines[i]);
+		refresh();
+		return;
+	}
+	framebuffer_clear(framebuffer);
+	for (int i = 0; i < 2 && lines[i]; i++)
+		framebuffer_centered(framebuffer, i + 1, lines[i]);
+	if (terminal)
+		ansi_terminal_flush(terminal, framebuffer);
+}
 
-	// pre-render the next block window
-	fill_window(bd->next_block_window, COLOR_PAIR(0));
-	mvwprintw(bd->next_block_window, 1, 2, "NEXT");
-	render_tetris_piece(bd->next_block_window, view->next_block, right,
-	                    (struct position){1, 2});
-	box(bd->next_block_window, 0, 0);
-	wnoutrefresh(bd->next_block_window);
+void render_frame(void) {
+	struct game_view_data view;
+	struct render_layout layout;
+	int ndrawn = 0;
 
-	// pre-render the hold block window
-	fill_window(bd->hold_block_window, COLOR_PAIR(0));
-	mvwprintw(bd->hold_block_window, 1, 2, "HOLD");
-	render_tetris_piece(bd->hold_block_window, view->hold_block, right,
-	                    (struct position){1, 2});
-	box(bd->hold_block_window, 0, 0);
-	wnoutrefresh(bd->hold_block_window);
+	if (boards == NULL)
+		return;
+	if (dirty && backend == RENDER_CURSES)
+		_render_refresh_layout();
+	else if (dirty)
+		refresh_framebuffer_layout();
 
-	// pre-render the points window
-	char output_buffer[64];
-	sprintf(output_buffer, "POINTS\n %d", view->points);
-	mvwprintw(bd->points_window, 1, 1, output_buffer);
-	box(bd->points_window, 0, 0);
-	wnoutrefresh(bd->points_window);
+	if (too_narrow || too_short) {
+		// the message only needs to be shown once per layout
+		if (redraw)
+			render_too_small();
+		redraw = false;
+		return;
+	}
 
-	// pre-render the lines window
-	sprintf(output_buffer, "LINES\n %d", view->lines_cleared);
-	mvwprintw(bd->lines_window, 1, 1, output_buffer);
-	box(bd->lines_window, 0, 0);
-	wnoutrefresh(bd->lines_window);
+	// draw the latest frame of every board that changed since the last
+	// frame, skipping whatever was published in between
+	for (int i = 0; i < nboards; i++) {
+		struct board_display *bd = &boards[i];
+		unsigned sequence = frame_slot_sequence(&bd->frame);
+		if (sequence == 0 || (sequence == bd->drawn && !redraw))
+			continue;
+		int full = redraw || bd->drawn == 0;
+		bd->drawn = frame_slot_read(&bd->frame, &view);
+		if (record_fp) {
+			struct render_record record = {record_frame, i,
+			                               nboards, view};
+			fwrite(&record, sizeof(record), 1, record_fp);
+		}
+		if (backend == RENDER_CURSES) {
+			render_board(bd, &view, full);
+		} else if (!compact) {
+			render_layout_board(framebuffer->rows,
+			                    framebuffer->columns, nboards, i,
+			                    &layout);
+			framebuffer_draw_board(framebuffer, &layout, &view);
+		} else if (render_layout_compact_board(
+		               framebuffer->rows, framebuffer->columns, nboards,
+		               local, i, &layout)) {
+			framebuffer_draw_mini_board(framebuffer, &layout.board,
+			                            &view);
+		} else {
+			framebuffer_draw_board(framebuffer, &layout, &view);
+		}
+		ndrawn++;
+	}
+	redraw = false;
 
+	if (ndrawn == 0)
+		return;
+	if (record_fp) {
+		// a recording should survive the client being killed
+		fflush(record_fp);
+		record_frame++;
+	}
+	if (backend != RENDER_CURSES) {
+		if (terminal)
+			ansi_terminal_flush(terminal, framebuffer);
+		return;
+	}
 	wnoutrefresh(stdscr);
 	// do update flushes all the window changes by wnoutrefresh at once
 	doupdate();
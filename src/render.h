@@ -5,15 +5,95 @@
 // TODO look for a more elegant solution
 #undef MOUSE_MOVED
 #include <curses.h>
+#include <stdint.h>
+#include <stdio.h>
 
+#include "framebuffer.h"
 #include "tetris_game.h"
 
+enum render_backend {
+	/* draw with curses */
+	RENDER_CURSES,
+	/* draw with ANSI escape sequences, a whole frame at a time (see
+	 * ansi_terminal.h). Curses still reads the keys. */
+	RENDER_ANSI,
+	/* draw into a framebuffer that is never shown, without a terminal or
+	 * curses (see render_framebuffer). For tests and benchmarks. */
+	RENDER_HEADLESS,
+};
+
+/**
+ * A board as drawn by render_frame, as written by render_record and read back
+ * by bench_render. Records are written in the byte order and layout of the
+ * machine, so a recording is only meant to be replayed where it was made.
+ */
+struct render_record {
+	/* number of the frame the board was drawn in, counted from 0 */
+	uint32_t frame;
+	/* index of the board, and how many boards were shown */
+	uint16_t board;
+	uint16_t nboards;
+	struct game_view_data view;
+};
+
+/**
+ * Choose how games are drawn. Takes effect at the next render_init.
+ */
+void render_use_backend(enum render_backend backend);
+
+/**
+ * Name the board of the player at this terminal. Where the boards do not fit
+ * side by side at full size, the backends that draw into a framebuffer show
+ * this board at full size and the others as mini boards (see
+ * render_layout_compact_board). Takes effect at the next render_init.
+ */
+void render_set_local_board(char *name);
+
+/**
+ * Lay the boards out for a terminal of the given size, rather than for the
+ * size of the terminal. The headless backend has no terminal, so it is laid
+ * out for 0 columns until this is called. Pass 0 rows to go back to the
+ * terminal's size.
+ */
+void render_set_size(int rows, int columns);
+
+/**
+ * Append every board that render_frame draws to fp, as a struct
+ * render_record, until this is called with NULL
+ */
+void render_record(FILE *fp);
+
+/**
+ * The frame the boards were last drawn into, for the backends that draw into
+ * one. Valid until render_close.
+ * @return the framebuffer, or NULL when drawing with curses
+ */
+Framebuffer *render_framebuffer(void);
+
 void render_init(int n, char *names[]);
 
 void render_close(void);
 
+/**
+ * Publish the latest frame of a board. It is drawn by the next call to
+ * render_frame, unless a later frame replaces it first. May be called from any
+ * thread.
+ */
 void render_game_view_data(char *board_name, struct game_view_data *view);
 
+/**
+ * Like render_game_view_data, for the board at an index in the names given to
+ * render_init, which online is the party slot of the player
+ */
+void render_game_view_data_at(int index, struct game_view_data *view);
+
+/**
+ * Draw every board that was published since the last frame, along with
+ * anything a change of the terminal size calls for. Must be called from the
+ * thread that uses curses, at the rate frames should be drawn.
+ */
+void render_frame(void);
+
 int print_centered(WINDOW *w, int y, char *text);
 
 WINDOW *create_newwin(int height, int width, int starty, int startx);
@@ -0,0 +1,137 @@
+#include <curses.h>
+
+#include "render_layout.h"
+
+const struct render_colors render_palette[smashboy + 1] = {
+    [no_type] = {COLOR_WHITE, COLOR_WHITE},
+    [shadow] = {COLOR_CYAN, COLOR_CYAN},
+    [orange] = {COLOR_RED, COLOR_RED},
+    [blue] = {COLOR_BLUE, COLOR_GREEN},
+    [cleve] = {COLOR_GREEN, COLOR_GREEN},
+    [rhode] = {COLOR_YELLOW, COLOR_YELLOW},
+    [teewee] = {COLOR_MAGENTA, COLOR_MAGENTA},
+    [hero] = {COLOR_CYAN, COLOR_CYAN},
+    [smashboy] = {COLOR_WHITE, COLOR_WHITE},
+};
+
+int render_layout_fits(int rows, int columns, int nboards, int *too_narrow,
+                       int *too_short) {
+	int panel_width = columns / nboards;
+
+	*too_narrow = panel_width < BOARD_PANEL_WIDTH ? 1 : 0;
+	*too_short = rows < BOARD_HEIGHT + 2 ? 1 : 0;
+	return !*too_narrow && !*too_short;
+}
+
+void render_layout_board(int rows, int columns, int nboards, int i,
+                         struct render_layout *layout) {
+	int board_min_y = (rows - BOARD_HEIGHT) / 2;
+	if (board_min_y < 1)
+		board_min_y = 1;
+	int panel_width = columns / nboards;
+	int panel_lowx = panel_width * i;
+	int window_lowx = panel_lowx + (panel_width - BOARD_CH_WIDTH -
+	                                SECONDARY_WIN_WIDTH) / 2;
+	int secondary_x = window_lowx + BOARD_CH_WIDTH + 1;
+
+	layout->board = (struct render_box){
+	    BOARD_HEIGHT + 2, BOARD_CH_WIDTH + 2, board_min_y - 1,
+	    window_lowx - 1};
+	layout->next_block = (struct render_box){6, SECONDARY_WIN_WIDTH,
+	                                         board_min_y - 1, secondary_x};
+	layout->hold_block = (struct render_box){6, SECONDARY_WIN_WIDTH,
+	                                         board_min_y + 5, secondary_x};
+	layout->points = (struct render_box){4, SECONDARY_WIN_WIDTH,
+	                                     board_min_y + 11, secondary_x};
+	layout->lines = (struct render_box){4, SECONDARY_WIN_WIDTH,
+	                                    board_min_y + 15, secondary_x};
+}
+
+/**
+ * Work out the grid of mini boards of the compact layout
+ * @param n_minis set to the number of mini boards
+ * @param per_row set to the number of mini boards that fit in a row of the grid
+ * @param grid_rows set to the number of rows of mini boards that fit
+ */
+static void compact_grid(int rows, int columns, int nboards, int local,
+                         int *n_minis, int *per_row, int *grid_rows) {
+	int local_width = local >= 0 ? BOARD_PANEL_WIDTH : 0;
+
+	*n_minis = local >= 0 ? nboards - 1 : nboards;
+	// mini boards are a column apart
+	*per_row = (columns - local_width + 1) / (MINI_BOARD_WIDTH + 1);
+	*grid_rows = rows / MINI_BOARD_HEIGHT;
+}
+
+int render_layout_fits_compact(int rows, int columns, int nboards, int local,
+                               int *too_narrow, int *too_short) {
+	int n_minis, per_row, grid_rows;
+
+	compact_grid(rows, columns, nboards, local, &n_minis, &per_row,
+	             &grid_rows);
+	*too_short = grid_rows < 1 ||
+	             (local >= 0 && rows < BOARD_HEIGHT + 2) ? 1 : 0;
+	*too_narrow = !*too_short && per_row * grid_rows < n_minis ? 1 : 0;
+	return !*too_narrow && !*too_short;
+}
+
+int render_layout_compact_board(int rows, int columns, int nboards, int local,
+                                int i, struct render_layout *layout) {
+	int n_minis, per_row, grid_rows;
+	int local_width = local >= 0 ? BOARD_PANEL_WIDTH : 0;
+
+	if (i == local) {
+		render_layout_board(rows, local_width, 1, 0, layout);
+		return 0;
+	}
+
+	compact_grid(rows, columns, nboards, local, &n_minis, &per_row,
+	             &grid_rows);
+	// the grid is centered in the space beside the local board, using as
+	// few rows as it can
+	int used_rows = (n_minis + per_row - 1) / per_row;
+	int used_columns = n_minis < per_row ? n_minis : per_row;
+	int grid_y = (rows - used_rows * MINI_BOARD_HEIGHT) / 2;
+	int grid_x = local_width + (columns - local_width -
+	                            used_columns * (MINI_BOARD_WIDTH + 1) + 1) /
+	                               2;
+	int j = local >= 0 && i > local ? i - 1 : i;
+
+	layout->board = (struct render_box){
+	    MINI_BOARD_HEIGHT, MINI_BOARD_WIDTH,
+	    grid_y + j / per_row * MINI_BOARD_HEIGHT,
+	    grid_x + j % per_row * (MINI_BOARD_WIDTH + 1)};
+	return 1;
+}
+
+static struct position rotate_position(struct position pos, enum rotation rot) {
+	switch (rot) {
+	case right:
+		return (struct position){.x = pos.y, .y = -pos.x};
+	case invert:
+		return (struct position){.x = -pos.x, .y = -pos.y};
+	case left:
+		return (struct position){.x = -pos.y, .y = pos.x};
+	case none:
+	default:
+		return pos;
+	}
+}
+
+int render_piece_cells(enum block_type piece, enum rotation rot,
+                       struct position pos,
+                       struct position cells[RENDER_PIECE_CELLS]) {
+	struct position cell_offset;
+	const struct position *offsets;
+	int cell_count = get_tetris_block_offsets(&offsets, piece);
+	if (cell_count <= 0)
+		return 0;
+	if (cell_count > RENDER_PIECE_CELLS)
+		cell_count = RENDER_PIECE_CELLS;
+	for (int i = 0; i < cell_count; i++) {
+		cell_offset = rotate_position(offsets[i], rot);
+		cells[i] = (struct position){.x = pos.x + cell_offset.x,
+		                             .y = pos.y - cell_offset.y};
+	}
+	return cell_count;
+}
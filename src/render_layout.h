@@ -0,0 +1,115 @@
+/**
+ * Where the renderers put things on the terminal, and in which colors, so
+ * that every renderer draws the same picture. Coordinates are in characters,
+ * with the origin at the top left of the terminal.
+ */
+#ifndef TTETRIS_RENDER_LAYOUT_H
+#define TTETRIS_RENDER_LAYOUT_H
+
+#include "tetris_game.h"
+
+// width of the windows used to show the points, lines, next block, and hold
+// block
+#define SECONDARY_WIN_WIDTH 8
+#define CELL_WIDTH 2
+#define BOARD_CH_WIDTH (CELL_WIDTH * BOARD_WIDTH)
+// narrowest panel a board fits in at full size, with its secondary windows
+#define BOARD_PANEL_WIDTH (BOARD_CH_WIDTH + 10)
+
+// size of a mini board, border included. A mini board shows two rows of
+// cells in each row of characters, with half blocks, and one cell in each
+// column.
+#define MINI_BOARD_HEIGHT ((BOARD_HEIGHT + 1) / 2 + 2)
+#define MINI_BOARD_WIDTH (BOARD_WIDTH + 2)
+
+// most cells a piece is made of
+#define RENDER_PIECE_CELLS 4
+
+struct render_box {
+	int height;
+	int width;
+	int y;
+	int x;
+};
+
+/**
+ * The boxes a board is drawn in. Each is drawn with a border, inside which
+ * the contents start at row 1 and column 1.
+ */
+struct render_layout {
+	struct render_box board;
+	struct render_box next_block;
+	struct render_box hold_block;
+	struct render_box points;
+	struct render_box lines;
+};
+
+/**
+ * Foreground and background colors of a cell, as curses color numbers, which
+ * are also the numbers of the ANSI colors
+ */
+struct render_colors {
+	short fg;
+	short bg;
+};
+
+/**
+ * colors of the cells of each enum block_type
+ */
+extern const struct render_colors render_palette[smashboy + 1];
+
+/**
+ * Check that a terminal is large enough to show every board
+ * @param too_narrow set to 1 if the terminal is too narrow, else 0
+ * @param too_short set to 1 if the terminal is too short, else 0
+ * @return 1 if the boards fit, else 0
+ */
+int render_layout_fits(int rows, int columns, int nboards, int *too_narrow,
+                       int *too_short);
+
+/**
+ * Lay out board i of nboards on a terminal, which must be large enough
+ */
+void render_layout_board(int rows, int columns, int nboards, int i,
+                         struct render_layout *layout);
+
+/**
+ * Check that a terminal is large enough for the compact layout, in which the
+ * board of the local player is shown at full size on the left, and every
+ * other board as a mini board in a grid beside it
+ * @param local index of the local player's board, or -1 to show every board
+ *              as a mini board
+ * @param too_narrow set to 1 if the terminal is too narrow, else 0
+ * @param too_short set to 1 if the terminal is too short, else 0
+ * @return 1 if the boards fit, else 0
+ */
+int render_layout_fits_compact(int rows, int columns, int nboards, int local,
+                               int *too_narrow, int *too_short);
+
+/**
+ * Lay out board i of nboards in the compact layout, on a terminal which must
+ * be large enough. The local board is laid out as a single board would be by
+ * render_layout_board. For a mini board, only layout->board is set.
+ * @return 1 if board i is a mini board, else 0
+ */
+int render_layout_compact_board(int rows, int columns, int nboards, int local,
+                                int i, struct render_layout *layout);
+
+/**
+ * Find the cells covered by a piece
+ *
+ * IMPORTANT NOTE: The position for this function is given in screen space,
+ * where the origin is the top left. The origin for the tetris library is bottom
+ * left. As a result, this function flips the Y axis.
+ *
+ * @param piece tetris piece
+ * @param rot   tetris piece rotation
+ * @param pos   position of the piece in cells, relative to the window
+ * @param cells set to the position of each cell of the piece
+ * @return number of cells, or 0 for no piece
+ */
+int render_piece_cells(enum block_type piece, enum rotation rot,
+                       struct position pos,
+                       struct position cells[RENDER_PIECE_CELLS]);
+
+#endif // TTETRIS_RENDER_LAYOUT_H
@@ -1,9 +1,11 @@
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
 
@@ -16,139 +18,325 @@
 #include <arpa/inet.h>
 #include <asm/socket.h>
 #include <netinet/in.h>
-#include <sys/select.h>
+#include <sys/resource.h>
 #endif
 
+#include "connection.h"
 #include "list.h"
 #include "log.h"
 #include "message.h"
 #include "os_compat.h"
 #include "player.h"
+#include "reactor.h"
+#include "simulation.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "udp.h"
+
+// a player's game is stopped after this long without any input from them
+#define SERVER_IDLE_TIMEOUT_MS (5 * 60 * 1000)
+// interval at which the simulation workers' stats are logged
+#define SERVER_STATS_INTERVAL_MS (60 * 1000)
+
+// (optional) socket for the datagram transport (see udp.h)
+static SOCKET udp_sock = -1;
 
 /**
- * get and bind a socket
- * @param host string IP address
- * @param port numeric port
- * @return EXIT_SUCCESS or EXIT_FAILURE
+ * Look up the connection of a player, from any thread
+ * @return a reference to the connection, to be dropped with connection_put,
+ *         or NULL if the player has none
  */
-int make_socket(char *host, uint16_t port) {
-	int sock;
-	struct sockaddr_in name;
-
-#ifdef THIS_IS_WINDOWS
-	WSADATA wsaData;
-	int startup_result;
-	// perform the required initialization for winsock
-	if ((startup_result = WSAStartup(MAKEWORD(2, 2), &wsaData)) != 0) {
-		fprintf(logging_fp, "WSAStartup failed with error: %d\n",
-		        startup_result);
-		return EXIT_FAILURE;
+static Connection *player_connection(Player *player) {
+	SOCKET fd = __atomic_load_n(&player->fd, __ATOMIC_ACQUIRE);
+	Connection *conn = connection_get(fd);
+
+	// The player's socket may have been closed and handed to a new client
+	// since the fd was read. The player's fd is cleared before their
+	// socket is closed, so it has changed if that happened.
+	if (conn && __atomic_load_n(&player->fd, __ATOMIC_ACQUIRE) != fd) {
+		connection_put(conn);
+		return NULL;
 	}
-#endif
+	return conn;
+}
 
-	// get a socket
-	sock = socket(PF_INET, SOCK_STREAM, 0);
-	if (sock < 0) {
-		char errmsg[256];
-		last_error_message_to_buffer(errmsg, 256);
-		fprintf(stderr, errmsg);
-		return EXIT_FAILURE;
-	}
+static void tell_party_that_the_game_started(TetrisParty *party) {
+	int i;
+	Player *player;
+	List *players = ttetris_party_get_players(party);
 
-#ifdef THIS_IS_NOT_WINDOWS
-	// forcefully attaching socket to the port
-	int opt = 1;
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt,
-	               sizeof(opt))) {
-		perror("setsockopt");
-		return EXIT_FAILURE;
+	StringArray *party_members =
+	    string_array_create(players->length, PLAYER_NAME_MAX_CHARS);
+	// each member's slot, which their boards are sent with, is their
+	// position in the list
+	for (i = 0; i < players->length; i++) {
+		player = (Player *)list_get(players, i);
+		player->party_slot = i;
+		string_array_set_item(party_members, i, player->name);
 	}
-#endif
+	Blob *party_members_blob = string_array_serialize(party_members);
 
-	// Give the socket a name.
-	name.sin_family = AF_INET;
-	name.sin_port = htons(port);
+	// every member gets the same message, so build it once and share it
+	Frame *frame =
+	    frame_create(party_members_blob->bytes, party_members_blob->length,
+	                 0, MSG_TYPE_GAME_STARTED);
+	destroy_blob(party_members_blob);
+	string_array_destroy(party_members);
 
-#ifdef THIS_IS_WINDOWS
-	WSAStringToAddress((LPSTR)host, AF_INET, NULL, (LPSOCKADDR)&name,
-	                   (LPINT)sizeof(name));
-#else
-	inet_pton(AF_INET, host, &name.sin_addr.s_addr);
+	for (i = 0; i < players->length; i++) {
+		player = (Player *)list_get(players, i);
+		Connection *conn = player_connection(player);
+		if (conn) {
+			message_queue_frame(conn->outbox, frame);
+			connection_mark_dirty(conn);
+			connection_put(conn);
+		}
+	}
+	frame_unref(frame);
+}
 
-#endif
+/**
+ * Queue the player's board for a member of their party, or the player
+ * themselves. A player whose client predicts their own game gets the game's
+ * state instead of the board. Members using datagrams get the board right
+ * away as a datagram instead.
+ */
+static void queue_board_for(Player *player, Frame *frame, Player *member) {
+	Connection *conn;
+	Frame *state = NULL;
+
+	// members in lockstep simulate the board themselves
+	if (member->lockstep || (conn = player_connection(member)) == NULL)
+		return;
+	if (member == player && player->predicts)
+		frame = state = player_state_frame(player);
+	if (member->udp &&
+	    __atomic_load_n(&member->udp->ready, __ATOMIC_ACQUIRE)) {
+		udp_send_frame(udp_sock, member->udp, frame);
+	} else {
+		message_queue_frame(conn->outbox, frame);
+		connection_mark_dirty(conn);
+	}
+	connection_put(conn);
+	frame_unref(state);
+}
 
-	if (bind(sock, (struct sockaddr *)&name, sizeof(name)) < 0) {
-		perror("bind");
-		return EXIT_FAILURE;
+/**
+ * Queue the player's board for everyone who can see it: the whole party if
+ * the player has one, or otherwise just the player. Nothing is written until
+ * the dirty connections are flushed.
+ */
+static void queue_board_for_party(Player *player) {
+	// the board is serialized once and the same frame is queued for every
+	// member of the party
+	Frame *frame = player_board_frame(player);
+
+	// if the player has no party, just send the board to the player
+	if (player->party == NULL) {
+		queue_board_for(player, frame, player);
+		frame_unref(frame);
+		return;
 	}
 
-	fprintf(logging_fp, "make_socket: binding successful to %s:%d\n", host,
-	        port);
+	List *party_members = ttetris_party_get_players(player->party);
+	for (int i = 0; i < party_members->length; i++)
+		queue_board_for(player, frame,
+		                (Player *)list_get(party_members, i));
+	frame_unref(frame);
+}
 
-	return sock;
+/**
+ * Render function for players on the server, called from the game clock for
+ * every timed change to the player's game. The frames are only queued; they
+ * are written once every game changed by the clock tick has been rendered.
+ */
+static int broadcast_board(Player *player) {
+	queue_board_for_party(player);
+	return EXIT_SUCCESS;
 }
 
-static void tell_party_that_the_game_started(TetrisParty *party) {
-	int i;
-	Player *player;
-	List *players = ttetris_party_get_players(party);
+/**
+ * Relay function for players on the server, called by the owner of the game
+ * for every event applied to it. Party members in lockstep get the event, and
+ * after every step of gravity a hash to check their copy of the game against.
+ */
+static void relay_event(Player *player, enum player_event event, int arg,
+                        uint32_t tick) {
+	Frame *frame = NULL, *hash = NULL;
+	Connection *conn;
+
+	if (player->party == NULL)
+		return;
+
+	List *party_members = ttetris_party_get_players(player->party);
+	for (int i = 0; i < party_members->length; i++) {
+		Player *member = (Player *)list_get(party_members, i);
+		if (!member->lockstep ||
+		    (conn = player_connection(member)) == NULL)
+			continue;
+		// only build the frames once someone needs them
+		if (frame == NULL) {
+			frame = lockstep_frame(player, event, arg, tick);
+			if (event == PLAYER_EVENT_GRAVITY)
+				hash = lockstep_hash_frame(player, tick);
+		}
+		message_queue_frame(conn->outbox, frame);
+		if (hash)
+			message_queue_frame(conn->outbox, hash);
+		connection_mark_dirty(conn);
+		connection_put(conn);
+	}
+	frame_unref(frame);
+	frame_unref(hash);
+}
 
-	StringArray *party_members =
-	    string_array_create(players->length, PLAYER_NAME_MAX_CHARS);
-	for (i = 0; i < players->length; i++)
-		string_array_set_item(party_members, i,
-		                      ((Player *)list_get(players, i))->name);
-	Blob *party_members_blob = string_array_serialize(party_members);
+/**
+ * Apply a batch of inputs (see MSG_TYPE_INPUTS) to the player's game
+ * @param received (optional) sequence number of the last input taken, for
+ *        inputs that may be sent more than once. Inputs up to it are skipped,
+ *        and it is moved on past the inputs taken.
+ */
+static void read_inputs(Player *player, uint16_t seq, char *body,
+                        uint16_t length, uint16_t *received) {
+	// the ring holds no more than this, so anything beyond it is dropped
+	Input inputs[INPUT_RING_SIZE];
+
+	int n = input_records_read(body, length, seq, received, inputs,
+	                           ARRAY_SIZE(inputs));
+	int posted = player_post_inputs(player, inputs, n);
+	// inputs that did not fit are taken when they are sent again
+	if (received && posted > 0)
+		__atomic_store_n(received, inputs[posted - 1].seq,
+		                 __ATOMIC_RELEASE);
+}
 
-	for (i = 0; i < players->length; i++) {
-		player = (Player *)list_get(players, i);
-		if (player->fd)
-			message_blob(player->fd, party_members_blob, 0,
-			             MSG_TYPE_GAME_STARTED);
+/**
+ * @return non-zero if the message is an input from the player
+ */
+static int is_input_message(msg_type_t message_type) {
+	switch (message_type) {
+	case MSG_TYPE_ROTATE:
+	case MSG_TYPE_TRANSLATE:
+	case MSG_TYPE_LOWER:
+	case MSG_TYPE_DROP:
+	case MSG_TYPE_SWAP_HOLD:
+	case MSG_TYPE_INPUTS:
+		return 1;
+	default:
+		return 0;
 	}
 }
 
 /**
- * Returns -1 if EOF is received or 0 otherwise.
+ * Give the player a datagram transport, if the server has a datagram socket,
+ * and reply with its token (see MSG_TYPE_DATAGRAM). Asking again gives out a
+ * new token, with which the client may send from a new address.
+ */
+static void open_datagrams(Connection *conn, Player *player, int request_id) {
+	uint64_t token = 0;
+
+	// the peer is read by other threads as soon as it is set, so it is
+	// only set once it is whole
+	if (udp_sock >= 0 && player->udp == NULL &&
+	    conn->fd < (1 << UDP_TOKEN_FD_BITS))
+		__atomic_store_n(&player->udp, udp_peer_create(conn->fd),
+		                 __ATOMIC_RELEASE);
+	else if (player->udp)
+		udp_peer_renew(player->udp, conn->fd);
+	if (player->udp)
+		token = udp_peer_token(player->udp);
+	connection_queue_nbytes(conn, (char *)&token, sizeof(token),
+	                        request_id, MSG_TYPE_DATAGRAM);
+}
+
+/**
+ * Receive the datagrams of every player using them. Each datagram carries the
+ * inputs its sender has not seen acknowledged yet, and is answered with an
+ * acknowledgement right away.
  */
-int read_from_client(SOCKET filedes) {
-	unsigned int max_errmsg = 256;
-	char errmsg[max_errmsg];
-	char buffer[MAXMSG];
-	Blob *blob;
-
-	// remember that more than one TCP packet may be read by this command
-	//	int nbytes = read(filedes, buffer, MAXMSG);
-	int nbytes = recv(filedes, buffer, MAXMSG, 0);
-
-	// exit early if there was an error
-	if (nbytes < 0) {
-		last_error_message_to_buffer(errmsg, max_errmsg);
-		fprintf(logging_fp, "read_from_client: %s\n", errmsg);
-		return EXIT_SUCCESS;
+static void *receive_datagrams(void *data) {
+	char buffer[UDP_DATAGRAM_MAX];
+	struct udp_header *udp = (struct udp_header *)buffer;
+	MessageHeader *header = (MessageHeader *)(udp + 1);
+	struct sockaddr_storage from;
+	socklen_t from_length;
+
+	while (1) {
+		from_length = sizeof(from);
+		if (udp_receive(udp_sock, buffer, &from, &from_length) < 0)
+			continue;
+
+		// boards go to wherever the first datagram with the token
+		// came from
+		Player *player = get_player_from_fd(UDP_TOKEN_FD(udp->token));
+		if (player == NULL || player->udp == NULL ||
+		    udp_peer_accept(player->udp, udp->token, &from,
+		                    from_length) != EXIT_SUCCESS) {
+			fprintf(logging_fp, "receive_datagrams: dropped a "
+			                    "datagram with an unknown token or "
+			                    "sender\n");
+			if (player)
+				player_release(player);
+			continue;
+		}
+		UdpPeer *peer = player->udp;
+
+		if (header->message_type != MSG_TYPE_INPUTS) {
+			player_release(player);
+			continue;
+		}
+		read_inputs(player, header->request_id, (char *)(header + 1),
+		            header->content_length, &peer->received);
+		connection_flush_dirty();
+
+		// an empty batch acknowledges the inputs taken
+		Frame *ack = frame_create(NULL, 0, 0, MSG_TYPE_INPUTS);
+		udp_send_frame(udp_sock, peer, ack);
+		frame_unref(ack);
+		player_release(player);
 	}
+	return NULL;
+}
 
-	// exit early if we reached the end-of-file
-	if (nbytes == 0)
-		return -1;
+/**
+ * Handle every complete message in the connection's inbox. A message that has
+ * only partially arrived is left in the inbox until the rest of it is read.
+ *
+ * Returns 0, since no message currently causes the connection to be closed.
+ */
+int read_from_client(Connection *conn) {
+	SOCKET filedes = conn->fd;
+	Blob opponents_blob;
 
-	// data was successfully read into the buffer
-	fprintf(stderr, "read_from_client: received %d bytes from client\n",
-	        nbytes);
+	// remember that more than one TCP packet may have been read
+	fprintf(stderr, "read_from_client: handling %d bytes from client\n",
+	        conn->inbox_length);
 
-	char *end = buffer + nbytes;
-	char *cursor = buffer;
+	char *end = conn->inbox + conn->inbox_length;
+	char *cursor = conn->inbox;
 
 	Player *opponent;
 	Player *player = get_player_from_fd(filedes);
-	if (player == 0) {
-		printf("read_from_client: player is null for socket file "
-		       "descriptor.\n");
-	}
+	int posted_input = 0;
 	char name[16];
 
-	while (cursor < end) {
-		MessageHeader *header = (MessageHeader *)buffer;
+	while (end - cursor >= (int)sizeof(MessageHeader)) {
+		MessageHeader *header = (MessageHeader *)cursor;
+
+		// if the magic number is wrong, we have lost track of where
+		// messages start, so the rest of the inbox is discarded
+		if (header->magic_number != MSG_MAGIC_NUMBER) {
+			fprintf(logging_fp,
+			        "read_from_client: incorrect magic number\n");
+			cursor = end;
+			break;
+		}
+
+		// wait for the rest of the message to arrive
+		if (end - cursor <
+		    (int)sizeof(MessageHeader) + header->content_length)
+			break;
+
 		fprintf(stderr,
 		        "read_from_client: magic=0x%x id=%d n_bytes=%d "
 		        "msg_type=%s\n",
@@ -159,58 +347,127 @@ int read_from_client(SOCKET filedes) {
 		// increment the cursor to the start of the message body
 		cursor += sizeof(MessageHeader);
 
+		// everything but registering and listing needs a player
+		if (player == NULL &&
+		    header->message_type != MSG_TYPE_REGISTER &&
+		    header->message_type != MSG_TYPE_LIST) {
+			fprintf(logging_fp,
+			        "read_from_client: player is null for socket "
+			        "file descriptor.\n");
+			cursor += header->content_length;
+			continue;
+		}
+
+		// once a player has switched to datagrams, their inputs are
+		// only taken from those (see Player.udp)
+		if (player && player->udp &&
+		    is_input_message(header->message_type)) {
+			cursor += header->content_length;
+			continue;
+		}
+
 		switch (header->message_type) {
 		case MSG_TYPE_START_GAME:
 			if (player->party == 0)
 				break;
-			ttetris_party_start(player->party);
+			// members in lockstep need to know the party before
+			// the first snapshots of its games arrive
 			tell_party_that_the_game_started(player->party);
+			ttetris_party_start(player->party);
 			break;
 		case MSG_TYPE_REGISTER:
 			sscanf(cursor, "%15s", name);
+			// registering again leaves the old player behind
+			if (player) {
+				player_disconnect(player);
+				player_release(player);
+			}
 			player = player_create(filedes, name);
-			player->render = send_player;
-			message_nbytes(filedes, NULL, 0, header->request_id,
-			               MSG_TYPE_REGISTER_SUCCESS);
+			if (player == NULL) {
+				connection_queue_nbytes(
+				    conn, NULL, 0, header->request_id,
+				    MSG_TYPE_REGISTER_FAILURE);
+				break;
+			}
+			// like a player that was looked up, the new one is
+			// released once the inbox has been handled
+			player_ref(player);
+			player->render = broadcast_board;
+			player->relay = relay_event;
+			connection_queue_nbytes(conn, NULL, 0,
+			                        header->request_id,
+			                        MSG_TYPE_REGISTER_SUCCESS);
 			break;
 		case MSG_TYPE_ROTATE:
-			rotate_block(player->contents, cursor[0]);
+			player_post_input(player, PLAYER_EVENT_ROTATE,
+			                  cursor[0], header->request_id);
+			posted_input = 1;
 			break;
 		case MSG_TYPE_TRANSLATE:
-			if (cursor[0]) {
-				translate_block_left(player->contents);
-			} else {
-				translate_block_right(player->contents);
-			}
+			player_post_input(player, PLAYER_EVENT_TRANSLATE,
+			                  cursor[0], header->request_id);
+			posted_input = 1;
 			break;
 		case MSG_TYPE_LOWER:
-			lower_block(player->contents, 0);
+			player_post_input(player, PLAYER_EVENT_LOWER, 0,
+			                  header->request_id);
+			posted_input = 1;
 			break;
 		case MSG_TYPE_DROP:
-			hard_drop(player->contents);
+			player_post_input(player, PLAYER_EVENT_DROP, 0,
+			                  header->request_id);
+			posted_input = 1;
 			break;
 		case MSG_TYPE_SWAP_HOLD:
-			swap_hold_block(player->contents);
+			player_post_input(player, PLAYER_EVENT_SWAP_HOLD, 0,
+			                  header->request_id);
+			posted_input = 1;
+			break;
+		case MSG_TYPE_INPUTS:
+			read_inputs(player, header->request_id, cursor,
+			            header->content_length, NULL);
+			posted_input = 1;
+			break;
+		case MSG_TYPE_PREDICT:
+			player->predicts = 1;
+			break;
+		case MSG_TYPE_DATAGRAM:
+			open_datagrams(conn, player, header->request_id);
+			break;
+		case MSG_TYPE_LOCKSTEP:
+			player->lockstep = 1;
+			break;
+		case MSG_TYPE_RESYNC:
+			// the body is the slot of the game to send again
+			if (player->party == NULL || header->content_length < 1)
+				break;
+			List *members =
+			    ttetris_party_get_players(player->party);
+			uint8_t slot = cursor[0];
+			if (slot < members->length)
+				player_post((Player *)list_get(members, slot),
+				            PLAYER_EVENT_SNAPSHOT, 0);
 			break;
 		case MSG_TYPE_OPPONENT:
-			blob = malloc(sizeof(blob));
-			blob->bytes = cursor;
-			blob->length = header->content_length;
+			opponents_blob.bytes = cursor;
+			opponents_blob.length = header->content_length;
 			StringArray *opponent_names =
-			    string_array_deserialize(blob);
+			    string_array_deserialize(&opponents_blob);
 
+			// every opponent is found before the party is handed
+			// to its members, so that it is never simulated half
+			// built
 			TetrisParty *party = ttetris_party_create();
 			ttetris_party_player_add(party, player);
-
 			for (int i = 0; i < opponent_names->length; i++) {
-
 				opponent = player_get_by_name(
 				    string_array_get_item(opponent_names, i));
-
 				if (!opponent) {
 					fprintf(logging_fp,
 					        "read_from_client: Could "
 					        "not find opponent\n");
+					ttetris_party_destroy(party);
+					party = NULL;
 					break;
 				}
 				fprintf(stderr,
@@ -218,11 +475,27 @@ int read_from_client(SOCKET filedes) {
 				        "number %d to party: %s\n",
 				        i, opponent->name);
 				ttetris_party_player_add(party, opponent);
+				player_release(opponent);
+			}
+			string_array_destroy(opponent_names);
+			if (party == NULL)
+				break;
+			ttetris_party_publish(party);
+
+			// the party's games are handled by the reactor thread
+			// serving its leader
+			List *party_members = ttetris_party_get_players(party);
+			for (int i = 1; i < party_members->length; i++) {
+				Connection *opponent_conn = player_connection(
+				    (Player *)list_get(party_members, i));
+				reactor_migrate(opponent_conn, conn->owner);
+				connection_put(opponent_conn);
 			}
 
 			break;
 		case MSG_TYPE_LIST:
-			send_online_users(filedes, header->request_id);
+			send_online_users(conn->outbox, header->request_id);
+			connection_mark_dirty(conn);
 			break;
 		default:
 			fprintf(stderr,
@@ -235,33 +508,75 @@ int read_from_client(SOCKET filedes) {
 		cursor += header->content_length;
 	}
 
+	// drop the handled messages from the inbox
+	connection_consume_inbox(conn, cursor - conn->inbox);
+
+	// Send the board, which goes out along with any replies once the
+	// caller flushes the dirty connections. Inputs render the board
+	// themselves; for a party, once the worker has applied them.
+	if (player && !posted_input)
+		player_post(player, PLAYER_EVENT_RENDER, 0);
+
+	if (player)
+		player_release(player);
+
+	return 0;
+}
+
+static void on_accept(Connection *conn) {
+	fprintf(logging_fp, "on_accept: new connection on socket %d\n",
+	        conn->fd);
+}
+
+static void on_close(Connection *conn) {
+	fprintf(logging_fp, "on_close: received EOF\n");
+	Player *player = get_player_from_fd(conn->fd);
 	if (player) {
-		// if the player has a party, send the board to all players
-		if (player->party) {
-			List *party_members =
-			    ttetris_party_get_players(player->party);
-			for (int i = 0; i < party_members->length; i++)
-				send_player(
-				    ((Player *)list_get(party_members, i))->fd,
-				    player);
-		}
-		// otherwise, just send the board to the player
-		else {
-			send_player(player->fd, player);
-		}
+		player_disconnect(player);
+		player_release(player);
 	}
+}
 
-	return 0;
+static const ReactorHandlers server_handlers = {
+    .on_accept = on_accept,
+    .on_data = read_from_client,
+    .on_close = on_close,
+};
+
+static void log_stats(Timer *timer, void *data) {
+	simulation_log_stats();
+	timer_wheel_schedule(player_game_clock(), timer,
+	                     SERVER_STATS_INTERVAL_MS);
 }
 
 void usage() {
-	fprintf(stderr, "Usage: ./server [-h] [-a ADDRESS] [-p PORT]\n");
+	fprintf(stderr, "Usage: ./server [-h] [-a ADDRESS] [-p PORT] "
+	                "[-b BACKLOG] [-r select|epoll|uring] [-t THREADS] "
+	                "[-c] [-w WORKERS] [-u] [-L LOSS] [-U PATH]\n");
 	exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[]) {
 	char host[128] = "127.0.0.1";
 	char port[6] = "5555";
+	int backlog = SOMAXCONN;
+	int nthreads = 1;
+	int pin_cpus = 0;
+	int datagrams = 0;
+	char *socket_path = NULL;
+	TransportAddress address;
+	pthread_t datagram_thread;
+	Timer stats_timer;
+#ifdef THIS_IS_NOT_WINDOWS
+	int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	int nworkers = 2;
+#endif
+#ifdef __linux__
+	enum reactor_backend backend = REACTOR_EPOLL;
+#else
+	enum reactor_backend backend = REACTOR_SELECT;
+#endif
 
 	// set the logger file pointer to stderr
 	logging_set_fp(stderr);
@@ -271,7 +586,7 @@ int main(int argc, char *argv[]) {
 	// treated differently than unknown flags. The proceding colons indicate
 	// that flags must have a value.
 	int opt;
-	while ((opt = getopt(argc, argv, ":ha:p:")) != -1) {
+	while ((opt = getopt(argc, argv, ":ha:p:b:r:t:cw:uL:U:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage();
@@ -284,6 +599,45 @@ int main(int argc, char *argv[]) {
 			strncpy(port, optarg, 5);
 			printf("port: %s\n", optarg);
 			break;
+		case 'b':
+			backlog = atoi(optarg);
+			printf("backlog: %d\n", backlog);
+			break;
+		case 'r':
+			if (reactor_backend_from_str(optarg, &backend) !=
+			    EXIT_SUCCESS) {
+				printf("unknown reactor backend: %s\n", optarg);
+				usage();
+			}
+			printf("reactor: %s\n", optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads < 1)
+				usage();
+			printf("reactor threads: %d\n", nthreads);
+			break;
+		case 'c':
+			pin_cpus = 1;
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			if (nworkers < 1)
+				usage();
+			printf("simulation workers: %d\n", nworkers);
+			break;
+		case 'u':
+			datagrams = 1;
+			break;
+		case 'L':
+			// drop datagrams on purpose, to test over loopback
+			udp_set_loss(atoi(optarg));
+			printf("datagram loss: %d%%\n", atoi(optarg));
+			break;
+		case 'U':
+			socket_path = optarg;
+			printf("socket: %s\n", optarg);
+			break;
 		case ':':
 			printf("option -%c needs a value\n", optopt);
 			break;
@@ -300,98 +654,60 @@ int main(int argc, char *argv[]) {
 		usage();
 	}
 
-	SOCKET sock;
-	fd_set active_fd_set;
-	int i;
-	struct sockaddr_in clientname;
-	size_t size;
+#ifdef THIS_IS_NOT_WINDOWS
+	// every connection holds a file descriptor, so allow as many as the
+	// hard limit permits
+	struct rlimit nofile;
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0) {
+		nofile.rlim_cur = nofile.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &nofile);
+	}
+#endif
 
-	/* Create the socket and set it up to accept connections. */
-	sock = make_socket(host, numeric_port);
-	if (listen(sock, 1) < 0) {
-		perror("listen");
-		exit(EXIT_FAILURE);
+	/* Create the sockets and set them up to accept connections. Every
+	 * reactor thread has its own socket, bound to the same port. A Unix
+	 * domain socket has a single path, so the threads share it. */
+	if (socket_path)
+		transport_address_unix(&address, socket_path);
+	else
+		transport_address_tcp(&address, host, numeric_port);
+	SOCKET *socks = malloc(sizeof(SOCKET) * nthreads);
+	for (int i = 0; i < nthreads; i++) {
+		if (socket_path && i > 0)
+			socks[i] = dup(socks[0]);
+		else
+			socks[i] = transport_listen(&address, backlog);
+		if (socks[i] < 0)
+			exit(EXIT_FAILURE);
 	}
 
 	fprintf(logging_fp, "main: Started listening\n");
 
-	// TODO What is the maximum number of sockets we can put in a file
-	//  descriptor set?
-	int max_sockets = 50;
-	SOCKET client_socket[max_sockets];
-	for (i = 0; i < max_sockets; i++)
-		client_socket[i] = 0;
+	/* Optionally, receive datagrams on the same port */
+	if (datagrams) {
+		udp_sock = udp_open(host, numeric_port, 1);
+		if (udp_sock < 0)
+			exit(EXIT_FAILURE);
+		srand(time(NULL));
+		pthread_create(&datagram_thread, NULL, receive_datagrams,
+		               NULL);
+	}
 
 	/* Initialize the player list */
 	player_init();
+	player_set_idle_timeout(SERVER_IDLE_TIMEOUT_MS);
+	player_set_tick_done(connection_flush_dirty);
 
-	while (1) {
-		// clear the socket fd set
-		FD_ZERO(&active_fd_set);
-
-		// add the main listening socket to our active set
-		FD_SET(sock, &active_fd_set);
-
-		// add (non-NULL) child sockets to the active fd set
-		for (i = 0; i < max_sockets; i++)
-			if (client_socket[i] > 0)
-				FD_SET(client_socket[i], &active_fd_set);
-
-		// Block until input arrives on one or more active sockets.
-		if (select(FD_SETSIZE, &active_fd_set, NULL, NULL, NULL) < 0) {
-			perror("select");
-			return EXIT_FAILURE;
-		}
-
-		// service the listening socket
-		//
-		// for new connections:
-		// - accept the connection
-		// - create a file descriptor for the connection
-		// - add the file descriptor to the file descriptor set
-		if (FD_ISSET(sock, &active_fd_set)) {
-			size = sizeof(clientname);
-			SOCKET new =
-			    accept(sock, (struct sockaddr *)&clientname,
-			           (socklen_t *)&size);
-			if (new < 0) {
-				perror("accept");
-				continue;
-			}
-			fprintf(logging_fp,
-			        "main: new connection from host %s, "
-			        "port %hu.\n",
-			        inet_ntoa(clientname.sin_addr),
-			        ntohs(clientname.sin_port));
-
-			FD_SET(new, &active_fd_set);
-
-			// put the socket in our manual list of sockets
-			for (i = 0; i < max_sockets; i++)
-				if (client_socket[i] == 0) {
-					client_socket[i] = new;
-					break;
-				}
-		}
+	/* Parties are simulated by a pool of workers */
+	simulation_set_batch_done(connection_flush_dirty);
+	if (simulation_start(nworkers) != EXIT_SUCCESS)
+		exit(EXIT_FAILURE);
+	timer_init(&stats_timer, log_stats, NULL);
+	timer_wheel_schedule(player_game_clock(), &stats_timer,
+	                     SERVER_STATS_INTERVAL_MS);
 
-		// service all the sockets with previously accepted connections
-		// that have input pending
-		for (i = 0; i < max_sockets; i++) {
-			SOCKET s = client_socket[i];
-
-			// exit early if the file descriptor i is not in the set
-			if (!FD_ISSET(s, &active_fd_set))
-				continue;
-
-			// handle data on sockets already in the file descriptor
-			// set
-			if (read_from_client(s) < 0) {
-				fprintf(logging_fp, "main: received EOF\n");
-				close(i);
-				client_socket[i] = 0;
-			}
-		}
-	}
+	return reactor_run_threads(backend, socks, nthreads, pin_cpus,
+	                           &server_handlers);
 }
 
 // vi:noet:noai:sw=0:sts=0:ts=8
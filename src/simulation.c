@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "simulation.h"
+
+// initial number of tasks a deque can hold before it grows
+#define SIM_DEQUE_CAPACITY 64
+
+/**
+ * Double ended queue of tasks. The owning worker pushes and pops at the back;
+ * other workers steal from the front. Every deque has its own lock, which is
+ * only contended while a task is being stolen.
+ */
+struct sim_deque {
+	SimTask **tasks;
+	/* index of the front task, and number of tasks, in the ring */
+	int front;
+	int length;
+	int capacity;
+	pthread_mutex_t lock;
+};
+
+struct sim_worker {
+	int index;
+	pthread_t thread;
+	struct sim_deque deque;
+	/* counters since the last simulation_log_stats */
+	uint64_t busy_ns;
+	unsigned long tasks_run;
+	unsigned long tasks_stolen;
+};
+
+static struct sim_worker *workers = NULL;
+static int worker_count = 0;
+static void (*batch_done)(void) = NULL;
+
+// number of tasks waiting in any deque. Workers sleep when it drops to zero.
+static int tasks_waiting = 0;
+static int sleeping_workers = 0;
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+
+// the worker run by the current thread, if any
+static __thread struct sim_worker *current_worker = NULL;
+
+// start of the period covered by the stats
+static uint64_t stats_start_ns;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sim_deque_push(struct sim_deque *deque, SimTask *task) {
+	pthread_mutex_lock(&deque->lock);
+	if (deque->length == deque->capacity) {
+		// unroll the ring into a larger array
+		int capacity = deque->capacity * 2;
+		SimTask **tasks = malloc(sizeof(SimTask *) * capacity);
+		for (int i = 0; i < deque->length; i++)
+			tasks[i] = deque->tasks[(deque->front + i) %
+			                        deque->capacity];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->front = 0;
+		deque->capacity = capacity;
+	}
+	deque->tasks[(deque->front + deque->length) % deque->capacity] = task;
+	deque->length++;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static SimTask *sim_deque_pop_back(struct sim_deque *deque) {
+	SimTask *task = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->length > 0) {
+		deque->length--;
+		task = deque->tasks[(deque->front + deque->length) %
+		                    deque->capacity];
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
+
+static SimTask *sim_deque_steal_front(struct sim_deque *deque) {
+	SimTask *task = NULL;
+
+	// don't queue up behind a busy owner, just try another deque
+	if (pthread_mutex_trylock(&deque->lock) != 0)
+		return NULL;
+	if (deque->length > 0) {
+		task = deque->tasks[deque->front];
+		deque->front = (deque->front + 1) % deque->capacity;
+		deque->length--;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
+
+/**
+ * queue a task on a worker's deque, and wake a worker if any are asleep
+ */
+static void sim_enqueue(struct sim_worker *worker, SimTask *task) {
+	sim_deque_push(&worker->deque, task);
+
+	pthread_mutex_lock(&sleep_lock);
+	tasks_waiting++;
+	if (sleeping_workers > 0)
+		pthread_cond_signal(&sleep_cond);
+	pthread_mutex_unlock(&sleep_lock);
+}
+
+/**
+ * Find the next task for a worker: its own newest task, or else the oldest
+ * task of another worker. Sleeps until a task is available.
+ */
+static SimTask *sim_next_task(struct sim_worker *worker) {
+	SimTask *task;
+
+	while (1) {
+		task = sim_deque_pop_back(&worker->deque);
+
+		// start with the next worker, so that thieves spread out
+		for (int i = 1; !task && i < worker_count; i++) {
+			struct sim_worker *victim =
+			    &workers[(worker->index + i) % worker_count];
+			if ((task = sim_deque_steal_front(&victim->deque)))
+				worker->tasks_stolen++;
+		}
+
+		pthread_mutex_lock(&sleep_lock);
+		if (task) {
+			tasks_waiting--;
+			pthread_mutex_unlock(&sleep_lock);
+			return task;
+		}
+		// a task queued since we looked is found on the next pass
+		if (tasks_waiting == 0) {
+			sleeping_workers++;
+			pthread_cond_wait(&sleep_cond, &sleep_lock);
+			sleeping_workers--;
+		}
+		pthread_mutex_unlock(&sleep_lock);
+	}
+}
+
+static void *sim_worker_loop(void *input) {
+	struct sim_worker *worker = (struct sim_worker *)input;
+	SimTask *task;
+	uint64_t start;
+
+	current_worker = worker;
+	fprintf(logging_fp, "sim_worker_loop: worker %d started\n",
+	        worker->index);
+
+	while (1) {
+		task = sim_next_task(worker);
+
+		start = now_ns();
+		task->run(task);
+		if (batch_done)
+			batch_done();
+		worker->busy_ns += now_ns() - start;
+		worker->tasks_run++;
+
+		// run the task again if it was scheduled while it ran,
+		// otherwise let the next schedule queue it
+		if (__sync_bool_compare_and_swap(&task->state, SIM_TASK_QUEUED,
+		                                 SIM_TASK_IDLE))
+			continue;
+		task->state = SIM_TASK_QUEUED;
+		sim_enqueue(worker, task);
+	}
+	return NULL;
+}
+
+int simulation_start(int nworkers) {
+	workers = calloc(sizeof(struct sim_worker), nworkers);
+	for (int i = 0; i < nworkers; i++) {
+		workers[i].index = i;
+		workers[i].deque.capacity = SIM_DEQUE_CAPACITY;
+		workers[i].deque.tasks =
+		    malloc(sizeof(SimTask *) * SIM_DEQUE_CAPACITY);
+		pthread_mutex_init(&workers[i].deque.lock, NULL);
+	}
+	stats_start_ns = now_ns();
+
+	for (int i = 0; i < nworkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, sim_worker_loop,
+		                   &workers[i])) {
+			fprintf(logging_fp, "simulation_start: could not "
+			                    "create worker thread\n");
+			return EXIT_FAILURE;
+		}
+		// publish each worker only once its thread exists
+		__sync_synchronize();
+		worker_count = i + 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+int simulation_running(void) { return worker_count > 0; }
+
+void simulation_task_init(SimTask *task, void (*run)(SimTask *task)) {
+	static int next_home = 0;
+
+	memset(task, 0, sizeof(SimTask));
+	task->run = run;
+	task->state = SIM_TASK_IDLE;
+	task->home = __sync_fetch_and_add(&next_home, 1);
+}
+
+void simulation_schedule(SimTask *task) {
+	int state;
+
+	while (1) {
+		state = task->state;
+		if (state == SIM_TASK_IDLE) {
+			if (__sync_bool_compare_and_swap(&task->state, state,
+			                                 SIM_TASK_QUEUED))
+				break;
+		} else if (state == SIM_TASK_QUEUED) {
+			// the task may already be running, so make sure it
+			// runs once more. If it has not started yet, that
+			// costs one extra (empty) run.
+			if (__sync_bool_compare_and_swap(&task->state, state,
+			                                 SIM_TASK_RERUN))
+				return;
+		} else {
+			return;
+		}
+	}
+
+	// a worker keeps the tasks it schedules; anyone else queues the task
+	// on its home worker
+	if (current_worker)
+		sim_enqueue(current_worker, task);
+	else
+		sim_enqueue(&workers[task->home % worker_count], task);
+}
+
+void simulation_set_batch_done(void (*fn)(void)) { batch_done = fn; }
+
+void simulation_log_stats(void) {
+	uint64_t now = now_ns();
+	double elapsed = now - stats_start_ns;
+
+	for (int i = 0; i < worker_count; i++) {
+		struct sim_worker *worker = &workers[i];
+		fprintf(logging_fp,
+		        "simulation_log_stats: worker %d: %.1f%% busy, %lu "
+		        "tasks run, %lu stolen\n",
+		        i, elapsed > 0 ? 100.0 * worker->busy_ns / elapsed : 0,
+		        worker->tasks_run, worker->tasks_stolen);
+		// the counters are only written by the worker, so the reset
+		// may lose a few counts, which is fine for stats
+		worker->busy_ns = 0;
+		worker->tasks_run = 0;
+		worker->tasks_stolen = 0;
+	}
+	stats_start_ns = now;
+}
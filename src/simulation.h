@@ -0,0 +1,72 @@
+/**
+ * A fixed pool of worker threads that simulates parties.
+ *
+ * Work is described by tasks. Scheduling a task queues it on a worker's
+ * deque, unless it is already queued or running, so a task is never run by
+ * two workers at once. Whatever a task touches therefore needs no locking, as
+ * long as only that task touches it.
+ *
+ * A worker takes the newest task from the back of its own deque. A worker
+ * that runs out of tasks steals the oldest task from the front of another
+ * worker's deque before going to sleep.
+ */
+#ifndef TTETRIS_SIMULATION_H
+#define TTETRIS_SIMULATION_H
+
+enum sim_task_state {
+	SIM_TASK_IDLE,
+	/* queued on a deque, or running */
+	SIM_TASK_QUEUED,
+	/* running, and scheduled again since it started */
+	SIM_TASK_RERUN,
+};
+
+typedef struct ttetris_sim_task SimTask;
+
+struct ttetris_sim_task {
+	/* called on a worker thread for every time the task is scheduled,
+	 * although schedules that arrive before it runs are merged */
+	void (*run)(SimTask *task);
+	/* enum sim_task_state, changed atomically */
+	int state;
+	/* worker that the task is queued on when scheduled from outside the
+	 * pool, so that it tends to stay on the same core */
+	int home;
+};
+
+/**
+ * Start the worker threads. Until this is called, simulation_running returns
+ * zero and callers are expected to do the work themselves.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int simulation_start(int nworkers);
+
+/**
+ * @return non-zero if the worker pool has been started
+ */
+int simulation_running(void);
+
+/**
+ * Prepare a task for use
+ */
+void simulation_task_init(SimTask *task, void (*run)(SimTask *task));
+
+/**
+ * Make sure that the task runs (again) on some worker. May be called from
+ * any thread.
+ */
+void simulation_schedule(SimTask *task);
+
+/**
+ * Call fn on the worker thread after every task it runs, for example to
+ * write out everything the task produced
+ */
+void simulation_set_batch_done(void (*fn)(void));
+
+/**
+ * Log how busy each worker has been since the last call, how many tasks it
+ * ran and how many of them it stole
+ */
+void simulation_log_stats(void);
+
+#endif // TTETRIS_SIMULATION_H
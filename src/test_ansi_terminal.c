@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ansi_terminal.h"
+#include "framebuffer.h"
+
+#define ROWS 30
+#define COLUMNS 80
+
+static int pipe_fds[2];
+
+/**
+ * Flush a frame, and check that exactly the expected bytes were written
+ * @return 0 if they were
+ */
+static int flush_writes(AnsiTerminal *terminal, Framebuffer *frame,
+                        char *expected) {
+	static char buffer[4 * ROWS * COLUMNS];
+	int n = ansi_terminal_flush(terminal, frame), length = 0;
+
+	if (n > 0)
+		length = read(pipe_fds[0], buffer, sizeof(buffer));
+	if (n != (int)strlen(expected) || length != n ||
+	    memcmp(buffer, expected, n) != 0) {
+		fprintf(stderr, "expected %zu bytes, wrote %d\n",
+		        strlen(expected), n);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void) {
+	int failures = 0;
+
+	if (pipe(pipe_fds) < 0)
+		return EXIT_FAILURE;
+	Framebuffer *frame = framebuffer_create(ROWS, COLUMNS);
+	AnsiTerminal *terminal = ansi_terminal_create(pipe_fds[1]);
+
+	// the first frame clears the screen, and a blank frame needs nothing
+	// more
+	failures += flush_writes(terminal, frame, "\e[m\e[H\e[2J");
+	// an unchanged frame is not written at all
+	failures += flush_writes(terminal, frame, "");
+	if (failures == 0)
+		fprintf(stderr, "Test 1: only the first frame was written.\n");
+	else
+		fprintf(stderr, "Test 1: %d frames went wrong\n", failures);
+	int total = failures;
+
+	// changed cells are reached by moving the cursor, and colors are only
+	// changed where they change
+	failures = 0;
+	framebuffer_text(frame, 2, 10, "ab");
+	frame->cells[2 * COLUMNS + 20] = (FramebufferCell){' ', orange};
+	frame->cells[2 * COLUMNS + 21] = (FramebufferCell){' ', orange};
+	failures += flush_writes(terminal, frame, "\e[3;11Hab\e[8C\e[31;41m  ");
+	// short runs of unchanged cells are written over rather than moved
+	// past
+	frame->cells[2 * COLUMNS + 10].ch = 'x';
+	frame->cells[2 * COLUMNS + 12].ch = 'y';
+	failures += flush_writes(terminal, frame, "\e[3;11H\e[mxby");
+	if (failures == 0)
+		fprintf(stderr, "Test 2: only the changed cells were "
+		                "written.\n");
+	else
+		fprintf(stderr, "Test 2: %d frames went wrong\n", failures);
+	total += failures;
+
+	// once forgotten, the screen is cleared and drawn again
+	failures = 0;
+	ansi_terminal_forget(terminal);
+	failures += flush_writes(terminal, frame,
+	                         "\e[m\e[H\e[2J\e[3;11Hxby\e[7C\e[31;41m  ");
+	if (failures == 0)
+		fprintf(stderr, "Test 3: a forgotten screen was drawn "
+		                "again.\n");
+	else
+		fprintf(stderr, "Test 3: %d frames went wrong\n", failures);
+	total += failures;
+
+	// halves are drawn with half blocks, in the colors of both halves
+	failures = 0;
+	frame->cells[4 * COLUMNS] =
+	    (FramebufferCell){FRAMEBUFFER_HALVES, orange, cleve};
+	frame->cells[4 * COLUMNS + 1] =
+	    (FramebufferCell){FRAMEBUFFER_HALVES, no_type, hero};
+	failures += flush_writes(terminal, frame,
+	                         "\e[5;1H\e[31;42m\xe2\x96\x80"
+	                         "\e[36;49m\xe2\x96\x84");
+	if (failures == 0)
+		fprintf(stderr, "Test 4: halves were drawn with half "
+		                "blocks.\n");
+	else
+		fprintf(stderr, "Test 4: %d frames went wrong\n", failures);
+	total += failures;
+
+	ansi_terminal_destroy(terminal);
+	framebuffer_destroy(frame);
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_slot.h"
+
+#define FRAME_COUNT 200000
+#define WRITER_COUNT 2
+
+static FrameSlot slot;
+
+/**
+ * Fill every field of a frame with the same number, so that a frame copied
+ * out halfway through being written can be told apart
+ */
+static void fill_frame(struct game_view_data *view, int n) {
+	for (int r = 0; r < BOARD_HEIGHT; r++)
+		for (int c = 0; c < BOARD_WIDTH; c++)
+			view->board[r][c] = n;
+	view->next_block = n;
+	view->hold_block = n;
+	view->points = n;
+	view->lines_cleared = n;
+}
+
+static int frame_is_whole(struct game_view_data *view) {
+	for (int r = 0; r < BOARD_HEIGHT; r++)
+		for (int c = 0; c < BOARD_WIDTH; c++)
+			if (view->board[r][c] != view->points)
+				return 0;
+	return view->next_block == (enum block_type)view->points &&
+	       view->hold_block == (enum block_type)view->points &&
+	       view->lines_cleared == view->points;
+}
+
+static void *publish_frames(void *data) {
+	static struct game_view_data views[WRITER_COUNT];
+	int writer = (int)(long)data;
+	struct game_view_data *view = &views[writer];
+
+	for (int i = 1; i <= FRAME_COUNT; i++) {
+		fill_frame(view, i * WRITER_COUNT + writer);
+		frame_slot_publish(&slot, view);
+	}
+	return NULL;
+}
+
+/**
+ * Read frames while several writers publish them. Every frame read must be
+ * whole, and the sequence must only move forward.
+ * @return number of frames that were not whole, or went backwards
+ */
+static int read_while_publishing(int *nread) {
+	pthread_t writers[WRITER_COUNT];
+	struct game_view_data view;
+	unsigned sequence, last = 0;
+	int failures = 0;
+
+	for (long i = 0; i < WRITER_COUNT; i++)
+		pthread_create(&writers[i], NULL, publish_frames, (void *)i);
+	*nread = 0;
+	while (last != 2u * FRAME_COUNT * WRITER_COUNT) {
+		if (frame_slot_sequence(&slot) == last)
+			continue;
+		sequence = frame_slot_read(&slot, &view);
+		if (sequence & 1 || sequence < last || !frame_is_whole(&view))
+			failures++;
+		last = sequence;
+		(*nread)++;
+	}
+	for (int i = 0; i < WRITER_COUNT; i++)
+		pthread_join(writers[i], NULL);
+	return failures;
+}
+
+/**
+ * Publish several frames without reading any. Only the last is read.
+ * @return 0 if it was
+ */
+static int read_latest(void) {
+	struct game_view_data view;
+	unsigned sequence = frame_slot_sequence(&slot);
+
+	for (int i = 1; i <= 3; i++) {
+		fill_frame(&view, i);
+		frame_slot_publish(&slot, &view);
+	}
+	return frame_slot_read(&slot, &view) != sequence + 6 ||
+	       !frame_is_whole(&view) || view.points != 3;
+}
+
+int main(void) {
+	int failures, latest, nread;
+
+	failures = read_while_publishing(&nread);
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d frames were read whole, %d were "
+		                "skipped.\n",
+		        nread, FRAME_COUNT * WRITER_COUNT - nread);
+	else
+		fprintf(stderr, "Test 1: %d frames went wrong\n", failures);
+
+	latest = read_latest();
+	if (latest == 0)
+		fprintf(stderr, "Test 2: only the latest frame was read.\n");
+	else
+		fprintf(stderr, "Test 2: an older frame was read\n");
+
+	return failures || latest ? EXIT_FAILURE : EXIT_SUCCESS;
+}
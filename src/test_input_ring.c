@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "input_ring.h"
+
+#define INPUT_COUNT 1000000
+
+static InputRing ring;
+
+static void *produce(void *data) {
+	Input input = {0, 0, 0, 0, 0};
+
+	for (uint64_t i = 0; i < INPUT_COUNT; i++) {
+		input.timestamp_ms = i;
+		// wait for the consumer to catch up
+		while (input_ring_push(&ring, &input) != EXIT_SUCCESS)
+			sched_yield();
+	}
+	return NULL;
+}
+
+int main(void) {
+	pthread_t producer;
+	Input input;
+	uint64_t expected = 0;
+	int failures = 0;
+
+	// every input must come out exactly once, in the order it went in
+	pthread_create(&producer, NULL, produce, NULL);
+	while (expected < INPUT_COUNT) {
+		if (input_ring_pop(&ring, &input) != EXIT_SUCCESS) {
+			sched_yield();
+			continue;
+		}
+		if (input.timestamp_ms != expected)
+			failures++;
+		expected = input.timestamp_ms + 1;
+	}
+	pthread_join(producer, NULL);
+
+	if (input_ring_pop(&ring, &input) == EXIT_SUCCESS)
+		failures++;
+
+	if (failures == 0)
+		fprintf(stderr, "Test 1: every input arrived in order.\n");
+	else
+		fprintf(stderr, "Test 1: %d inputs arrived out of order\n",
+		        failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list.h"
+
+#define ITEM_COUNT 10000
+
+int main(void) {
+	List *list = list_create();
+	int failures = 0;
+
+	// items come back in the order they were appended
+	for (intptr_t i = 0; i < ITEM_COUNT; i++)
+		list_append(list, (void *)(i + 1));
+	if (list->length != ITEM_COUNT)
+		failures++;
+	for (intptr_t i = 0; i < ITEM_COUNT; i++)
+		if (list_get(list, i) != (void *)(i + 1))
+			failures++;
+	if (list_get(list, -1) != NULL || list_get(list, ITEM_COUNT) != NULL)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d items were appended in order.\n",
+		        ITEM_COUNT);
+	else
+		fprintf(stderr, "Test 1: %d items went wrong\n", failures);
+	int total = failures;
+
+	// removing an item moves the last one into its place
+	failures = 0;
+	if (list_swap_remove(list, 0) != (void *)1 ||
+	    list_get(list, 0) != (void *)ITEM_COUNT ||
+	    list->length != ITEM_COUNT - 1)
+		failures++;
+	while (list->length > 0)
+		if (list_swap_remove(list, list->length / 2) == NULL)
+			failures++;
+	if (list_swap_remove(list, 0) != NULL)
+		failures++;
+	// the list can be used again once empty
+	list_append(list, (void *)7);
+	if (list_get(list, 0) != (void *)7 || list->length != 1)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 2: items were removed.\n");
+	else
+		fprintf(stderr, "Test 2: %d removals went wrong\n", failures);
+	total += failures;
+
+	list_free(list);
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
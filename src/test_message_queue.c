@@ -0,0 +1,237 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "log.h"
+#include "message.h"
+
+#define FRAME_COUNT 2000
+#define MAX_IOV 16
+// small enough that most flushes only write part of the queue
+#define SEND_BUFFER_SIZE 4096
+
+/**
+ * Create a connected pair of sockets, whose writing end never blocks and
+ * holds little
+ */
+static int socket_pair(SOCKET fds[2]) {
+	int size = SEND_BUFFER_SIZE;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
+	}
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	socket_set_nonblocking(fds[0]);
+	socket_set_nonblocking(fds[1]);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * A numbered frame with a body of a length that varies with the number
+ */
+static Frame *numbered_frame(int i) {
+	int n = (i * 37) % 700;
+	Frame *frame = frame_create(NULL, n, i % 65536, MSG_TYPE_BOARD);
+	for (int j = 0; j < n; j++)
+		frame_body(frame)[j] = (char)(i + j);
+	return frame;
+}
+
+/**
+ * Read whatever has arrived, at most limit bytes
+ * @return number of bytes read
+ */
+static int drain(SOCKET fd, char *into, int limit) {
+	int n = read(fd, into, limit);
+	return n > 0 ? n : 0;
+}
+
+/**
+ * Queue the same frames for two sockets, and flush both while reading little
+ * at a time, so that writes stop in the middle of frames. Each socket must
+ * get exactly the frames' bytes, and the queues must give up every reference
+ * they took.
+ * @return number of things that went wrong
+ */
+static int flush_shared_frames(void) {
+	static Frame *frames[FRAME_COUNT];
+	static char expected[FRAME_COUNT * 800];
+	static char received[2][FRAME_COUNT * 800];
+	int expected_length = 0, received_length[2] = {0, 0};
+	SOCKET fds[2][2];
+	MessageQueue *queues[2];
+	int failures = 0;
+
+	for (int q = 0; q < 2; q++) {
+		if (socket_pair(fds[q]) != EXIT_SUCCESS)
+			return 1;
+		queues[q] = message_queue_create();
+	}
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		frames[i] = numbered_frame(i);
+		memcpy(expected + expected_length, frames[i]->bytes,
+		       frames[i]->length);
+		expected_length += frames[i]->length;
+		for (int q = 0; q < 2; q++)
+			message_queue_frame(queues[q], frames[i]);
+	}
+
+	for (int round = 0; round < 100000; round++) {
+		int pending = 0;
+		for (int q = 0; q < 2; q++) {
+			int left = message_queue_flush(queues[q], fds[q][0]);
+			if (left < 0)
+				return failures + 1;
+			pending += left;
+			// the two readers take different amounts, so the
+			// queues are cut at different places
+			received_length[q] += drain(
+			    fds[q][1], received[q] + received_length[q],
+			    q == 0 ? 1000 : 333);
+		}
+		if (pending == 0 && received_length[0] == expected_length &&
+		    received_length[1] == expected_length)
+			break;
+	}
+
+	for (int q = 0; q < 2; q++) {
+		if (received_length[q] != expected_length ||
+		    memcmp(received[q], expected, expected_length) != 0)
+			failures++;
+		if (message_queue_pending(queues[q]) != 0)
+			failures++;
+	}
+	// only the test's own reference is left
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		if (frames[i]->refcount != 1)
+			failures++;
+		frame_unref(frames[i]);
+	}
+	for (int q = 0; q < 2; q++) {
+		message_queue_destroy(queues[q]);
+		close(fds[q][0]);
+		close(fds[q][1]);
+	}
+	return failures;
+}
+
+struct appender {
+	MessageQueue *queue;
+	/* the bytes of every frame appended, in order */
+	char *expected;
+	int expected_length;
+	/* set once every frame was appended */
+	int finished;
+};
+
+/**
+ * Append numbered frames to the queue while the other thread writes it
+ */
+static void *append_frames(void *data) {
+	struct appender *appender = (struct appender *)data;
+
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		Frame *frame = numbered_frame(i);
+		memcpy(appender->expected + appender->expected_length,
+		       frame->bytes, frame->length);
+		appender->expected_length += frame->length;
+		message_queue_frame(appender->queue, frame);
+		frame_unref(frame);
+		if (i % 16 == 0)
+			usleep(100);
+	}
+	__atomic_store_n(&appender->finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ * Write the queue asynchronously, the way the io_uring backend does, a few
+ * bytes less than asked for each time, while another thread keeps appending.
+ * A flush in the middle of a write must not write anything, and the socket
+ * must get every frame exactly once, in order.
+ * @return number of things that went wrong
+ */
+static int write_while_appending(void) {
+	static char expected[FRAME_COUNT * 800];
+	static char received[FRAME_COUNT * 800];
+	struct appender appender = {message_queue_create(), expected, 0, 0};
+	struct iovec iov[MAX_IOV];
+	int received_length = 0, failures = 0;
+	pthread_t thread;
+	SOCKET fds[2];
+
+	if (socket_pair(fds) != EXIT_SUCCESS)
+		return 1;
+	pthread_create(&thread, NULL, append_frames, &appender);
+
+	for (int round = 0; round < 1000000; round++) {
+		int iovcnt = message_queue_begin_write(appender.queue, iov,
+		                                       MAX_IOV);
+		if (iovcnt > 0) {
+			// a write in progress keeps others off the queue, and
+			// anything they wrote would show up twice
+			int pending = message_queue_pending(appender.queue);
+			if (message_queue_flush(appender.queue, fds[0]) <
+			    pending)
+				failures++;
+
+			// only send part of what was asked for
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovcnt;
+			if (iovcnt > 1)
+				msg.msg_iovlen = 1 + round % iovcnt;
+			else if (iov[0].iov_len > 1)
+				iov[0].iov_len -= round % iov[0].iov_len;
+			int n = sendmsg(fds[0], &msg, MSG_DONTWAIT);
+			message_queue_end_write(appender.queue, n);
+		}
+		received_length +=
+		    drain(fds[1], received + received_length, 700);
+
+		if (__atomic_load_n(&appender.finished, __ATOMIC_ACQUIRE) &&
+		    message_queue_pending(appender.queue) == 0 &&
+		    received_length == appender.expected_length)
+			break;
+	}
+	pthread_join(thread, NULL);
+
+	if (received_length != appender.expected_length ||
+	    memcmp(received, expected, received_length) != 0)
+		failures++;
+	message_queue_destroy(appender.queue);
+	close(fds[0]);
+	close(fds[1]);
+	return failures;
+}
+
+int main(void) {
+	logging_set_fp(fopen("/dev/null", "w"));
+
+	int failures = flush_shared_frames();
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d frames shared by two queues were "
+		                "written whole, across partial writes.\n",
+		        FRAME_COUNT);
+	else
+		fprintf(stderr, "Test 1: %d things went wrong\n", failures);
+	int total = failures;
+
+	failures = write_while_appending();
+	if (failures == 0)
+		fprintf(stderr, "Test 2: frames appended during asynchronous "
+		                "writes went out once, in order.\n");
+	else
+		fprintf(stderr, "Test 2: %d things went wrong\n", failures);
+	total += failures;
+
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,14 +1,138 @@
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "log.h"
 #include "player.h"
 
+#define PLAYER_COUNT 2000
+
+/**
+ * Look a player up, giving the reference back right away, since only the
+ * pointer is compared
+ */
+static struct st_player *by_fd(int fd) {
+	struct st_player *player = get_player_from_fd(fd);
+	if (player)
+		player_release(player);
+	return player;
+}
+
+static struct st_player *by_name(char *name) {
+	struct st_player *player = player_get_by_name(name);
+	if (player)
+		player_release(player);
+	return player;
+}
+
 int main(void) {
+	int failures = 0;
+
+	logging_set_fp(fopen("/dev/null", "w"));
 	player_init();
 	struct st_player *george = player_create(0, "George");
 
-	if (get_player_from_fd(0) == george)
+	if (by_fd(0) == george)
 		fprintf(stderr,
 		        "Test 1: George stored and retrieved successfully.\n");
 	else
 		fprintf(stderr, "Test 1: Failed to retrieve player George\n");
+	int total = by_fd(0) != george;
+
+	// a lobby of players can be found by connection and by name
+	static struct st_player *players[PLAYER_COUNT];
+	char name[16];
+	for (int i = 0; i < PLAYER_COUNT; i++) {
+		snprintf(name, sizeof(name), "player%d", i);
+		players[i] = player_create(i + 1, name);
+	}
+	for (int i = 0; i < PLAYER_COUNT; i++) {
+		snprintf(name, sizeof(name), "player%d", i);
+		if (by_fd(i + 1) != players[i] || by_name(name) != players[i])
+			failures++;
+	}
+	if (by_name("nobody") != NULL)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 2: %d players were found by fd and by "
+		                "name.\n",
+		        PLAYER_COUNT);
+	else
+		fprintf(stderr, "Test 2: %d lookups went wrong\n", failures);
+	total += failures;
+
+	// players who disconnected can no longer be found, and their names
+	// can be taken again
+	failures = 0;
+	for (int i = 0; i < PLAYER_COUNT; i += 2)
+		player_set_fd(players[i], -1);
+	for (int i = 0; i < PLAYER_COUNT; i++) {
+		snprintf(name, sizeof(name), "player%d", i);
+		struct st_player *expected = i % 2 ? players[i] : NULL;
+		if (by_fd(i + 1) != expected || by_name(name) != expected)
+			failures++;
+	}
+	struct st_player *again = player_create(1, "player0");
+	if (by_fd(1) != again || by_name("player0") != again ||
+	    by_name("player1") != players[1])
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 3: disconnected players were taken out "
+		                "of the registry.\n");
+	else
+		fprintf(stderr, "Test 3: %d lookups went wrong\n", failures);
+	total += failures;
+
+	// players who leave are taken out of the list of players, however
+	// many come and go
+	failures = 0;
+	for (int round = 0; round < 10; round++) {
+		for (int i = 1; i < PLAYER_COUNT; i += 2) {
+			player_disconnect(players[i]);
+			snprintf(name, sizeof(name), "player%d", i);
+			players[i] = player_create(i + 1, name);
+		}
+	}
+	for (int i = 1; i < PLAYER_COUNT; i += 2)
+		player_disconnect(players[i]);
+	player_disconnect(again);
+	player_disconnect(george);
+	StringArray *names = player_names(0);
+	if (names->length != 0)
+		failures++;
+	if (by_fd(2) != NULL || by_name("player1") != NULL)
+		failures++;
+	string_array_destroy(names);
+	if (failures == 0)
+		fprintf(stderr, "Test 4: players who left were taken out of "
+		                "the list.\n");
+	else
+		fprintf(stderr, "Test 4: %d players were left behind\n",
+		        failures);
+	total += failures;
+
+	// a name stays with the connected player who has it, and is only free
+	// again once they left
+	failures = 0;
+	struct st_player *first = player_create(1, "Twin");
+	if (player_create(2, "Twin") != NULL)
+		failures++;
+	if (by_fd(1) != first || by_fd(2) != NULL ||
+	    by_name("Twin") != first)
+		failures++;
+	player_disconnect(first);
+	struct st_player *second = player_create(2, "Twin");
+	if (second == NULL || by_name("Twin") != second)
+		failures++;
+	if (second)
+		player_disconnect(second);
+	if (by_name("Twin") != NULL)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 5: a name was only taken once at a "
+		                "time.\n");
+	else
+		fprintf(stderr, "Test 5: %d checks went wrong\n", failures);
+	total += failures;
+
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
 }
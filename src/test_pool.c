@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+#define OBJECT_COUNT 1000
+
+struct object {
+	int number;
+	char padding[20];
+};
+
+static Pool object_pool = POOL_INITIALIZER(struct object, 64);
+
+int main(void) {
+	static struct object *objects[OBJECT_COUNT];
+	int failures = 0;
+
+	// objects are zeroed, aligned, and apart from each other
+	for (int i = 0; i < OBJECT_COUNT; i++) {
+		objects[i] = pool_alloc(&object_pool);
+		if (objects[i]->number != 0 || (size_t)objects[i] % 16)
+			failures++;
+		objects[i]->number = i;
+		memset(objects[i]->padding, 0xff, sizeof(objects[i]->padding));
+	}
+	for (int i = 0; i < OBJECT_COUNT; i++)
+		if (objects[i]->number != i)
+			failures++;
+	if (pool_in_use(&object_pool) != OBJECT_COUNT ||
+	    pool_capacity(&object_pool) < OBJECT_COUNT)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d objects were allocated.\n",
+		        OBJECT_COUNT);
+	else
+		fprintf(stderr, "Test 1: %d objects went wrong\n", failures);
+	int total = failures;
+
+	// objects that come and go reuse the memory of those freed, rather
+	// than growing the pool
+	failures = 0;
+	int capacity = pool_capacity(&object_pool);
+	for (int round = 0; round < 100; round++) {
+		for (int i = round % 2; i < OBJECT_COUNT; i += 2)
+			pool_free(&object_pool, objects[i]);
+		for (int i = round % 2; i < OBJECT_COUNT; i += 2) {
+			objects[i] = pool_alloc(&object_pool);
+			if (objects[i]->padding[0] != 0)
+				failures++;
+			objects[i]->padding[0] = 1;
+		}
+	}
+	if (pool_capacity(&object_pool) != capacity ||
+	    pool_in_use(&object_pool) != OBJECT_COUNT)
+		failures++;
+	for (int i = 0; i < OBJECT_COUNT; i++)
+		pool_free(&object_pool, objects[i]);
+	pool_free(&object_pool, NULL);
+	if (pool_in_use(&object_pool) != 0)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 2: freed objects were reused.\n");
+	else
+		fprintf(stderr, "Test 2: %d objects went wrong\n", failures);
+	total += failures;
+
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "prediction.h"
+
+#define INPUT_COUNT 10000
+// number of inputs in flight between the client and the server
+#define LATENCY 8
+
+struct sent_input {
+	uint16_t seq;
+	int event;
+	int arg;
+};
+
+/**
+ * Play a game on a simulated server and a predicting client, with the server
+ * lagging LATENCY inputs behind. If gravity is on, the server also lowers the
+ * block on its own now and then, which the client cannot predict.
+ * @return number of times the prediction was rolled back, or -1 if the
+ *         client and server disagree in the end
+ */
+static long play(int gravity) {
+	static struct sent_input sent[INPUT_COUNT];
+	struct game_contents *server = NULL;
+	struct game_state state, predicted;
+	Prediction *prediction = prediction_create();
+	int applied = 0;
+	uint16_t ack = 0;
+
+	srand(1);
+	new_seeded_game(&server, 42);
+	save_game_state(server, &state);
+	prediction_reconcile(prediction, 0, &state);
+
+	for (int i = 0; i < INPUT_COUNT; i++) {
+		// mostly moves, with the occasional drop
+		int event = PLAYER_EVENT_ROTATE + rand() % 3;
+		if (rand() % 20 == 0)
+			event = PLAYER_EVENT_DROP + rand() % 2;
+		int arg = rand() % 2;
+		sent[i] = (struct sent_input){
+		    prediction_input(prediction, event, arg), event, arg};
+
+		// the server catches up to the inputs sent LATENCY ago
+		for (; applied <= i - LATENCY; applied++) {
+			player_apply_event(server, sent[applied].event,
+			                   sent[applied].arg);
+			ack = sent[applied].seq;
+		}
+		if (gravity && rand() % 10 == 0)
+			lower_block(server, 1);
+		save_game_state(server, &state);
+		prediction_reconcile(prediction, ack, &state);
+	}
+
+	for (; applied < INPUT_COUNT; applied++) {
+		player_apply_event(server, sent[applied].event,
+		                   sent[applied].arg);
+		ack = sent[applied].seq;
+	}
+	save_game_state(server, &state);
+	prediction_reconcile(prediction, ack, &state);
+
+	long rollbacks = prediction->rollbacks;
+	save_game_state(prediction->contents, &predicted);
+	if (memcmp(&predicted, &state, sizeof(state)) != 0 ||
+	    prediction->pending_length != 0)
+		rollbacks = -1;
+
+	destroy_game(&server);
+	prediction_destroy(prediction);
+	return rollbacks;
+}
+
+int main(void) {
+	int failures = 0;
+
+	logging_set_fp(stderr);
+
+	// without anything the client cannot see coming, every prediction
+	// should hold
+	long rollbacks = play(0);
+	if (rollbacks == 0) {
+		fprintf(stderr, "Test 1: the prediction was always right.\n");
+	} else {
+		fprintf(stderr, "Test 1: %ld rollbacks without gravity\n",
+		        rollbacks);
+		failures++;
+	}
+
+	rollbacks = play(1);
+	if (rollbacks > 0) {
+		fprintf(stderr,
+		        "Test 2: the prediction was corrected %ld times, and "
+		        "agrees with the server.\n",
+		        rollbacks);
+	} else {
+		fprintf(stderr, "Test 2: the prediction disagrees with the "
+		                "server\n");
+		failures++;
+	}
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "render.h"
+#include "render_layout.h"
+#include "tetris_game.h"
+
+#define ROWS 30
+#define COLUMNS 80
+
+static FramebufferCell cell_at(Framebuffer *fb, int y, int x) {
+	return fb->cells[y * fb->columns + x];
+}
+
+/**
+ * Check that a board was drawn where the layout puts it
+ * @return the number of cells that were not
+ */
+static int check_board(Framebuffer *fb, int i, struct game_view_data *view) {
+	struct render_layout layout;
+	int failures = 0;
+
+	render_layout_board(ROWS, COLUMNS, 2, i, &layout);
+	if (cell_at(fb, layout.board.y, layout.board.x).ch != '+')
+		failures++;
+	for (int r = 0; r < BOARD_HEIGHT; r++) {
+		for (int c = 0; c < BOARD_WIDTH; c++) {
+			int color = view->board[r][c];
+			if (color == shadow)
+				continue;
+			FramebufferCell cell =
+			    cell_at(fb, layout.board.y + BOARD_HEIGHT - r,
+			            layout.board.x + 1 + c * CELL_WIDTH);
+			if (cell.color != color)
+				failures++;
+		}
+	}
+	if (cell_at(fb, layout.points.y + 1, layout.points.x + 1).ch != 'P')
+		failures++;
+	return failures;
+}
+
+/**
+ * Check that a mini board shows each pair of rows of a board in a row of
+ * characters
+ * @return the number of cells that do not
+ */
+static int check_mini_board(Framebuffer *fb, struct render_box *box,
+                            struct game_view_data *view) {
+	int failures = 0;
+
+	if (box->height != MINI_BOARD_HEIGHT ||
+	    box->width != MINI_BOARD_WIDTH ||
+	    cell_at(fb, box->y, box->x).ch != '+')
+		failures++;
+	for (int r = 0; r < BOARD_HEIGHT; r++) {
+		for (int c = 0; c < BOARD_WIDTH; c++) {
+			int color = view->board[r][c];
+			if (color == shadow)
+				color = no_type;
+			FramebufferCell cell =
+			    cell_at(fb, box->y + (BOARD_HEIGHT - r + 1) / 2,
+			            box->x + 1 + c);
+			// the upper half is shown in the cell's own colors
+			int upper = (BOARD_HEIGHT - r) % 2;
+			if (cell.ch == FRAMEBUFFER_HALVES && upper)
+				failures += cell.color != color;
+			else if (cell.ch == FRAMEBUFFER_HALVES)
+				failures += cell.lower != color;
+			else
+				failures += cell.color != color;
+		}
+	}
+	return failures;
+}
+
+int main(void) {
+	char *names[] = {"alice", "bob"};
+	struct game_contents *gc = NULL;
+	struct game_view_data *view = NULL;
+	int failures = 0;
+
+	logging_set_fp(fopen("/dev/null", "w"));
+	render_use_backend(RENDER_HEADLESS);
+	render_set_size(ROWS, COLUMNS);
+	render_init(2, names);
+	Framebuffer *fb = render_framebuffer();
+
+	// only the board that was published is drawn
+	new_seeded_game(&gc, 7);
+	translate_block_left(gc);
+	generate_game_view_data(gc, &view);
+	render_game_view_data("alice", view);
+	render_frame();
+	failures += check_board(fb, 0, view);
+	struct render_layout layout;
+	render_layout_board(ROWS, COLUMNS, 2, 1, &layout);
+	if (cell_at(fb, layout.board.y, layout.board.x).ch != ' ')
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 1: the published board was drawn.\n");
+	else
+		fprintf(stderr, "Test 1: %d cells went wrong\n", failures);
+	int total = failures;
+
+	// a board drawn again shows its latest frame
+	failures = 0;
+	hard_drop(gc);
+	generate_game_view_data(gc, &view);
+	render_game_view_data("bob", view);
+	render_frame();
+	failures += check_board(fb, 1, view);
+	if (failures == 0)
+		fprintf(stderr, "Test 2: the latest frame was drawn.\n");
+	else
+		fprintf(stderr, "Test 2: %d cells went wrong\n", failures);
+	total += failures;
+
+	// a terminal too small for the boards, even as mini boards, only shows
+	// why
+	failures = 0;
+	render_set_size(MINI_BOARD_HEIGHT - 1, COLUMNS);
+	render_frame();
+	fb = render_framebuffer();
+	char *message = "Terminal too short! Resize to play.";
+	int x = (COLUMNS - (int)strlen(message)) / 2;
+	for (int i = 0; message[i]; i++)
+		if (cell_at(fb, 1, x + i).ch != message[i])
+			failures++;
+	if (cell_at(fb, layout.board.y, layout.board.x).ch != ' ')
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 3: the terminal was too short.\n");
+	else
+		fprintf(stderr, "Test 3: %d cells went wrong\n", failures);
+	total += failures;
+
+	render_close();
+
+	// boards that do not fit side by side are drawn as mini boards, but
+	// for the local player's
+	failures = 0;
+	char *party[] = {"a", "b", "c", "d", "e", "f"};
+	render_set_local_board("c");
+	render_set_size(ROWS, COLUMNS);
+	render_init(6, party);
+	fb = render_framebuffer();
+	for (int i = 0; i < 6; i++)
+		render_game_view_data(party[i], view);
+	render_frame();
+	if (render_layout_compact_board(ROWS, COLUMNS, 6, 2, 2, &layout) ||
+	    cell_at(fb, layout.board.y, layout.board.x).ch != '+')
+		failures++;
+	for (int i = 0; i < 6; i++) {
+		if (i == 2 || !render_layout_compact_board(ROWS, COLUMNS, 6, 2,
+		                                           i, &layout))
+			continue;
+		failures += check_mini_board(fb, &layout.board, view);
+	}
+	if (failures == 0)
+		fprintf(stderr, "Test 4: the other boards were drawn as mini "
+		                "boards.\n");
+	else
+		fprintf(stderr, "Test 4: %d cells went wrong\n", failures);
+	total += failures;
+
+	render_close();
+	destroy_game(&gc);
+	destroy_game_view_data(&view);
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "client_conn.h"
+#include "log.h"
+#include "message.h"
+#include "transport.h"
+
+// enough requests for the generation of every slot to wrap around
+#define REQUEST_COUNT 100000
+
+struct server {
+	SOCKET fd;
+};
+
+/**
+ * Answer every request with its own body. Before each answer, answer the
+ * request before it again, which the client has released by then.
+ */
+static void *answer_requests(void *data) {
+	struct server *server = (struct server *)data;
+	static char buffer[8 * MAXMSG];
+	int length = 0, n;
+	uint16_t last_id = 0;
+
+	while ((n = recv(server->fd, buffer + length, sizeof(buffer) - length,
+	                 0)) > 0) {
+		length += n;
+		char *cursor = buffer, *end = buffer + length;
+		while (end - cursor >= (long)sizeof(MessageHeader)) {
+			MessageHeader *header = (MessageHeader *)cursor;
+			char *body = cursor + sizeof(MessageHeader);
+			int n_body = header->content_length;
+			if (end - body < n_body)
+				break;
+			if (last_id)
+				message_nbytes(server->fd, "stale", 6, last_id,
+				               MSG_TYPE_LIST_RESPONSE);
+			message_nbytes(server->fd, body, n_body,
+			               header->request_id,
+			               MSG_TYPE_LIST_RESPONSE);
+			last_id = header->request_id;
+			cursor = body + n_body;
+		}
+		length -= cursor - buffer;
+		memmove(buffer, cursor, length);
+	}
+	return NULL;
+}
+
+/**
+ * Send requests one after the other, and check that each gets its own
+ * response
+ * @return number of requests that did not
+ */
+static int send_requests(NetClient *net_client) {
+	int failures = 0;
+
+	for (uint32_t i = 0; i < REQUEST_COUNT; i++) {
+		NetRequest *request = ttetris_net_request(
+		    net_client, (char *)&i, sizeof(i), MSG_TYPE_LIST);
+		if (request == NULL) {
+			failures++;
+			continue;
+		}
+		ttetris_net_request_block_for_response(request);
+		if (request->length != sizeof(i) ||
+		    memcmp(request->cursor, &i, sizeof(i)) != 0)
+			failures++;
+		ttetris_net_request_release(net_client, request);
+	}
+	return failures;
+}
+
+/**
+ * Take every slot without waiting for the responses. One more request must
+ * be refused, and releasing the requests must make room again.
+ * @return number of requests that were refused or taken wrongly
+ */
+static int fill_slots(NetClient *net_client) {
+	NetRequest *requests[NET_REQUEST_SLOTS];
+	int failures = 0;
+
+	for (int i = 0; i < NET_REQUEST_SLOTS; i++) {
+		requests[i] =
+		    ttetris_net_request(net_client, NULL, 0, MSG_TYPE_LIST);
+		if (requests[i] == NULL)
+			failures++;
+	}
+	if (ttetris_net_request(net_client, NULL, 0, MSG_TYPE_LIST))
+		failures++;
+	// the responses may arrive while the requests are released
+	for (int i = 0; i < NET_REQUEST_SLOTS; i++)
+		if (requests[i])
+			ttetris_net_request_release(net_client, requests[i]);
+	if (net_client->free_requests_length != NET_REQUEST_SLOTS)
+		failures++;
+	return failures;
+}
+
+struct callbacks {
+	int called;
+	int failures;
+	TetrisEvent *done;
+};
+
+/**
+ * Check that a response holds the number it was sent with, and count it
+ */
+static void count_response(NetClient *net_client, NetRequest *request,
+                           void *data) {
+	struct callbacks *callbacks = (struct callbacks *)data;
+	uint32_t i = callbacks->called++;
+
+	if (request->length != sizeof(i) ||
+	    memcmp(request->cursor, &i, sizeof(i)) != 0)
+		callbacks->failures++;
+	if (callbacks->called == NET_REQUEST_SLOTS)
+		ttetris_event_mark_complete(callbacks->done);
+}
+
+/**
+ * Send as many requests with callbacks as there are slots, without waiting
+ * in between. Each must be called back once, in order, and release its
+ * slot.
+ * @return number of requests that went wrong
+ */
+static int call_back(NetClient *net_client) {
+	struct callbacks callbacks = {0, 0, ttetris_event_create()};
+
+	for (uint32_t i = 0; i < NET_REQUEST_SLOTS; i++)
+		if (ttetris_net_request_async(net_client, (char *)&i, sizeof(i),
+		                              MSG_TYPE_LIST, count_response,
+		                              &callbacks) != EXIT_SUCCESS)
+			callbacks.failures++;
+	ttetris_event_block_for_completion(callbacks.done);
+	ttetris_event_destroy(callbacks.done);
+	// the last request is released once its callback has returned
+	for (int free = 0; free != NET_REQUEST_SLOTS; usleep(1000)) {
+		pthread_mutex_lock(&net_client->requests_lock);
+		free = net_client->free_requests_length;
+		pthread_mutex_unlock(&net_client->requests_lock);
+	}
+	return callbacks.failures;
+}
+
+int main(void) {
+	SOCKET pair[2];
+	struct server server;
+	pthread_t thread;
+	int failures, filled, called;
+
+	// the message helpers log every message
+	logging_set_fp(fopen("/dev/null", "w"));
+
+	if (transport_pair(pair) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	NetClient *net_client = net_client_init();
+	net_client->fd = pair[0];
+	server.fd = pair[1];
+	pthread_create(&thread, NULL, answer_requests, &server);
+	tetris_listen(net_client);
+
+	failures = send_requests(net_client);
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d requests got their own "
+		                "responses.\n",
+		        REQUEST_COUNT);
+	else
+		fprintf(stderr, "Test 1: %d requests went wrong\n", failures);
+
+	filled = fill_slots(net_client);
+	if (filled == 0)
+		fprintf(stderr, "Test 2: every slot was taken and released.\n");
+	else
+		fprintf(stderr, "Test 2: %d requests were taken wrongly\n",
+		        filled);
+
+	called = call_back(net_client);
+	if (called == 0)
+		fprintf(stderr, "Test 3: every callback was called once, in "
+		                "order.\n");
+	else
+		fprintf(stderr, "Test 3: %d callbacks went wrong\n", called);
+
+	shutdown(pair[0], SHUT_RDWR);
+	pthread_join(net_client->listen_thread, NULL);
+	close(pair[0]);
+	pthread_join(thread, NULL);
+	close(pair[1]);
+	return failures || filled || called ? EXIT_FAILURE : EXIT_SUCCESS;
+}
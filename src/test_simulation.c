@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "simulation.h"
+
+#define WORKER_COUNT 4
+#define TASK_COUNT 3
+#define SCHEDULER_COUNT 4
+#define SCHEDULE_ROUNDS 5000
+#define CHILD_COUNT 256
+#define RERUN_ROUNDS 200
+
+struct counted_task {
+	/* first, so that the task can be cast back */
+	SimTask task;
+	/* number of workers running the task right now */
+	int running;
+	/* set once two workers ran the task at the same time */
+	int overlapped;
+	/* number of times the task was scheduled, and how many of those the
+	 * latest run had seen when it started */
+	int scheduled;
+	int seen;
+	int runs;
+	/* thread that ran the task last */
+	pthread_t thread;
+};
+
+static struct counted_task tasks[TASK_COUNT];
+static struct counted_task children[CHILD_COUNT];
+static struct counted_task spawner;
+
+static void run_counted(SimTask *task) {
+	struct counted_task *counted = (struct counted_task *)task;
+
+	if (__atomic_add_fetch(&counted->running, 1, __ATOMIC_ACQ_REL) > 1)
+		__atomic_store_n(&counted->overlapped, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&counted->seen,
+	                 __atomic_load_n(&counted->scheduled, __ATOMIC_ACQUIRE),
+	                 __ATOMIC_RELAXED);
+	counted->runs++;
+	counted->thread = pthread_self();
+	// sleep rather than spin, so that other threads get to schedule the
+	// task while it runs even on a single core
+	usleep(50);
+	__atomic_sub_fetch(&counted->running, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Count a schedule before making it, so that any run that starts because of
+ * it sees it
+ */
+static void schedule_counted(struct counted_task *counted) {
+	__atomic_add_fetch(&counted->scheduled, 1, __ATOMIC_ACQ_REL);
+	simulation_schedule(&counted->task);
+}
+
+static void *schedule_tasks(void *data) {
+	int offset = *(int *)data;
+
+	// pace the schedules, so that many of them land while the task runs
+	for (int round = 0; round < SCHEDULE_ROUNDS; round++) {
+		schedule_counted(&tasks[(round + offset) % TASK_COUNT]);
+		usleep(10);
+	}
+	return NULL;
+}
+
+/**
+ * Runs on a worker, so every child is queued on that worker's deque
+ */
+static void spawn_children(SimTask *task) {
+	run_counted(task);
+	for (int i = 0; i < CHILD_COUNT; i++)
+		schedule_counted(&children[i]);
+}
+
+/**
+ * Wait for a task to have no run left to do
+ * @return non-zero if it settled within a few seconds
+ */
+static int settled(struct counted_task *counted) {
+	for (int i = 0; i < 5000; i++) {
+		if (__atomic_load_n(&counted->task.state, __ATOMIC_ACQUIRE) ==
+		        SIM_TASK_IDLE &&
+		    __atomic_load_n(&counted->running, __ATOMIC_ACQUIRE) == 0)
+			return 1;
+		usleep(1000);
+	}
+	return 0;
+}
+
+/**
+ * Schedule a task again while it runs, and check that it runs once more
+ * @return number of rounds that went wrong
+ */
+static int rerun_while_running(struct counted_task *counted) {
+	int failures = 0;
+
+	for (int round = 0; round < RERUN_ROUNDS; round++) {
+		schedule_counted(counted);
+		// let a worker start it
+		for (int i = 0; i < 100000; i++) {
+			if (__atomic_load_n(&counted->running,
+			                    __ATOMIC_ACQUIRE))
+				break;
+			sched_yield();
+		}
+		schedule_counted(counted);
+		if (!settled(counted) || counted->overlapped ||
+		    counted->seen != counted->scheduled)
+			failures++;
+	}
+	return failures;
+}
+
+int main(void) {
+	pthread_t schedulers[SCHEDULER_COUNT];
+	int offsets[SCHEDULER_COUNT];
+	int failures = 0;
+
+	logging_set_fp(fopen("/dev/null", "w"));
+	if (simulation_start(WORKER_COUNT) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	// threads outside the pool schedule the same tasks over and over.
+	// Each task only runs on one worker at a time, and its last run
+	// starts after its last schedule.
+	for (int i = 0; i < TASK_COUNT; i++)
+		simulation_task_init(&tasks[i].task, run_counted);
+	for (int i = 0; i < SCHEDULER_COUNT; i++) {
+		offsets[i] = i;
+		pthread_create(&schedulers[i], NULL, schedule_tasks,
+		               &offsets[i]);
+	}
+	for (int i = 0; i < SCHEDULER_COUNT; i++)
+		pthread_join(schedulers[i], NULL);
+	for (int i = 0; i < TASK_COUNT; i++) {
+		if (!settled(&tasks[i]) || tasks[i].overlapped ||
+		    tasks[i].seen != tasks[i].scheduled || tasks[i].runs == 0 ||
+		    tasks[i].runs > tasks[i].scheduled)
+			failures++;
+	}
+	if (failures == 0)
+		fprintf(stderr, "Test 1: %d tasks scheduled from %d threads "
+		                "ran alone, and after their last schedule.\n",
+		        TASK_COUNT, SCHEDULER_COUNT);
+	else
+		fprintf(stderr, "Test 1: %d tasks went wrong\n", failures);
+	int total = failures;
+
+	// a schedule that arrives while the task runs is not lost
+	failures = rerun_while_running(&tasks[0]);
+	if (failures == 0)
+		fprintf(stderr, "Test 2: a task scheduled while it ran ran "
+		                "again, %d times.\n",
+		        RERUN_ROUNDS);
+	else
+		fprintf(stderr, "Test 2: %d reruns were lost\n", failures);
+	total += failures;
+
+	// tasks scheduled by a worker are queued on its own deque, and the
+	// other workers steal some of them
+	failures = 0;
+	simulation_task_init(&spawner.task, spawn_children);
+	for (int i = 0; i < CHILD_COUNT; i++)
+		simulation_task_init(&children[i].task, run_counted);
+	schedule_counted(&spawner);
+	if (!settled(&spawner))
+		failures++;
+	int stolen = 0;
+	for (int i = 0; i < CHILD_COUNT; i++) {
+		if (!settled(&children[i]) || children[i].runs != 1 ||
+		    children[i].overlapped)
+			failures++;
+		else if (!pthread_equal(children[i].thread, spawner.thread))
+			stolen++;
+	}
+	if (stolen == 0)
+		failures++;
+	if (failures == 0)
+		fprintf(stderr, "Test 3: %d of %d tasks queued by one worker "
+		                "were stolen by others.\n",
+		        stolen, CHILD_COUNT);
+	else
+		fprintf(stderr, "Test 3: %d things went wrong\n", failures);
+	total += failures;
+
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
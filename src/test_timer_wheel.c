@@ -0,0 +1,97 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#include "timer_wheel.h"
+
+#define TIMER_COUNT 1000
+
+static uint64_t fired_at[TIMER_COUNT];
+static TimerWheel *wheel;
+
+static void on_expire(Timer *timer, void *data) {
+	fired_at[(long)data] = timer_wheel_now_ms(wheel);
+}
+
+/**
+ * Drive a wheel of 10 ms ticks from a loop in real time, the way a client
+ * does, until a timer set for delay_ms fires
+ * @param use_fd non-zero to wait for the wheel's descriptor, or zero to go by
+ *        the monotonic clock
+ * @return milliseconds it took the timer to fire
+ */
+static int catch_up(int delay_ms, int use_fd) {
+	TimerWheel *clock = timer_wheel_create(10);
+	int fd = use_fd ? timer_wheel_open_fd(clock) : -1;
+	uint64_t start = monotonic_ms();
+	Timer timer;
+
+	timer_init(&timer, on_expire, 0);
+	timer_wheel_schedule(clock, &timer, delay_ms);
+	while (timer_pending(&timer)) {
+		if (fd >= 0) {
+			struct pollfd pfd = {fd, POLLIN, 0};
+			poll(&pfd, 1, -1);
+		} else {
+			usleep(2000);
+		}
+		timer_wheel_catch_up(clock, fd);
+	}
+	if (fd >= 0)
+		close(fd);
+	timer_wheel_destroy(clock);
+	return monotonic_ms() - start;
+}
+
+int main(void) {
+	static Timer timers[TIMER_COUNT];
+	uint64_t due[TIMER_COUNT];
+	int failures = 0;
+
+	// drive a wheel of 1 ms ticks by hand, with delays that reach every
+	// level of the wheel
+	wheel = timer_wheel_create(1);
+	srand(1);
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		int delay = rand() % (1 << (6 * (1 + i % 4)));
+		timer_init(&timers[i], on_expire, (void *)(long)i);
+		timer_wheel_schedule(wheel, &timers[i], delay);
+		due[i] = delay ? delay : 1;
+	}
+	// cancelled timers must not fire
+	for (int i = 0; i < TIMER_COUNT; i += 10) {
+		timer_wheel_cancel(wheel, &timers[i]);
+		due[i] = 0;
+	}
+
+	timer_wheel_advance(wheel, 1 << 24);
+
+	for (int i = 0; i < TIMER_COUNT; i++)
+		if (fired_at[i] != due[i])
+			failures++;
+
+	if (failures == 0)
+		fprintf(stderr, "Test 1: every timer expired on time.\n");
+	else
+		fprintf(stderr, "Test 1: %d timers expired at the wrong time\n",
+		        failures);
+
+	// a timer fires once its time has passed, give or take a tick
+	for (int use_fd = 1; use_fd >= 0; use_fd--) {
+		int took = catch_up(100, use_fd);
+		char *how = use_fd ? "a timerfd" : "the monotonic clock";
+		if (took >= 90 && took <= 130) {
+			fprintf(stderr, "Test %d: a timer driven by %s fired "
+			                "on time.\n",
+			        3 - use_fd, how);
+		} else {
+			fprintf(stderr, "Test %d: a timer driven by %s fired "
+			                "after %d ms\n",
+			        3 - use_fd, how, took);
+			failures++;
+		}
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
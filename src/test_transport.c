@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "log.h"
+#include "message.h"
+#include "transport.h"
+
+#define MESSAGE_COUNT 10000
+#define SOCKET_PATH "/tmp/tetris-mint-test.sock"
+
+struct sender {
+	SOCKET fd;
+};
+
+/**
+ * Send numbered messages of varying lengths, from another thread so that
+ * neither end blocks the other
+ */
+static void *send_messages(void *data) {
+	struct sender *sender = (struct sender *)data;
+	char body[256];
+
+	for (int i = 0; i < MESSAGE_COUNT; i++) {
+		int n = i % sizeof(body);
+		memset(body, i, n);
+		message_nbytes(sender->fd, body, n, i % 65536, MSG_TYPE_BOARD);
+	}
+	return NULL;
+}
+
+/**
+ * Send messages from one socket to the other, and check that they all arrive
+ * whole and in order
+ * @return number of messages that did not
+ */
+static int exchange(SOCKET from, SOCKET to) {
+	static char buffer[8 * MAXMSG];
+	struct sender sender = {from};
+	pthread_t thread;
+	int length = 0, received = 0, failures = 0, n;
+
+	pthread_create(&thread, NULL, send_messages, &sender);
+	while (received < MESSAGE_COUNT &&
+	       (n = recv(to, buffer + length, sizeof(buffer) - length, 0)) >
+	           0) {
+		length += n;
+		char *cursor = buffer, *end = buffer + length;
+		while (end - cursor >= (long)sizeof(MessageHeader)) {
+			MessageHeader *header = (MessageHeader *)cursor;
+			char *body = cursor + sizeof(MessageHeader);
+			int n_body = header->content_length;
+			if (end - body < n_body)
+				break;
+			if (header->magic_number != MSG_MAGIC_NUMBER ||
+			    header->request_id != received % 65536 ||
+			    n_body != received % 256 ||
+			    (n_body && body[n_body - 1] != (char)received))
+				failures++;
+			received++;
+			cursor = body + n_body;
+		}
+		length -= cursor - buffer;
+		memmove(buffer, cursor, length);
+	}
+	pthread_join(thread, NULL);
+	close(from);
+	close(to);
+	return failures + MESSAGE_COUNT - received;
+}
+
+/**
+ * Listen on the address, connect to it, and exchange messages over the
+ * connection
+ * @return number of messages that did not arrive whole and in order
+ */
+static int exchange_over(TransportAddress *address) {
+	SOCKET listener = transport_listen(address, 1);
+	if (listener < 0)
+		return MESSAGE_COUNT;
+	SOCKET client = transport_connect(address);
+	SOCKET server = accept(listener, NULL, NULL);
+	close(listener);
+	if (client < 0 || server < 0)
+		return MESSAGE_COUNT;
+	return exchange(client, server);
+}
+
+/**
+ * Exchange messages over TCP on loopback, on a port picked by the kernel
+ * @return number of messages that did not arrive whole and in order
+ */
+static int exchange_over_tcp(void) {
+	TransportAddress address;
+	struct sockaddr_in name;
+	socklen_t name_length = sizeof(name);
+
+	transport_address_tcp(&address, "127.0.0.1", 0);
+	SOCKET listener = transport_listen(&address, 1);
+	if (listener < 0)
+		return MESSAGE_COUNT;
+	getsockname(listener, (struct sockaddr *)&name, &name_length);
+	transport_address_tcp(&address, "127.0.0.1", ntohs(name.sin_port));
+	SOCKET client = transport_connect(&address);
+	SOCKET server = accept(listener, NULL, NULL);
+	close(listener);
+	if (client < 0 || server < 0)
+		return MESSAGE_COUNT;
+	return exchange(client, server);
+}
+
+static void report(int test, char *name, int failures) {
+	if (failures == 0)
+		fprintf(stderr, "Test %d: every message arrived over %s.\n",
+		        test, name);
+	else
+		fprintf(stderr, "Test %d: %d messages went wrong over %s\n",
+		        test, failures, name);
+}
+
+int main(void) {
+	TransportAddress address;
+	SOCKET pair[2];
+	int failures, total = 0;
+
+	// the message helpers log every message
+	logging_set_fp(fopen("/dev/null", "w"));
+
+	failures = MESSAGE_COUNT;
+	if (transport_pair(pair) == EXIT_SUCCESS)
+		failures = exchange(pair[0], pair[1]);
+	report(1, "an in-process pair", failures);
+	total += failures;
+
+	transport_address_unix(&address, SOCKET_PATH);
+	failures = exchange_over(&address);
+	unlink(SOCKET_PATH);
+	report(2, "a Unix domain socket", failures);
+	total += failures;
+
+	failures = exchange_over_tcp();
+	report(3, "TCP", failures);
+	total += failures;
+
+	return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "log.h"
+#include "udp.h"
+
+#define INPUT_COUNT 10000
+// share of the datagrams dropped in each direction
+#define LOSS_PERCENT 30
+#define BOARD_COUNT 1000
+
+/**
+ * Send inputs from a client socket to a server socket over loopback, with
+ * datagrams dropped in both directions. The server must read every input
+ * exactly once, in order.
+ * @return number of inputs that were lost, repeated or out of order
+ */
+static int send_inputs(void) {
+	char buffer[UDP_DATAGRAM_MAX];
+	struct udp_header *udp = (struct udp_header *)buffer;
+	MessageHeader *header = (MessageHeader *)(udp + 1);
+	struct sockaddr_in addr;
+	socklen_t addr_length = sizeof(addr);
+	struct sockaddr_storage from;
+	socklen_t from_length;
+	Input inputs[INPUT_RING_SIZE];
+	UdpInputs pending;
+	UdpPeer *peer;
+	int sent = 0, read = 0, failures = 0;
+	uint16_t seq = 1, expected = 1;
+
+	SOCKET server = udp_open("127.0.0.1", 0, 1);
+	getsockname(server, (struct sockaddr *)&addr, &addr_length);
+	SOCKET client = udp_open("127.0.0.1", ntohs(addr.sin_port), 0);
+	udp_inputs_init(&pending);
+	peer = udp_peer_create(5);
+	srand(1);
+
+	for (int round = 0; read < INPUT_COUNT && round < 100 * INPUT_COUNT;
+	     round++) {
+		// a frame's worth of inputs, some of them repeated, as long as
+		// there is room for them
+		struct input_record batch[4];
+		int n = 0;
+		uint16_t first = seq;
+		while (n < 4 && sent < INPUT_COUNT &&
+		       pending.length + n < INPUT_BATCH_MAX) {
+			int repeat = 1 + rand() % 3;
+			if (repeat > INPUT_COUNT - sent)
+				repeat = INPUT_COUNT - sent;
+			int event = PLAYER_EVENT_ROTATE + rand() % 5;
+			batch[n++] =
+			    (struct input_record){sent, event, 0, repeat, 0};
+			sent += repeat;
+			while (repeat--)
+				if (++seq == 0)
+					seq = 1;
+		}
+		if (n)
+			udp_inputs_add(&pending, first, batch, n);
+		udp_inputs_send(&pending, client, udp_peer_token(peer));
+
+		// the server reads what arrived, and acknowledges it
+		while (udp_wait(server, 1) > 0) {
+			from_length = sizeof(from);
+			if (udp_receive(server, buffer, &from, &from_length) <
+			        0 ||
+			    udp_peer_accept(peer, udp->token, &from,
+			                    from_length) != EXIT_SUCCESS)
+				continue;
+			n = input_records_read(
+			    (char *)(header + 1), header->content_length,
+			    header->request_id, &peer->received, inputs,
+			    INPUT_RING_SIZE);
+			for (int i = 0; i < n; i++, read++) {
+				if (inputs[i].seq != expected)
+					failures++;
+				expected = inputs[i].seq + 1;
+				if (expected == 0)
+					expected = 1;
+			}
+			if (n)
+				peer->received = inputs[n - 1].seq;
+			Frame *ack = frame_create(NULL, 0, 0, MSG_TYPE_INPUTS);
+			udp_send_frame(server, peer, ack);
+			frame_unref(ack);
+		}
+
+		while (udp_wait(client, 0) > 0)
+			if (udp_receive(client, buffer, NULL, NULL) >= 0)
+				udp_inputs_ack(&pending, udp->ack);
+	}
+
+	udp_peer_destroy(peer);
+	close(client);
+	close(server);
+	return failures + (INPUT_COUNT - read);
+}
+
+/**
+ * Show boards of a few players arriving out of order. Only boards newer than
+ * the last one shown for the same player may be shown, and the newest board
+ * of every player must be.
+ * @return number of boards shown when they should not have been, or not shown
+ *         when they should have been
+ */
+static int show_latest(void) {
+	uint32_t shown[3] = {0, 0, 0};
+	uint32_t seqs[BOARD_COUNT];
+	UdpLatest latest;
+	int failures = 0;
+
+	memset(&latest, 0, sizeof(latest));
+	for (int i = 0; i < BOARD_COUNT; i++)
+		seqs[i] = i + 1;
+	// swap boards that were sent close together
+	for (int i = 0; i + 3 < BOARD_COUNT; i++) {
+		int j = i + rand() % 4;
+		uint32_t seq = seqs[i];
+		seqs[i] = seqs[j];
+		seqs[j] = seq;
+	}
+
+	for (int i = 0; i < BOARD_COUNT; i++) {
+		int player = seqs[i] % 3;
+		if (udp_latest_accept(&latest, player, seqs[i])) {
+			if (seqs[i] <= shown[player])
+				failures++;
+			shown[player] = seqs[i];
+		}
+	}
+	for (int player = 0; player < 3; player++)
+		if (shown[player] + 3 <= BOARD_COUNT)
+			failures++;
+	return failures;
+}
+
+/**
+ * Check that tokens cannot be guessed from the connection, and that a peer's
+ * address is only taken from the first datagram with the token, until the
+ * token is renewed
+ * @return number of checks that went wrong
+ */
+static int check_tokens(void) {
+	struct sockaddr_storage first, second;
+	int failures = 0;
+
+	memset(&first, 0, sizeof(first));
+	memset(&second, 0, sizeof(second));
+	((struct sockaddr_in *)&first)->sin_port = htons(1000);
+	((struct sockaddr_in *)&second)->sin_port = htons(2000);
+
+	UdpPeer *peer = udp_peer_create(7);
+	UdpPeer *other = udp_peer_create(7);
+	uint64_t token = udp_peer_token(peer);
+	if (UDP_TOKEN_FD(token) != 7 || token >> UDP_TOKEN_FD_BITS == 0 ||
+	    token == udp_peer_token(other))
+		failures++;
+
+	// only the right token binds the address, and only once
+	if (udp_peer_accept(peer, token ^ (1ULL << 40), &first,
+	                    sizeof(first)) == EXIT_SUCCESS ||
+	    peer->ready)
+		failures++;
+	if (udp_peer_accept(peer, token, &first, sizeof(first)) !=
+	        EXIT_SUCCESS ||
+	    udp_peer_accept(peer, token, &second, sizeof(second)) ==
+	        EXIT_SUCCESS ||
+	    memcmp(&peer->addr, &first, sizeof(first)) != 0)
+		failures++;
+
+	// a new token lets the client move, and the old one is refused
+	udp_peer_renew(peer, 7);
+	if (udp_peer_accept(peer, token, &second, sizeof(second)) ==
+	        EXIT_SUCCESS ||
+	    udp_peer_accept(peer, udp_peer_token(peer), &second,
+	                    sizeof(second)) != EXIT_SUCCESS ||
+	    memcmp(&peer->addr, &second, sizeof(second)) != 0)
+		failures++;
+
+	udp_peer_destroy(peer);
+	udp_peer_destroy(other);
+	return failures;
+}
+
+int main(void) {
+	int failures;
+
+	logging_set_fp(stderr);
+	udp_set_loss(LOSS_PERCENT);
+
+	failures = send_inputs();
+	if (failures == 0)
+		fprintf(stderr, "Test 1: every input arrived once, in order, "
+		                "despite %d%% loss.\n",
+		        LOSS_PERCENT);
+	else
+		fprintf(stderr, "Test 1: %d inputs were lost or out of order\n",
+		        failures);
+
+	int shown = show_latest();
+	if (shown == 0)
+		fprintf(stderr, "Test 2: only the latest boards were shown.\n");
+	else
+		fprintf(stderr, "Test 2: %d boards were shown wrongly\n",
+		        shown);
+
+	int tokens = check_tokens();
+	if (tokens == 0)
+		fprintf(stderr, "Test 3: datagrams were only taken with the "
+		                "token, from the address it was first used "
+		                "from.\n");
+	else
+		fprintf(stderr, "Test 3: %d token checks went wrong\n",
+		        tokens);
+
+	return failures || shown || tokens ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -10,9 +10,15 @@
 #include <time.h>
 
 #include "os_compat.h"
+#include "pool.h"
 #include "tetris_game.h"
 #include "tetris_game_priv.h"
 
+// games and their views are reused as players come and go, rather than
+// allocated for each of them
+static Pool contents_pool = POOL_INITIALIZER(struct game_contents, 64);
+static Pool view_pool = POOL_INITIALIZER(struct game_view_data, 64);
+
 /*
  * Destroys a game_contents and frees memory
  */
@@ -25,7 +31,8 @@ int destroy_game(struct game_contents **game_contents) {
 	*game_contents = NULL;
 	// free mem
 	free(gc_temp->active_block);
-	free(gc_temp);
+	free(gc_temp->shadow_block);
+	pool_free(&contents_pool, gc_temp);
 	return 0;
 }
 
@@ -69,7 +76,7 @@ int new_seeded_game(struct game_contents **game_contents, unsigned int seed) {
 	// destroy old memory cleanly
 	destroy_game(game_contents);
 	// allocate new memory
-	*game_contents = calloc(1, sizeof(**game_contents));
+	*game_contents = pool_alloc(&contents_pool);
 	(*game_contents)->active_block = calloc(1, sizeof(struct active_block));
 	(*game_contents)->shadow_block = calloc(1, sizeof(struct active_block));
 	// set values
@@ -324,6 +331,7 @@ int rotate_block(struct game_contents *gc, int clockwise) {
 		}
 	}
 	// we have exhasted options.. can not rotate!
+	destroy_block(&new_block);
 	return -1;
 }
 
@@ -361,6 +369,14 @@ int lower_block(struct game_contents *game_contents, int forced) {
 	return -1;
 }
 
+int block_can_lower(struct game_contents *gc) {
+	struct active_block *probe = NULL;
+	clone_block(gc->active_block, &probe);
+	int ret = lower_block_helper(gc, probe);
+	destroy_block(&probe);
+	return ret != 0;
+}
+
 int hard_drop(struct game_contents *gc) {
 	while (lower_block_helper(gc, gc->active_block))
 		;
@@ -381,7 +397,7 @@ int generate_game_view_data(struct game_contents *gc,
 	struct position cur_unit_pos;
 	// alloc new gvd
 	if (!(*gvd)) {
-		*gvd = calloc(1, sizeof(struct game_view_data));
+		*gvd = create_game_view_data();
 	}
 	memcpy((*gvd)->board, gc->board,
 	       sizeof(int) * BOARD_WIDTH * BOARD_HEIGHT);
@@ -410,6 +426,96 @@ int generate_game_view_data(struct game_contents *gc,
 	return 0;
 }
 
+struct game_view_data *create_game_view_data(void) {
+	return pool_alloc(&view_pool);
+}
+
+int destroy_game_view_data(struct game_view_data **gvd) {
+	if (!(*gvd)) // NULL catch
+		return -1;
+	pool_free(&view_pool, *gvd);
+	*gvd = NULL;
+	return 0;
+}
+
+/*
+ * Looks up a block by its type, giving the null block for no_type
+ */
+static int block_from_type(struct tetris_block *block, enum block_type type) {
+	int i;
+	if (type == no_type) {
+		*block = tetris_block_null;
+		return 0;
+	}
+	for (i = 0; i < ARRAY_SIZE(available_blocks); i++) {
+		if (type == available_blocks[i].type) {
+			*block = available_blocks[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int save_game_state(struct game_contents *gc, struct game_state *state) {
+	memset(state, 0, sizeof(*state));
+	state->points = gc->points;
+	state->lines_cleared = gc->lines_cleared;
+	state->auto_lower_count = gc->auto_lower_count;
+	state->swap_h_block_count = gc->swap_h_block_count;
+	state->seed = gc->seed;
+	state->next_block = gc->next_block.type;
+	state->hold_block = gc->hold_block.type;
+	state->active_block = gc->active_block->tetris_block.type;
+	state->rotation = gc->active_block->rotation;
+	state->position = gc->active_block->position;
+	memcpy(state->board, gc->board, sizeof(state->board));
+	return 0;
+}
+
+int load_game_state(struct game_contents **game_contents,
+                    struct game_state *state) {
+	struct game_contents *gc;
+	struct tetris_block next, hold, active;
+
+	if (block_from_type(&next, state->next_block) ||
+	    block_from_type(&hold, state->hold_block) ||
+	    block_from_type(&active, state->active_block) ||
+	    state->rotation < none || state->rotation > left)
+		return -1;
+
+	if (!(*game_contents)) {
+		*game_contents = pool_alloc(&contents_pool);
+		(*game_contents)->active_block =
+		    calloc(1, sizeof(struct active_block));
+		(*game_contents)->shadow_block =
+		    calloc(1, sizeof(struct active_block));
+	}
+	gc = *game_contents;
+	gc->points = state->points;
+	gc->lines_cleared = state->lines_cleared;
+	gc->auto_lower_count = state->auto_lower_count;
+	gc->swap_h_block_count = state->swap_h_block_count;
+	gc->seed = state->seed;
+	gc->next_block = next;
+	gc->hold_block = hold;
+	gc->active_block->tetris_block = active;
+	gc->active_block->rotation = state->rotation;
+	gc->active_block->position = state->position;
+	memcpy(gc->board, state->board, sizeof(gc->board));
+	return 0;
+}
+
+unsigned int hash_game_state(struct game_state *state) {
+	// 32-bit FNV-1a
+	unsigned int hash = 2166136261u;
+	unsigned char *byte = (unsigned char *)state;
+	for (size_t i = 0; i < sizeof(*state); i++) {
+		hash ^= byte[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 int swap_hold_block(struct game_contents *gc) {
 	struct tetris_block active_type;
 
@@ -60,6 +60,25 @@ struct game_view_data {
 	int board[BOARD_HEIGHT][BOARD_WIDTH];
 };
 
+/**
+ * Everything needed to recreate a game exactly, laid out flat so that it can
+ * be copied, compared with memcmp and sent over the network
+ */
+struct game_state {
+	int points;
+	int lines_cleared;
+	int auto_lower_count;
+	int swap_h_block_count;
+	/* state of the random number generator, for the blocks to come */
+	unsigned int seed;
+	enum block_type next_block;
+	enum block_type hold_block;
+	enum block_type active_block;
+	enum rotation rotation;
+	struct position position;
+	int board[BOARD_HEIGHT][BOARD_WIDTH];
+};
+
 /**
  * Lowers the block down the board by 1
  * @param forced - 0 if move is done by client, non-zero if by game
@@ -67,6 +86,12 @@ struct game_view_data {
  */
 int lower_block(struct game_contents *game_contents, int forced);
 
+/**
+ * Checks whether the active block could be lowered, without moving it
+ * @return - non-zero if the block can be lowered, 0 if it rests on the stack
+ */
+int block_can_lower(struct game_contents *game_contents);
+
 /*
  * Translates a block left a unit
  * @return - 0 if piece moved, else non-zero
@@ -106,12 +131,44 @@ int new_seeded_game(struct game_contents **game_contents, unsigned int seed);
  */
 int destroy_game(struct game_contents **game_contents);
 
+/*
+ * Captures the game in a game_state. Unused bytes are zeroed, so that two
+ * states of the same game compare equal.
+ * @return 0
+ */
+int save_game_state(struct game_contents *gc, struct game_state *state);
+
+/*
+ * Recreates a game from a game_state, allocating game contents if needed
+ * @return 0, or -1 if the state names a block that does not exist
+ */
+int load_game_state(struct game_contents **game_contents,
+                    struct game_state *state);
+
+/*
+ * Hashes a game_state, for cheaply checking that two copies of a game agree
+ */
+unsigned int hash_game_state(struct game_state *state);
+
 /*
  * Makes a game_view_data with a representation of all active board pieces
  */
 int generate_game_view_data(struct game_contents *gc,
                             struct game_view_data **gvd);
 
+/*
+ * Makes an empty game_view_data, to be filled in by generate_game_view_data
+ * or copied into
+ */
+struct game_view_data *create_game_view_data(void);
+
+/*
+ * Destroy a game_view_data made by create_game_view_data or
+ * generate_game_view_data, and set the pointer to NULL
+ * @return 0, or -1 if there was none
+ */
+int destroy_game_view_data(struct game_view_data **gvd);
+
 /**
  * Check if the game is over
  * @param game_contents
@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include "log.h"
+#include "os_compat.h"
+#include "timer_wheel.h"
+
+// each wheel has 64 slots, and each outer wheel covers 64 times the span of
+// the one inside it. Four wheels of 10 ms ticks cover about 46 hours.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN(level) (1ULL << (WHEEL_BITS * ((level) + 1)))
+
+struct ttetris_timer_wheel {
+	int tick_ms;
+	/* the last tick that has been processed */
+	uint64_t now;
+	Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	/* timers that expired in the tick being processed, but whose
+	 * callbacks have not been called yet */
+	Timer *expired;
+	void (*batch_done)(void);
+	/* monotonic_ms when the wheel was created, at tick 0 */
+	uint64_t start_ms;
+	pthread_mutex_t lock;
+	pthread_t thread;
+};
+
+TimerWheel *timer_wheel_create(int tick_ms) {
+	TimerWheel *wheel = calloc(sizeof(TimerWheel), 1);
+	wheel->tick_ms = tick_ms;
+	wheel->start_ms = monotonic_ms();
+	pthread_mutex_init(&wheel->lock, NULL);
+	return wheel;
+}
+
+void timer_wheel_destroy(TimerWheel *wheel) {
+	pthread_mutex_destroy(&wheel->lock);
+	free(wheel);
+}
+
+void timer_wheel_set_batch_done(TimerWheel *wheel, void (*fn)(void)) {
+	wheel->batch_done = fn;
+}
+
+void timer_init(Timer *timer, void (*callback)(Timer *timer, void *data),
+                void *data) {
+	memset(timer, 0, sizeof(Timer));
+	timer->callback = callback;
+	timer->data = data;
+}
+
+int timer_pending(Timer *timer) { return timer->pprev != NULL; }
+
+static void timer_link(Timer **head, Timer *timer) {
+	timer->next = *head;
+	if (*head)
+		(*head)->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+}
+
+static void timer_unlink(Timer *timer) {
+	if (timer->pprev == NULL)
+		return;
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/**
+ * Put a timer in the slot matching its expiry. The wheel lock must be held.
+ */
+static void timer_wheel_place(TimerWheel *wheel, Timer *timer) {
+	uint64_t delta = timer->expires - wheel->now;
+	int level;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < WHEEL_SPAN(level))
+			break;
+
+	// timers beyond the outermost wheel wait in its last slot, and are
+	// placed again when it is cascaded
+	uint64_t expires = timer->expires;
+	if (delta >= WHEEL_SPAN(WHEEL_LEVELS - 1))
+		expires = wheel->now + WHEEL_SPAN(WHEEL_LEVELS - 1) - 1;
+
+	int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	timer_link(&wheel->slots[level][slot], timer);
+}
+
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, int delay_ms) {
+	// round up, and never schedule for a tick that is already processed
+	uint64_t ticks = (delay_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+	if (ticks == 0)
+		ticks = 1;
+
+	pthread_mutex_lock(&wheel->lock);
+	timer_unlink(timer);
+	timer->expires = wheel->now + ticks;
+	timer_wheel_place(wheel, timer);
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer) {
+	pthread_mutex_lock(&wheel->lock);
+	timer_unlink(timer);
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * Advance the wheel by one tick, moving the timers that expire into the
+ * expired list. The wheel lock must be held.
+ */
+static void timer_wheel_tick(TimerWheel *wheel) {
+	Timer *timer, *next;
+
+	wheel->now++;
+
+	// whenever an inner wheel wraps around, spread the next slot of the
+	// wheel outside it over the inner wheels
+	for (int level = 1; level < WHEEL_LEVELS; level++) {
+		if (wheel->now & (WHEEL_SPAN(level - 1) - 1))
+			break;
+		int slot = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		timer = wheel->slots[level][slot];
+		wheel->slots[level][slot] = NULL;
+		for (; timer; timer = next) {
+			next = timer->next;
+			timer->pprev = NULL;
+			timer_wheel_place(wheel, timer);
+		}
+	}
+
+	// every timer in the current slot of the innermost wheel is due
+	int slot = wheel->now & WHEEL_MASK;
+	for (timer = wheel->slots[0][slot]; timer; timer = next) {
+		next = timer->next;
+		timer_unlink(timer);
+		timer_link(&wheel->expired, timer);
+	}
+}
+
+int timer_wheel_advance(TimerWheel *wheel, uint64_t ticks) {
+	Timer *timer;
+	int fired = 0, fired_in_tick;
+
+	pthread_mutex_lock(&wheel->lock);
+	for (uint64_t i = 0; i < ticks; i++) {
+		timer_wheel_tick(wheel);
+
+		// Run the callbacks without holding the lock, so that they
+		// can schedule timers. Each timer is unlinked before its
+		// callback runs, so a callback (or another thread) may
+		// reschedule or cancel it.
+		fired_in_tick = 0;
+		while ((timer = wheel->expired)) {
+			timer_unlink(timer);
+			pthread_mutex_unlock(&wheel->lock);
+			timer->callback(timer, timer->data);
+			fired_in_tick++;
+			pthread_mutex_lock(&wheel->lock);
+		}
+
+		if (fired_in_tick && wheel->batch_done) {
+			pthread_mutex_unlock(&wheel->lock);
+			wheel->batch_done();
+			pthread_mutex_lock(&wheel->lock);
+		}
+		fired += fired_in_tick;
+	}
+	pthread_mutex_unlock(&wheel->lock);
+
+	return fired;
+}
+
+uint64_t timer_wheel_now_ms(TimerWheel *wheel) {
+	return wheel->now * wheel->tick_ms;
+}
+
+int timer_wheel_open_fd(TimerWheel *wheel) {
+#ifdef __linux__
+	struct itimerspec interval;
+
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	interval.it_interval.tv_sec = wheel->tick_ms / 1000;
+	interval.it_interval.tv_nsec = (wheel->tick_ms % 1000) * 1000000L;
+	interval.it_value = interval.it_interval;
+	if (timerfd_settime(timer_fd, 0, &interval, NULL) < 0) {
+		perror("timerfd_settime");
+		close(timer_fd);
+		return -1;
+	}
+	return timer_fd;
+#else
+	return -1;
+#endif
+}
+
+int timer_wheel_catch_up(TimerWheel *wheel, int fd) {
+	uint64_t ticks;
+
+#ifdef __linux__
+	if (fd >= 0) {
+		// the count covers any ticks missed while we were busy
+		if (read(fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+			if (errno != EINTR && errno != EAGAIN)
+				perror("read");
+			return 0;
+		}
+		return timer_wheel_advance(wheel, ticks);
+	}
+#endif
+	// only the caller advances the wheel, so now cannot move under us
+	uint64_t due = (monotonic_ms() - wheel->start_ms) / wheel->tick_ms;
+	if (due <= wheel->now)
+		return 0;
+	ticks = due - wheel->now;
+	return timer_wheel_advance(wheel, ticks);
+}
+
+static void *timer_wheel_thread(void *input) {
+	TimerWheel *wheel = (TimerWheel *)input;
+
+#ifdef __linux__
+	int timer_fd = timer_wheel_open_fd(wheel);
+	if (timer_fd < 0)
+		return NULL;
+
+	// reading the timerfd blocks until the next tick
+	while (1)
+		timer_wheel_catch_up(wheel, timer_fd);
+#else
+	struct timespec tick = {wheel->tick_ms / 1000,
+	                        (wheel->tick_ms % 1000) * 1000000L};
+
+	while (1) {
+		nanosleep(&tick, NULL);
+		timer_wheel_catch_up(wheel, -1);
+	}
+#endif
+}
+
+int timer_wheel_start(TimerWheel *wheel) {
+	if (pthread_create(&wheel->thread, NULL, timer_wheel_thread, wheel)) {
+		fprintf(logging_fp, "timer_wheel_start: could not create "
+		                    "thread\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/**
+ * A hierarchical timer wheel, driving every timed game event from a single
+ * thread.
+ *
+ * Time advances in fixed ticks. Timers due within the next 64 ticks sit in
+ * the slot for their tick on the innermost wheel; timers further out sit on
+ * one of the coarser outer wheels and are cascaded inwards as their time
+ * approaches. Scheduling and cancelling are O(1), and a tick only touches the
+ * timers that are due.
+ *
+ * On Linux, the wheel's thread is woken by a timerfd, which also reports how
+ * many ticks were missed if the thread fell behind. Instead of a thread of its
+ * own, an event loop can wait for the timerfd along with everything else it
+ * waits for, and advance the wheel itself (see timer_wheel_open_fd).
+ */
+#ifndef TTETRIS_TIMER_WHEEL_H
+#define TTETRIS_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+typedef struct ttetris_timer Timer;
+
+struct ttetris_timer {
+	/* called on the wheel's thread when the timer expires */
+	void (*callback)(Timer *timer, void *data);
+	void *data;
+	/* tick at which the timer expires */
+	uint64_t expires;
+	/* links for the wheel slot holding the timer. pprev is NULL while the
+	 * timer is not scheduled. */
+	Timer *next;
+	Timer **pprev;
+};
+
+typedef struct ttetris_timer_wheel TimerWheel;
+
+/**
+ * Allocate a timer wheel
+ * @param tick_ms length of a tick in milliseconds
+ */
+TimerWheel *timer_wheel_create(int tick_ms);
+
+/**
+ * Free a wheel that was never started (see timer_wheel_open_fd)
+ */
+void timer_wheel_destroy(TimerWheel *wheel);
+
+/**
+ * Start a thread that advances the wheel in real time
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int timer_wheel_start(TimerWheel *wheel);
+
+/**
+ * Open a file descriptor that becomes readable on every tick of the wheel,
+ * for an event loop that advances the wheel with timer_wheel_catch_up rather
+ * than starting a thread for it
+ * @return the descriptor, or -1 where there are no timerfds. The loop should
+ *         then call timer_wheel_catch_up at least once per tick.
+ */
+int timer_wheel_open_fd(TimerWheel *wheel);
+
+/**
+ * Advance the wheel by every tick that has passed since it was last advanced,
+ * reading the descriptor from timer_wheel_open_fd if there is one
+ * @param fd the descriptor, or -1 to go by the monotonic clock
+ * @return number of timers that expired
+ */
+int timer_wheel_catch_up(TimerWheel *wheel, int fd);
+
+/**
+ * Call fn once after every tick in which at least one timer expired, for
+ * example to write out everything the expired timers produced at once
+ */
+void timer_wheel_set_batch_done(TimerWheel *wheel, void (*fn)(void));
+
+/**
+ * Prepare a timer for use. The timer is not scheduled.
+ */
+void timer_init(Timer *timer, void (*callback)(Timer *timer, void *data),
+                void *data);
+
+/**
+ * (Re)schedule a timer to expire after delay_ms, rounded up to a whole tick.
+ * May be called from any thread, including from a timer callback.
+ */
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, int delay_ms);
+
+/**
+ * Unschedule a timer. Its callback may still be running on the wheel's
+ * thread if it had already expired.
+ */
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer);
+
+/**
+ * @return non-zero if the timer is scheduled
+ */
+int timer_pending(Timer *timer);
+
+/**
+ * Advance the wheel by a number of ticks, running the callback of every timer
+ * that expires. Used by the wheel's thread, and by tests that drive the wheel
+ * by hand.
+ * @return number of timers that expired
+ */
+int timer_wheel_advance(TimerWheel *wheel, uint64_t ticks);
+
+/**
+ * @return the current time of the wheel in milliseconds since it was created
+ */
+uint64_t timer_wheel_now_ms(TimerWheel *wheel);
+
+#endif // TTETRIS_TIMER_WHEEL_H
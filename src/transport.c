@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "log.h"
+#include "message.h"
+#include "transport.h"
+
+void transport_address_tcp(TransportAddress *address, char *host,
+                           uint16_t port) {
+	memset(address, 0, sizeof(TransportAddress));
+	address->kind = TRANSPORT_TCP;
+	strncpy(address->host, host, sizeof(address->host) - 1);
+	address->port = port;
+}
+
+void transport_address_unix(TransportAddress *address, char *path) {
+	memset(address, 0, sizeof(TransportAddress));
+	address->kind = TRANSPORT_UNIX;
+	strncpy(address->path, path, sizeof(address->path) - 1);
+}
+
+/**
+ * Perform the initialization winsock requires before any other socket call
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int transport_startup(void) {
+#ifdef THIS_IS_WINDOWS
+	WSADATA wsaData;
+	int startup_result;
+	if ((startup_result = WSAStartup(MAKEWORD(2, 2), &wsaData)) != 0) {
+		fprintf(logging_fp, "WSAStartup failed with error: %d\n",
+		        startup_result);
+		return EXIT_FAILURE;
+	}
+#endif
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Fill in the socket address for a transport address
+ * @return length of the socket address, or 0 on failure
+ */
+static socklen_t transport_sockaddr(TransportAddress *address,
+                                    struct sockaddr_storage *name) {
+	memset(name, 0, sizeof(*name));
+
+	if (address->kind == TRANSPORT_UNIX) {
+#ifdef THIS_IS_WINDOWS
+		fprintf(logging_fp, "transport_sockaddr: Unix domain sockets "
+		                    "are not supported\n");
+		return 0;
+#else
+		struct sockaddr_un *un = (struct sockaddr_un *)name;
+		un->sun_family = AF_UNIX;
+		strncpy(un->sun_path, address->path, sizeof(un->sun_path) - 1);
+		return sizeof(struct sockaddr_un);
+#endif
+	}
+
+	struct sockaddr_in *in = (struct sockaddr_in *)name;
+	struct hostent *hostinfo = gethostbyname(address->host);
+	if (hostinfo == NULL) {
+		fprintf(logging_fp, "Unknown host %s.\n", address->host);
+		return 0;
+	}
+	in->sin_family = AF_INET;
+	in->sin_port = htons(address->port);
+	in->sin_addr = *(struct in_addr *)hostinfo->h_addr_list[0];
+	return sizeof(struct sockaddr_in);
+}
+
+SOCKET transport_listen(TransportAddress *address, int backlog) {
+	struct sockaddr_storage name;
+	socklen_t name_length;
+	SOCKET sock;
+
+	if (transport_startup() != EXIT_SUCCESS ||
+	    (name_length = transport_sockaddr(address, &name)) == 0)
+		return -1;
+
+	sock = socket(name.ss_family, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+#ifdef THIS_IS_NOT_WINDOWS
+	if (address->kind == TRANSPORT_UNIX) {
+		// a socket left behind by a server that is gone would keep
+		// the path from being bound
+		unlink(address->path);
+	} else {
+		// forcefully attaching socket to the port. The options are
+		// separate flags, not bits that can be combined in a single
+		// call. SO_REUSEPORT lets every reactor thread bind its own
+		// socket to the port.
+		int opt = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt,
+		               sizeof(opt))) {
+			perror("setsockopt");
+			close(sock);
+			return -1;
+		}
+#ifdef SO_REUSEPORT
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt,
+		               sizeof(opt))) {
+			perror("setsockopt");
+			close(sock);
+			return -1;
+		}
+#endif
+	}
+#endif
+
+	if (bind(sock, (struct sockaddr *)&name, name_length) < 0) {
+		perror("bind");
+		close(sock);
+		return -1;
+	}
+	if (listen(sock, backlog) < 0) {
+		perror("listen");
+		close(sock);
+		return -1;
+	}
+
+	if (address->kind == TRANSPORT_UNIX)
+		fprintf(logging_fp, "transport_listen: listening on %s\n",
+		        address->path);
+	else
+		fprintf(logging_fp, "transport_listen: listening on %s:%d\n",
+		        address->host, address->port);
+	return sock;
+}
+
+SOCKET transport_connect(TransportAddress *address) {
+	struct sockaddr_storage name;
+	socklen_t name_length;
+	SOCKET sock;
+
+	if (transport_startup() != EXIT_SUCCESS ||
+	    (name_length = transport_sockaddr(address, &name)) == 0)
+		return -1;
+
+	sock = socket(name.ss_family, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(sock, (struct sockaddr *)&name, name_length) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	// inputs are tiny and latency sensitive, so don't let them sit in the
+	// kernel waiting to be coalesced
+	if (address->kind == TRANSPORT_TCP)
+		socket_set_nodelay(sock);
+	return sock;
+}
+
+int transport_pair(SOCKET sockets[2]) {
+#ifdef THIS_IS_WINDOWS
+	fprintf(logging_fp, "transport_pair: not supported\n");
+	return EXIT_FAILURE;
+#else
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+#endif
+}
+
+void transport_peer_to_str(struct sockaddr_storage *peer, char *buffer,
+                           int n) {
+	struct sockaddr_in *in = (struct sockaddr_in *)peer;
+
+	if (peer->ss_family == AF_INET)
+		snprintf(buffer, n, "host %s, port %hu",
+		         inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+	else
+		snprintf(buffer, n, "a local socket");
+}
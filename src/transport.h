@@ -0,0 +1,72 @@
+/**
+ * Where the server and its clients meet.
+ *
+ * Clients connect to the server over TCP, or, when they run on the same
+ * machine (like bots and spectator tools), over a Unix domain socket, which
+ * skips the TCP stack. Either way the connection is a stream socket, which the
+ * message layer and the reactors read and write the same way.
+ *
+ * For tests and benchmarks, transport_pair connects two sockets within the
+ * process.
+ */
+#ifndef TTETRIS_TRANSPORT_H
+#define TTETRIS_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+enum transport_kind {
+	TRANSPORT_TCP,
+	TRANSPORT_UNIX,
+};
+
+typedef struct ttetris_transport_address TransportAddress;
+
+struct ttetris_transport_address {
+	enum transport_kind kind;
+	/* for TCP, the host and port */
+	char host[128];
+	uint16_t port;
+	/* for Unix domain sockets, the path of the socket */
+	char path[108];
+};
+
+void transport_address_tcp(TransportAddress *address, char *host,
+                           uint16_t port);
+
+void transport_address_unix(TransportAddress *address, char *path);
+
+/**
+ * Create a socket that accepts connections on the address. A stale Unix
+ * domain socket left at the path is replaced. TCP sockets may share their
+ * port with other listening sockets (SO_REUSEPORT).
+ * @return the socket, or -1 on failure
+ */
+SOCKET transport_listen(TransportAddress *address, int backlog);
+
+/**
+ * Connect to the address
+ * @return the socket, or -1 on failure
+ */
+SOCKET transport_connect(TransportAddress *address);
+
+/**
+ * Create two sockets connected to each other
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int transport_pair(SOCKET sockets[2]);
+
+/**
+ * Describe the peer of an accepted connection, for logging
+ */
+void transport_peer_to_str(struct sockaddr_storage *peer, char *buffer,
+                           int n);
+
+#endif // TTETRIS_TRANSPORT_H
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+#include "log.h"
+#include "udp.h"
+
+static int loss_percent;
+// counts the datagrams sent, to decide which ones to drop
+static unsigned loss_counter;
+
+SOCKET udp_open(char *host, uint16_t port, int bind_to_port) {
+	struct addrinfo hints, *info;
+	char port_str[6];
+	SOCKET fd;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(port_str, sizeof(port_str), "%u", port);
+	if (getaddrinfo(host, port_str, &hints, &info) != 0) {
+		fprintf(logging_fp, "udp_open: unknown host %s\n", host);
+		return -1;
+	}
+
+	fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (fd < 0) {
+		perror("socket");
+	} else if ((bind_to_port ? bind(fd, info->ai_addr, info->ai_addrlen)
+	                         : connect(fd, info->ai_addr,
+	                                   info->ai_addrlen)) < 0) {
+		perror(bind_to_port ? "bind" : "connect");
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(info);
+	return fd;
+}
+
+void udp_set_loss(int percent) { loss_percent = percent; }
+
+/**
+ * @return non-zero if the next datagram should be dropped on purpose
+ */
+static int udp_drop(void) {
+	if (loss_percent <= 0)
+		return 0;
+	// spread the counter out, so that the drops do not come in a pattern
+	unsigned n = __atomic_fetch_add(&loss_counter, 1, __ATOMIC_RELAXED);
+	n = (n + 1) * 2654435761U;
+	return (int)((n >> 16) % 100) < loss_percent;
+}
+
+int udp_send(SOCKET fd, struct sockaddr *addr, socklen_t addr_length,
+             struct udp_header *header, char *message, int length) {
+	char datagram[UDP_DATAGRAM_MAX];
+	int n = sizeof(*header) + length;
+
+	if (n > UDP_DATAGRAM_MAX) {
+		fprintf(logging_fp, "udp_send: %d bytes do not fit\n", n);
+		return EXIT_FAILURE;
+	}
+	if (udp_drop())
+		return EXIT_SUCCESS;
+
+	// a datagram is sent in one piece, so build it in one buffer
+	memcpy(datagram, header, sizeof(*header));
+	memcpy(datagram + sizeof(*header), message, length);
+	if (sendto(fd, datagram, n, 0, addr, addr ? addr_length : 0) < 0) {
+		char errmsg[256];
+		last_error_message_to_buffer(errmsg, 256);
+		fprintf(logging_fp, "udp_send: %s\n", errmsg);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Draw a token for a connection: its file descriptor, and random bits above
+ */
+static int udp_token_create(SOCKET connection_fd, uint64_t *token) {
+	uint64_t bits;
+
+	if (random_bytes(&bits, sizeof(bits)) != EXIT_SUCCESS) {
+		fprintf(logging_fp, "udp_token_create: no random bytes\n");
+		return EXIT_FAILURE;
+	}
+	*token = (bits << UDP_TOKEN_FD_BITS) | (uint64_t)connection_fd;
+	return EXIT_SUCCESS;
+}
+
+UdpPeer *udp_peer_create(SOCKET connection_fd) {
+	UdpPeer *peer = calloc(1, sizeof(UdpPeer));
+
+	if (udp_token_create(connection_fd, &peer->token) != EXIT_SUCCESS) {
+		free(peer);
+		return NULL;
+	}
+	pthread_mutex_init(&peer->lock, NULL);
+	return peer;
+}
+
+void udp_peer_destroy(UdpPeer *peer) {
+	if (peer == NULL)
+		return;
+	pthread_mutex_destroy(&peer->lock);
+	free(peer);
+}
+
+int udp_peer_renew(UdpPeer *peer, SOCKET connection_fd) {
+	uint64_t token;
+
+	if (udp_token_create(connection_fd, &token) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	pthread_mutex_lock(&peer->lock);
+	peer->token = token;
+	__atomic_store_n(&peer->ready, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&peer->lock);
+	return EXIT_SUCCESS;
+}
+
+uint64_t udp_peer_token(UdpPeer *peer) {
+	pthread_mutex_lock(&peer->lock);
+	uint64_t token = peer->token;
+	pthread_mutex_unlock(&peer->lock);
+	return token;
+}
+
+int udp_peer_accept(UdpPeer *peer, uint64_t token,
+                    struct sockaddr_storage *from, socklen_t from_length) {
+	int ret = EXIT_SUCCESS;
+
+	pthread_mutex_lock(&peer->lock);
+	if (token != peer->token) {
+		ret = EXIT_FAILURE;
+	} else if (!peer->ready) {
+		memcpy(&peer->addr, from, from_length);
+		peer->addr_length = from_length;
+		__atomic_store_n(&peer->ready, 1, __ATOMIC_RELEASE);
+	} else if (from_length != peer->addr_length ||
+	           memcmp(from, &peer->addr, from_length) != 0) {
+		// only a token given out over the connection moves the
+		// client somewhere else, so that whoever sees the token
+		// cannot take the client's boards
+		ret = EXIT_FAILURE;
+	}
+	pthread_mutex_unlock(&peer->lock);
+	return ret;
+}
+
+int udp_send_frame(SOCKET fd, UdpPeer *peer, Frame *frame) {
+	struct sockaddr_storage addr;
+	socklen_t addr_length;
+	struct udp_header header = {
+	    UDP_MAGIC_NUMBER,
+	    __atomic_load_n(&peer->received, __ATOMIC_ACQUIRE),
+	    __atomic_add_fetch(&peer->seq, 1, __ATOMIC_RELAXED), 0};
+
+	pthread_mutex_lock(&peer->lock);
+	header.token = peer->token;
+	memcpy(&addr, &peer->addr, peer->addr_length);
+	addr_length = peer->addr_length;
+	pthread_mutex_unlock(&peer->lock);
+
+	return udp_send(fd, (struct sockaddr *)&addr, addr_length, &header,
+	                frame->bytes, frame->length);
+}
+
+int udp_wait(SOCKET fd, int timeout_ms) {
+	struct pollfd pfd = {fd, POLLIN, 0};
+	return poll(&pfd, 1, timeout_ms);
+}
+
+int udp_receive(SOCKET fd, char *buffer, struct sockaddr_storage *from,
+                socklen_t *from_length) {
+	struct udp_header *header = (struct udp_header *)buffer;
+	MessageHeader *message =
+	    (MessageHeader *)(buffer + sizeof(struct udp_header));
+
+	int n = recvfrom(fd, buffer, UDP_DATAGRAM_MAX, 0,
+	                 (struct sockaddr *)from, from ? from_length : NULL);
+	if (n < (int)(sizeof(*header) + sizeof(*message)))
+		return -1;
+	if (header->magic_number != UDP_MAGIC_NUMBER ||
+	    message->magic_number != MSG_MAGIC_NUMBER ||
+	    n < (int)(sizeof(*header) + sizeof(*message)) +
+	            message->content_length) {
+		fprintf(logging_fp, "udp_receive: dropped a bad datagram\n");
+		return -1;
+	}
+	return n;
+}
+
+void udp_inputs_init(UdpInputs *pending) {
+	memset(pending, 0, sizeof(UdpInputs));
+	pthread_mutex_init(&pending->lock, NULL);
+}
+
+int udp_inputs_add(UdpInputs *pending, uint16_t seq,
+                   struct input_record *records, int n) {
+	int ret = EXIT_SUCCESS;
+
+	pthread_mutex_lock(&pending->lock);
+	if (pending->length == 0)
+		pending->first_seq = seq;
+	if (n > INPUT_BATCH_MAX - pending->length) {
+		fprintf(logging_fp, "udp_inputs_add: dropped %d inputs\n",
+		        n - (INPUT_BATCH_MAX - pending->length));
+		n = INPUT_BATCH_MAX - pending->length;
+		ret = EXIT_FAILURE;
+	}
+	memcpy(pending->records + pending->length, records,
+	       n * sizeof(struct input_record));
+	pending->length += n;
+	pthread_mutex_unlock(&pending->lock);
+	return ret;
+}
+
+void udp_inputs_ack(UdpInputs *pending, uint16_t ack) {
+	int acked = 0;
+
+	// nothing has been taken yet
+	if (ack == 0)
+		return;
+	pthread_mutex_lock(&pending->lock);
+	while (acked < pending->length &&
+	       (int16_t)(pending->first_seq - ack) <= 0) {
+		if (--pending->records[acked].repeat == 0)
+			acked++;
+		// numbered inputs skip 0, like in MSG_TYPE_INPUTS
+		if (++pending->first_seq == 0)
+			pending->first_seq = 1;
+	}
+	pending->length -= acked;
+	memmove(pending->records, pending->records + acked,
+	        pending->length * sizeof(struct input_record));
+	pthread_mutex_unlock(&pending->lock);
+}
+
+int udp_inputs_send(UdpInputs *pending, SOCKET fd, uint64_t token) {
+	int ret = EXIT_SUCCESS;
+
+	pthread_mutex_lock(&pending->lock);
+	if (pending->length > 0) {
+		struct udp_header header = {UDP_MAGIC_NUMBER, 0,
+		                            ++pending->seq, token};
+		Frame *frame = frame_create(
+		    (char *)pending->records,
+		    pending->length * sizeof(struct input_record),
+		    pending->first_seq, MSG_TYPE_INPUTS);
+		ret = udp_send(fd, NULL, 0, &header, frame->bytes,
+		               frame->length);
+		frame_unref(frame);
+		pending->sent_ms = monotonic_ms();
+	}
+	pthread_mutex_unlock(&pending->lock);
+	return ret;
+}
+
+int udp_inputs_resend_due(UdpInputs *pending) {
+	pthread_mutex_lock(&pending->lock);
+	int due = pending->length > 0 &&
+	          monotonic_ms() - pending->sent_ms >= UDP_RESEND_MS;
+	pthread_mutex_unlock(&pending->lock);
+	return due;
+}
+
+int udp_latest_accept(UdpLatest *latest, int slot, uint32_t seq) {
+	// boards of players beyond the table are always shown
+	if (slot < 0 || slot >= UDP_LATEST_MAX)
+		return 1;
+	if (latest->shown[slot] && (int32_t)(seq - latest->seqs[slot]) <= 0)
+		return 0;
+	latest->shown[slot] = 1;
+	latest->seqs[slot] = seq;
+	return 1;
+}
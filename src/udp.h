@@ -0,0 +1,226 @@
+/**
+ * Datagram transport, used next to a client's TCP connection once the client
+ * asks for it (see MSG_TYPE_DATAGRAM). Everything else stays on TCP.
+ *
+ * Every datagram starts with a udp_header, followed by one framed message.
+ *
+ * Boards and game states are sent from the server unreliably. The datagrams
+ * to a client are numbered, and the client only shows a board that is newer
+ * than the last one it showed for the same player, so a lost or late board is
+ * simply replaced by the next one instead of holding up everything behind it.
+ *
+ * Inputs are sent from the client reliably. Every datagram from the client
+ * carries every input the server has not acknowledged yet, and the client
+ * sends them again if no acknowledgement arrives for a while. Every datagram
+ * from the server acknowledges the last input it has taken from the client,
+ * and the server answers every datagram with inputs right away.
+ *
+ * For testing over loopback, a share of the datagrams sent can be dropped on
+ * purpose with udp_set_loss.
+ */
+#ifndef TTETRIS_UDP_H
+#define TTETRIS_UDP_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "os_compat.h"
+#ifdef THIS_IS_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include "message.h"
+
+#define UDP_MAGIC_NUMBER 0xfeefU
+
+// large enough for a board, and small enough not to be fragmented
+#define UDP_DATAGRAM_MAX 1400
+
+// inputs that have not been acknowledged are sent again this often
+#define UDP_RESEND_MS 50
+
+// number of players whose last board a client keeps track of, which is every
+// party slot
+#define UDP_LATEST_MAX 256
+
+// the low bits of a token are the file descriptor of the client's
+// connection, and the rest are random, so that a token cannot be guessed
+#define UDP_TOKEN_FD_BITS 20
+#define UDP_TOKEN_FD(token) ((token) & ((1U << UDP_TOKEN_FD_BITS) - 1))
+
+struct udp_header {
+	uint16_t magic_number;
+	/* in datagrams from the server, the sequence number of the last input
+	 * taken from the client's datagrams */
+	uint16_t ack;
+	/* numbers the datagrams from one sender to one receiver */
+	uint32_t seq;
+	/* identifies the client to the server (see MSG_TYPE_DATAGRAM) */
+	uint64_t token;
+};
+
+typedef struct ttetris_udp_peer UdpPeer;
+
+/**
+ * The server's side of a client's datagram transport
+ */
+struct ttetris_udp_peer {
+	/* the token, and where the client's datagrams come from and boards
+	 * are sent, guarded by lock. The address is taken from the first
+	 * datagram carrying the token, and kept until a new token is given
+	 * out over the client's connection. */
+	uint64_t token;
+	struct sockaddr_storage addr;
+	socklen_t addr_length;
+	pthread_mutex_t lock;
+	/* non-zero once the address is known, set under lock and read
+	 * atomically */
+	char ready;
+	/* number of datagrams sent to the client, changed atomically */
+	uint32_t seq;
+	/* sequence number of the last input taken from the client's
+	 * datagrams. Only the thread receiving datagrams changes it, and
+	 * does so atomically. */
+	uint16_t received;
+};
+
+typedef struct ttetris_udp_inputs UdpInputs;
+
+/**
+ * The client's inputs that the server has not acknowledged yet
+ */
+struct ttetris_udp_inputs {
+	struct input_record records[INPUT_BATCH_MAX];
+	int length;
+	/* sequence number of the first input in records */
+	uint16_t first_seq;
+	/* number of datagrams sent to the server */
+	uint32_t seq;
+	/* monotonic_ms when the inputs were last sent */
+	uint64_t sent_ms;
+	pthread_mutex_t lock;
+};
+
+typedef struct ttetris_udp_latest UdpLatest;
+
+/**
+ * Sequence number of the last board a client showed for each party slot
+ */
+struct ttetris_udp_latest {
+	uint32_t seqs[UDP_LATEST_MAX];
+	/* non-zero for the slots a board was shown for */
+	char shown[UDP_LATEST_MAX];
+};
+
+/**
+ * Open a datagram socket
+ * @param bind_to_port non-zero to receive on the port (server), or zero to
+ *        send to host and port (client)
+ * @return the socket, or -1 on failure
+ */
+SOCKET udp_open(char *host, uint16_t port, int bind_to_port);
+
+/**
+ * Drop this percentage of the datagrams sent, to test over loopback
+ */
+void udp_set_loss(int percent);
+
+/**
+ * Send a datagram holding the header and a framed message
+ * @param addr destination, or NULL for a socket opened by a client
+ * @return EXIT_SUCCESS or EXIT_FAILURE. A datagram dropped on purpose
+ *         counts as sent.
+ */
+int udp_send(SOCKET fd, struct sockaddr *addr, socklen_t addr_length,
+             struct udp_header *header, char *message, int length);
+
+/**
+ * Create the server's side of a client's datagram transport, with a new
+ * random token for the client's connection
+ * @return the peer, or NULL if no random token could be had
+ */
+UdpPeer *udp_peer_create(SOCKET connection_fd);
+
+void udp_peer_destroy(UdpPeer *peer);
+
+/**
+ * Give the peer a new random token, forgetting the address, so that the
+ * client can send from somewhere else once it has the token
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if no random token could be had
+ */
+int udp_peer_renew(UdpPeer *peer, SOCKET connection_fd);
+
+/**
+ * @return the peer's token
+ */
+uint64_t udp_peer_token(UdpPeer *peer);
+
+/**
+ * Check a datagram's token against the peer's, and take its sender as the
+ * peer's address if the peer has none yet
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the token is wrong or the datagram
+ *         came from somewhere other than the peer's address
+ */
+int udp_peer_accept(UdpPeer *peer, uint64_t token,
+                    struct sockaddr_storage *from, socklen_t from_length);
+
+/**
+ * Send a frame to a client, numbered and acknowledging the last input taken
+ * from the client
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int udp_send_frame(SOCKET fd, UdpPeer *peer, Frame *frame);
+
+/**
+ * Wait until a datagram can be read
+ * @return positive if one can, 0 on timeout, or negative on error
+ */
+int udp_wait(SOCKET fd, int timeout_ms);
+
+/**
+ * Receive a datagram, checking that it holds a whole framed message
+ * @param from (optional) filled with the sender's address
+ * @return length of the datagram, or -1 if there was none or it was not valid
+ */
+int udp_receive(SOCKET fd, char *buffer, struct sockaddr_storage *from,
+                socklen_t *from_length);
+
+void udp_inputs_init(UdpInputs *pending);
+
+/**
+ * Add inputs, numbered on from the pending ones starting at seq, to be sent
+ * until they are acknowledged
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if there was no room for them all
+ */
+int udp_inputs_add(UdpInputs *pending, uint16_t seq,
+                   struct input_record *records, int n);
+
+/**
+ * Forget the inputs up to and including ack. An ack of 0 acknowledges
+ * nothing.
+ */
+void udp_inputs_ack(UdpInputs *pending, uint16_t ack);
+
+/**
+ * Send every pending input, if there are any
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int udp_inputs_send(UdpInputs *pending, SOCKET fd, uint64_t token);
+
+/**
+ * @return non-zero if inputs have been pending for UDP_RESEND_MS without
+ *         being sent again
+ */
+int udp_inputs_resend_due(UdpInputs *pending);
+
+/**
+ * Decide whether a board numbered seq is newer than the last one shown for
+ * the player in a party slot, and remember it if it is
+ * @return non-zero if the board should be shown
+ */
+int udp_latest_accept(UdpLatest *latest, int slot, uint32_t seq);
+
+#endif // TTETRIS_UDP_H
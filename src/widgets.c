@@ -114,14 +114,17 @@ void selection_destroy(WidgetSelection *selection) {
 	free(selection);
 }
 
-/**
- * Select from a given number of options
- */
-struct ttetris_widget_selection *ttviz_select(char **options, int num_options,
-                                              char *desc,
-                                              int is_single_selection) {
-	int i, ch, _exit;
+struct ttetris_widget_select {
 	CursesCombobox *entry;
+	char **options;
+	int num_options;
+	int is_single_selection;
+};
+
+WidgetSelect *ttviz_select_begin(char **options, int num_options, char *desc,
+                                 int is_single_selection) {
+	int _exit;
+	WidgetSelect *select = malloc(sizeof(WidgetSelect));
 
 	clear();
 
@@ -133,27 +136,39 @@ struct ttetris_widget_selection *ttviz_select(char **options, int num_options,
 	mvprintw(4, 2, desc);
 
 	// the sizing of this widget is pretty arbitrary
-	if ((_exit = curses_combobox_create(&entry, stdscr, 7, 20, 5, 1,
-	                                    options, num_options)) !=
+	if ((_exit = curses_combobox_create(&select->entry, stdscr, 7, 20, 5,
+	                                    1, options, num_options)) !=
 	    EXIT_SUCCESS)
 		exit(_exit);
-	curses_combobox_refresh(entry);
+	curses_combobox_refresh(select->entry);
 
-	while ((ch = getch()) != '\n') {
-		// ignore space for single selection
-		if (is_single_selection && ch == ' ')
-			continue;
-		curses_combobox_feed(entry, ch);
-		curses_combobox_refresh(entry);
-	}
+	select->options = options;
+	select->num_options = num_options;
+	select->is_single_selection = is_single_selection;
+	return select;
+}
+
+int ttviz_select_feed(WidgetSelect *select, int ch) {
+	if (ch == '\n')
+		return 1;
+	// ignore space for single selection, and timeouts of getch
+	if (ch == ERR || (select->is_single_selection && ch == ' '))
+		return 0;
+	curses_combobox_feed(select->entry, ch);
+	curses_combobox_refresh(select->entry);
+	return 0;
+}
 
+WidgetSelection *ttviz_select_end(WidgetSelect *select) {
+	int i, num_options = select->num_options;
+	CursesCombobox *entry = select->entry;
 	int *is_option_selected = curses_combobox_value(entry);
 
 	WidgetSelection *w_selection = malloc(sizeof(WidgetSelection));
-	w_selection->options = options;
+	w_selection->options = select->options;
 	w_selection->num_options = num_options;
 
-	if (is_single_selection) {
+	if (select->is_single_selection) {
 		w_selection->num_selected = 1;
 		w_selection->indices =
 		    calloc(sizeof(int), w_selection->num_selected);
@@ -176,10 +191,26 @@ struct ttetris_widget_selection *ttviz_select(char **options, int num_options,
 	}
 
 	curses_combobox_destroy(entry);
+	free(select);
 
 	return w_selection;
 }
 
+/**
+ * Select from a given number of options
+ */
+struct ttetris_widget_selection *ttviz_select(char **options, int num_options,
+                                              char *desc,
+                                              int is_single_selection) {
+	WidgetSelect *select = ttviz_select_begin(options, num_options, desc,
+	                                          is_single_selection);
+
+	while (!ttviz_select_feed(select, getch())) {
+	}
+
+	return ttviz_select_end(select);
+}
+
 int selection_to_index(WidgetSelection *selection) {
 	return selection->indices[0];
 }
@@ -20,6 +20,30 @@ void selection_destroy(WidgetSelection *selection);
 int ttviz_entry(char *user_input, char *label, int max_length);
 WidgetSelection *ttviz_select(char **options, int num_options, char *desc,
                               int is_single_selection);
+
+typedef struct ttetris_widget_select WidgetSelect;
+
+/**
+ * Show a selection that the caller feeds keys to one at a time, so that it can
+ * do other work in between. ttviz_select does the same but waits for the keys
+ * itself.
+ * @param options must outlive the widget and its selection
+ */
+WidgetSelect *ttviz_select_begin(char **options, int num_options, char *desc,
+                                 int is_single_selection);
+
+/**
+ * Feed a key, or ERR from a getch that timed out, to the selection
+ * @return non-zero once the selection has been confirmed
+ */
+int ttviz_select_feed(WidgetSelect *select, int ch);
+
+/**
+ * Free the widget
+ * @return what was selected
+ */
+WidgetSelection *ttviz_select_end(WidgetSelect *select);
+
 int edit_keybindings(ControlKeybindings *keybindings);
 
 #endif // TTETRIS_WIDGETS_H
\ No newline at end of file